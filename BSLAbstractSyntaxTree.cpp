@@ -1,406 +1,1236 @@
-#include "BSLToken.h"
+﻿#include "BSLToken.h"
 #include "BSLAbstractSyntaxTree.h"
-#include <stack>
-
+#include "BSLParallel.h"
+#include "BSLTrace.h"
 
 
 namespace BSL
 {
 
-void ReduceNodesByParsingSubscriptExpression(std::list<IAbstractSyntaxTreeNode*> m_tempNodes)
+uint32_t SyntaxTree::AddNode(ASTNodeTypes type, uint32_t token, uint32_t payload)
+{
+	astNode_t node;
+	node.type = type;
+	node.token = token;
+	node.firstChild = AST_NO_NODE;
+	node.nextSibling = AST_NO_NODE;
+	node.payload = payload;
+
+	m_Nodes.push_back(node);
+	m_LastChildren.push_back(AST_NO_NODE);
+
+	return (uint32_t)(m_Nodes.size() - 1);
+}
+
+uint32_t SyntaxTree::AddSubprogram(ASTNodeTypes type, uint32_t token, const subprogramPayload_t& subprogram)
+{
+	m_Subprograms.push_back(subprogram);
+	return AddNode(type, token, (uint32_t)(m_Subprograms.size() - 1));
+}
+
+uint32_t SyntaxTree::AddNumericConstant(uint32_t token, double value)
 {
-	if (m_tempNodes.size() < 3)
+	m_NumericConstants.push_back(value);
+	return AddNode(ASTNodeTypes::NumericConstant, token, (uint32_t)(m_NumericConstants.size() - 1));
+}
+
+void SyntaxTree::AddChild(uint32_t parent, uint32_t child)
+{
+	uint32_t lastChild = m_LastChildren[parent];
+
+	if (lastChild != AST_NO_NODE)
+		m_Nodes[lastChild].nextSibling = child;
+	else
+		m_Nodes[parent].firstChild = child;
+
+	m_LastChildren[parent] = child;
+	m_Nodes[child].nextSibling = AST_NO_NODE;
+}
+
+void SyntaxTree::DetachChildren(uint32_t parent)
+{
+	m_Nodes[parent].firstChild = AST_NO_NODE;
+	m_LastChildren[parent] = AST_NO_NODE;
+}
+
+void SyntaxTree::ShiftTokens(uint32_t first, ptrdiff_t delta)
+{
+	if (!delta)
 		return;
 
-	//for (int i = 1; i < m_tempNodes.size() - 2; i++)
-	size_t i = m_tempNodes.size() - 1;
-	auto it = m_tempNodes.end();
-	std::advance(it, -1);
+	for (astNode_t& node : m_Nodes)
+		if (node.token != AST_NO_TOKEN && node.token >= first)
+			node.token = (uint32_t)(node.token + delta);
+
+	for (subprogramPayload_t& subprogram : m_Subprograms)
+		if (subprogram.endToken >= first)
+			subprogram.endToken = (uint32_t)(subprogram.endToken + delta);
 
-	while (i > 0)
+	for (parseDiagnostic_t& diagnostic : m_Diagnostics)
+		if (diagnostic.token != AST_NO_TOKEN && diagnostic.token >= first)
+			diagnostic.token = (uint32_t)(diagnostic.token + delta);
+}
+
+uint32_t SyntaxTree::CopyNodes(const SyntaxTree& from, uint32_t first, uint32_t last)
+{
+	uint32_t base = (uint32_t)m_Nodes.size();
+
+	auto relocate = [&](uint32_t index)
 	{
-		IAbstractSyntaxTreeNode* pRight = *it; std::advance(it, -1); i--;		
-		
+		return index == AST_NO_NODE ? AST_NO_NODE : index - first + base;
+	};
 
-		if (pRight->Type() == ASTNodeTypes::Unparsed)
-		{
-			UnparsedNode* bracketNodeRight = dynamic_cast<UnparsedNode*>(pRight);
-			if (NULL == bracketNodeRight)
-				continue;
+	m_Nodes.resize(base + (last - first));
+	m_LastChildren.resize(base + (last - first));
 
-			auto rightNodeStart = it;
-			std::advance(it, 1);
+	astNode_t* nodes = m_Nodes.data() + base;
+	uint32_t* lastChildren = m_LastChildren.data() + base;
 
-			if (bracketNodeRight->TokenType() == TokenTypes::ClosingSquareBracket)
-			{
-				while (i >= 0)
-				{
-					IAbstractSyntaxTreeNode* pLeft = *it; std::advance(it, -1); i--;
-					if (pLeft->Type() == ASTNodeTypes::Unparsed)
-					{
-						UnparsedNode* bracketNodeLeft = dynamic_cast<UnparsedNode*>(pLeft);
-						if (NULL == bracketNodeRight)
-							continue;
+	for (uint32_t i = first; i < last; i++)
+	{
+		astNode_t node = from.m_Nodes[i];
 
-						if (bracketNodeLeft->TokenType() == TokenTypes::OpeningSquareBracket)
-						{
-							auto rightNodeStart = it;
-							std::advance(it, 1);
-						}
-					}
-				}
+		node.firstChild = relocate(node.firstChild);
+		node.nextSibling = relocate(node.nextSibling);
 
+		if (node.payload != AST_NO_NODE)
+		{
+			switch (node.type)
+			{
+			case ASTNodeTypes::Function:
+			case ASTNodeTypes::Procedure:
+				m_Subprograms.push_back(from.m_Subprograms[node.payload]);
+				node.payload = (uint32_t)(m_Subprograms.size() - 1);
+				break;
+			case ASTNodeTypes::NumericConstant:
+				m_NumericConstants.push_back(from.m_NumericConstants[node.payload]);
+				node.payload = (uint32_t)(m_NumericConstants.size() - 1);
+				break;
 			}
 		}
 
+		*nodes++ = node;
+		*lastChildren++ = relocate(from.m_LastChildren[i]);
 	}
+
+	return base;
 }
 
-void ReduceNodesByParsingMemberExpressions(std::list<IAbstractSyntaxTreeNode*> m_tempNodes)
+void SyntaxTree::Clear()
 {
-	
-	if (m_tempNodes.size() < 3)
-		return;
+	m_Nodes = std::vector<astNode_t>();
+	m_LastChildren = std::vector<uint32_t>();
+	m_Subprograms = std::vector<subprogramPayload_t>();
+	m_NumericConstants = std::vector<double>();
+	m_Diagnostics = std::vector<parseDiagnostic_t>();
+	m_Arena.Release();
+	m_UnreachableNodes = 0;
+}
 
-	//for (int i = 1; i < m_tempNodes.size() - 2; i++)
-	size_t i = m_tempNodes.size() - 1;
-	auto it = m_tempNodes.end();
-	std::advance(it, -1);
+// What a diagnostic expected, for messages
+static const char* ExpectedText(TokenTypes type)
+{
+	switch (type)
+	{
+	case TokenTypes::Identifier: return "a name";
+	case TokenTypes::OpeningBracket: return "'('";
+	case TokenTypes::ClosingBracket: return "')'";
+	case TokenTypes::ClosingSquareBracket: return "']'";
+	case TokenTypes::EndProcedure: return "EndProcedure";
+	case TokenTypes::EndFunction: return "EndFunction";
+	case TokenTypes::OperatorThen: return "Then";
+	case TokenTypes::DirectiveIf: return "#If";
+	case TokenTypes::DirectiveEndIf: return "#EndIf";
+	case TokenTypes::DirectiveInsert: return "#Insert";
+	case TokenTypes::DirectiveEndInsert: return "#EndInsert";
+	case TokenTypes::DirectiveDelete: return "#Delete";
+	case TokenTypes::DirectiveEndDelete: return "#EndDelete";
+	}
 
-	while(i > 0)
+	return "another token";
+}
+
+std::string DiagnosticMessage(const parseDiagnostic_t& diagnostic)
+{
+	switch (diagnostic.code)
 	{
-		IAbstractSyntaxTreeNode* pRight = *it; std::advance(it, -1); i--;
-		IAbstractSyntaxTreeNode* pMid  = *it; std::advance(it, -1); i--;
-		IAbstractSyntaxTreeNode* pLeft = *it; std::advance(it, -1); i--;
+	case DiagnosticCodes::UnexpectedToken:
+		return std::string("expected ") + ExpectedText(diagnostic.expected);
+	case DiagnosticCodes::ExpectedExpression:
+		return "expected an expression";
+	case DiagnosticCodes::MissingEndKeyword:
+		return std::string(diagnostic.expected == TokenTypes::EndFunction ? "function" : "procedure") + " has no " + ExpectedText(diagnostic.expected);
+	case DiagnosticCodes::UnmatchedEndKeyword:
+		return "end keyword outside of a procedure or function";
+	case DiagnosticCodes::UnmatchedDirective:
+		return std::string("directive without a matching ") + ExpectedText(diagnostic.expected);
+	case DiagnosticCodes::MissingEndDirective:
+		return std::string("directive has no ") + ExpectedText(diagnostic.expected);
+	}
+
+	return "syntax error";
+}
 
-		if (pMid->Type() == ASTNodeTypes::Unparsed)
+// Binding strength of operators, loosest first
+enum class Precedence : int
+{
+	Lowest,
+	Or,
+	And,
+	Not,
+	Comparison,
+	Additive,
+	Multiplicative,
+	Unary,
+};
+
+typedef struct
+{
+	ASTNodeTypes type;
+	ASTOperators op;
+	Precedence precedence;
+
+	// <=, >= and <> are two adjacent tokens
+	size_t tokenCount;
+}binaryOperator_t;
+
+// Precedence climbing over the tokens of a span, appending nodes to the tree
+// as soon as their operands are complete. Never goes back, so every token is
+// looked at a bounded number of times.
+class StatementParser
+{
+	const TokenTable* m_Tokens;
+	size_t m_Position;
+	size_t m_End;
+
+	SyntaxTree& m_Tree;
+
+	// Type of the next token past comments, EndExpression at the end
+	TokenTypes PeekType()
+	{
+		while (m_Position < m_End && m_Tokens->Type(m_Position) == TokenTypes::Comment)
+			m_Position++;
+
+		if (m_Position == m_End)
+			return TokenTypes::EndExpression;
+
+		return m_Tokens->Type(m_Position);
+	}
+
+	uint32_t Next()
+	{
+		return (uint32_t)m_Position++;
+	}
+
+	bool Accept(TokenTypes type)
+	{
+		if (PeekType() != type || m_Position == m_End)
+			return false;
+
+		m_Position++;
+		return true;
+	}
+
+	// Error at the next token; one per token, so that an error doesn't show
+	// again as each enclosing expression finds something missing
+	void Diagnose(DiagnosticCodes code, TokenTypes expected = TokenTypes::Identifier)
+	{
+		PeekType();
+
+		uint32_t token = m_Position < m_Tokens->Size() ? (uint32_t)m_Position : AST_NO_TOKEN;
+		const std::vector<parseDiagnostic_t>& diagnostics = m_Tree.Diagnostics();
+
+		if (diagnostics.empty() || diagnostics.back().token != token)
+			m_Tree.AddDiagnostic(code, token, expected);
+	}
+
+	void Expect(TokenTypes type)
+	{
+		if (!Accept(type))
+			Diagnose(DiagnosticCodes::UnexpectedToken, type);
+	}
+
+	bool FollowsImmediately(TokenTypes type) const
+	{
+		return m_Position + 1 < m_End && m_Tokens->Type(m_Position + 1) == type &&
+			m_Tokens->SourceOffset(m_Position + 1) == m_Tokens->SourceOffset(m_Position) + 1;
+	}
+
+	bool PeekBinaryOperator(binaryOperator_t& op)
+	{
+		switch (PeekType())
 		{
-			UnparsedNode *dotNode = dynamic_cast<UnparsedNode *>(pMid);
-			if (NULL != dotNode)
+		case TokenTypes::KeywordOr:
+			op = { ASTNodeTypes::LogicalExpression, ASTOperators::Or, Precedence::Or, 1 };
+			return true;
+		case TokenTypes::KeywordAnd:
+			op = { ASTNodeTypes::LogicalExpression, ASTOperators::And, Precedence::And, 1 };
+			return true;
+		case TokenTypes::EqualsSign:
+			op = { ASTNodeTypes::ComparisonExpression, ASTOperators::Equal, Precedence::Comparison, 1 };
+			return true;
+		case TokenTypes::LessSign:
+			if (FollowsImmediately(TokenTypes::EqualsSign))
+				op = { ASTNodeTypes::ComparisonExpression, ASTOperators::LessOrEqual, Precedence::Comparison, 2 };
+			else if (FollowsImmediately(TokenTypes::GreaterSign))
+				op = { ASTNodeTypes::ComparisonExpression, ASTOperators::NotEqual, Precedence::Comparison, 2 };
+			else
+				op = { ASTNodeTypes::ComparisonExpression, ASTOperators::Less, Precedence::Comparison, 1 };
+			return true;
+		case TokenTypes::GreaterSign:
+			if (FollowsImmediately(TokenTypes::EqualsSign))
+				op = { ASTNodeTypes::ComparisonExpression, ASTOperators::GreaterOrEqual, Precedence::Comparison, 2 };
+			else
+				op = { ASTNodeTypes::ComparisonExpression, ASTOperators::Greater, Precedence::Comparison, 1 };
+			return true;
+		case TokenTypes::PlusSign:
+			op = { ASTNodeTypes::ArithmeticExpression, ASTOperators::Add, Precedence::Additive, 1 };
+			return true;
+		case TokenTypes::MinusSign:
+			op = { ASTNodeTypes::ArithmeticExpression, ASTOperators::Subtract, Precedence::Additive, 1 };
+			return true;
+		case TokenTypes::MultiplySign:
+			op = { ASTNodeTypes::ArithmeticExpression, ASTOperators::Multiply, Precedence::Multiplicative, 1 };
+			return true;
+		case TokenTypes::DivisionSign:
+			op = { ASTNodeTypes::ArithmeticExpression, ASTOperators::Divide, Precedence::Multiplicative, 1 };
+			return true;
+		case TokenTypes::ModuloSign:
+			op = { ASTNodeTypes::ArithmeticExpression, ASTOperators::Modulo, Precedence::Multiplicative, 1 };
+			return true;
+		}
+
+		return false;
+	}
+
+	uint32_t AddBinary(const binaryOperator_t& op, uint32_t token, uint32_t left, uint32_t right)
+	{
+		uint32_t node = m_Tree.AddNode(op.type, token, (uint32_t)op.op);
+
+		m_Tree.AddChild(node, left);
+		m_Tree.AddChild(node, right);
+
+		return node;
+	}
+
+	// Identifier node for the next token, which has to be one
+	uint32_t AddIdentifier()
+	{
+		uint32_t token = Next();
+		return m_Tree.AddNode(ASTNodeTypes::Identifier, token, m_Tokens->Atom(token));
+	}
+
+	uint32_t AddUnary(ASTNodeTypes type, ASTOperators op, uint32_t token, uint32_t operand)
+	{
+		uint32_t node = m_Tree.AddNode(type, token, (uint32_t)op);
+		m_Tree.AddChild(node, operand);
+
+		return node;
+	}
+
+	// Arguments up to the closing bracket become children of node; an
+	// argument left out between commas gets an Unparsed node without a
+	// token, so that the others keep their positions
+	void ParseArguments(uint32_t node)
+	{
+		if (Accept(TokenTypes::ClosingBracket))
+			return;
+
+		while (true)
+		{
+			TokenTypes type = PeekType();
+
+			if (type == TokenTypes::Comma || type == TokenTypes::ClosingBracket)
+				m_Tree.AddChild(node, m_Tree.AddNode(ASTNodeTypes::Unparsed));
+			else if (!StartsExpression(type))
+			{
+				Diagnose(DiagnosticCodes::UnexpectedToken, TokenTypes::ClosingBracket);
+				return;
+			}
+			else
 			{
-				if (dotNode->TokenType() == TokenTypes::DotSign)
+				m_Tree.AddChild(node, ParseExpression(Precedence::Lowest));
+				type = PeekType();
+
+				if (type != TokenTypes::Comma && type != TokenTypes::ClosingBracket)
 				{
-					MemberExpressionNode* newNode = new MemberExpressionNode(pLeft, pRight);
+					Diagnose(DiagnosticCodes::UnexpectedToken, TokenTypes::ClosingBracket);
+					return;
+				}
+			}
+
+			Next();
+
+			if (type == TokenTypes::ClosingBracket)
+				return;
+		}
+	}
+
+	// Member access, subscripts and calls following an operand
+	uint32_t ParsePostfix(uint32_t operand)
+	{
+		while (true)
+		{
+			switch (PeekType())
+			{
+			case TokenTypes::DotSign:
+				{
+					uint32_t node = m_Tree.AddNode(ASTNodeTypes::MemberExpression, Next());
+					m_Tree.AddChild(node, operand);
+
+					if (PeekType() == TokenTypes::Identifier)
+						m_Tree.AddChild(node, AddIdentifier());
+					else
+					{
+						Diagnose(DiagnosticCodes::UnexpectedToken);
+						m_Tree.AddChild(node, m_Tree.AddNode(ASTNodeTypes::Unparsed));
+					}
 
-					m_tempNodes.remove(pLeft);
-					m_tempNodes.remove(pMid);
-					m_tempNodes.remove(pRight);
+					operand = node;
+				}
+				break;
+			case TokenTypes::OpeningSquareBracket:
+				{
+					uint32_t node = m_Tree.AddNode(ASTNodeTypes::SubscriptExpression, Next());
+					m_Tree.AddChild(node, operand);
+					m_Tree.AddChild(node, ParseExpression(Precedence::Lowest));
+					Expect(TokenTypes::ClosingSquareBracket);
 
-					auto newPos = m_tempNodes.begin();
-					std::advance(newPos, (i + 2));
-					m_tempNodes.insert(newPos, newNode);
+					operand = node;
+				}
+				break;
+			case TokenTypes::OpeningBracket:
+				{
+					uint32_t node = m_Tree.AddNode(ASTNodeTypes::SubprogramCall, Next());
+					m_Tree.AddChild(node, operand);
+					ParseArguments(node);
 
+					operand = node;
 				}
+				break;
+			default:
+				return operand;
 			}
 		}
-	
 	}
 
-}
+	// Operand with its prefix operators and postfix parts
+	uint32_t ParseOperand()
+	{
+		switch (PeekType())
+		{
+		case TokenTypes::Identifier:
+			return ParsePostfix(AddIdentifier());
+		case TokenTypes::NumericConst:
+			{
+				uint32_t token = Next();
+				return m_Tree.AddNumericConstant(token, m_Tokens->NumericValue(token));
+			}
+		case TokenTypes::StringConst:
+			return m_Tree.AddNode(ASTNodeTypes::StringConstant, Next());
+		case TokenTypes::DateConst:
+			return m_Tree.AddNode(ASTNodeTypes::DateConstant, Next());
+		case TokenTypes::BooleanConst:
+			return m_Tree.AddNode(ASTNodeTypes::BooleanConstant, Next());
+		case TokenTypes::OpeningBracket:
+			{
+				Next();
+				uint32_t inner = ParseExpression(Precedence::Lowest);
+				Expect(TokenTypes::ClosingBracket);
+
+				return ParsePostfix(inner);
+			}
+		case TokenTypes::MinusSign:
+			{
+				uint32_t token = Next();
+				return AddUnary(ASTNodeTypes::ArithmeticExpression, ASTOperators::Negate, token, ParseExpression(Precedence::Unary));
+			}
+		case TokenTypes::PlusSign:
+			Next();
+			return ParseExpression(Precedence::Unary);
+		case TokenTypes::KeywordNot:
+			{
+				uint32_t token = Next();
+				return AddUnary(ASTNodeTypes::LogicalExpression, ASTOperators::Not, token, ParseExpression(Precedence::Comparison));
+			}
+		case TokenTypes::OperatorNew:
+			{
+				// Новый Тип, Новый Тип(аргументы) or Новый(тип, аргументы)
+				uint32_t node = m_Tree.AddNode(ASTNodeTypes::NewExpression, Next());
+
+				bool named = PeekType() == TokenTypes::Identifier;
+
+				if (named)
+					m_Tree.AddChild(node, AddIdentifier());
+
+				if (Accept(TokenTypes::OpeningBracket))
+					ParseArguments(node);
+				else if (!named)
+					Diagnose(DiagnosticCodes::UnexpectedToken);
+
+				return node;
+			}
+		}
+
+		Diagnose(DiagnosticCodes::ExpectedExpression);
+		return m_Tree.AddNode(ASTNodeTypes::Unparsed);
+	}
+
+	// Binary operators binding at least as tight as minPrecedence, with left
+	// as the first operand; all of them are left associative
+	uint32_t ParseBinary(uint32_t left, Precedence minPrecedence)
+	{
+		binaryOperator_t op;
+
+		while (PeekBinaryOperator(op) && op.precedence >= minPrecedence)
+		{
+			uint32_t token = Next();
+			m_Position += op.tokenCount - 1;
+
+			uint32_t right = ParseExpression((Precedence)((int)op.precedence + 1));
+			left = AddBinary(op, token, left, right);
+		}
+
+		return left;
+	}
+
+	uint32_t ParseExpression(Precedence minPrecedence)
+	{
+		return ParseBinary(ParseOperand(), minPrecedence);
+	}
+
+	// Assignment, or an expression evaluated for its effect, i.e. a call. The
+	// target is parsed first with comparisons excluded, so that an = right
+	// after it is the assignment rather than an equality.
+	uint32_t ParseAssignmentOrExpression()
+	{
+		uint32_t target = ParseExpression(Precedence::Additive);
+
+		if (PeekType() == TokenTypes::EqualsSign)
+		{
+			uint32_t node = m_Tree.AddNode(ASTNodeTypes::AssigmentExpression, Next());
+
+			m_Tree.AddChild(node, target);
+			m_Tree.AddChild(node, ParseExpression(Precedence::Lowest));
+
+			return node;
+		}
+
+		return ParseBinary(target, Precedence::Lowest);
+	}
+
+	static bool StartsExpression(TokenTypes type)
+	{
+		switch (type)
+		{
+		case TokenTypes::Identifier:
+		case TokenTypes::NumericConst:
+		case TokenTypes::StringConst:
+		case TokenTypes::DateConst:
+		case TokenTypes::BooleanConst:
+		case TokenTypes::OpeningBracket:
+		case TokenTypes::MinusSign:
+		case TokenTypes::PlusSign:
+		case TokenTypes::KeywordNot:
+		case TokenTypes::OperatorNew:
+			return true;
+		}
+
+		return false;
+	}
+
+	// Keywords followed by a condition or a value, where = compares
+	static bool PrecedesExpression(TokenTypes type)
+	{
+		switch (type)
+		{
+		case TokenTypes::OperatorReturn:
+		case TokenTypes::OperatorIf:
+		case TokenTypes::OperatorElseIf:
+		case TokenTypes::OperatorWhile:
+		case TokenTypes::DirectiveIf:
+		case TokenTypes::DirectiveElseIf:
+			return true;
+		}
+
+		return false;
+	}
+
+	// Tokens that start a subprogram header or end a block, so a statement
+	// missing its ';' ends before them
+	static bool EndsStatement(TokenTypes type)
+	{
+		switch (type)
+		{
+		case TokenTypes::Annotation:
+		case TokenTypes::BeginProcedure:
+		case TokenTypes::BeginFunction:
+		case TokenTypes::EndProcedure:
+		case TokenTypes::EndFunction:
+		case TokenTypes::OperatorElse:
+		case TokenTypes::OperatorElseIf:
+		case TokenTypes::OperatorEndIf:
+		case TokenTypes::OperatorEndLoop:
+		case TokenTypes::OperatorEndTry:
+			return true;
+		}
+
+		return false;
+	}
+public:
+	StatementParser(const TokenTable* tokens, size_t begin, size_t end, SyntaxTree& tree) : m_Tokens(tokens), m_Position(begin), m_End(end), m_Tree(tree)
+	{
+	}
+
+	size_t Position() const
+	{
+		return m_Position;
+	}
+
+	// Statement up to and including the next ';', AST_NO_NODE if it is empty
+	uint32_t ParseStatement()
+	{
+		PeekType();
+
+		uint32_t first = (uint32_t)m_Position;
+		uint32_t statement = AST_NO_NODE;
+		uint32_t piece = AST_NO_NODE;
+		bool expression = false;
+
+		while (true)
+		{
+			TokenTypes type = PeekType();
 
-IAbstractSyntaxTreeNode::IAbstractSyntaxTreeNode(ASTNodeTypes type) : m_nodeType(type)
+			// Those tokens end a statement that has something already, at the
+			// start of one they are parsed as Unparsed
+			if (type == TokenTypes::EndExpression || (piece != AST_NO_NODE && EndsStatement(type)))
+				break;
+
+			if (piece != AST_NO_NODE && statement == AST_NO_NODE)
+			{
+				statement = m_Tree.AddNode(ASTNodeTypes::UnparsedExpression, first);
+				m_Tree.AddChild(statement, piece);
+			}
+
+			if (StartsExpression(type))
+				piece = expression ? ParseExpression(Precedence::Lowest) : ParseAssignmentOrExpression();
+			else
+				piece = m_Tree.AddNode(ASTNodeTypes::Unparsed, Next());
+
+			expression = PrecedesExpression(type);
+
+			if (statement != AST_NO_NODE)
+				m_Tree.AddChild(statement, piece);
+		}
+
+		Accept(TokenTypes::EndExpression);
+
+		return statement != AST_NO_NODE ? statement : piece;
+	}
+};
+
+// Parses the statement at the read position of source and moves past it
+static uint32_t BuildStatement(TokenSpan* source, SyntaxTree& tree)
 {
-	m_Nodes.clear();
+	StatementParser parser(source->Table(), source->Position(), source->End(), tree);
+	uint32_t result = parser.ParseStatement();
+
+	source->Seek(parser.Position());
+
+	return result;
 }
 
-IAbstractSyntaxTreeNode::~IAbstractSyntaxTreeNode()
+// Tokens of a subprogram up to its end keyword, or, if that is missing, up
+// to the next subprogram, so that one unterminated subprogram doesn't take
+// the rest of the module with it
+typedef struct
 {
-	for (auto item : m_Nodes)
-		delete item;
+	// Procedure or Function keyword
+	uint32_t keyword;
 
-	m_Nodes.clear();
-}
+	// The header and the statements are [keyword + 1, end); end is the end
+	// keyword unless next is end too
+	size_t end;
+
+	// Where the module walk goes on
+	size_t next;
+}subprogramBody_t;
 
-int Precedence(TokenTypes token)
+// Subprograms don't nest, so the body ends at the first end keyword of
+// either kind, or before the next header or annotation
+static subprogramBody_t FindSubprogramBody(const TokenTable* tokens, uint32_t keyword, size_t limit)
 {
-	switch (token)
+	TraceScope scope("extract");
+
+	for (size_t i = keyword + 1; i < limit; i++)
 	{
-	case TokenTypes::PlusSign:
-		return 1;
-	case TokenTypes::MinusSign:
-		return 1;
-	case TokenTypes::MultiplySign:
-		return 2;
-	case TokenTypes::DivisionSign:
-		return 2;
-	case TokenTypes::DotSign:
-		return 0;
+		switch (tokens->Type(i))
+		{
+		case TokenTypes::EndProcedure:
+		case TokenTypes::EndFunction:
+			return { keyword, i, i + 1 };
+		case TokenTypes::BeginProcedure:
+		case TokenTypes::BeginFunction:
+		case TokenTypes::Annotation:
+			return { keyword, i, i };
+		}
 	}
 
-	return -1;
+	return { keyword, limit, limit };
 }
 
-void ShuntAlgo(TokenStream* source);
+static uint32_t BuildSubprogram(TokenTable* tokens, const subprogramBody_t& body, const std::vector<uint32_t>& annotations, SyntaxTree& tree);
 
-IAbstractSyntaxTreeNode* BSL::BuildAbstractSyntaxTree(TokenStream* source)
+uint32_t BuildAbstractSyntaxTree(TokenSpan* source, SyntaxTree& tree)
 {
-	IAbstractSyntaxTreeNode* pResult = new IAbstractSyntaxTreeNode(ASTNodeTypes::Module);
+	TraceScope scope("parse");
+	TokenTable* tokens = source->Table();
 
-	std::vector<std::wstring> annotations;
+	tree.SetTokens(tokens);
+	uint32_t result = tree.AddNode(ASTNodeTypes::Module);
 
-	while (true)
-	{
-		tokenStreamElement_t* token = source->ReadToken();
+	// Tokens of the annotations seen since the last subprogram, which takes them over
+	std::vector<uint32_t> annotations;
 
-		if (!token)
-			break;
+	while (source->Position() < source->End())
+	{
+		size_t position = source->Position();
 
-		switch(token->type)
+		switch (tokens->Type(position))
 		{
 		case TokenTypes::Annotation:
-			annotations.push_back(token->value);
-			continue;
+			source->ReadToken();
+			annotations.push_back((uint32_t)position);
 			break;
 		case TokenTypes::Comment:
-			continue;
+			source->ReadToken();
 			break;
 		case TokenTypes::BeginProcedure:
+		case TokenTypes::BeginFunction:
 			{
-				auto tokenStream = source->ExtractSubstream(TokenTypes::BeginProcedure, TokenTypes::EndProcedure);
-				SubprogramTreeNode* pNode = new SubprogramTreeNode(tokenStream, ASTNodeTypes::Procedure, annotations);
-				pResult->AddNode(pNode);
-				delete tokenStream;
+				subprogramBody_t body = FindSubprogramBody(tokens, (uint32_t)position, source->End());
+				uint32_t node = BuildSubprogram(tokens, body, annotations, tree);
+
+				annotations.clear();
+				tree.AddChild(result, node);
+				source->Seek(body.next);
 			}
 			break;
+		case TokenTypes::EndProcedure:
 		case TokenTypes::EndFunction:
-			{
-				auto tokenStream = source->ExtractSubstream(TokenTypes::BeginFunction, TokenTypes::EndFunction);
-				SubprogramTreeNode* pNode = new SubprogramTreeNode(tokenStream, ASTNodeTypes::Function, annotations);
-				pResult->AddNode(pNode);
-				delete tokenStream;
-			}
+			tree.AddDiagnostic(DiagnosticCodes::UnmatchedEndKeyword, (uint32_t)position);
+			source->ReadToken();
 			break;
-		case TokenTypes::Identifier:
+		default:
 			{
+				uint32_t node = BuildStatement(source, tree);
 
-			
-			source->Reset();
-			ShuntAlgo(source);
-
-// 				int a = 1;
-// 
-// 				std::list<IAbstractSyntaxTreeNode*> m_tempNodes;
-// 
-// 				while (true)
-// 				{
-// 					tokenStreamElement_t* el = source->ReadToken();
-// 					if (!el)
-// 						break;
-// 
-// 					m_tempNodes.push_back(new UnparsedNode(el));
-// 				}
-// 
-// 				ReduceNodesByParsingMemberExpressions(m_tempNodes);
-// 				ReduceNodesByParsingSubscriptExpression(m_tempNodes);
-				
-				
+				if (node != AST_NO_NODE)
+					tree.AddChild(result, node);
 			}
 			break;
 		}
 
 	}
 
-	return pResult;
+	return result;
 }
 
-void ShuntAlgo(TokenStream * source)
+// Token to report an error at position at, AST_NO_TOKEN past the last one
+static uint32_t DiagnosticToken(const TokenTable* tokens, size_t position)
 {
-	//tokenStreamElement_t* nextToken = source->PeekNextToken();
+	return position < tokens->Size() ? (uint32_t)position : AST_NO_TOKEN;
+}
 
-	std::stack<tokenStreamElement_t*> op_stack;
-	std::vector<tokenStreamElement_t*> output;
+// Header of a Function or Procedure node, the statements of its body become
+// its children; annotations are the tokens of the annotations before it. A
+// broken header is diagnosed and the body taken to start past its closing
+// bracket, if it has one before the first ';'.
+static uint32_t BuildSubprogram(TokenTable* tokens, const subprogramBody_t& body, const std::vector<uint32_t>& annotations, SyntaxTree& tree)
+{
+	AstArena& arena = tree.Arena();
 
-	while (true)
-	{
-		tokenStreamElement_t* token = source->ReadToken();
+	bool function = tokens->Type(body.keyword) == TokenTypes::BeginFunction;
+	TokenTypes endKeyword = function ? TokenTypes::EndFunction : TokenTypes::EndProcedure;
 
-		if (!token)
-			break;
+	if (body.next == body.end)
+		tree.AddDiagnostic(DiagnosticCodes::MissingEndKeyword, body.keyword, endKeyword);
 
-		switch (token->type)
-		{
-		case TokenTypes::NumericConst:
-			output.push_back(token);
-			break;
-		case TokenTypes::Identifier:
-			output.push_back(token);
-			break;
-		case TokenTypes::OpeningBracket:
+	std::vector<std::string_view> annotationNames;
+	std::vector<uint32_t> annotationAtoms;
 
-			if (output.back()->type == TokenTypes::Identifier)
-				token->isFunctionCallHint = true;
+	for (uint32_t annotation : annotations)
+	{
+		annotationNames.push_back(arena.CopyString(tokens->Value(annotation)));
+		annotationAtoms.push_back(tokens->Atom(annotation));
+	}
 
-			op_stack.push(token);
-			break;
-		case TokenTypes::OpeningSquareBracket:
-			op_stack.push(token);
-			break;
-		case TokenTypes::PlusSign:
-		case TokenTypes::MinusSign:
-		case TokenTypes::DotSign:
-		case TokenTypes::EqualsSign:		
-		case TokenTypes::MultiplySign:
-		case TokenTypes::DivisionSign:
+	subprogramPayload_t subprogram;
+	subprogram.name = std::string_view();
+	subprogram.nameAtom = IDENTIFIER_NO_ATOM;
+	subprogram.annotations = arena.CopyArray(annotationNames);
+	subprogram.annotationAtoms = arena.CopyArray(annotationAtoms);
+	subprogram.exported = false;
+	subprogram.endToken = (uint32_t)(body.next - 1);
 
-			if (!op_stack.empty())
-			{
-				while (Precedence(op_stack.top()->type) >= Precedence(token->type))
-				{
-					if (Precedence(op_stack.top()->type) == -1)
-						break;
+	std::vector<argumentDescriptor_t> arguments;
 
-					output.push_back(op_stack.top());
-					op_stack.pop();
+	size_t position = body.keyword + 1;
 
-					if (op_stack.empty())
-						break;
-				}
-			}
+	// Type of the header token at position past comments, EndExpression past the body
+	auto peek = [&]()
+	{
+		while (position < body.end && tokens->Type(position) == TokenTypes::Comment)
+			position++;
 
-			op_stack.push(token);
-			break;
-		case TokenTypes::ClosingBracket:
+		return position < body.end ? tokens->Type(position) : TokenTypes::EndExpression;
+	};
 
-			while (true)
-			{
-				if (op_stack.empty())
-					throw new std::exception("Mismatched parenthesis");
+	// Moves past the token at position if it has the type, diagnoses it otherwise
+	auto expect = [&](TokenTypes type)
+	{
+		if (peek() == type)
+		{
+			position++;
+			return true;
+		}
 
+		tree.AddDiagnostic(DiagnosticCodes::UnexpectedToken, DiagnosticToken(tokens, position), type);
+		return false;
+	};
 
-				if (op_stack.top()->type == TokenTypes::OpeningBracket)
-				{
-					tokenStreamElement_t* top = op_stack.top();
+	bool valid = expect(TokenTypes::Identifier);
 
-					if (top->isFunctionCallHint)
-						output.push_back(top);
+	if (valid)
+	{
+		subprogram.name = arena.CopyString(tokens->Value(position - 1));
+		subprogram.nameAtom = tokens->Atom(position - 1);
+	}
 
-					op_stack.pop();
-					break;
-				}
+	valid = valid && expect(TokenTypes::OpeningBracket);
+
+	if (valid && peek() == TokenTypes::ClosingBracket)
+		position++;
+	else
+	{
+		while (valid)
+		{
+			argumentDescriptor_t desc;
+			desc.byValue = false;
+			desc.hasDefaultValue = false;
+			desc.defaultValue = std::string_view();
 
-				output.push_back(op_stack.top());
-				op_stack.pop();
+			if (peek() == TokenTypes::KeywordVal)
+			{
+				desc.byValue = true;
+				position++;
 			}
-			break;
-		case TokenTypes::ClosingSquareBracket:
 
-			while (true)
+			if (!expect(TokenTypes::Identifier))
 			{
-				if (op_stack.empty())
-					throw new std::exception("Mismatched parenthesis");
+				valid = false;
+				break;
+			}
+
+			desc.name = arena.CopyString(tokens->Value(position - 1));
+			desc.nameAtom = tokens->Atom(position - 1);
 
+			if (peek() == TokenTypes::EqualsSign)
+			{
+				position++;
 
-				if (op_stack.top()->type == TokenTypes::OpeningSquareBracket)
+				bool negative = peek() == TokenTypes::MinusSign;
+
+				if (negative)
+					position++;
+
+				switch (peek())
 				{
-					output.push_back(op_stack.top());
-					op_stack.pop();
+				case TokenTypes::Comma:
+				case TokenTypes::ClosingBracket:
+				case TokenTypes::EndExpression:
+					tree.AddDiagnostic(DiagnosticCodes::ExpectedExpression, DiagnosticToken(tokens, position));
+					valid = false;
 					break;
 				}
 
-				output.push_back(op_stack.top());
-				op_stack.pop();
+				if (!valid)
+					break;
+
+				if (negative)
+					desc.defaultValue = arena.CopyString("-" + std::string(tokens->Value(position++)));
+				else
+					desc.defaultValue = arena.CopyString(tokens->Value(position++));
+
+				desc.hasDefaultValue = true;
+			}
+
+			arguments.push_back(desc);
+
+			if (peek() == TokenTypes::Comma)
+				position++;
+			else
+			{
+				valid = expect(TokenTypes::ClosingBracket);
+				break;
 			}
-			break;
 		}
-
 	}
 
-	while (!op_stack.empty())
+	if (!valid)
 	{
-		if (op_stack.top()->type == TokenTypes::OpeningBracket)
-			throw new std::exception("Mismatched parenthesis");
+		for (size_t i = position; i < body.end && tokens->Type(i) != TokenTypes::EndExpression; i++)
+		{
+			if (tokens->Type(i) == TokenTypes::ClosingBracket)
+			{
+				position = i + 1;
+				break;
+			}
+		}
+	}
 
-		output.push_back(op_stack.top());
-		op_stack.pop();
+	subprogram.arguments = arena.CopyArray(arguments);
+
+	if (peek() == TokenTypes::ExportKeyword)
+	{
+		position++;
+		subprogram.exported = true;
 	}
 
-	for (auto item : output)
+	uint32_t result = tree.AddSubprogram(function ? ASTNodeTypes::Function : ASTNodeTypes::Procedure, body.keyword, subprogram);
+	TokenSpan statements(tokens, position, body.end);
+
+	while (statements.Position() < statements.End())
 	{
-		wprintf(L"%s ", item->value.c_str());
+		uint32_t node = BuildStatement(&statements, tree);
+
+		if (node != AST_NO_NODE)
+			tree.AddChild(result, node);
 	}
 
+	// Closed by the end keyword of the other kind
+	if (body.next > body.end && tokens->Type(body.end) != endKeyword)
+		tree.AddDiagnostic(DiagnosticCodes::UnexpectedToken, (uint32_t)body.end, endKeyword);
+
+	return result;
 }
 
-SubprogramTreeNode::SubprogramTreeNode(TokenStream* stream, ASTNodeTypes type, std::vector<std::wstring> annotations): IAbstractSyntaxTreeNode(type)
+// Subprogram found by the boundary scan of BuildAbstractSyntaxTreeParallel
+typedef struct
 {
-	m_Annotations.clear();
+	subprogramBody_t body;
 
-	for (auto annotation : annotations)
-		m_Annotations.push_back(annotation);
+	// Tokens of the annotations before it
+	std::vector<uint32_t> annotations;
 
-	tokenStreamElement_t* programName = stream->ReadToken(true);
-	stream->CheckToken(TokenTypes::OpeningBracket);
+	// Nodes [firstNode, lastNode) and diagnostics [firstDiagnostic,
+	// lastDiagnostic) of the tree of the worker that parsed it
+	size_t worker;
+	uint32_t firstNode;
+	uint32_t lastNode;
+	size_t firstDiagnostic;
+	size_t lastDiagnostic;
+}subprogramExtent_t;
 
-	m_Name = programName->value;
+uint32_t BuildAbstractSyntaxTreeParallel(TokenSpan* source, SyntaxTree& tree, size_t threadCount)
+{
+	if (!threadCount)
+		threadCount = HardwareThreadCount();
 
-	while (true)
-	{
-		tokenStreamElement_t* token = stream->ReadToken(true);
+	if (threadCount == 1)
+		return BuildAbstractSyntaxTree(source, tree);
 
-		if (token->type == TokenTypes::ClosingBracket)
-			break;
+	TraceScope scope("parse");
+
+	TokenTable* tokens = source->Table();
+	size_t start = source->Position();
 
-		
-		argumentDescriptor_t desc;
-		desc.byValue = false;
-		desc.hasDefaultValue = false;
-		desc.defaultValue = L"";
+	// Statements at module level never contain annotations or subprogram
+	// keywords, so the extents are found without parsing them
+	std::vector<subprogramExtent_t> subprograms;
+	std::vector<uint32_t> annotations;
 
-		if (token->type == TokenTypes::KeywordVal)
+	for (size_t position = start; position < source->End();)
+	{
+		switch (tokens->Type(position))
 		{
-			desc.byValue = true;
-			
-			token = stream->ReadToken(true);
-			desc.name = token->value;
-		}		
-		else
-			desc.name = token->value;
+		case TokenTypes::Annotation:
+			annotations.push_back((uint32_t)position);
+			break;
+		case TokenTypes::BeginProcedure:
+		case TokenTypes::BeginFunction:
+			{
+				subprogramExtent_t subprogram = {};
+				subprogram.body = FindSubprogramBody(tokens, (uint32_t)position, source->End());
+				subprogram.annotations.swap(annotations);
+
+				position = subprogram.body.next;
+				subprograms.push_back(std::move(subprogram));
+			}
+			continue;
+		}
+
+		position++;
+	}
+
+	// One tree per worker, subprograms it parses follow each other there
+	std::vector<SyntaxTree> parts(threadCount);
+
+	for (SyntaxTree& part : parts)
+		part.SetTokens(tokens);
+
+	ParallelFor(subprograms.size(), threadCount, [&](size_t worker, size_t index)
+	{
+		TraceScope scope("parse subprogram");
+
+		subprogramExtent_t& subprogram = subprograms[index];
+		SyntaxTree& part = parts[worker];
 
-		token = stream->ReadToken(true);
+		subprogram.worker = worker;
+		subprogram.firstNode = (uint32_t)part.Size();
+		subprogram.firstDiagnostic = part.Diagnostics().size();
 
-		switch (token->type)
+		BuildSubprogram(tokens, subprogram.body, subprogram.annotations, part);
+
+		subprogram.lastNode = (uint32_t)part.Size();
+		subprogram.lastDiagnostic = part.Diagnostics().size();
+	});
+
+	// Same walk as BuildAbstractSyntaxTree, taking the parsed subprograms.
+	// Reserving for them up front keeps the table from being moved while
+	// they are copied; module level statements are usually few.
+	size_t subprogramNodes = 0;
+
+	for (SyntaxTree& part : parts)
+		subprogramNodes += part.Size();
+
+	tree.SetTokens(tokens);
+	tree.Reserve(tree.Size() + subprogramNodes + 1);
+	uint32_t result = tree.AddNode(ASTNodeTypes::Module);
+
+	for (SyntaxTree& part : parts)
+		tree.Arena().Adopt(std::move(part.Arena()));
+
+	size_t next = 0;
+	source->Seek(start);
+
+	while (source->Position() < source->End())
+	{
+		size_t position = source->Position();
+
+		switch (tokens->Type(position))
 		{
-			case TokenTypes::ClosingBracket:
-				m_Arguments.push_back(desc);
-				break;
-			case TokenTypes::EqualsSign:
-				token = stream->ReadToken(true);
-				desc.defaultValue = token->value;
-				desc.hasDefaultValue = true;
-				m_Arguments.push_back(desc);
-				break;
-			case TokenTypes::Comma:
-				m_Arguments.push_back(desc);
-				break;
+		case TokenTypes::Annotation:
+		case TokenTypes::Comment:
+			source->ReadToken();
+			break;
+		case TokenTypes::BeginProcedure:
+		case TokenTypes::BeginFunction:
+			{
+				subprogramExtent_t& subprogram = subprograms[next++];
+				const SyntaxTree& part = parts[subprogram.worker];
+
+				for (size_t i = subprogram.firstDiagnostic; i < subprogram.lastDiagnostic; i++)
+					tree.AddDiagnostic(part.Diagnostics()[i].code, part.Diagnostics()[i].token, part.Diagnostics()[i].expected);
+
+				tree.AddChild(result, tree.CopyNodes(part, subprogram.firstNode, subprogram.lastNode));
+				source->Seek(subprogram.body.next);
+			}
+			break;
+		case TokenTypes::EndProcedure:
+		case TokenTypes::EndFunction:
+			tree.AddDiagnostic(DiagnosticCodes::UnmatchedEndKeyword, (uint32_t)position);
+			source->ReadToken();
+			break;
+		default:
+			{
+				uint32_t node = BuildStatement(source, tree);
+
+				if (node != AST_NO_NODE)
+					tree.AddChild(result, node);
+			}
+			break;
 		}
+	}
+
+	return result;
+}
+
+// Nodes of the subtree rooted at node
+static size_t SubtreeSize(const SyntaxTree& tree, uint32_t node)
+{
+	size_t size = 0;
+	std::vector<uint32_t> pending(1, node);
+
+	while (!pending.empty())
+	{
+		uint32_t index = pending.back();
+		pending.pop_back();
+		size++;
+
+		for (uint32_t child = tree.Node(index).firstChild; child != AST_NO_NODE; child = tree.Node(child).nextSibling)
+			pending.push_back(child);
+	}
+
+	return size;
+}
 
+uint32_t ReparseAbstractSyntaxTree(TokenSpan* source, const tokenStreamEdit_t& edit, SyntaxTree& tree)
+{
+	TraceScope scope("reparse");
+
+	if (!tree.Size() || tree.Node(0).type != ASTNodeTypes::Module || tree.UnreachableNodes() > tree.Size() / 2)
+	{
+		tree.Clear();
+		return BuildAbstractSyntaxTree(source, tree);
 	}
 
-	if (stream->CurrentToken()->type == TokenTypes::ExportKeyword)
+	TokenTable* tokens = source->Table();
+
+	// Tokens before the edit kept their indices, those from editEnd on are
+	// the old ones moved by delta
+	size_t editEnd = edit.firstToken + edit.insertedTokens;
+	ptrdiff_t delta = (ptrdiff_t)edit.insertedTokens - (ptrdiff_t)edit.removedTokens;
+
+	// Diagnostics outside the edit, at the new token indices and still in
+	// order; those of the subprograms kept are taken over
+	std::vector<parseDiagnostic_t> oldDiagnostics;
+
+	for (const parseDiagnostic_t& diagnostic : tree.Diagnostics())
 	{
-		m_Export = true;		
+		if (diagnostic.token < edit.firstToken)
+			oldDiagnostics.push_back(diagnostic);
+		else if (diagnostic.token != AST_NO_TOKEN && diagnostic.token >= edit.firstToken + edit.removedTokens)
+			oldDiagnostics.push_back({ diagnostic.code, (uint32_t)(diagnostic.token + delta), diagnostic.expected });
 	}
 
-	while (true)
+	tree.SetDiagnostics(std::vector<parseDiagnostic_t>());
+
+	// Subprograms by their keyword before the edit, in source order
+	std::vector<std::pair<uint32_t, uint32_t>> oldSubprograms;
+	size_t unreachable = 0;
+
+	for (AstNode node : tree.Root().Children())
+	{
+		if (node.Type() == ASTNodeTypes::Function || node.Type() == ASTNodeTypes::Procedure)
+			oldSubprograms.emplace_back(tree.Node(node.Index()).token, node.Index());
+		else
+			unreachable += SubtreeSize(tree, node.Index());
+	}
+
+	tree.ShiftTokens((uint32_t)(edit.firstToken + edit.removedTokens), delta);
+	tree.SetTokens(source->Table());
+	tree.DetachChildren(0);
+
+	size_t nextOld = 0;
+	size_t nextDiagnostic = 0;
+
+	// Same walk as BuildAbstractSyntaxTree. A subprogram is parsed the same as
+	// before if the edit is past its end keyword, or past everything since
+	// the previous subprogram, where its annotations are collected from; those
+	// are compared anyway, as a removed annotation leaves no tokens behind.
+	// Subprograms kept are skipped using their end token, so the walk costs
+	// the module level tokens plus the subprograms parsed again.
+	std::vector<uint32_t> annotations;
+	size_t regionStart = source->Position();
+
+	while (source->Position() < source->End())
 	{
-		TokenStream* pExpressionStream = stream->ExtractExpressionSubstream();
+		size_t position = source->Position();
+
+		switch (tokens->Type(position))
+		{
+		case TokenTypes::Annotation:
+			source->ReadToken();
+			annotations.push_back((uint32_t)position);
+			break;
+		case TokenTypes::Comment:
+			source->ReadToken();
+			break;
+		case TokenTypes::BeginProcedure:
+		case TokenTypes::BeginFunction:
+			{
+				uint32_t keyword = (uint32_t)position;
+				uint32_t oldKeyword = AST_NO_TOKEN;
+
+				if (keyword < edit.firstToken)
+					oldKeyword = keyword;
+				else if (regionStart >= editEnd)
+					oldKeyword = (uint32_t)(keyword - delta);
+
+				uint32_t node = AST_NO_NODE;
+
+				if (oldKeyword != AST_NO_TOKEN)
+				{
+					while (nextOld < oldSubprograms.size() && oldSubprograms[nextOld].first < oldKeyword)
+						unreachable += SubtreeSize(tree, oldSubprograms[nextOld++].second);
+
+					if (nextOld < oldSubprograms.size() && oldSubprograms[nextOld].first == oldKeyword)
+					{
+						const subprogramPayload_t& subprogram = tree.Subprogram(oldSubprograms[nextOld].second);
+
+						// End tokens are shifted already, those before the edit kept their
+						// index. Without its end keyword a subprogram ends where the next
+						// one starts, which the edit may have moved, so it is parsed again.
+						bool unchanged = keyword >= edit.firstToken || subprogram.endToken < edit.firstToken;
+
+						if (unchanged)
+						{
+							TokenTypes end = tokens->Type(subprogram.endToken);
+							unchanged = end == TokenTypes::EndProcedure || end == TokenTypes::EndFunction;
+						}
+
+						if (unchanged && std::equal(subprogram.annotations.begin(), subprogram.annotations.end(), annotations.begin(), annotations.end(),
+							[&](std::string_view name, uint32_t annotation) { return name == tokens->Value(annotation); }))
+						{
+							node = oldSubprograms[nextOld++].second;
+							source->Seek(subprogram.endToken + 1);
+
+							// One at the keyword is the previous subprogram's, running into
+							// this one, and found again with it if it is
+							while (nextDiagnostic < oldDiagnostics.size() && oldDiagnostics[nextDiagnostic].token <= keyword)
+								nextDiagnostic++;
+
+							for (; nextDiagnostic < oldDiagnostics.size() && oldDiagnostics[nextDiagnostic].token <= subprogram.endToken; nextDiagnostic++)
+								tree.AddDiagnostic(oldDiagnostics[nextDiagnostic].code, oldDiagnostics[nextDiagnostic].token, oldDiagnostics[nextDiagnostic].expected);
+						}
+					}
+				}
+
+				if (node == AST_NO_NODE)
+				{
+					subprogramBody_t body = FindSubprogramBody(tokens, keyword, source->End());
+					node = BuildSubprogram(tokens, body, annotations, tree);
+					source->Seek(body.next);
+				}
 
-		if (!pExpressionStream)
+				annotations.clear();
+				tree.AddChild(0, node);
+				regionStart = source->Position();
+			}
+			break;
+		case TokenTypes::EndProcedure:
+		case TokenTypes::EndFunction:
+			tree.AddDiagnostic(DiagnosticCodes::UnmatchedEndKeyword, (uint32_t)position);
+			source->ReadToken();
 			break;
+		default:
+			{
+				uint32_t node = BuildStatement(source, tree);
 
-		IAbstractSyntaxTreeNode* pNode = BuildAbstractSyntaxTree(pExpressionStream);
-		AddNode(pNode);
+				if (node != AST_NO_NODE)
+					tree.AddChild(0, node);
+			}
+			break;
+		}
 	}
 
-}
+	for (; nextOld < oldSubprograms.size(); nextOld++)
+		unreachable += SubtreeSize(tree, oldSubprograms[nextOld].second);
 
-SubprogramTreeNode::~SubprogramTreeNode()
-{
-	m_Annotations.clear();
-	m_Annotations.shrink_to_fit();
+	tree.AddUnreachableNodes(unreachable);
 
-	m_Arguments.clear();
-	m_Arguments.shrink_to_fit();
+	return 0;
 }
 
 }
\ No newline at end of file
@@ -1,12 +1,14 @@
 #pragma once
 #include <algorithm>
-#include <list>
+#include <string>
+#include <vector>
 #include "BSLToken.h"
+#include "BSLArena.h"
 
 namespace BSL
 {
 
-enum class ASTNodeTypes
+enum class ASTNodeTypes : uint8_t
 {
 	Module,
 	Function,
@@ -23,104 +25,432 @@ enum class ASTNodeTypes
 	NumericConstant,
 	Unparsed,
 	UnparsedExpression,
+	ComparisonExpression,
+	LogicalExpression,
+	NewExpression,
+	Identifier,
+	StringConstant,
+	DateConstant,
+	BooleanConstant,
 };
 
-class IAbstractSyntaxTreeNode
+// Number of ASTNodeTypes values, BooleanConstant being the last one
+constexpr size_t AST_NODE_TYPE_COUNT = (size_t)ASTNodeTypes::BooleanConstant + 1;
+
+// Operator of an ArithmeticExpression, ComparisonExpression or
+// LogicalExpression node, kept in the node's payload. Negate and Not nodes
+// have one child, the others two.
+enum class ASTOperators : uint8_t
 {
-protected:
-	
-	std::list<IAbstractSyntaxTreeNode*>	m_Nodes;
+	Add,
+	Subtract,
+	Multiply,
+	Divide,
+	Modulo,
+	Negate,
+	Equal,
+	NotEqual,
+	Less,
+	LessOrEqual,
+	Greater,
+	GreaterOrEqual,
+	And,
+	Or,
+	Not,
+};
 
-	size_t m_sourceCodeStartingOffset;
-	size_t m_sourceCodeLength;
+constexpr uint32_t AST_NO_NODE = 0xFFFFFFFF;
+constexpr uint32_t AST_NO_TOKEN = 0xFFFFFFFF;
 
-	textHumanPosition_t m_startingPosition;
-	textHumanPosition_t m_endingPosition;
+// Row of the SyntaxTree node table. Children are chained through sibling
+// indices; data that only some node types have is kept in side tables of the
+// tree, payload being the row there, or is the payload itself: the operator
+// of operator nodes, the g_Identifiers atom of Identifier nodes.
+typedef struct
+{
+	ASTNodeTypes type;
 
-public:
-	IAbstractSyntaxTreeNode(ASTNodeTypes type);
-	virtual ~IAbstractSyntaxTreeNode();
+	// Token the node was built from, AST_NO_TOKEN if none
+	uint32_t token;
 
-	void AddNode(IAbstractSyntaxTreeNode* pNode)
-	{
-		m_Nodes.push_back(pNode);
-	}
+	uint32_t firstChild;
+	uint32_t nextSibling;
 
-	ASTNodeTypes Type()
-	{
-		return m_nodeType;
-	}
-
-protected:
-	ASTNodeTypes m_nodeType;
-};
+	uint32_t payload;
+}astNode_t;
 
 typedef struct  
 {
-	std::wstring name;
+	std::string_view name;
+	uint32_t nameAtom;
 	bool byValue;
 	bool hasDefaultValue;
-	std::wstring defaultValue;
+	std::string_view defaultValue;
 }argumentDescriptor_t;
 
-class SubprogramTreeNode: public IAbstractSyntaxTreeNode
+// Side table row of Function and Procedure nodes
+typedef struct
 {
-	std::vector<std::wstring> m_Annotations;
-	std::wstring	m_Name;
-	std::vector<argumentDescriptor_t> m_Arguments;
-	bool m_Export;
-public:
-	SubprogramTreeNode(TokenStream* stream, ASTNodeTypes type,std::vector<std::wstring> annotations);
-	~SubprogramTreeNode();
+	std::string_view name;
+	uint32_t nameAtom;
+	ArenaArray<std::string_view> annotations;
+	ArenaArray<uint32_t> annotationAtoms;
+	ArenaArray<argumentDescriptor_t> arguments;
+	bool exported;
+
+	// EndProcedure or EndFunction token; the last token of the body if the
+	// end keyword is missing
+	uint32_t endToken;
+}subprogramPayload_t;
+
+enum class DiagnosticCodes : uint8_t
+{
+	// The token is not the expected type
+	UnexpectedToken,
+	// An operand is missing at the token
+	ExpectedExpression,
+	// The subprogram whose keyword the token is has no end keyword, expected
+	// being the one it lacks; it ends before the next subprogram
+	MissingEndKeyword,
+	// An end keyword outside of any subprogram
+	UnmatchedEndKeyword,
+	// A preprocessor directive continuing or closing a block that is not
+	// open, expected being the directive opening such blocks
+	UnmatchedDirective,
+	// The directive opening a block that is never closed, expected being the
+	// directive that closes it; the block ends at the end of the module
+	MissingEndDirective,
 };
 
-class NumericConstantTreeNode : public IAbstractSyntaxTreeNode
+// Error found while building a tree; the tree is built around it anyway
+typedef struct
 {
-	double m_Value;
+	DiagnosticCodes code;
+
+	// AST_NO_TOKEN at the end of the module
+	uint32_t token;
+
+	TokenTypes expected;
+}parseDiagnostic_t;
+
+// Text for a user, without the position
+std::string DiagnosticMessage(const parseDiagnostic_t& diagnostic);
+
+class SyntaxTree;
+
+// Read-only reference to a node of a SyntaxTree; tests false for no node
+class AstNode
+{
+	const SyntaxTree* m_Tree;
+	uint32_t m_Index;
 public:
-	NumericConstantTreeNode(double value) : IAbstractSyntaxTreeNode(ASTNodeTypes::NumericConstant)
+	AstNode() : m_Tree(nullptr), m_Index(AST_NO_NODE)
 	{
-		m_Value = value;
 	}
-};
 
-class MemberExpressionNode : public IAbstractSyntaxTreeNode
-{
-	IAbstractSyntaxTreeNode* m_LeftNode;
-	IAbstractSyntaxTreeNode* m_RightNode;
-public:
-	MemberExpressionNode(IAbstractSyntaxTreeNode * left, IAbstractSyntaxTreeNode * right) : IAbstractSyntaxTreeNode(ASTNodeTypes::MemberExpression)
+	AstNode(const SyntaxTree* tree, uint32_t index) : m_Tree(tree), m_Index(index)
 	{
-		m_LeftNode = left;
-		m_RightNode = right;
 	}
-};
 
-class UnparsedNode : public IAbstractSyntaxTreeNode
-{
-	tokenStreamElement_t* m_Token;
-public:
-	UnparsedNode(tokenStreamElement_t* token) : IAbstractSyntaxTreeNode(ASTNodeTypes::Unparsed)
+	explicit operator bool() const
 	{
-		m_Token = token;
+		return m_Index != AST_NO_NODE;
 	}
 
-	TokenTypes TokenType()
+	uint32_t Index() const
 	{
-		return m_Token->type;
+		return m_Index;
 	}
-	
+
+	inline ASTNodeTypes Type() const;
+	inline AstNode FirstChild() const;
+	inline AstNode NextSibling() const;
+
+	// Only valid while the token stream the tree was built from is
+	inline TokenHandle Token() const;
+
+	class ChildIterator
+	{
+		const SyntaxTree* m_Tree;
+		uint32_t m_Index;
+	public:
+		ChildIterator(const SyntaxTree* tree, uint32_t index) : m_Tree(tree), m_Index(index)
+		{
+		}
+
+		AstNode operator*() const
+		{
+			return AstNode(m_Tree, m_Index);
+		}
+
+		inline ChildIterator& operator++();
+
+		bool operator!=(const ChildIterator& other) const
+		{
+			return m_Index != other.m_Index;
+		}
+	};
+
+	class ChildRange
+	{
+		const SyntaxTree* m_Tree;
+		uint32_t m_First;
+	public:
+		ChildRange(const SyntaxTree* tree, uint32_t first) : m_Tree(tree), m_First(first)
+		{
+		}
+
+		ChildIterator begin() const
+		{
+			return ChildIterator(m_Tree, m_First);
+		}
+
+		ChildIterator end() const
+		{
+			return ChildIterator(m_Tree, AST_NO_NODE);
+		}
+	};
+
+	inline ChildRange Children() const;
+
+	// Side table data, valid for the node types that have it
+	inline const subprogramPayload_t& Subprogram() const;
+	inline double NumericValue() const;
+	inline ASTOperators Operator() const;
+	inline uint32_t Atom() const;
 };
 
-class UnparsedExpression : public IAbstractSyntaxTreeNode
+// Syntax tree of a module as one contiguous node table. Node 0 is the root
+// once the tree is built; strings and arrays the nodes refer to are in the
+// tree's arena, so the whole tree is freed with a handful of frees. After
+// ReparseAbstractSyntaxTree the table also holds rows nothing links to any
+// more, so walk the tree from the root rather than the table by index.
+class SyntaxTree
 {
+	AstArena m_Arena;
+
+	std::vector<astNode_t> m_Nodes;
+
+	// Last child of every node, only needed while children are added
+	std::vector<uint32_t> m_LastChildren;
+
+	std::vector<subprogramPayload_t> m_Subprograms;
+	std::vector<double> m_NumericConstants;
+
+	// In token order
+	std::vector<parseDiagnostic_t> m_Diagnostics;
+
+	TokenTable* m_Tokens;
+
+	// Rows left behind by ReparseAbstractSyntaxTree
+	size_t m_UnreachableNodes;
 public:
-	UnparsedExpression(tokenStreamElement_t*) : IAbstractSyntaxTreeNode(ASTNodeTypes::UnparsedExpression)
+	SyntaxTree() : m_Tokens(nullptr), m_UnreachableNodes(0)
+	{
+	}
+
+	AstArena& Arena()
+	{
+		return m_Arena;
+	}
+
+	void SetTokens(TokenTable* tokens)
+	{
+		m_Tokens = tokens;
+	}
+
+	uint32_t AddNode(ASTNodeTypes type, uint32_t token = AST_NO_TOKEN, uint32_t payload = AST_NO_NODE);
+	uint32_t AddSubprogram(ASTNodeTypes type, uint32_t token, const subprogramPayload_t& subprogram);
+	uint32_t AddNumericConstant(uint32_t token, double value);
+	void AddChild(uint32_t parent, uint32_t child);
+
+	// Diagnostics are added in token order
+	void AddDiagnostic(DiagnosticCodes code, uint32_t token, TokenTypes expected = TokenTypes::Identifier)
+	{
+		m_Diagnostics.push_back({ code, token, expected });
+	}
+
+	const std::vector<parseDiagnostic_t>& Diagnostics() const
+	{
+		return m_Diagnostics;
+	}
+
+	// Replaces the diagnostics, e.g. after merging those of several trees
+	void SetDiagnostics(std::vector<parseDiagnostic_t> diagnostics)
+	{
+		m_Diagnostics = std::move(diagnostics);
+	}
+
+	// Unlinks all children of parent, which keep their own children
+	void DetachChildren(uint32_t parent);
+
+	// Adds delta to every token index from first on, end tokens of
+	// subprograms and diagnostics included, for a tree that outlives an edit
+	// of its tokens
+	void ShiftTokens(uint32_t first, ptrdiff_t delta);
+
+	// Appends copies of nodes [first, last) of from, none of which may link
+	// outside that range, with their side table rows; returns the new index
+	// of first. Strings stay in from's arena, see AstArena::Adopt.
+	uint32_t CopyNodes(const SyntaxTree& from, uint32_t first, uint32_t last);
+
+	void Reserve(size_t nodes)
+	{
+		m_Nodes.reserve(nodes);
+		m_LastChildren.reserve(nodes);
+	}
+
+	// Frees all nodes at once
+	void Clear();
+
+	size_t Size() const
+	{
+		return m_Nodes.size();
+	}
+
+	size_t UnreachableNodes() const
+	{
+		return m_UnreachableNodes;
+	}
+
+	void AddUnreachableNodes(size_t count)
+	{
+		m_UnreachableNodes += count;
+	}
+
+	const astNode_t& Node(uint32_t index) const
+	{
+		return m_Nodes[index];
+	}
+
+	AstNode Root() const
 	{
+		return AstNode(this, m_Nodes.empty() ? AST_NO_NODE : 0);
+	}
+
+	const subprogramPayload_t& Subprogram(uint32_t index) const
+	{
+		return m_Subprograms[m_Nodes[index].payload];
+	}
+
+	double NumericValue(uint32_t index) const
+	{
+		return m_NumericConstants[m_Nodes[index].payload];
+	}
+
+	ASTOperators Operator(uint32_t index) const
+	{
+		return (ASTOperators)m_Nodes[index].payload;
+	}
+
+	uint32_t Atom(uint32_t index) const
+	{
+		return m_Nodes[index].payload;
+	}
+
+	TokenHandle Token(uint32_t index) const
+	{
+		uint32_t token = m_Nodes[index].token;
+
+		if (token == AST_NO_TOKEN || !m_Tokens)
+			return TokenHandle();
 
+		return TokenHandle(m_Tokens, token);
 	}
 };
 
-IAbstractSyntaxTreeNode* BuildAbstractSyntaxTree(TokenStream* source);
+ASTNodeTypes AstNode::Type() const
+{
+	return m_Tree->Node(m_Index).type;
+}
+
+AstNode AstNode::FirstChild() const
+{
+	return AstNode(m_Tree, m_Tree->Node(m_Index).firstChild);
+}
+
+AstNode AstNode::NextSibling() const
+{
+	return AstNode(m_Tree, m_Tree->Node(m_Index).nextSibling);
+}
+
+TokenHandle AstNode::Token() const
+{
+	return m_Tree->Token(m_Index);
+}
+
+AstNode::ChildIterator& AstNode::ChildIterator::operator++()
+{
+	m_Index = m_Tree->Node(m_Index).nextSibling;
+	return *this;
+}
+
+AstNode::ChildRange AstNode::Children() const
+{
+	return ChildRange(m_Tree, m_Tree->Node(m_Index).firstChild);
+}
+
+const subprogramPayload_t& AstNode::Subprogram() const
+{
+	return m_Tree->Subprogram(m_Index);
+}
+
+double AstNode::NumericValue() const
+{
+	return m_Tree->NumericValue(m_Index);
+}
+
+ASTOperators AstNode::Operator() const
+{
+	return m_Tree->Operator(m_Index);
+}
+
+uint32_t AstNode::Atom() const
+{
+	return m_Tree->Atom(m_Index);
+}
+
+// Adds the nodes of source to tree under a new Module node and returns its
+// index; the first call on an empty tree makes that node the root. Strings
+// are copied into the tree, only AstNode::Token refers back to the tokens.
+//
+// Statements are parsed in one pass up to the next ';', or up to a keyword
+// closing a block such as EndIf if the statement before it lacks the ';'.
+// Expressions become operator, member, subscript, call and constant nodes;
+// where the expression grammar stops (control statement keywords, stray
+// tokens) the statement is an UnparsedExpression whose children are an
+// Unparsed node for every such token and the expressions between them. An
+// Unparsed node without a token stands for a missing operand or for an
+// argument left out of a call.
+//
+// Nothing is thrown for errors in the module: each is added to the tree's
+// diagnostics and parsing goes on from the next ';', the end of a broken
+// subprogram header or, for a subprogram missing its end keyword, the next
+// subprogram, so a broken module gets a tree of all that could be parsed.
+uint32_t BuildAbstractSyntaxTree(TokenSpan* source, SyntaxTree& tree);
+
+// Builds the same tree as BuildAbstractSyntaxTree, parsing subprograms on
+// threadCount threads, 0 meaning one per core. A scan over token types finds
+// the subprogram extents first; their nodes are then copied into tree in
+// source order along with the diagnostics. With one thread this is
+// BuildAbstractSyntaxTree.
+uint32_t BuildAbstractSyntaxTreeParallel(TokenSpan* source, SyntaxTree& tree, size_t threadCount = 0);
+
+// Brings a tree built from source before an edit up to date with it, edit
+// being what TokenStream::ApplyEdit returned (see CombineEdits for several).
+// Subprograms whose tokens the edit did not touch keep their nodes, shifted
+// to the new token indices; the others and the module level statements are
+// parsed again and appended, and the root's children relinked in source
+// order. Rows of the replaced nodes stay behind until they outnumber the
+// rest, when the tree is built from scratch instead. Diagnostics of the kept
+// subprograms are kept, the others found again.
+uint32_t ReparseAbstractSyntaxTree(TokenSpan* source, const tokenStreamEdit_t& edit, SyntaxTree& tree);
+
+// Parses the built-in cases of constructs the parser once got wrong and
+// reports those whose tree or diagnostics are not as expected, then makes
+// random edits to the given modules, or to generated ones without any, and
+// reports reparses that differ from a full build; returns nonzero if there
+// are any. Takes --edits N per module and --seed N.
+int RunParserCheck(int argc, char** argv);
 
 }
@@ -0,0 +1,106 @@
+#include "BSLArena.h"
+#include <cstring>
+
+namespace BSL
+{
+
+AstArena::AstArena()
+{
+	m_Current = nullptr;
+	m_Remaining = 0;
+	m_BytesAllocated = 0;
+}
+
+AstArena::AstArena(AstArena&& other) noexcept : m_Blocks(std::move(other.m_Blocks))
+{
+	m_Current = other.m_Current;
+	m_Remaining = other.m_Remaining;
+	m_BytesAllocated = other.m_BytesAllocated;
+
+	other.m_Blocks.clear();
+	other.m_Current = nullptr;
+	other.m_Remaining = 0;
+	other.m_BytesAllocated = 0;
+}
+
+AstArena& AstArena::operator=(AstArena&& other) noexcept
+{
+	if (this != &other)
+	{
+		Release();
+
+		std::swap(m_Blocks, other.m_Blocks);
+		std::swap(m_Current, other.m_Current);
+		std::swap(m_Remaining, other.m_Remaining);
+		std::swap(m_BytesAllocated, other.m_BytesAllocated);
+	}
+
+	return *this;
+}
+
+AstArena::~AstArena()
+{
+	Release();
+}
+
+// Allocations too large for a quarter of a block get a block of their own,
+// so the rest of the current block is not wasted
+void* AstArena::AllocateBlock(size_t size, size_t alignment)
+{
+	// Blocks come from operator new, which aligns for any fundamental type
+	size_t blockSize = size + alignment;
+	bool dedicated = blockSize > BlockSize / 4;
+
+	if (!dedicated)
+		blockSize = BlockSize;
+
+	char* block = new char[blockSize];
+	m_Blocks.push_back(block);
+	m_BytesAllocated += size;
+
+	if (dedicated)
+		return block;
+
+	m_Current = block + size;
+	m_Remaining = blockSize - size;
+
+	return block;
+}
+
+std::string_view AstArena::CopyString(std::string_view value)
+{
+	if (value.empty())
+		return std::string_view();
+
+	char* data = (char*)Allocate(value.length(), 1);
+	memcpy(data, value.data(), value.length());
+
+	return std::string_view(data, value.length());
+}
+
+void AstArena::Adopt(AstArena&& other)
+{
+	if (this == &other)
+		return;
+
+	m_Blocks.insert(m_Blocks.end(), other.m_Blocks.begin(), other.m_Blocks.end());
+	m_BytesAllocated += other.m_BytesAllocated;
+
+	other.m_Blocks.clear();
+	other.m_Current = nullptr;
+	other.m_Remaining = 0;
+	other.m_BytesAllocated = 0;
+}
+
+void AstArena::Release()
+{
+	for (char* block : m_Blocks)
+		delete[] block;
+
+	m_Blocks.clear();
+	m_Current = nullptr;
+	m_Remaining = 0;
+	m_BytesAllocated = 0;
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace BSL
+{
+
+// Array allocated in an AstArena; a plain view, copying it copies no elements
+template<class T>
+class ArenaArray
+{
+	const T* m_Data;
+	size_t m_Size;
+public:
+	ArenaArray() : m_Data(nullptr), m_Size(0)
+	{
+	}
+
+	ArenaArray(const T* data, size_t size) : m_Data(data), m_Size(size)
+	{
+	}
+
+	size_t Size() const
+	{
+		return m_Size;
+	}
+
+	const T& operator[](size_t index) const
+	{
+		return m_Data[index];
+	}
+
+	const T* begin() const
+	{
+		return m_Data;
+	}
+
+	const T* end() const
+	{
+		return m_Data + m_Size;
+	}
+};
+
+// Bump allocator owning the nodes and strings of one syntax tree. Nothing in
+// it is destroyed on its own: all blocks are released at once with the arena,
+// so whatever is allocated here must not own memory elsewhere.
+class AstArena
+{
+	std::vector<char*> m_Blocks;
+
+	char* m_Current;
+	size_t m_Remaining;
+
+	size_t m_BytesAllocated;
+
+	void* AllocateBlock(size_t size, size_t alignment);
+public:
+	static const size_t BlockSize = 64 * 1024;
+
+	AstArena();
+	AstArena(AstArena&& other) noexcept;
+	AstArena& operator=(AstArena&& other) noexcept;
+	AstArena(const AstArena&) = delete;
+	AstArena& operator=(const AstArena&) = delete;
+	~AstArena();
+
+	void* Allocate(size_t size, size_t alignment)
+	{
+		size_t padding = (alignment - ((uintptr_t)m_Current & (alignment - 1))) & (alignment - 1);
+
+		if (size + padding > m_Remaining)
+			return AllocateBlock(size, alignment);
+
+		char* result = m_Current + padding;
+
+		m_Current += size + padding;
+		m_Remaining -= size + padding;
+		m_BytesAllocated += size;
+
+		return result;
+	}
+
+	template<class T, class... Args>
+	T* New(Args&&... args)
+	{
+		return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	std::string_view CopyString(std::string_view value);
+
+	template<class T>
+	ArenaArray<T> CopyArray(const std::vector<T>& values)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "arena arrays are never destroyed");
+
+		if (values.empty())
+			return ArenaArray<T>();
+
+		T* data = (T*)Allocate(sizeof(T) * values.size(), alignof(T));
+		std::copy(values.begin(), values.end(), data);
+
+		return ArenaArray<T>(data, values.size());
+	}
+
+	// Takes over the blocks of other, so what was allocated there stays valid
+	// as long as this arena; other is left empty
+	void Adopt(AstArena&& other);
+
+	// Frees all blocks; everything allocated so far becomes invalid
+	void Release();
+
+	// Heap allocations made so far, one per block
+	size_t BlockCount() const
+	{
+		return m_Blocks.size();
+	}
+
+	size_t BytesAllocated() const
+	{
+		return m_BytesAllocated;
+	}
+};
+
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include <type_traits>
+#include <vector>
+#include "BSLAbstractSyntaxTree.h"
+
+namespace BSL
+{
+
+// Statically dispatched visitor: Derived hides the Visit<Type> methods for
+// the node types it handles, everything else ends up in VisitNode. Dispatch
+// is a switch over ASTNodeTypes calling Derived directly, so it inlines.
+// Result is what each visit returns; with the pre-order walker a bool result
+// of false skips the children of that node.
+template<class Derived, class Result = void>
+class AstVisitor
+{
+	Derived& Self()
+	{
+		return *static_cast<Derived*>(this);
+	}
+public:
+	Result Visit(AstNode node)
+	{
+		switch (node.Type())
+		{
+		case ASTNodeTypes::Module:
+			return Self().VisitModule(node);
+		case ASTNodeTypes::Function:
+			return Self().VisitFunction(node);
+		case ASTNodeTypes::Procedure:
+			return Self().VisitProcedure(node);
+		case ASTNodeTypes::ConditionalOperator:
+			return Self().VisitConditionalOperator(node);
+		case ASTNodeTypes::ArithmeticExpression:
+			return Self().VisitArithmeticExpression(node);
+		case ASTNodeTypes::AssigmentExpression:
+			return Self().VisitAssigmentExpression(node);
+		case ASTNodeTypes::MemberExpression:
+			return Self().VisitMemberExpression(node);
+		case ASTNodeTypes::SubscriptExpression:
+			return Self().VisitSubscriptExpression(node);
+		case ASTNodeTypes::Comment:
+			return Self().VisitComment(node);
+		case ASTNodeTypes::ForLoop:
+			return Self().VisitForLoop(node);
+		case ASTNodeTypes::WhileLoop:
+			return Self().VisitWhileLoop(node);
+		case ASTNodeTypes::SubprogramCall:
+			return Self().VisitSubprogramCall(node);
+		case ASTNodeTypes::NumericConstant:
+			return Self().VisitNumericConstant(node);
+		case ASTNodeTypes::Unparsed:
+			return Self().VisitUnparsed(node);
+		case ASTNodeTypes::UnparsedExpression:
+			return Self().VisitUnparsedExpression(node);
+		case ASTNodeTypes::ComparisonExpression:
+			return Self().VisitComparisonExpression(node);
+		case ASTNodeTypes::LogicalExpression:
+			return Self().VisitLogicalExpression(node);
+		case ASTNodeTypes::NewExpression:
+			return Self().VisitNewExpression(node);
+		case ASTNodeTypes::Identifier:
+			return Self().VisitIdentifier(node);
+		case ASTNodeTypes::StringConstant:
+			return Self().VisitStringConstant(node);
+		case ASTNodeTypes::DateConstant:
+			return Self().VisitDateConstant(node);
+		case ASTNodeTypes::BooleanConstant:
+			return Self().VisitBooleanConstant(node);
+		}
+
+		return Self().VisitNode(node);
+	}
+
+	Result VisitNode(AstNode)
+	{
+		return Result();
+	}
+
+	Result VisitModule(AstNode node) { return Self().VisitNode(node); }
+	Result VisitFunction(AstNode node) { return Self().VisitNode(node); }
+	Result VisitProcedure(AstNode node) { return Self().VisitNode(node); }
+	Result VisitConditionalOperator(AstNode node) { return Self().VisitNode(node); }
+	Result VisitArithmeticExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitAssigmentExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitMemberExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitSubscriptExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitComment(AstNode node) { return Self().VisitNode(node); }
+	Result VisitForLoop(AstNode node) { return Self().VisitNode(node); }
+	Result VisitWhileLoop(AstNode node) { return Self().VisitNode(node); }
+	Result VisitSubprogramCall(AstNode node) { return Self().VisitNode(node); }
+	Result VisitNumericConstant(AstNode node) { return Self().VisitNode(node); }
+	Result VisitUnparsed(AstNode node) { return Self().VisitNode(node); }
+	Result VisitUnparsedExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitComparisonExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitLogicalExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitNewExpression(AstNode node) { return Self().VisitNode(node); }
+	Result VisitIdentifier(AstNode node) { return Self().VisitNode(node); }
+	Result VisitStringConstant(AstNode node) { return Self().VisitNode(node); }
+	Result VisitDateConstant(AstNode node) { return Self().VisitNode(node); }
+	Result VisitBooleanConstant(AstNode node) { return Self().VisitNode(node); }
+};
+
+// Walkers below go without recursion, keeping the path from the root in
+// stack, which callers visiting many trees can pass in to reuse.
+
+// Visits root and its descendants, every node before its children
+template<class Visitor>
+void WalkPreOrder(AstNode root, Visitor& visitor, std::vector<AstNode>& stack)
+{
+	typedef decltype(visitor.Visit(root)) result_t;
+
+	auto visit = [&](AstNode node) -> bool
+	{
+		if constexpr (std::is_same<result_t, bool>::value)
+			return visitor.Visit(node);
+		else
+		{
+			visitor.Visit(node);
+			return true;
+		}
+	};
+
+	if (!root)
+		return;
+
+	size_t base = stack.size();
+	AstNode node = root;
+	bool descend = visit(node);
+
+	while (true)
+	{
+		AstNode child = descend ? node.FirstChild() : AstNode();
+
+		if (child)
+		{
+			stack.push_back(node);
+			node = child;
+			descend = visit(node);
+			continue;
+		}
+
+		// Up until a node with a next sibling, never past root
+		while (stack.size() > base && !node.NextSibling())
+		{
+			node = stack.back();
+			stack.pop_back();
+		}
+
+		if (stack.size() == base)
+			return;
+
+		node = node.NextSibling();
+		descend = visit(node);
+	}
+}
+
+// Visits root and its descendants, every node after its children
+template<class Visitor>
+void WalkPostOrder(AstNode root, Visitor& visitor, std::vector<AstNode>& stack)
+{
+	if (!root)
+		return;
+
+	size_t base = stack.size();
+	AstNode node = root;
+
+	while (true)
+	{
+		while (AstNode child = node.FirstChild())
+		{
+			stack.push_back(node);
+			node = child;
+		}
+
+		visitor.Visit(node);
+
+		// Parents are done once their last child is
+		while (stack.size() > base && !node.NextSibling())
+		{
+			node = stack.back();
+			stack.pop_back();
+			visitor.Visit(node);
+		}
+
+		if (stack.size() == base)
+			return;
+
+		node = node.NextSibling();
+	}
+}
+
+template<class Visitor>
+void WalkPreOrder(AstNode root, Visitor& visitor)
+{
+	std::vector<AstNode> stack;
+	WalkPreOrder(root, visitor, stack);
+}
+
+template<class Visitor>
+void WalkPostOrder(AstNode root, Visitor& visitor)
+{
+	std::vector<AstNode> stack;
+	WalkPostOrder(root, visitor, stack);
+}
+
+}
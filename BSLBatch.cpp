@@ -0,0 +1,432 @@
+#include "BSLBatch.h"
+#include "BSLAbstractSyntaxTree.h"
+#include "BSLDirectives.h"
+#include "BSLModuleCache.h"
+#include "BSLParallel.h"
+#include "BSLToken.h"
+#include "BSLTraceReport.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace BSL
+{
+
+typedef struct
+{
+	// Empty unless the module failed
+	std::string error;
+
+	size_t tokens;
+	size_t nodes;
+
+	// Compiled out for the --context given
+	size_t inactiveTokens;
+
+	// Read from the cache rather than parsed
+	bool cached;
+}batchResult_t;
+
+typedef struct
+{
+	double seconds;
+	size_t failed;
+	size_t tokens;
+	size_t nodes;
+	size_t inactiveTokens;
+	size_t cached;
+}batchTotals_t;
+
+// * matches any run of symbols, ? any single byte
+static bool MatchWildcard(std::string_view pattern, std::string_view name)
+{
+	size_t p = 0;
+	size_t n = 0;
+
+	// Where to resume if the last * has to take one more symbol
+	size_t starPattern = std::string_view::npos;
+	size_t starName = 0;
+
+	while (n < name.length())
+	{
+		if (p < pattern.length() && (pattern[p] == '?' || pattern[p] == name[n]))
+		{
+			p++;
+			n++;
+		}
+		else if (p < pattern.length() && pattern[p] == '*')
+		{
+			starPattern = p++;
+			starName = n;
+		}
+		else if (starPattern != std::string_view::npos)
+		{
+			p = starPattern + 1;
+			n = ++starName;
+		}
+		else
+			return false;
+	}
+
+	while (p < pattern.length() && pattern[p] == '*')
+		p++;
+
+	return p == pattern.length();
+}
+
+static bool IsModuleFile(const fs::path& path)
+{
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+
+	return extension == ".bsl";
+}
+
+static void AddFile(const fs::path& path, std::vector<batchFile_t>& files)
+{
+	std::error_code error;
+	uintmax_t size = fs::file_size(path, error);
+
+	files.push_back({ path.string(), error ? 0 : size });
+}
+
+bool CollectFiles(const char* argument, std::vector<batchFile_t>& files)
+{
+	fs::path path(argument);
+	std::error_code error;
+
+	std::string name = path.filename().string();
+
+	if (name.find_first_of("*?") != std::string::npos)
+	{
+		fs::path directory = path.parent_path();
+
+		if (directory.empty())
+			directory = ".";
+
+		for (fs::directory_iterator entry(directory, error), end; !error && entry != end; entry.increment(error))
+			if (entry->is_regular_file(error) && MatchWildcard(name, entry->path().filename().string()))
+				AddFile(entry->path(), files);
+
+		return !error;
+	}
+
+	if (fs::is_directory(path, error))
+	{
+		for (fs::recursive_directory_iterator entry(path, fs::directory_options::skip_permission_denied, error), end; !error && entry != end; entry.increment(error))
+			if (entry->is_regular_file(error) && IsModuleFile(entry->path()))
+				AddFile(entry->path(), files);
+
+		return !error;
+	}
+
+	if (!fs::exists(path, error))
+		return false;
+
+	AddFile(path, files);
+	return true;
+}
+
+// Position and message of the first of the diagnostics of a module and how
+// many more there are, counting others found elsewhere; empty if there are none
+static std::string DescribeDiagnostics(const TokenTable& tokens, const std::vector<parseDiagnostic_t>& diagnostics, size_t others = 0)
+{
+	if (diagnostics.empty())
+		return std::string();
+
+	const parseDiagnostic_t& first = diagnostics.front();
+	std::string error = "end of module";
+
+	if (first.token != AST_NO_TOKEN)
+	{
+		textHumanPosition_t position = tokens.TextPosition(first.token);
+		error = std::to_string(position.row) + ":" + std::to_string(position.column);
+	}
+
+	error += ": " + DiagnosticMessage(first);
+
+	if (diagnostics.size() + others > 1)
+		error += " (" + std::to_string(diagnostics.size() + others - 1) + " more)";
+
+	return error;
+}
+
+// With symbols, only the code compiled for them is parsed. With metrics,
+// the tokens and nodes of the module are counted into them.
+static void ProcessFile(const batchFile_t& file, const ModuleCache* cache, const DirectiveSymbols* symbols, batchResult_t& result, moduleMetrics_t* metrics)
+{
+	SourceBuffer source;
+
+	if (!source.LoadFile(file.path.c_str()))
+	{
+		result.error = "can't open";
+		return;
+	}
+
+	uint64_t sourceHash = 0;
+
+	if (cache)
+	{
+		sourceHash = HashSource(source.Text());
+
+		CachedModule module;
+
+		if (cache->Load(source.Text(), sourceHash, module))
+		{
+			result.tokens = module.TokenCount();
+			result.nodes = module.NodeCount();
+			result.cached = true;
+			return;
+		}
+	}
+
+	TokenStream stream(std::move(source));
+	SyntaxTree tree;
+
+	if (symbols)
+	{
+		TokenTable compiled;
+		std::vector<inactiveTokenRange_t> inactive;
+		std::vector<parseDiagnostic_t> directiveDiagnostics;
+
+		PruneInactiveCode(*stream.Table(), *symbols, compiled, inactive, directiveDiagnostics);
+
+		TokenSpan span(&compiled, 0, compiled.Size());
+		BuildAbstractSyntaxTree(&span, tree);
+
+		result.tokens = compiled.Size();
+		result.nodes = tree.Size();
+
+		// Directive errors come first, their tokens being those of the whole module
+		result.error = DescribeDiagnostics(*stream.Table(), directiveDiagnostics, tree.Diagnostics().size());
+
+		if (result.error.empty())
+			result.error = DescribeDiagnostics(compiled, tree.Diagnostics());
+
+		if (metrics)
+		{
+			CountTokenTypes(compiled, *metrics);
+			CountNodeTypes(tree, *metrics);
+		}
+
+		for (const inactiveTokenRange_t& range : inactive)
+			result.inactiveTokens += range.lastToken - range.firstToken;
+
+		return;
+	}
+
+	BuildAbstractSyntaxTree(&stream, tree);
+
+	result.tokens = stream.Size();
+	result.nodes = tree.Size();
+	result.error = DescribeDiagnostics(*stream.Table(), tree.Diagnostics());
+
+	if (metrics)
+	{
+		CountTokenTypes(*stream.Table(), *metrics);
+		CountNodeTypes(tree, *metrics);
+	}
+
+	// Failed modules are not cached, they are parsed again next time
+	if (cache && result.error.empty())
+		cache->Store(sourceHash, *stream.Table(), tree);
+}
+
+// With metrics, the pass is traced: they get the counters of every module
+// and the trace events only the events of this pass
+static batchTotals_t RunBatchPass(const std::vector<batchFile_t>& files, const ModuleCache* cache, const DirectiveSymbols* symbols, size_t threadCount,
+	std::vector<batchResult_t>& results, std::vector<moduleMetrics_t>* metrics)
+{
+	results.assign(files.size(), batchResult_t());
+
+	if (metrics)
+	{
+		metrics->assign(files.size(), moduleMetrics_t());
+
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			(*metrics)[i].path = files[i].path;
+			(*metrics)[i].bytes = files[i].size;
+		}
+
+		ClearTraceEvents();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	WorkStealingFor(files.size(), threadCount, [&](size_t, size_t index)
+	{
+		if (!metrics)
+		{
+			ProcessFile(files[index], cache, symbols, results[index], nullptr);
+			return;
+		}
+
+		moduleMetrics_t& module = (*metrics)[index];
+		allocationCounters_t before = ThreadAllocations();
+
+		SetTraceModule((int64_t)index);
+
+		{
+			TraceScope scope("module");
+			ProcessFile(files[index], cache, symbols, results[index], &module);
+		}
+
+		SetTraceModule(-1);
+
+		allocationCounters_t after = ThreadAllocations();
+		module.allocations.count = after.count - before.count;
+		module.allocations.bytes = after.bytes - before.bytes;
+	});
+
+	batchTotals_t totals = {};
+	totals.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (const batchResult_t& result : results)
+	{
+		totals.failed += result.error.empty() ? 0 : 1;
+		totals.tokens += result.tokens;
+		totals.nodes += result.nodes;
+		totals.inactiveTokens += result.inactiveTokens;
+		totals.cached += result.cached ? 1 : 0;
+	}
+
+	return totals;
+}
+
+int RunBatch(int argc, char** argv)
+{
+	size_t threadCount = HardwareThreadCount();
+	bool scaling = false;
+	std::unique_ptr<ModuleCache> cache;
+	std::unique_ptr<DirectiveSymbols> symbols;
+	const char* tracePath = nullptr;
+	const char* metricsPath = nullptr;
+	std::vector<batchFile_t> files;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			threadCount = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--scaling"))
+			scaling = true;
+		else if (!strcmp(argv[i], "--cache") && i + 1 < argc)
+			cache = std::make_unique<ModuleCache>(argv[++i]);
+		else if (!strcmp(argv[i], "--context") && i + 1 < argc)
+		{
+			symbols = std::make_unique<DirectiveSymbols>();
+
+			if (!symbols->DefineContext(argv[++i]))
+			{
+				fprintf(stderr, "Unknown context %s, expected one of %s\n", argv[i], ExecutionContextNames().c_str());
+				return 1;
+			}
+		}
+		else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (!strcmp(argv[i], "--metrics") && i + 1 < argc)
+			metricsPath = argv[++i];
+		else if (!CollectFiles(argv[i], files))
+			fprintf(stderr, "Can't read %s\n", argv[i]);
+	}
+
+	if (files.empty())
+	{
+		fprintf(stderr, "No modules to parse\n");
+		return 1;
+	}
+
+	// Entries hold whole modules
+	if (symbols && cache)
+	{
+		fprintf(stderr, "--cache can't be used with --context\n");
+		return 1;
+	}
+
+	// Largest first, so a big module doesn't start last and hold up the end
+	std::sort(files.begin(), files.end(), [](const batchFile_t& a, const batchFile_t& b)
+	{
+		return a.size != b.size ? a.size > b.size : a.path < b.path;
+	});
+
+	uintmax_t bytes = 0;
+
+	for (const batchFile_t& file : files)
+		bytes += file.size;
+
+	std::vector<batchResult_t> results;
+	batchTotals_t totals;
+
+	// Traced passes only keep the events of the last one
+	std::vector<moduleMetrics_t> metrics;
+	bool tracing = tracePath || metricsPath;
+
+	if (tracing)
+		EnableTracing(true);
+
+	if (scaling)
+	{
+		// The first pass also brings the files into the page cache
+		double baseSeconds = RunBatchPass(files, cache.get(), symbols.get(), 1, results, tracing ? &metrics : nullptr).seconds;
+
+		for (size_t threads : { 1, 2, 4, 8, 16 })
+		{
+			threadCount = threads;
+			totals = RunBatchPass(files, cache.get(), symbols.get(), threadCount, results, tracing ? &metrics : nullptr);
+
+			if (threadCount == 1)
+				baseSeconds = totals.seconds;
+
+			printf("%2zu threads: %.3f s, %.1f MB/s, %.2fx\n", threadCount, totals.seconds, bytes / totals.seconds / 1e6, baseSeconds / totals.seconds);
+		}
+	}
+	else
+		totals = RunBatchPass(files, cache.get(), symbols.get(), threadCount, results, tracing ? &metrics : nullptr);
+
+	if (tracing)
+	{
+		EnableTracing(false);
+
+		std::vector<traceEvent_t> events = CollectTraceEvents();
+
+		if (tracePath && !WriteChromeTrace(tracePath, events, metrics))
+			fprintf(stderr, "Can't write %s\n", tracePath);
+
+		if (metricsPath && !WriteTraceMetrics(metricsPath, events, metrics, totals.seconds, threadCount))
+			fprintf(stderr, "Can't write %s\n", metricsPath);
+	}
+
+	std::vector<size_t> failed;
+
+	for (size_t i = 0; i < files.size(); i++)
+		if (!results[i].error.empty())
+			failed.push_back(i);
+
+	std::sort(failed.begin(), failed.end(), [&](size_t a, size_t b) { return files[a].path < files[b].path; });
+
+	for (size_t i : failed)
+		printf("%s: %s\n", files[i].path.c_str(), results[i].error.c_str());
+
+	printf("%zu modules, %.1f MB, %zu tokens, %zu nodes in %.3f s on %zu threads (%.1f MB/s), %zu failed\n",
+		files.size(), bytes / 1e6, totals.tokens, totals.nodes, totals.seconds, threadCount, bytes / totals.seconds / 1e6, totals.failed);
+
+	if (cache)
+		printf("%zu modules read from the cache, %zu parsed\n", totals.cached, files.size() - totals.cached);
+
+	if (symbols)
+		printf("%zu tokens compiled out\n", totals.inactiveTokens);
+
+	return totals.failed ? 1 : 0;
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace BSL
+{
+
+typedef struct
+{
+	std::string path;
+	uintmax_t size;
+}batchFile_t;
+
+// Adds the files argument names: a module file, a directory searched
+// recursively for .bsl files, or a path with * and ? in its last component,
+// matching files of that directory. Returns false if it can't be read.
+bool CollectFiles(const char* argument, std::vector<batchFile_t>& files);
+
+// Entry point of "BSLTool batch [-j threads] [--scaling] [--cache directory]
+// [--context name] [--trace file] [--metrics file] path...": reads, lexes and
+// parses every module the paths name on a work-stealing pool and reports the
+// modules that failed; returns nonzero if any did. With --cache, modules that
+// have an entry in that ModuleCache are read from it instead, and parsed ones
+// are stored. With --context, e.g. Server, only the code compiled for that
+// execution context is parsed. --trace writes a Chrome trace of the phases on
+// every thread, --metrics a JSON summary of the run and of every module; with
+// --scaling they cover the last pass.
+int RunBatch(int argc, char** argv);
+
+}
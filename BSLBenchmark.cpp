@@ -0,0 +1,1298 @@
+﻿#include "BSLBenchmark.h"
+#include "BSLToken.h"
+#include "BSLAbstractSyntaxTree.h"
+#include "BSLAstVisitor.h"
+#include "BSLDirectives.h"
+#include "BSLJson.h"
+#include "BSLLanguageServer.h"
+#include "BSLMemoryStats.h"
+#include "BSLModuleGenerator.h"
+#include "BSLParallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <utility>
+
+namespace BSL
+{
+
+typedef struct
+{
+	const char* name;
+	void (*run)();
+}benchmarkDescriptor_t;
+
+template<typename Function>
+double MeasureSeconds(Function function)
+{
+	auto start = std::chrono::steady_clock::now();
+	function();
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// ASCII and Cyrillic only, which is all the generated words use
+void UppercaseUtf8(std::string& value)
+{
+	for (size_t i = 0; i < value.length(); i++)
+	{
+		unsigned char c = value[i];
+
+		if (c >= 'a' && c <= 'z')
+			value[i] = c - ('a' - 'A');
+		else if (c == 0xD0 && i + 1 < value.length() && (unsigned char)value[i + 1] >= 0xB0)
+			value[++i] -= 0x20;
+		else if (c == 0xD1 && i + 1 < value.length() && (unsigned char)value[i + 1] < 0x90)
+		{
+			value[i] = (char)0xD0;
+			value[++i] += 0x20;
+		}
+	}
+}
+
+// Identifier-heavy word mix: mostly identifiers, some keywords, random letter case
+std::vector<std::string> GenerateLookupWords(size_t count, unsigned seed)
+{
+	const char* identifiers[] =
+	{
+		u8"Результат", u8"ЗаполнитьДанные", u8"Параметр1", u8"Объект", u8"Свойство", u8"ТаблицаЗначений",
+		u8"Строка", u8"Массив", u8"ИндексСтроки", u8"Контрагент", u8"ДокументОбъект", u8"Сообщить",
+		u8"Value", u8"GetValue", u8"Counter", u8"Items", u8"i", u8"Запрос", u8"Выборка", u8"Номенклатура",
+		u8"ТекущаяДата", u8"Элемент", u8"СтруктураПараметров", u8"Отказ", u8"СтандартнаяОбработка",
+	};
+
+	const char* keywords[] =
+	{
+		u8"Если", u8"Тогда", u8"КонецЕсли", u8"Для", u8"Каждого", u8"Цикл", u8"КонецЦикла", u8"Новый",
+		u8"Процедура", u8"КонецПроцедуры", u8"Знач", u8"И", u8"Или", u8"Не", u8"Истина", u8"Ложь",
+		u8"If", u8"Then", u8"EndIf", u8"While", u8"New", u8"Function", u8"EndFunction", u8"Export",
+	};
+
+	std::mt19937 random(seed);
+	std::vector<std::string> words;
+	words.reserve(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		std::string word;
+
+		if (random() % 10 < 7)
+			word = identifiers[random() % std::size(identifiers)];
+		else
+			word = keywords[random() % std::size(keywords)];
+
+		if (random() % 4 == 0)
+			UppercaseUtf8(word);
+
+		words.push_back(word);
+	}
+
+	return words;
+}
+
+void BenchmarkKeywordLookup()
+{
+	const size_t wordCount = 1 << 16;
+	const size_t rounds = 32;
+
+	auto words = GenerateLookupWords(wordCount, 12345);
+
+	for (auto& word : words)
+	{
+		if (TokenTypeFromValue(word) != TokenTypeFromValueLinear(word))
+		{
+			printf("keywords: lookup mismatch, results are not comparable\n");
+			return;
+		}
+	}
+
+	size_t checksum = 0;
+
+	double linearSeconds = MeasureSeconds([&]()
+	{
+		for (size_t round = 0; round < rounds; round++)
+			for (auto& word : words)
+				checksum += (size_t)TokenTypeFromValueLinear(word);
+	});
+
+	double hashedSeconds = MeasureSeconds([&]()
+	{
+		for (size_t round = 0; round < rounds; round++)
+			for (auto& word : words)
+				checksum += (size_t)TokenTypeFromValue(word);
+	});
+
+	double lookups = (double)wordCount * rounds;
+
+	printf("keywords: linear %.1f ns/lookup, hashed %.1f ns/lookup, speedup %.1fx (checksum %zu)\n",
+		linearSeconds * 1e9 / lookups, hashedSeconds * 1e9 / lookups, linearSeconds / hashedSeconds, checksum);
+}
+
+// Procedures with annotations, arguments and a few statements each, with
+// every kind of expression the parser builds nodes for
+std::string GenerateModuleText(size_t procedures)
+{
+	std::string text;
+	char header[256];
+
+	for (size_t i = 0; i < procedures; i++)
+	{
+		snprintf(header, sizeof(header), u8"&НаСервере\nПроцедура Обработать%zu(Знач Параметр1, Параметр2 = %zu, Параметр3) Экспорт\n", i, i % 100);
+		text += header;
+
+		text += u8"\tРезультат = Параметр1.Количество() + Параметр2[0] * 3;\n";
+		text += u8"\tЕсли Результат >= 10 И Не Параметр3 Тогда\n";
+		text += u8"\t\tСообщить(\"Готово: \" + Результат);\n";
+		text += u8"\tКонецЕсли;\n";
+		text += u8"\tИтог = Новый Структура(\"Сумма\", -Результат / 2);\n";
+		text += u8"\tИтог.Сумма = Итог.Сумма % 7 + (1 - 2) * 3;\n";
+		text += u8"\tПараметр1[Итог.Сумма] = Параметр1.Найти(Итог, , 1) <> Неопределено;\n";
+
+		text += u8"КонецПроцедуры\n\n";
+	}
+
+	return text;
+}
+
+// Statements in a module made by GenerateModuleText
+const size_t g_GeneratedStatements = 6;
+
+class NodeCounter : public AstVisitor<NodeCounter>
+{
+public:
+	size_t count = 0;
+
+	void VisitNode(AstNode)
+	{
+		count++;
+	}
+};
+
+// Build time per statement should not depend on the module size
+void BenchmarkSyntaxTree(size_t procedures)
+{
+	const size_t rounds = 5;
+
+	TokenStream stream(GenerateModuleText(procedures));
+
+	double buildSeconds = 1e9;
+	double walkSeconds = 1e9;
+	double teardownSeconds = 1e9;
+	size_t nodes = 0;
+	size_t bytes = 0;
+
+	for (size_t round = 0; round < rounds; round++)
+	{
+		SyntaxTree tree;
+
+		stream.Reset();
+
+		buildSeconds = std::min(buildSeconds, MeasureSeconds([&]()
+		{
+			BuildAbstractSyntaxTree(&stream, tree);
+		}));
+
+		walkSeconds = std::min(walkSeconds, MeasureSeconds([&]()
+		{
+			NodeCounter counter;
+			WalkPreOrder(tree.Root(), counter);
+			nodes = counter.count;
+		}));
+
+		bytes = tree.Arena().BytesAllocated() + tree.Size() * sizeof(astNode_t);
+
+		teardownSeconds = std::min(teardownSeconds, MeasureSeconds([&]()
+		{
+			tree.Clear();
+		}));
+	}
+
+	printf("ast: %zu procedures built in %.2f ms (%.0f ns/statement), %zu nodes walked in %.3f ms, freed in %.3f ms; %zu KB\n",
+		procedures, buildSeconds * 1e3, buildSeconds * 1e9 / (procedures * g_GeneratedStatements), nodes, walkSeconds * 1e3, teardownSeconds * 1e3, bytes / 1024);
+}
+
+void BenchmarkSyntaxTree()
+{
+	for (size_t procedures : { 2000, 20000, 100000 })
+		BenchmarkSyntaxTree(procedures);
+}
+
+static bool SameArguments(const argumentDescriptor_t& a, const argumentDescriptor_t& b)
+{
+	return a.name == b.name && a.byValue == b.byValue && a.hasDefaultValue == b.hasDefaultValue && a.defaultValue == b.defaultValue;
+}
+
+// Same type, token and side table data, links aside
+static bool SameNode(const SyntaxTree& a, uint32_t indexA, const SyntaxTree& b, uint32_t indexB)
+{
+	const astNode_t& nodeA = a.Node(indexA);
+	const astNode_t& nodeB = b.Node(indexB);
+
+	if (nodeA.type != nodeB.type || nodeA.token != nodeB.token)
+		return false;
+
+	switch (nodeA.type)
+	{
+	case ASTNodeTypes::Function:
+	case ASTNodeTypes::Procedure:
+		{
+			const subprogramPayload_t& subprogramA = a.Subprogram(indexA);
+			const subprogramPayload_t& subprogramB = b.Subprogram(indexB);
+
+			return subprogramA.name == subprogramB.name && subprogramA.exported == subprogramB.exported &&
+				std::equal(subprogramA.annotations.begin(), subprogramA.annotations.end(), subprogramB.annotations.begin(), subprogramB.annotations.end()) &&
+				std::equal(subprogramA.arguments.begin(), subprogramA.arguments.end(), subprogramB.arguments.begin(), subprogramB.arguments.end(), SameArguments);
+		}
+	case ASTNodeTypes::NumericConstant:
+		return a.NumericValue(indexA) == b.NumericValue(indexB);
+	default:
+		return nodeA.payload == nodeB.payload;
+	}
+}
+
+// Same nodes at the same indices with the same side table data
+bool SameSyntaxTree(const SyntaxTree& a, const SyntaxTree& b)
+{
+	if (a.Size() != b.Size())
+		return false;
+
+	for (uint32_t i = 0; i < a.Size(); i++)
+	{
+		const astNode_t& nodeA = a.Node(i);
+		const astNode_t& nodeB = b.Node(i);
+
+		if (nodeA.firstChild != nodeB.firstChild || nodeA.nextSibling != nodeB.nextSibling || !SameNode(a, i, b, i))
+			return false;
+	}
+
+	return true;
+}
+
+// Same nodes reached from the roots in the same order, wherever in the
+// table they are
+bool SameSyntaxTreeShape(const SyntaxTree& a, const SyntaxTree& b)
+{
+	if (!a.Root() || !b.Root())
+		return !a.Root() && !b.Root();
+
+	std::vector<std::pair<uint32_t, uint32_t>> pending(1, std::make_pair(0u, 0u));
+
+	while (!pending.empty())
+	{
+		uint32_t indexA = pending.back().first;
+		uint32_t indexB = pending.back().second;
+		pending.pop_back();
+
+		if (!SameNode(a, indexA, b, indexB))
+			return false;
+
+		uint32_t childA = a.Node(indexA).firstChild;
+		uint32_t childB = b.Node(indexB).firstChild;
+
+		for (; childA != AST_NO_NODE && childB != AST_NO_NODE; childA = a.Node(childA).nextSibling, childB = b.Node(childB).nextSibling)
+			pending.emplace_back(childA, childB);
+
+		if (childA != childB)
+			return false;
+	}
+
+	return true;
+}
+
+void BenchmarkParallelParsing()
+{
+	const size_t procedures = 20000;
+	const size_t rounds = 5;
+
+	TokenStream stream(GenerateModuleText(procedures));
+
+	SyntaxTree reference;
+	double sequentialSeconds = 1e9;
+
+	for (size_t round = 0; round < rounds; round++)
+	{
+		reference.Clear();
+		stream.Reset();
+
+		sequentialSeconds = std::min(sequentialSeconds, MeasureSeconds([&]()
+		{
+			BuildAbstractSyntaxTree(&stream, reference);
+		}));
+	}
+
+	printf("parallel: %zu procedures, sequential build %.2f ms\n", procedures, sequentialSeconds * 1e3);
+
+	for (size_t threads : { 1, 2, 4, 8, 16 })
+	{
+		double seconds = 1e9;
+		bool same = true;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			SyntaxTree tree;
+			stream.Reset();
+
+			seconds = std::min(seconds, MeasureSeconds([&]()
+			{
+				BuildAbstractSyntaxTreeParallel(&stream, tree, threads);
+			}));
+
+			same = same && SameSyntaxTree(reference, tree);
+		}
+
+		printf("parallel: %2zu threads %.2f ms, %.2fx sequential%s\n",
+			threads, seconds * 1e3, sequentialSeconds / seconds, same ? "" : ", TREE DIFFERS");
+	}
+}
+
+// An edit a user makes in a module of GenerateModuleText: the first
+// occurrence of find after the middle procedure's header becomes replace
+typedef struct
+{
+	const char* name;
+	const char* find;
+	const char* replace;
+}moduleEdit_t;
+
+// A one-line edit in the middle of a module of about 20000 lines, reparsed
+// and compared to a tree built from scratch, then undone the same way
+void BenchmarkReparse()
+{
+	const size_t procedures = 1820;
+	const size_t rounds = 10;
+
+	const moduleEdit_t edits[] =
+	{
+		{ "new operand", u8"* 3;", u8"* 3 + 1;" },
+		{ "renamed identifier", u8"Итог.Сумма %", u8"Итог.Сумм %" },
+		{ "removed semicolon", u8"КонецЕсли;", u8"КонецЕсли" },
+		{ "new statement", u8"\tКонецЕсли;\n", u8"\tКонецЕсли;\n\tИтог = 0;\n" },
+		{ "removed annotation", u8"&НаСервере\n", u8"" },
+		{ "new end keyword", u8"\tКонецЕсли;\n", u8"\tКонецЕсли;\nКонецПроцедуры\n" },
+		{ "new procedure", u8"КонецПроцедуры\n", u8"КонецПроцедуры\nПроцедура Новая()\nКонецПроцедуры\n" },
+	};
+
+	std::string text = GenerateModuleText(procedures);
+	size_t middle = text.find(u8"Обработать" + std::to_string(procedures / 2) + "(");
+
+	TokenStream stream(text);
+
+	double buildSeconds = 1e9;
+
+	for (size_t round = 0; round < rounds; round++)
+	{
+		SyntaxTree tree;
+		stream.Reset();
+
+		buildSeconds = std::min(buildSeconds, MeasureSeconds([&]()
+		{
+			BuildAbstractSyntaxTree(&stream, tree);
+		}));
+	}
+
+	printf("reparse: %zu lines, full build %.3f ms\n", (size_t)std::count(text.begin(), text.end(), '\n'), buildSeconds * 1e3);
+
+	SyntaxTree tree;
+	stream.Reset();
+	BuildAbstractSyntaxTree(&stream, tree);
+
+	// Reparses after an edit; checking the tree against a fresh build leaves
+	// the caches cold, so that is only done once at the end
+	auto reparse = [&](size_t offset, size_t removed, std::string_view inserted, double& seconds, bool check)
+	{
+		tokenStreamEdit_t edit = stream.ApplyEdit(offset, removed, inserted);
+		stream.Reset();
+
+		seconds = std::min(seconds, MeasureSeconds([&]()
+		{
+			ReparseAbstractSyntaxTree(&stream, edit, tree);
+		}));
+
+		if (!check)
+			return true;
+
+		TokenStream fresh{ std::string(stream.SourceText()) };
+		SyntaxTree reference;
+		BuildAbstractSyntaxTree(&fresh, reference);
+
+		return SameSyntaxTreeShape(tree, reference);
+	};
+
+	for (const moduleEdit_t& edit : edits)
+	{
+		size_t offset = text.find(edit.find, middle);
+		std::string_view find(edit.find);
+		std::string_view replace(edit.replace);
+
+		double editSeconds = 1e9;
+		double undoSeconds = 1e9;
+		bool same = true;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			same = reparse(offset, find.length(), replace, editSeconds, round + 1 == rounds) && same;
+			same = reparse(offset, replace.length(), find, undoSeconds, round + 1 == rounds) && same;
+		}
+
+		printf("reparse: %-18s %.3f ms, undone %.3f ms, %.0fx faster than a build%s\n",
+			edit.name, editSeconds * 1e3, undoSeconds * 1e3, buildSeconds / std::max(editSeconds, undoSeconds), same ? "" : ", TREE DIFFERS");
+	}
+
+	printf("reparse: %zu of %zu rows unreachable\n", tree.UnreachableNodes(), tree.Size());
+}
+
+// Module of GenerateModuleText with its procedures in turn compiled on the
+// server only, on clients only and everywhere, the way modules mixing client
+// and server code are laid out
+std::string GenerateMixedModuleText(size_t procedures)
+{
+	const char* const end = u8"КонецПроцедуры\n\n";
+
+	std::string source = GenerateModuleText(procedures);
+	std::string text;
+	size_t position = 0;
+
+	for (size_t i = 0; i < procedures; i++)
+	{
+		size_t next = source.find(end, position) + strlen(end);
+		std::string_view procedure(source.data() + position, next - position);
+
+		switch (i % 3)
+		{
+		case 0:
+			text += u8"#Если Сервер Или ТолстыйКлиентОбычноеПриложение Или ВнешнееСоединение Тогда\n";
+			text += procedure;
+			text += u8"#КонецЕсли\n\n";
+			break;
+		case 1:
+			text += u8"#Если Не Клиент Тогда\n#Иначе\n";
+			text += procedure;
+			text += u8"#КонецЕсли\n\n";
+			break;
+		default:
+			text += procedure;
+			break;
+		}
+
+		position = next;
+	}
+
+	return text;
+}
+
+// Parsing a mixed module for one execution context against parsing it whole
+void BenchmarkDirectives()
+{
+	const size_t procedures = 3000;
+	const size_t rounds = 10;
+
+	TokenStream stream(GenerateMixedModuleText(procedures));
+
+	double wholeSeconds = 1e9;
+
+	for (size_t round = 0; round < rounds; round++)
+	{
+		SyntaxTree tree;
+		stream.Reset();
+
+		wholeSeconds = std::min(wholeSeconds, MeasureSeconds([&]()
+		{
+			BuildAbstractSyntaxTree(&stream, tree);
+		}));
+	}
+
+	printf("directives: %zu procedures, %zu tokens, whole module %.3f ms\n", procedures, stream.Size(), wholeSeconds * 1e3);
+
+	for (const char* context : { "Server", "ThinClient" })
+	{
+		DirectiveSymbols symbols;
+		symbols.DefineContext(context);
+
+		bool server = !strcmp(context, "Server");
+		size_t expected = 0;
+
+		for (size_t i = 0; i < procedures; i++)
+			expected += i % 3 != (server ? 1 : 0) ? 1 : 0;
+
+		double pruneSeconds = 1e9;
+		double buildSeconds = 1e9;
+		size_t compiledTokens = 0;
+		size_t found = 0;
+
+		// Reused, so that rounds measure the same warm allocations as above
+		TokenTable compiled;
+		std::vector<inactiveTokenRange_t> inactive;
+		std::vector<parseDiagnostic_t> diagnostics;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			SyntaxTree tree;
+			compiled.Clear();
+			inactive.clear();
+			diagnostics.clear();
+
+			pruneSeconds = std::min(pruneSeconds, MeasureSeconds([&]()
+			{
+				PruneInactiveCode(*stream.Table(), symbols, compiled, inactive, diagnostics);
+			}));
+
+			TokenSpan span(&compiled, 0, compiled.Size());
+
+			buildSeconds = std::min(buildSeconds, MeasureSeconds([&]()
+			{
+				BuildAbstractSyntaxTree(&span, tree);
+			}));
+
+			compiledTokens = compiled.Size();
+			found = 0;
+
+			for (AstNode child : tree.Root().Children())
+				found += child.Type() == ASTNodeTypes::Procedure ? 1 : 0;
+		}
+
+		printf("directives: %-10s %zu tokens, prune %.3f ms, build %.3f ms, %.2fx faster than the whole module%s\n",
+			context, compiledTokens, pruneSeconds * 1e3, buildSeconds * 1e3, wholeSeconds / (pruneSeconds + buildSeconds),
+			found == expected ? "" : ", PROCEDURES DIFFER");
+	}
+}
+
+// Module of GenerateModuleText with a syntax error in every tenth procedure,
+// in turn a missing ')', a missing operand and a missing end keyword
+std::string GenerateBrokenModuleText(size_t procedures)
+{
+	const char* const end = u8"КонецПроцедуры\n\n";
+	const std::pair<const char*, const char*> errors[] =
+	{
+		{ u8"Параметр1.Количество()", u8"Параметр1.Количество(" },
+		{ u8"Параметр2[0] * 3;", u8"Параметр2[0] * ;" },
+		{ end, u8"\n" },
+	};
+
+	std::string source = GenerateModuleText(procedures);
+	std::string text;
+	size_t position = 0;
+
+	for (size_t i = 0; i < procedures; i++)
+	{
+		size_t next = source.find(end, position) + strlen(end);
+		std::string procedure = source.substr(position, next - position);
+
+		if (i % 10 == 0)
+		{
+			const auto& error = errors[i / 10 % 3];
+			procedure.replace(procedure.find(error.first), strlen(error.first), error.second);
+		}
+
+		text += procedure;
+		position = next;
+	}
+
+	return text;
+}
+
+// Parsing a module with errors against parsing the same module without them:
+// recovery should cost little, and every error should be reported once
+// without losing the procedures after it
+void BenchmarkRecovery()
+{
+	const size_t procedures = 3000;
+	const size_t rounds = 10;
+
+	for (bool broken : { false, true })
+	{
+		TokenStream stream(broken ? GenerateBrokenModuleText(procedures) : GenerateModuleText(procedures));
+
+		double buildSeconds = 1e9;
+		size_t diagnostics = 0;
+		size_t found = 0;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			SyntaxTree tree;
+			stream.Reset();
+
+			buildSeconds = std::min(buildSeconds, MeasureSeconds([&]()
+			{
+				BuildAbstractSyntaxTree(&stream, tree);
+			}));
+
+			diagnostics = tree.Diagnostics().size();
+			found = 0;
+
+			for (AstNode child : tree.Root().Children())
+				found += child.Type() == ASTNodeTypes::Procedure ? 1 : 0;
+		}
+
+		size_t expected = broken ? (procedures + 9) / 10 : 0;
+
+		printf("recovery: %-6s module %zu tokens, build %.3f ms (%.1f MB/s), %zu diagnostics%s\n",
+			broken ? "broken" : "valid", stream.Size(), buildSeconds * 1e3, stream.Table()->Source().buffer.Text().length() / buildSeconds / 1e6, diagnostics,
+			diagnostics == expected && found == procedures ? "" : ", RECOVERY DIFFERS");
+	}
+}
+
+// Tree of random shape and node types with up to 3 children per node, built
+// depth first like the parser does, so subtrees are mostly contiguous
+void GenerateSyntaxTree(SyntaxTree& tree, size_t nodeCount, unsigned seed)
+{
+	const size_t typeCount = AST_NODE_TYPE_COUNT;
+	const size_t maxDepth = 16;
+
+	std::mt19937 random(seed);
+
+	// Nodes still getting children and how many more each gets
+	std::vector<std::pair<uint32_t, size_t>> open;
+
+	tree.AddNode(ASTNodeTypes::Module);
+
+	while (tree.Size() < nodeCount)
+	{
+		if (open.empty())
+			open.emplace_back(0, 4);
+
+		if (open.back().second == 0)
+		{
+			open.pop_back();
+			continue;
+		}
+
+		open.back().second--;
+
+		uint32_t node = tree.AddNode((ASTNodeTypes)(random() % typeCount));
+		tree.AddChild(open.back().first, node);
+
+		if (open.size() < maxDepth)
+			open.emplace_back(node, random() % 4);
+	}
+}
+
+// Per-type work every dispatch variant does for each node
+class TypeChecksum
+{
+public:
+	size_t sum = 0;
+
+	template<ASTNodeTypes Type>
+	void Add(uint32_t index)
+	{
+		sum += (index ^ (uint32_t)Type) * ((size_t)Type + 1);
+	}
+};
+
+class ChecksumVisitor : public AstVisitor<ChecksumVisitor>
+{
+public:
+	TypeChecksum checksum;
+
+	void VisitModule(AstNode node) { checksum.Add<ASTNodeTypes::Module>(node.Index()); }
+	void VisitFunction(AstNode node) { checksum.Add<ASTNodeTypes::Function>(node.Index()); }
+	void VisitProcedure(AstNode node) { checksum.Add<ASTNodeTypes::Procedure>(node.Index()); }
+	void VisitConditionalOperator(AstNode node) { checksum.Add<ASTNodeTypes::ConditionalOperator>(node.Index()); }
+	void VisitArithmeticExpression(AstNode node) { checksum.Add<ASTNodeTypes::ArithmeticExpression>(node.Index()); }
+	void VisitAssigmentExpression(AstNode node) { checksum.Add<ASTNodeTypes::AssigmentExpression>(node.Index()); }
+	void VisitMemberExpression(AstNode node) { checksum.Add<ASTNodeTypes::MemberExpression>(node.Index()); }
+	void VisitSubscriptExpression(AstNode node) { checksum.Add<ASTNodeTypes::SubscriptExpression>(node.Index()); }
+	void VisitComment(AstNode node) { checksum.Add<ASTNodeTypes::Comment>(node.Index()); }
+	void VisitForLoop(AstNode node) { checksum.Add<ASTNodeTypes::ForLoop>(node.Index()); }
+	void VisitWhileLoop(AstNode node) { checksum.Add<ASTNodeTypes::WhileLoop>(node.Index()); }
+	void VisitSubprogramCall(AstNode node) { checksum.Add<ASTNodeTypes::SubprogramCall>(node.Index()); }
+	void VisitNumericConstant(AstNode node) { checksum.Add<ASTNodeTypes::NumericConstant>(node.Index()); }
+	void VisitUnparsed(AstNode node) { checksum.Add<ASTNodeTypes::Unparsed>(node.Index()); }
+	void VisitUnparsedExpression(AstNode node) { checksum.Add<ASTNodeTypes::UnparsedExpression>(node.Index()); }
+	void VisitComparisonExpression(AstNode node) { checksum.Add<ASTNodeTypes::ComparisonExpression>(node.Index()); }
+	void VisitLogicalExpression(AstNode node) { checksum.Add<ASTNodeTypes::LogicalExpression>(node.Index()); }
+	void VisitNewExpression(AstNode node) { checksum.Add<ASTNodeTypes::NewExpression>(node.Index()); }
+	void VisitIdentifier(AstNode node) { checksum.Add<ASTNodeTypes::Identifier>(node.Index()); }
+	void VisitStringConstant(AstNode node) { checksum.Add<ASTNodeTypes::StringConstant>(node.Index()); }
+	void VisitDateConstant(AstNode node) { checksum.Add<ASTNodeTypes::DateConstant>(node.Index()); }
+	void VisitBooleanConstant(AstNode node) { checksum.Add<ASTNodeTypes::BooleanConstant>(node.Index()); }
+};
+
+// Heap-allocated polymorphic nodes the way the tree used to be, one class per node type
+class IBenchmarkNode
+{
+public:
+	uint32_t index;
+
+	virtual ~IBenchmarkNode() {}
+	virtual void Accept(TypeChecksum& checksum) = 0;
+};
+
+template<ASTNodeTypes Type>
+class BenchmarkNode : public IBenchmarkNode
+{
+public:
+	void Accept(TypeChecksum& checksum) override
+	{
+		checksum.Add<Type>(index);
+	}
+};
+
+template<size_t... Types>
+std::unique_ptr<IBenchmarkNode> MakeBenchmarkNode(ASTNodeTypes type, std::index_sequence<Types...>)
+{
+	std::unique_ptr<IBenchmarkNode> node;
+	(void)((type == (ASTNodeTypes)Types ? (node = std::make_unique<BenchmarkNode<(ASTNodeTypes)Types>>(), true) : false) || ...);
+
+	return node;
+}
+
+template<ASTNodeTypes Type>
+bool CastAndAdd(IBenchmarkNode* node, TypeChecksum& checksum)
+{
+	BenchmarkNode<Type>* typedNode = dynamic_cast<BenchmarkNode<Type>*>(node);
+
+	if (!typedNode)
+		return false;
+
+	checksum.Add<Type>(typedNode->index);
+	return true;
+}
+
+// Tries the node classes in order until a cast succeeds
+template<size_t... Types>
+void DispatchByCast(IBenchmarkNode* node, TypeChecksum& checksum, std::index_sequence<Types...>)
+{
+	(void)(CastAndAdd<(ASTNodeTypes)Types>(node, checksum) || ...);
+}
+
+// Same nodes in the same order for all variants, so only the dispatch differs;
+// the pre-order walk adds the cost of following the tree structure
+void BenchmarkVisitorDispatch()
+{
+	const size_t nodeCount = 1 << 20;
+	const size_t rounds = 10;
+	typedef std::make_index_sequence<AST_NODE_TYPE_COUNT> node_types_t;
+
+	SyntaxTree tree;
+	GenerateSyntaxTree(tree, nodeCount, 12345);
+
+	std::vector<std::unique_ptr<IBenchmarkNode>> nodes;
+	nodes.reserve(nodeCount);
+
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		nodes.push_back(MakeBenchmarkNode(tree.Node(i).type, node_types_t()));
+		nodes.back()->index = i;
+	}
+
+	size_t sums[4] = {};
+
+	double staticSeconds = MeasureSeconds([&]()
+	{
+		ChecksumVisitor visitor;
+
+		for (size_t round = 0; round < rounds; round++)
+			for (uint32_t i = 0; i < nodeCount; i++)
+				visitor.Visit(AstNode(&tree, i));
+
+		sums[0] = visitor.checksum.sum;
+	});
+
+	double walkSeconds = MeasureSeconds([&]()
+	{
+		ChecksumVisitor visitor;
+		std::vector<AstNode> stack;
+
+		for (size_t round = 0; round < rounds; round++)
+			WalkPreOrder(tree.Root(), visitor, stack);
+
+		sums[1] = visitor.checksum.sum;
+	});
+
+	double virtualSeconds = MeasureSeconds([&]()
+	{
+		TypeChecksum checksum;
+
+		for (size_t round = 0; round < rounds; round++)
+			for (auto& node : nodes)
+				node->Accept(checksum);
+
+		sums[2] = checksum.sum;
+	});
+
+	double castSeconds = MeasureSeconds([&]()
+	{
+		TypeChecksum checksum;
+
+		for (size_t round = 0; round < rounds; round++)
+			for (auto& node : nodes)
+				DispatchByCast(node.get(), checksum, node_types_t());
+
+		sums[3] = checksum.sum;
+	});
+
+	if (sums[0] != sums[1] || sums[0] != sums[2] || sums[0] != sums[3])
+	{
+		printf("visitor: checksum mismatch, results are not comparable\n");
+		return;
+	}
+
+	double visits = (double)nodeCount * rounds;
+
+	printf("visitor: static %.2f ns/node, pre-order walk %.2f ns/node, virtual %.2f ns/node, dynamic_cast %.2f ns/node\n",
+		staticSeconds * 1e9 / visits, walkSeconds * 1e9 / visits, virtualSeconds * 1e9 / visits, castSeconds * 1e9 / visits);
+}
+
+static std::string LspNotification(const char* method, const std::function<void(JsonWriter&)>& params)
+{
+	JsonWriter writer;
+
+	writer.BeginObject();
+	writer.Key("jsonrpc").String("2.0");
+	writer.Key("method").String(method);
+	writer.Key("params");
+	params(writer);
+	writer.EndObject();
+
+	return writer.Release();
+}
+
+static std::string LspRequest(int id, const char* method, const std::function<void(JsonWriter&)>& params)
+{
+	std::string message = LspNotification(method, params);
+
+	// Notification plus an id member
+	message.insert(1, "\"id\":" + std::to_string(id) + ",");
+
+	return message;
+}
+
+static void WriteLspPosition(JsonWriter& writer, size_t line, size_t character)
+{
+	writer.BeginObject();
+	writer.Key("line").Int(line);
+	writer.Key("character").Int(character);
+	writer.EndObject();
+}
+
+// Latency of what an editor sends while the user types in a module of about
+// 10000 lines, JSON parsing and writing included: an edit in the middle of
+// the module, then the outline, folding and a hover on the edited procedure
+void BenchmarkLanguageServer()
+{
+	// GenerateModuleText writes 11 lines per procedure
+	const size_t procedures = 910;
+	const size_t linesPerProcedure = 11;
+	const size_t rounds = 100;
+
+	std::string text = GenerateModuleText(procedures);
+	const char* uri = "file:///bench/Module.bsl";
+
+	LanguageServer server;
+	std::vector<std::string> output;
+
+	auto send = [&](const std::string& message)
+	{
+		output.clear();
+
+		return MeasureSeconds([&]()
+		{
+			server.HandleMessage(message, output);
+		});
+	};
+
+	auto textDocument = [&](JsonWriter& writer)
+	{
+		writer.Key("textDocument");
+		writer.BeginObject();
+		writer.Key("uri").String(uri);
+		writer.EndObject();
+	};
+
+	send(LspRequest(0, "initialize", [](JsonWriter& writer) { writer.BeginObject(); writer.EndObject(); }));
+
+	double openSeconds = send(LspNotification("textDocument/didOpen", [&](JsonWriter& writer)
+	{
+		writer.BeginObject();
+		writer.Key("textDocument");
+		writer.BeginObject();
+		writer.Key("uri").String(uri);
+		writer.Key("languageId").String("bsl");
+		writer.Key("version").Int(1);
+		writer.Key("text").String(text);
+		writer.EndObject();
+		writer.EndObject();
+	}));
+
+	// First statement of the middle procedure, after the tab
+	size_t editLine = procedures / 2 * linesPerProcedure + 2;
+
+	auto edit = [&](int version, size_t removed, const char* inserted)
+	{
+		return LspNotification("textDocument/didChange", [&](JsonWriter& writer)
+		{
+			writer.BeginObject();
+			writer.Key("textDocument");
+			writer.BeginObject();
+			writer.Key("uri").String(uri);
+			writer.Key("version").Int(version);
+			writer.EndObject();
+			writer.Key("contentChanges");
+			writer.BeginArray();
+			writer.BeginObject();
+			writer.Key("range");
+			writer.BeginObject();
+			writer.Key("start");
+			WriteLspPosition(writer, editLine, 1);
+			writer.Key("end");
+			WriteLspPosition(writer, editLine, 1 + removed);
+			writer.EndObject();
+			writer.Key("text").String(inserted);
+			writer.EndObject();
+			writer.EndArray();
+			writer.EndObject();
+		});
+	};
+
+	auto documentRequest = [&](int id, const char* method)
+	{
+		return LspRequest(id, method, [&](JsonWriter& writer)
+		{
+			writer.BeginObject();
+			textDocument(writer);
+			writer.EndObject();
+		});
+	};
+
+	// On the name of the edited procedure, past "Процедура "
+	std::string hover = LspRequest(4, "textDocument/hover", [&](JsonWriter& writer)
+	{
+		writer.BeginObject();
+		textDocument(writer);
+		writer.Key("position");
+		WriteLspPosition(writer, editLine - 1, 12);
+		writer.EndObject();
+	});
+
+	std::string insert = edit(2, 0, " ");
+	std::string remove = edit(3, 1, "");
+	std::string symbols = documentRequest(1, "textDocument/documentSymbol");
+	std::string folding = documentRequest(2, "textDocument/foldingRange");
+
+	const char* names[] = { "didChange", "documentSymbol", "foldingRange", "hover" };
+	std::vector<double> samples[4];
+	size_t responseBytes[4] = {};
+
+	for (size_t round = 0; round < rounds; round++)
+	{
+		samples[0].push_back(send(round % 2 ? remove : insert));
+		responseBytes[0] = output.empty() ? 0 : output[0].length();
+		samples[1].push_back(send(symbols));
+		responseBytes[1] = output.empty() ? 0 : output[0].length();
+		samples[2].push_back(send(folding));
+		responseBytes[2] = output.empty() ? 0 : output[0].length();
+		samples[3].push_back(send(hover));
+		responseBytes[3] = output.empty() ? 0 : output[0].length();
+	}
+
+	printf("lsp: %zu lines, didOpen %.2f ms\n", (size_t)std::count(text.begin(), text.end(), '\n'), openSeconds * 1e3);
+
+	for (size_t i = 0; i < 4; i++)
+	{
+		std::sort(samples[i].begin(), samples[i].end());
+
+		printf("lsp: %-14s median %.3f ms, p90 %.3f ms, max %.3f ms, %zu bytes\n",
+			names[i], samples[i][rounds / 2] * 1e3, samples[i][rounds * 9 / 10] * 1e3, samples[i].back() * 1e3, responseBytes[i]);
+	}
+}
+
+benchmarkDescriptor_t g_Benchmarks[] =
+{
+	{"keywords", BenchmarkKeywordLookup},
+	{"ast", BenchmarkSyntaxTree},
+	{"parallel", BenchmarkParallelParsing},
+	{"visitor", BenchmarkVisitorDispatch},
+	{"reparse", BenchmarkReparse},
+	{"directives", BenchmarkDirectives},
+	{"recovery", BenchmarkRecovery},
+	{"lsp", BenchmarkLanguageServer},
+};
+
+// Size with an optional K, M or G suffix, binary multiples; 0 if malformed
+static size_t ParseByteSize(const char* text)
+{
+	char* end;
+	double value = strtod(text, &end);
+
+	switch (*end)
+	{
+	case 'K': case 'k': value *= 1 << 10; end++; break;
+	case 'M': case 'm': value *= 1 << 20; end++; break;
+	case 'G': case 'g': value *= 1 << 30; end++; break;
+	}
+
+	return *end || value < 1 ? 0 : (size_t)value;
+}
+
+// Fastest of the runs of one suite benchmark and what the last run allocated
+class SuiteMeasurement
+{
+public:
+	double seconds = 1e9;
+	allocationCounters_t allocations = {};
+
+	template<typename Function>
+	void Run(Function function)
+	{
+		allocationCounters_t before = ThreadAllocations();
+		seconds = std::min(seconds, MeasureSeconds(function));
+		allocationCounters_t after = ThreadAllocations();
+
+		allocations.count = after.count - before.count;
+		allocations.bytes = after.bytes - before.bytes;
+	}
+};
+
+// One JSON object per line, so that runs can be compared line by line
+static void WriteSuiteRecord(FILE* output, const char* benchmark, unsigned seed, size_t bytes, size_t tokens, size_t rounds,
+	const SuiteMeasurement& measurement, const std::function<void(JsonWriter&)>& extra = nullptr)
+{
+	JsonWriter writer;
+
+	writer.BeginObject();
+	writer.Key("benchmark").String(benchmark);
+	writer.Key("seed").Int(seed);
+	writer.Key("bytes").Int(bytes);
+	writer.Key("tokens").Int(tokens);
+	writer.Key("rounds").Int(rounds);
+	writer.Key("seconds").Double(measurement.seconds, 6);
+	writer.Key("mb_per_s").Double(bytes / measurement.seconds / 1e6, 6);
+	writer.Key("tokens_per_s").Double(tokens / measurement.seconds, 6);
+	writer.Key("allocations").Int(measurement.allocations.count);
+	writer.Key("allocated_bytes").Int(measurement.allocations.bytes);
+	writer.Key("peak_rss").Int(PeakResidentBytes());
+
+	if (extra)
+		extra(writer);
+
+	writer.EndObject();
+
+	fprintf(output, "%s\n", writer.Text().c_str());
+	fflush(output);
+}
+
+// Lexing, keyword lookup, substream extraction and tree building over
+// modules of GenerateBslModule of every size. bytes is the module text for
+// all but the lookups, where it is the words looked up; peak_rss only grows,
+// so sizes are run in increasing order.
+static void RunBenchmarkSuite(const std::vector<size_t>& sizes, unsigned seed, size_t fixedRounds, FILE* output)
+{
+	for (size_t size : sizes)
+	{
+		std::string text = GenerateBslModule(size, seed);
+
+		// Enough rounds for small modules to outlast the clock resolution
+		size_t rounds = fixedRounds ? fixedRounds : std::clamp<size_t>((64 << 20) / text.length(), 3, 1000);
+
+		SuiteMeasurement lex;
+		std::unique_ptr<TokenStream> stream;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			stream.reset();
+			lex.Run([&]()
+			{
+				stream = std::make_unique<TokenStream>(text);
+			});
+		}
+
+		TokenTable& tokens = *stream->Table();
+		WriteSuiteRecord(output, "lex", seed, text.length(), tokens.Size(), rounds, lex);
+
+		std::vector<std::string_view> words;
+		size_t wordBytes = 0;
+
+		for (size_t i = 0; i < tokens.Size(); i++)
+		{
+			std::string_view value = tokens.Value(i);
+
+			if (!value.empty() && !tokens.HasFlag(i, TOKEN_FLAG_STRING_LITERAL) && (isalpha((unsigned char)value[0]) || (unsigned char)value[0] >= 0x80))
+			{
+				words.push_back(value);
+				wordBytes += value.length();
+			}
+		}
+
+		SuiteMeasurement lookup;
+		size_t checksum = 0;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			lookup.Run([&]()
+			{
+				for (std::string_view word : words)
+					checksum += (size_t)TokenTypeFromValue(word);
+			});
+		}
+
+		WriteSuiteRecord(output, "keyword_lookup", seed, wordBytes, words.size(), rounds, lookup, [&](JsonWriter& writer)
+		{
+			writer.Key("checksum").Int(checksum);
+		});
+
+		SuiteMeasurement extract;
+		size_t substreams = 0;
+		size_t substreamTokens = 0;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			extract.Run([&]()
+			{
+				stream->Reset();
+				substreams = 0;
+				substreamTokens = 0;
+
+				while (stream->Position() < stream->End())
+				{
+					TokenTypes type = tokens.Type(stream->Position());
+					stream->Seek(stream->Position() + 1);
+
+					if (type != TokenTypes::BeginProcedure && type != TokenTypes::BeginFunction)
+						continue;
+
+					bool function = type == TokenTypes::BeginFunction;
+
+					if (auto substream = stream->ExtractSubstream(type, function ? TokenTypes::EndFunction : TokenTypes::EndProcedure))
+					{
+						substreams++;
+						substreamTokens += substream->Size();
+					}
+				}
+			});
+		}
+
+		WriteSuiteRecord(output, "extract_substream", seed, text.length(), tokens.Size(), rounds, extract, [&](JsonWriter& writer)
+		{
+			writer.Key("substreams").Int(substreams);
+			writer.Key("substream_tokens").Int(substreamTokens);
+		});
+
+		SuiteMeasurement build;
+		SyntaxTree tree;
+
+		for (size_t round = 0; round < rounds; round++)
+		{
+			tree.Clear();
+			stream->Reset();
+
+			build.Run([&]()
+			{
+				BuildAbstractSyntaxTree(stream.get(), tree);
+			});
+		}
+
+		WriteSuiteRecord(output, "build_tree", seed, text.length(), tokens.Size(), rounds, build, [&](JsonWriter& writer)
+		{
+			writer.Key("nodes").Int(tree.Size());
+			writer.Key("diagnostics").Int(tree.Diagnostics().size());
+		});
+	}
+}
+
+// "bench suite [--sizes 1K,1M,...] [--seed N] [--rounds N] [--output file]"
+static int RunBenchmarkSuite(int argc, char** argv)
+{
+	std::vector<size_t> sizes;
+	unsigned seed = 1;
+	size_t rounds = 0;
+	const char* outputPath = nullptr;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--sizes") && i + 1 < argc)
+		{
+			std::string list = argv[++i];
+
+			for (size_t start = 0; start <= list.length();)
+			{
+				size_t comma = std::min(list.find(',', start), list.length());
+				size_t size = ParseByteSize(list.substr(start, comma - start).c_str());
+
+				if (!size)
+				{
+					fprintf(stderr, "Bad size in %s\n", argv[i]);
+					return 1;
+				}
+
+				sizes.push_back(size);
+				start = comma + 1;
+			}
+		}
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--rounds") && i + 1 < argc)
+			rounds = strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			outputPath = argv[++i];
+		else
+		{
+			fprintf(stderr, "Usage: BSLTool bench suite [--sizes 1K,64K,1M,16M] [--seed N] [--rounds N] [--output file]\n");
+			return 1;
+		}
+	}
+
+	if (sizes.empty())
+		sizes = { 1 << 10, 64 << 10, 1 << 20, 16 << 20 };
+
+	std::sort(sizes.begin(), sizes.end());
+
+	FILE* output = outputPath ? fopen(outputPath, "w") : stdout;
+
+	if (!output)
+	{
+		fprintf(stderr, "Can't write %s\n", outputPath);
+		return 1;
+	}
+
+	RunBenchmarkSuite(sizes, seed, rounds, output);
+
+	if (output != stdout)
+		fclose(output);
+
+	return 0;
+}
+
+int RunBenchmarks(int argc, char** argv)
+{
+	if (argc > 0 && !strcmp(argv[0], "suite"))
+		return RunBenchmarkSuite(argc - 1, argv + 1);
+
+	// The module the suite measures, to look at or to feed to other commands
+	if (argc > 1 && !strcmp(argv[0], "generate"))
+	{
+		size_t size = ParseByteSize(argv[1]);
+
+		if (!size)
+		{
+			fprintf(stderr, "Usage: BSLTool bench generate size [seed]\n");
+			return 1;
+		}
+
+		std::string text = GenerateBslModule(size, argc > 2 ? (unsigned)strtoul(argv[2], nullptr, 10) : 1);
+		fwrite(text.data(), 1, text.length(), stdout);
+		return 0;
+	}
+
+	for (auto& benchmark : g_Benchmarks)
+	{
+		bool selected = argc == 0;
+
+		for (int i = 0; i < argc; i++)
+			if (!strcmp(argv[i], benchmark.name))
+				selected = true;
+
+		if (selected)
+			benchmark.run();
+	}
+
+	return 0;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace BSL
+{
+
+// Entry point of "BSLTool bench [benchmark...]"; runs all benchmarks when none are named.
+// "bench suite" measures the lexer and parser on generated modules of given
+// sizes and writes JSON lines for comparing runs, "bench generate" writes
+// such a module to stdout.
+int RunBenchmarks(int argc, char** argv);
+
+}
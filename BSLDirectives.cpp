@@ -0,0 +1,414 @@
+﻿#include "BSLDirectives.h"
+#include "BSLTrace.h"
+#include <algorithm>
+
+namespace BSL
+{
+
+typedef struct
+{
+	const char* russian;
+	const char* english;
+}directiveSymbolName_t;
+
+// Preprocessor symbols in both spellings, in the order of directiveSymbolBits_t
+static const directiveSymbolName_t g_DirectiveSymbolNames[] =
+{
+	{u8"Клиент"                            ,u8"Client"},
+	{u8"НаКлиенте"                         ,u8"AtClient"},
+	{u8"Сервер"                            ,u8"Server"},
+	{u8"НаСервере"                         ,u8"AtServer"},
+	{u8"ТонкийКлиент"                      ,u8"ThinClient"},
+	{u8"ВебКлиент"                         ,u8"WebClient"},
+	{u8"МобильныйКлиент"                   ,u8"MobileClient"},
+	{u8"ТолстыйКлиентУправляемоеПриложение",u8"ThickClientManagedApplication"},
+	{u8"ТолстыйКлиентОбычноеПриложение"    ,u8"ThickClientOrdinaryApplication"},
+	{u8"ВнешнееСоединение"                 ,u8"ExternalConnection"},
+	{u8"МобильноеПриложениеКлиент"         ,u8"MobileAppClient"},
+	{u8"МобильноеПриложениеСервер"         ,u8"MobileAppServer"},
+	{u8"МобильныйАвтономныйСервер"         ,u8"MobileStandaloneServer"},
+};
+
+enum directiveSymbolBits_t : uint32_t
+{
+	SYMBOL_CLIENT = 1 << 0,
+	SYMBOL_AT_CLIENT = 1 << 1,
+	SYMBOL_SERVER = 1 << 2,
+	SYMBOL_AT_SERVER = 1 << 3,
+	SYMBOL_THIN_CLIENT = 1 << 4,
+	SYMBOL_WEB_CLIENT = 1 << 5,
+	SYMBOL_MOBILE_CLIENT = 1 << 6,
+	SYMBOL_THICK_CLIENT_MANAGED = 1 << 7,
+	SYMBOL_THICK_CLIENT_ORDINARY = 1 << 8,
+	SYMBOL_EXTERNAL_CONNECTION = 1 << 9,
+	SYMBOL_MOBILE_APP_CLIENT = 1 << 10,
+	SYMBOL_MOBILE_APP_SERVER = 1 << 11,
+	SYMBOL_MOBILE_STANDALONE_SERVER = 1 << 12,
+};
+
+constexpr uint32_t SYMBOLS_CLIENT = SYMBOL_CLIENT | SYMBOL_AT_CLIENT;
+constexpr uint32_t SYMBOLS_SERVER = SYMBOL_SERVER | SYMBOL_AT_SERVER;
+
+typedef struct
+{
+	const char* name;
+	uint32_t symbols;
+}executionContext_t;
+
+// An external connection runs server code in its own process, so it
+// compiles the server branches as well
+static const executionContext_t g_ExecutionContexts[] =
+{
+	{"Server", SYMBOLS_SERVER},
+	{"ThinClient", SYMBOLS_CLIENT | SYMBOL_THIN_CLIENT},
+	{"WebClient", SYMBOLS_CLIENT | SYMBOL_WEB_CLIENT},
+	{"MobileClient", SYMBOLS_CLIENT | SYMBOL_MOBILE_CLIENT},
+	{"ThickClientManagedApplication", SYMBOLS_CLIENT | SYMBOL_THICK_CLIENT_MANAGED},
+	{"ThickClientOrdinaryApplication", SYMBOLS_CLIENT | SYMBOL_THICK_CLIENT_ORDINARY},
+	{"ExternalConnection", SYMBOLS_SERVER | SYMBOL_EXTERNAL_CONNECTION},
+	{"MobileAppClient", SYMBOLS_CLIENT | SYMBOL_MOBILE_APP_CLIENT},
+	{"MobileAppServer", SYMBOLS_SERVER | SYMBOL_MOBILE_APP_SERVER},
+	{"MobileStandaloneServer", SYMBOLS_SERVER | SYMBOL_MOBILE_STANDALONE_SERVER},
+};
+
+std::string ExecutionContextNames()
+{
+	std::string result;
+
+	for (const executionContext_t& context : g_ExecutionContexts)
+	{
+		if (!result.empty())
+			result += ", ";
+
+		result += context.name;
+	}
+
+	return result;
+}
+
+void DirectiveSymbols::Define(std::string_view name)
+{
+	m_Atoms.insert(g_Identifiers.Intern(name));
+}
+
+bool DirectiveSymbols::DefineContext(std::string_view context)
+{
+	std::string folded = FoldIdentifier(context);
+
+	for (const executionContext_t& candidate : g_ExecutionContexts)
+	{
+		if (FoldIdentifier(candidate.name) != folded)
+			continue;
+
+		for (size_t i = 0; i < sizeof(g_DirectiveSymbolNames) / sizeof(g_DirectiveSymbolNames[0]); i++)
+		{
+			if (!(candidate.symbols & (1 << i)))
+				continue;
+
+			Define(g_DirectiveSymbolNames[i].russian);
+			Define(g_DirectiveSymbolNames[i].english);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+// Offset where the line holding offset ends, SIZE_MAX on the last line
+static size_t LineEnd(const std::vector<uint32_t>& lineStarts, size_t offset)
+{
+	size_t line = std::upper_bound(lineStarts.begin(), lineStarts.end(), (uint32_t)offset) - lineStarts.begin();
+	return line < lineStarts.size() ? lineStarts[line] : SIZE_MAX;
+}
+
+// Condition of #Если or #ИначеЕсли up to and including Тогда: symbols
+// combined with Не, И and Или, in that order of precedence, and brackets
+class DirectiveCondition
+{
+	const TokenTable& m_Tokens;
+	const DirectiveSymbols& m_Symbols;
+	size_t m_Position;
+
+	// End of the line of the directive
+	size_t m_LineEnd;
+
+	std::vector<parseDiagnostic_t>& m_Diagnostics;
+	bool m_Failed;
+
+	// EndExpression past the last token
+	TokenTypes PeekType() const
+	{
+		if (m_Position >= m_Tokens.Size())
+			return TokenTypes::EndExpression;
+
+		return m_Tokens.Type(m_Position);
+	}
+
+	// Only the first error is reported, the rest of the condition is skipped
+	bool Fail(TokenTypes expected)
+	{
+		if (!m_Failed)
+			m_Diagnostics.push_back({ DiagnosticCodes::UnexpectedToken, m_Position < m_Tokens.Size() ? (uint32_t)m_Position : AST_NO_TOKEN, expected });
+
+		m_Failed = true;
+		return false;
+	}
+
+	// Every operand is evaluated, so that the whole condition is checked
+	bool ParseOr()
+	{
+		bool result = ParseAnd();
+
+		while (!m_Failed && PeekType() == TokenTypes::KeywordOr)
+		{
+			m_Position++;
+			result = ParseAnd() || result;
+		}
+
+		return result;
+	}
+
+	bool ParseAnd()
+	{
+		bool result = ParseNot();
+
+		while (!m_Failed && PeekType() == TokenTypes::KeywordAnd)
+		{
+			m_Position++;
+			result = ParseNot() && result;
+		}
+
+		return result;
+	}
+
+	bool ParseNot()
+	{
+		switch (PeekType())
+		{
+		case TokenTypes::KeywordNot:
+			m_Position++;
+			return !ParseNot();
+		case TokenTypes::OpeningBracket:
+			{
+				m_Position++;
+				bool result = ParseOr();
+
+				if (m_Failed)
+					return false;
+
+				if (PeekType() != TokenTypes::ClosingBracket)
+					return Fail(TokenTypes::ClosingBracket);
+
+				m_Position++;
+				return result;
+			}
+		case TokenTypes::Identifier:
+			return m_Symbols.IsDefined(m_Tokens.Atom(m_Position++));
+		}
+
+		return Fail(TokenTypes::Identifier);
+	}
+public:
+	// position is the token after the directive
+	DirectiveCondition(const TokenTable& tokens, const DirectiveSymbols& symbols, size_t position, std::vector<parseDiagnostic_t>& diagnostics) :
+		m_Tokens(tokens), m_Symbols(symbols), m_Position(position), m_Diagnostics(diagnostics), m_Failed(false)
+	{
+		m_LineEnd = LineEnd(tokens.Source().lineStarts, tokens.SourceOffset(position - 1));
+	}
+
+	size_t Position() const
+	{
+		return m_Position;
+	}
+
+	// A malformed condition is reported and counts as false; the position is
+	// then past its Тогда, or past the directive line if there is none
+	bool Evaluate()
+	{
+		bool result = ParseOr();
+		TokenTypes type = PeekType();
+
+		if (!m_Failed && type != TokenTypes::OperatorThen && type != TokenTypes::DirectiveThen)
+			Fail(TokenTypes::OperatorThen);
+
+		if (m_Failed)
+		{
+			while (m_Position < m_Tokens.Size() && m_Tokens.RawStart(m_Position) < m_LineEnd)
+			{
+				type = m_Tokens.Type(m_Position++);
+
+				if (type == TokenTypes::OperatorThen || type == TokenTypes::DirectiveThen)
+					break;
+			}
+
+			return false;
+		}
+
+		m_Position++;
+		return result;
+	}
+};
+
+// Directive block open at the read position
+typedef struct
+{
+	// Directive that opened it
+	uint32_t directive;
+
+	// Directive that closes it
+	TokenTypes end;
+
+	// Tokens of the current branch are compiled; includes the enclosing blocks
+	bool active;
+
+	// A branch of an #Если was compiled already, so the rest are not
+	bool taken;
+}directiveBlock_t;
+
+void PruneInactiveCode(const TokenTable& source, const DirectiveSymbols& symbols, TokenTable& result, std::vector<inactiveTokenRange_t>& inactive,
+	std::vector<parseDiagnostic_t>& diagnostics)
+{
+	TraceScope scope("prune");
+
+	const std::vector<uint32_t>& lineStarts = source.Source().lineStarts;
+
+	std::vector<directiveBlock_t> blocks;
+
+	// Start of the run of compiled tokens not copied yet, or of the inactive
+	// range being skipped
+	size_t runStart = 0;
+	size_t position = 0;
+
+	size_t firstDiagnostic = diagnostics.size();
+
+	auto isActive = [&]()
+	{
+		return blocks.empty() || blocks.back().active;
+	};
+
+	auto enclosingActive = [&]()
+	{
+		return blocks.size() < 2 || blocks[blocks.size() - 2].active;
+	};
+
+	auto evaluate = [&]()
+	{
+		DirectiveCondition condition(source, symbols, position, diagnostics);
+		bool value = condition.Evaluate();
+		position = condition.Position();
+
+		return value;
+	};
+
+	while (position < source.Size())
+	{
+		TokenTypes type = source.Type(position);
+
+		switch (type)
+		{
+		case TokenTypes::DirectiveIf:
+		case TokenTypes::DirectiveElseIf:
+		case TokenTypes::DirectiveElse:
+		case TokenTypes::DirectiveEndIf:
+		case TokenTypes::DirectiveInsert:
+		case TokenTypes::DirectiveEndInsert:
+		case TokenTypes::DirectiveDelete:
+		case TokenTypes::DirectiveEndDelete:
+		case TokenTypes::DirectiveRegion:
+		case TokenTypes::DirectiveEndRegion:
+			break;
+		default:
+			position++;
+			continue;
+		}
+
+		bool wasActive = isActive();
+		size_t directive = position++;
+
+		if (wasActive)
+			result.Append(source, runStart, directive);
+
+		switch (type)
+		{
+		case TokenTypes::DirectiveIf:
+			{
+				bool value = evaluate();
+				blocks.push_back({ (uint32_t)directive, TokenTypes::DirectiveEndIf, wasActive && value, value });
+			}
+			break;
+		case TokenTypes::DirectiveElseIf:
+		case TokenTypes::DirectiveElse:
+			{
+				bool value = type == TokenTypes::DirectiveElse || evaluate();
+
+				// Dropped, past its condition
+				if (blocks.empty() || blocks.back().end != TokenTypes::DirectiveEndIf)
+				{
+					diagnostics.push_back({ DiagnosticCodes::UnmatchedDirective, (uint32_t)directive, TokenTypes::DirectiveIf });
+					break;
+				}
+
+				directiveBlock_t& block = blocks.back();
+				block.active = enclosingActive() && !block.taken && value;
+				block.taken = block.taken || value;
+			}
+			break;
+		case TokenTypes::DirectiveInsert:
+			blocks.push_back({ (uint32_t)directive, TokenTypes::DirectiveEndInsert, wasActive, true });
+			break;
+		case TokenTypes::DirectiveDelete:
+			blocks.push_back({ (uint32_t)directive, TokenTypes::DirectiveEndDelete, false, false });
+			break;
+		case TokenTypes::DirectiveEndIf:
+		case TokenTypes::DirectiveEndInsert:
+		case TokenTypes::DirectiveEndDelete:
+			// Dropped, leaving the open block to be closed by its own directive
+			if (blocks.empty() || blocks.back().end != type)
+			{
+				TokenTypes opening = type == TokenTypes::DirectiveEndIf ? TokenTypes::DirectiveIf :
+					type == TokenTypes::DirectiveEndInsert ? TokenTypes::DirectiveInsert : TokenTypes::DirectiveDelete;
+
+				diagnostics.push_back({ DiagnosticCodes::UnmatchedDirective, (uint32_t)directive, opening });
+				break;
+			}
+
+			blocks.pop_back();
+			break;
+		case TokenTypes::DirectiveRegion:
+			{
+				// The region name is the rest of the line
+				size_t lineEnd = LineEnd(lineStarts, source.SourceOffset(directive));
+
+				while (position < source.Size() && source.RawStart(position) < lineEnd && source.Type(position) == TokenTypes::Identifier)
+					position++;
+			}
+			break;
+		}
+
+		bool nowActive = isActive();
+
+		if (wasActive && !nowActive)
+			runStart = position;
+		else if (!wasActive && nowActive)
+			inactive.push_back({ (uint32_t)runStart, (uint32_t)directive });
+
+		if (nowActive)
+			runStart = position;
+	}
+
+	// Blocks left open end with the module
+	if (isActive())
+		result.Append(source, runStart, source.Size());
+	else
+		inactive.push_back({ (uint32_t)runStart, (uint32_t)source.Size() });
+
+	for (const directiveBlock_t& block : blocks)
+		diagnostics.push_back({ DiagnosticCodes::MissingEndDirective, block.directive, block.end });
+
+	// Those of unclosed blocks came last
+	std::stable_sort(diagnostics.begin() + firstDiagnostic, diagnostics.end(),
+		[](const parseDiagnostic_t& a, const parseDiagnostic_t& b) { return a.token < b.token; });
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "BSLAbstractSyntaxTree.h"
+#include "BSLToken.h"
+
+namespace BSL
+{
+
+// Preprocessor symbols defined for one compilation, by g_Identifiers atom, so
+// that #Если conditions test them in either spelling and letter case
+class DirectiveSymbols
+{
+	std::unordered_set<uint32_t> m_Atoms;
+public:
+	void Define(std::string_view name);
+
+	// Symbols the platform defines when compiling for an execution context
+	// named the way the English symbols are, e.g. "Server" or "ThinClient";
+	// false if there is no such context
+	bool DefineContext(std::string_view context);
+
+	bool IsDefined(uint32_t atom) const
+	{
+		return m_Atoms.count(atom) != 0;
+	}
+};
+
+// Contexts DirectiveSymbols::DefineContext accepts, comma separated
+std::string ExecutionContextNames();
+
+// Tokens [firstToken, lastToken) of the source table compiled out by a
+// directive, the directive lines around them aside
+typedef struct
+{
+	uint32_t firstToken;
+	uint32_t lastToken;
+}inactiveTokenRange_t;
+
+// Copies the tokens of source the compiler sees for symbols to result, which
+// shares the source text, so that only those are parsed: branches of #Если
+// whose condition is false and #Удаление blocks are left out and added to
+// inactive, the directive lines themselves are dropped. Tree token indices
+// then refer to result. Errors in the directives are added to diagnostics
+// in token order, at indices into source, and pruning goes on: a malformed
+// condition counts as false, an unmatched directive is ignored and a block
+// left open ends with the module.
+void PruneInactiveCode(const TokenTable& source, const DirectiveSymbols& symbols, TokenTable& result, std::vector<inactiveTokenRange_t>& inactive,
+	std::vector<parseDiagnostic_t>& diagnostics);
+
+}
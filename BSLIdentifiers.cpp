@@ -0,0 +1,163 @@
+#include "BSLIdentifiers.h"
+#include "BSLToken.h"
+#include <atomic>
+#include <cstring>
+#include <functional>
+
+namespace BSL
+{
+
+IdentifierTable g_Identifiers;
+
+// Slots of a new shard; it doubles once half of them are taken
+constexpr size_t IDENTIFIER_SHARD_SLOTS = 256;
+
+// FNV-1a of a folded identifier
+static uint64_t HashIdentifier(std::string_view folded)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (char c : folded)
+	{
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+// Entries of the per-thread cache of recent atoms, a power of two
+constexpr size_t IDENTIFIER_CACHE_SIZE = 512;
+
+// Longest spelling the cache keeps, so that an entry is one cache line
+constexpr size_t IDENTIFIER_CACHE_TEXT = 44;
+
+// Entry of the per-thread cache, direct mapped by the hash of the spelling
+// as written: names repeat in the same letter case within a module, so
+// most lookups are answered without folding
+typedef struct
+{
+	uint64_t serial;
+	uint64_t hash;
+	uint32_t atom;
+	uint32_t length;
+	char text[IDENTIFIER_CACHE_TEXT];
+}identifierCacheEntry_t;
+
+static std::atomic<uint64_t> g_IdentifierTableSerial(0);
+
+IdentifierShard::IdentifierShard() : m_Slots(IDENTIFIER_SHARD_SLOTS, identifierSlot_t{ 0, IDENTIFIER_NO_ATOM }), m_Count(0)
+{
+}
+
+IdentifierTable::IdentifierTable() : m_Serial(++g_IdentifierTableSerial)
+{
+}
+
+uint32_t IdentifierTable::Intern(std::string_view value)
+{
+	thread_local identifierCacheEntry_t cache[IDENTIFIER_CACHE_SIZE];
+
+	uint64_t spellingHash = std::hash<std::string_view>()(value);
+	identifierCacheEntry_t& cached = cache[spellingHash & (IDENTIFIER_CACHE_SIZE - 1)];
+
+	if (cached.serial == m_Serial && cached.hash == spellingHash && cached.length == value.length() && !memcmp(cached.text, value.data(), value.length()))
+		return cached.atom;
+
+	// Most identifiers are short, so the buffer rarely grows
+	thread_local std::string folded;
+	FoldIdentifier(value, folded);
+
+	uint32_t atom = Insert(folded, HashIdentifier(folded));
+
+	if (value.length() <= IDENTIFIER_CACHE_TEXT)
+	{
+		cached.serial = m_Serial;
+		cached.hash = spellingHash;
+		cached.atom = atom;
+		cached.length = (uint32_t)value.length();
+		memcpy(cached.text, value.data(), value.length());
+	}
+
+	return atom;
+}
+
+// The top bits of the hash pick the shard, the low ones the slot within it
+uint32_t IdentifierTable::Insert(std::string_view folded, uint64_t hash)
+{
+	size_t shardIndex = (size_t)(hash >> 58) & (IDENTIFIER_TABLE_SHARDS - 1);
+	IdentifierShard& shard = m_Shards[shardIndex];
+
+	std::lock_guard<std::mutex> lock(shard.m_Lock);
+
+	size_t mask = shard.m_Slots.size() - 1;
+
+	for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask)
+	{
+		identifierSlot_t& slot = shard.m_Slots[i];
+
+		if (slot.atom == IDENTIFIER_NO_ATOM)
+			break;
+
+		if (slot.hash == hash && shard.m_Texts[slot.atom / IDENTIFIER_TABLE_SHARDS] == folded)
+			return slot.atom;
+	}
+
+	uint32_t atom = (uint32_t)(shard.m_Texts.size() * IDENTIFIER_TABLE_SHARDS + shardIndex);
+	shard.m_Texts.push_back(shard.m_Strings.CopyString(folded));
+
+	// Grown before inserting, so there is always a free slot to stop probing at
+	if (++shard.m_Count * 2 > shard.m_Slots.size())
+	{
+		std::vector<identifierSlot_t> slots(shard.m_Slots.size() * 2, identifierSlot_t{ 0, IDENTIFIER_NO_ATOM });
+		size_t newMask = slots.size() - 1;
+
+		for (const identifierSlot_t& slot : shard.m_Slots)
+		{
+			if (slot.atom == IDENTIFIER_NO_ATOM)
+				continue;
+
+			size_t i = (size_t)slot.hash & newMask;
+
+			while (slots[i].atom != IDENTIFIER_NO_ATOM)
+				i = (i + 1) & newMask;
+
+			slots[i] = slot;
+		}
+
+		shard.m_Slots.swap(slots);
+		mask = newMask;
+	}
+
+	size_t i = (size_t)hash & mask;
+
+	while (shard.m_Slots[i].atom != IDENTIFIER_NO_ATOM)
+		i = (i + 1) & mask;
+
+	shard.m_Slots[i] = identifierSlot_t{ hash, atom };
+
+	return atom;
+}
+
+std::string_view IdentifierTable::Text(uint32_t atom)
+{
+	IdentifierShard& shard = m_Shards[atom % IDENTIFIER_TABLE_SHARDS];
+	std::lock_guard<std::mutex> lock(shard.m_Lock);
+
+	return shard.m_Texts[atom / IDENTIFIER_TABLE_SHARDS];
+}
+
+size_t IdentifierTable::Size()
+{
+	size_t size = 0;
+
+	for (IdentifierShard& shard : m_Shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.m_Lock);
+		size += shard.m_Count;
+	}
+
+	return size;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "BSLArena.h"
+
+namespace BSL
+{
+
+// Atom of no identifier, e.g. of a token that is not one
+constexpr uint32_t IDENTIFIER_NO_ATOM = 0xFFFFFFFF;
+
+// Shards of an IdentifierTable, a power of two
+constexpr size_t IDENTIFIER_TABLE_SHARDS = 64;
+
+// Open addressing slot of an identifier table shard
+typedef struct
+{
+	uint64_t hash;
+
+	// IDENTIFIER_NO_ATOM if the slot is free
+	uint32_t atom;
+}identifierSlot_t;
+
+// Identifiers whose hash falls into one shard, under a lock of their own
+class IdentifierShard
+{
+	std::mutex m_Lock;
+
+	std::vector<identifierSlot_t> m_Slots;
+	size_t m_Count;
+
+	// Folded spellings by atom / IDENTIFIER_TABLE_SHARDS, kept in m_Strings
+	std::vector<std::string_view> m_Texts;
+	AstArena m_Strings;
+
+	friend class IdentifierTable;
+public:
+	IdentifierShard();
+};
+
+// Maps every distinct identifier, compared the way the language compares
+// names, to a 32-bit atom, so that equal names are equal integers. Several
+// threads can intern at once: identifiers are spread over shards by hash,
+// each with its own lock, so threads lexing different modules rarely wait,
+// and every thread remembers its recent atoms, so that the names a module
+// repeats take no lock at all. Atoms are never freed and are only meaningful
+// within the process.
+class IdentifierTable
+{
+	IdentifierShard m_Shards[IDENTIFIER_TABLE_SHARDS];
+
+	// Tells the tables apart in the per-thread caches of recent atoms
+	uint64_t m_Serial;
+
+	// Atom of folded, found or added under the lock of its shard
+	uint32_t Insert(std::string_view folded, uint64_t hash);
+public:
+	IdentifierTable();
+	IdentifierTable(const IdentifierTable&) = delete;
+	IdentifierTable& operator=(const IdentifierTable&) = delete;
+
+	// Atom of value in any letter case, assigned if it is new
+	uint32_t Intern(std::string_view value);
+
+	// FoldIdentifier of the identifier, valid as long as the table
+	std::string_view Text(uint32_t atom);
+
+	// Distinct identifiers so far
+	size_t Size();
+};
+
+// Table the lexer interns identifiers and annotations into
+extern IdentifierTable g_Identifiers;
+
+}
@@ -0,0 +1,457 @@
+#include "BSLJson.h"
+#include "BSLSource.h"
+#include <cmath>
+#include <cstdio>
+#include <locale>
+#include <sstream>
+
+namespace BSL
+{
+
+// Nesting deeper than this is rejected rather than recursed into
+constexpr size_t JSON_MAX_DEPTH = 256;
+
+const JsonValue& JsonValue::operator[](std::string_view key) const
+{
+	static const JsonValue null;
+
+	for (const auto& member : m_Members)
+		if (member.first == key)
+			return member.second;
+
+	return null;
+}
+
+class JsonParser
+{
+	std::string_view m_Text;
+	size_t m_Offset;
+
+	void SkipWhitespace()
+	{
+		while (m_Offset < m_Text.length() && (m_Text[m_Offset] == ' ' || m_Text[m_Offset] == '\t' || m_Text[m_Offset] == '\n' || m_Text[m_Offset] == '\r'))
+			m_Offset++;
+	}
+
+	bool Accept(std::string_view literal)
+	{
+		if (m_Text.compare(m_Offset, literal.length(), literal) != 0)
+			return false;
+
+		m_Offset += literal.length();
+		return true;
+	}
+
+	bool ParseHex(uint32_t& value)
+	{
+		if (m_Offset + 4 > m_Text.length())
+			return false;
+
+		value = 0;
+
+		for (size_t i = 0; i < 4; i++)
+		{
+			char c = m_Text[m_Offset++];
+			value <<= 4;
+
+			if (c >= '0' && c <= '9')
+				value |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				value |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				value |= c - 'A' + 10;
+			else
+				return false;
+		}
+
+		return true;
+	}
+
+	bool ParseString(std::string& result)
+	{
+		// Opening quote is checked by the caller
+		m_Offset++;
+
+		while (m_Offset < m_Text.length())
+		{
+			size_t start = m_Offset;
+
+			while (m_Offset < m_Text.length() && m_Text[m_Offset] != '\"' && m_Text[m_Offset] != '\\')
+				m_Offset++;
+
+			result.append(m_Text.substr(start, m_Offset - start));
+
+			if (m_Offset == m_Text.length())
+				return false;
+
+			if (m_Text[m_Offset++] == '\"')
+				return true;
+
+			if (m_Offset == m_Text.length())
+				return false;
+
+			char escape = m_Text[m_Offset++];
+
+			switch (escape)
+			{
+			case '\"': result += '\"'; break;
+			case '\\': result += '\\'; break;
+			case '/': result += '/'; break;
+			case 'b': result += '\b'; break;
+			case 'f': result += '\f'; break;
+			case 'n': result += '\n'; break;
+			case 'r': result += '\r'; break;
+			case 't': result += '\t'; break;
+			case 'u':
+				{
+					uint32_t codePoint;
+
+					if (!ParseHex(codePoint))
+						return false;
+
+					// Surrogate pair
+					if (codePoint >= 0xD800 && codePoint < 0xDC00 && Accept("\\u"))
+					{
+						uint32_t low;
+
+						if (!ParseHex(low) || low < 0xDC00 || low >= 0xE000)
+							return false;
+
+						codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+					}
+
+					AppendUtf8(result, codePoint);
+				}
+				break;
+			default:
+				return false;
+			}
+		}
+
+		return false;
+	}
+
+	bool ParseNumber(double& result)
+	{
+		size_t start = m_Offset;
+		bool integer = true;
+
+		if (m_Offset < m_Text.length() && m_Text[m_Offset] == '-')
+			m_Offset++;
+
+		while (m_Offset < m_Text.length())
+		{
+			char c = m_Text[m_Offset];
+
+			if (c == '.' || c == 'e' || c == 'E' || c == '+' || (c == '-' && m_Offset > start))
+				integer = false;
+			else if (c < '0' || c > '9')
+				break;
+
+			m_Offset++;
+		}
+
+		std::string_view number = m_Text.substr(start, m_Offset - start);
+
+		if (number.empty() || number == "-")
+			return false;
+
+		// Positions and ids are integers, the rest is rare enough for a stream
+		if (integer)
+		{
+			double value = 0;
+
+			for (char c : number.substr(number[0] == '-' ? 1 : 0))
+				value = value * 10 + (c - '0');
+
+			result = number[0] == '-' ? -value : value;
+			return true;
+		}
+
+		// Independent of the C locale, which main sets to the user's one
+		std::istringstream stream{ std::string(number) };
+		stream.imbue(std::locale::classic());
+		stream >> result;
+
+		return !stream.fail();
+	}
+
+	bool ParseValue(JsonValue& result, size_t depth)
+	{
+		if (depth > JSON_MAX_DEPTH)
+			return false;
+
+		SkipWhitespace();
+
+		if (m_Offset == m_Text.length())
+			return false;
+
+		char c = m_Text[m_Offset];
+
+		if (c == '{')
+		{
+			m_Offset++;
+			result.m_Type = JsonTypes::Object;
+			SkipWhitespace();
+
+			if (Accept("}"))
+				return true;
+
+			while (true)
+			{
+				SkipWhitespace();
+
+				std::string key;
+
+				if (m_Offset == m_Text.length() || m_Text[m_Offset] != '\"' || !ParseString(key))
+					return false;
+
+				SkipWhitespace();
+
+				if (!Accept(":"))
+					return false;
+
+				result.m_Members.emplace_back(std::move(key), JsonValue());
+
+				if (!ParseValue(result.m_Members.back().second, depth + 1))
+					return false;
+
+				SkipWhitespace();
+
+				if (Accept("}"))
+					return true;
+
+				if (!Accept(","))
+					return false;
+			}
+		}
+
+		if (c == '[')
+		{
+			m_Offset++;
+			result.m_Type = JsonTypes::Array;
+			SkipWhitespace();
+
+			if (Accept("]"))
+				return true;
+
+			while (true)
+			{
+				result.m_Items.emplace_back();
+
+				if (!ParseValue(result.m_Items.back(), depth + 1))
+					return false;
+
+				SkipWhitespace();
+
+				if (Accept("]"))
+					return true;
+
+				if (!Accept(","))
+					return false;
+			}
+		}
+
+		if (c == '\"')
+		{
+			result.m_Type = JsonTypes::String;
+			return ParseString(result.m_String);
+		}
+
+		if (Accept("true") || Accept("false"))
+		{
+			result.m_Type = JsonTypes::Boolean;
+			result.m_Boolean = c == 't';
+			return true;
+		}
+
+		if (Accept("null"))
+			return true;
+
+		result.m_Type = JsonTypes::Number;
+		return ParseNumber(result.m_Number);
+	}
+public:
+	JsonParser(std::string_view text) : m_Text(text), m_Offset(0)
+	{
+	}
+
+	bool Parse(JsonValue& result)
+	{
+		if (!ParseValue(result, 0))
+			return false;
+
+		SkipWhitespace();
+		return m_Offset == m_Text.length();
+	}
+};
+
+bool JsonValue::Parse(std::string_view text, JsonValue& result)
+{
+	result = JsonValue();
+
+	JsonParser parser(text);
+	return parser.Parse(result);
+}
+
+void JsonWriter::BeginElement()
+{
+	if (m_AfterKey)
+	{
+		m_AfterKey = false;
+		return;
+	}
+
+	if (!m_HasElements.empty())
+	{
+		if (m_HasElements.back())
+			m_Text += ',';
+
+		m_HasElements.back() = true;
+	}
+}
+
+void JsonWriter::BeginObject()
+{
+	BeginElement();
+	m_Text += '{';
+	m_HasElements.push_back(false);
+}
+
+void JsonWriter::EndObject()
+{
+	m_Text += '}';
+	m_HasElements.pop_back();
+}
+
+void JsonWriter::BeginArray()
+{
+	BeginElement();
+	m_Text += '[';
+	m_HasElements.push_back(false);
+}
+
+void JsonWriter::EndArray()
+{
+	m_Text += ']';
+	m_HasElements.pop_back();
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key)
+{
+	String(key);
+	m_Text += ':';
+	m_AfterKey = true;
+
+	return *this;
+}
+
+void JsonWriter::String(std::string_view value)
+{
+	static const char hexDigits[] = "0123456789abcdef";
+
+	BeginElement();
+	m_Text += '\"';
+
+	size_t start = 0;
+
+	for (size_t i = 0; i < value.length(); i++)
+	{
+		unsigned char c = (unsigned char)value[i];
+
+		if (c >= 0x20 && c != '\"' && c != '\\')
+			continue;
+
+		m_Text.append(value.substr(start, i - start));
+		start = i + 1;
+
+		switch (c)
+		{
+		case '\"': m_Text += "\\\""; break;
+		case '\\': m_Text += "\\\\"; break;
+		case '\n': m_Text += "\\n"; break;
+		case '\r': m_Text += "\\r"; break;
+		case '\t': m_Text += "\\t"; break;
+		default:
+			m_Text += "\\u00";
+			m_Text += hexDigits[c >> 4];
+			m_Text += hexDigits[c & 15];
+			break;
+		}
+	}
+
+	m_Text.append(value.substr(start));
+	m_Text += '\"';
+}
+
+void JsonWriter::Int(int64_t value)
+{
+	BeginElement();
+	m_Text += std::to_string(value);
+}
+
+void JsonWriter::Double(double value, int precision)
+{
+	std::ostringstream stream;
+	stream.imbue(std::locale::classic());
+	stream.precision(precision);
+	stream << value;
+
+	BeginElement();
+	m_Text += stream.str();
+}
+
+void JsonWriter::Bool(bool value)
+{
+	BeginElement();
+	m_Text += value ? "true" : "false";
+}
+
+void JsonWriter::Null()
+{
+	BeginElement();
+	m_Text += "null";
+}
+
+void JsonWriter::Value(const JsonValue& value)
+{
+	switch (value.Type())
+	{
+	case JsonTypes::Null:
+		Null();
+		break;
+	case JsonTypes::Boolean:
+		Bool(value.AsBool());
+		break;
+	case JsonTypes::Number:
+		if (value.AsNumber() == std::floor(value.AsNumber()) && std::fabs(value.AsNumber()) < 9e15)
+			Int(value.AsInt());
+		else
+			Double(value.AsNumber());
+		break;
+	case JsonTypes::String:
+		String(value.AsString());
+		break;
+	case JsonTypes::Array:
+		BeginArray();
+
+		for (const JsonValue& item : value.Items())
+			Value(item);
+
+		EndArray();
+		break;
+	case JsonTypes::Object:
+		BeginObject();
+
+		for (const auto& member : value.Members())
+		{
+			Key(member.first);
+			Value(member.second);
+		}
+
+		EndObject();
+		break;
+	}
+}
+
+}
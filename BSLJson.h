@@ -0,0 +1,129 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace BSL
+{
+
+enum class JsonTypes : uint8_t
+{
+	Null,
+	Boolean,
+	Number,
+	String,
+	Array,
+	Object,
+};
+
+// Parsed JSON document node. Members of an object keep their order and are
+// looked up by a linear scan, which suits the small objects of JSON-RPC.
+class JsonValue
+{
+	JsonTypes m_Type;
+	bool m_Boolean;
+	double m_Number;
+	std::string m_String;
+
+	std::vector<JsonValue> m_Items;
+	std::vector<std::pair<std::string, JsonValue>> m_Members;
+
+	friend class JsonParser;
+public:
+	JsonValue() : m_Type(JsonTypes::Null), m_Boolean(false), m_Number(0)
+	{
+	}
+
+	JsonTypes Type() const
+	{
+		return m_Type;
+	}
+
+	bool IsNull() const
+	{
+		return m_Type == JsonTypes::Null;
+	}
+
+	bool AsBool() const
+	{
+		return m_Boolean;
+	}
+
+	double AsNumber() const
+	{
+		return m_Number;
+	}
+
+	int64_t AsInt() const
+	{
+		return (int64_t)m_Number;
+	}
+
+	// Empty for anything but a string
+	const std::string& AsString() const
+	{
+		return m_String;
+	}
+
+	// Array items
+	const std::vector<JsonValue>& Items() const
+	{
+		return m_Items;
+	}
+
+	const std::vector<std::pair<std::string, JsonValue>>& Members() const
+	{
+		return m_Members;
+	}
+
+	// Member of an object; a null value if there is none, so lookups chain
+	const JsonValue& operator[](std::string_view key) const;
+
+	// Whole text has to be one value, whitespace around it aside
+	static bool Parse(std::string_view text, JsonValue& result);
+};
+
+// Appends JSON text, putting commas between the members and items itself
+class JsonWriter
+{
+	std::string m_Text;
+
+	// Whether the innermost object or array already has an element
+	std::vector<bool> m_HasElements;
+	bool m_AfterKey;
+
+	void BeginElement();
+public:
+	JsonWriter() : m_AfterKey(false)
+	{
+	}
+
+	void BeginObject();
+	void EndObject();
+	void BeginArray();
+	void EndArray();
+
+	JsonWriter& Key(std::string_view key);
+
+	void String(std::string_view value);
+	void Int(int64_t value);
+	// With precision significant digits, 17 being enough to read value back
+	void Double(double value, int precision = 17);
+	void Bool(bool value);
+	void Null();
+	void Value(const JsonValue& value);
+
+	const std::string& Text() const
+	{
+		return m_Text;
+	}
+
+	std::string Release()
+	{
+		return std::move(m_Text);
+	}
+};
+
+}
@@ -0,0 +1,377 @@
+﻿#include "BSLToken.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace BSL
+{
+
+constexpr tokenDictionary_t g_TokenDictionary[] =
+{
+	{TokenTypes::BeginProcedure        ,u8"ПРОЦЕДУРА"                     ,u8"PROCEDURE"},
+	{TokenTypes::BeginFunction         ,u8"ФУНКЦИЯ"                       ,u8"FUNCTION"},
+	{TokenTypes::EndProcedure          ,u8"КОНЕЦПРОЦЕДУРЫ"                ,u8"ENDPROCEDURE"},
+	{TokenTypes::EndFunction           ,u8"КОНЕЦФУНКЦИИ"                  ,u8"ENDFUNCTION"},
+	{TokenTypes::EqualsSign            ,u8"="                             ,u8"="},
+	{TokenTypes::OpeningBracket        ,u8"("                             ,u8"("},
+	{TokenTypes::ClosingBracket        ,u8")"                             ,u8")"},
+	{TokenTypes::ExportKeyword         ,u8"ЭКСПОРТ"                       ,u8"EXPORT"},
+	{TokenTypes::Comma                 ,u8","		                     ,u8","},
+	{TokenTypes::EndExpression         ,u8";"                             ,u8";"},
+	{TokenTypes::PlusSign              ,u8"+"                             ,u8"+"},
+	{TokenTypes::MinusSign             ,u8"-"                             ,u8"-"},
+	{TokenTypes::MultiplySign          ,u8"*"                             ,u8"*"},
+	{TokenTypes::DivisionSign          ,u8"/"                             ,u8"/"},
+	{TokenTypes::ModuloSign            ,u8"%"                             ,u8"%"},
+	{TokenTypes::DotSign               ,u8"."                             ,u8"."},
+	{TokenTypes::BooleanConst          ,u8"ЛОЖЬ"                          ,u8"FALSE"},
+	{TokenTypes::BooleanConst          ,u8"ИСТИНА"                        ,u8"TRUE"},
+	{TokenTypes::OperatorNew           ,u8"НОВЫЙ"                         ,u8"NEW"},
+	{TokenTypes::OperatorIf            ,u8"ЕСЛИ"                          ,u8"IF"},
+	{TokenTypes::OperatorThen          ,u8"ТОГДА"                         ,u8"THEN"},
+	{TokenTypes::OperatorElse          ,u8"ИНАЧЕ"                         ,u8"ELSE"},
+	{TokenTypes::OperatorElseIf        ,u8"ИНАЧЕЕСЛИ"                     ,u8"ELSEIF"},
+	{TokenTypes::OperatorEndIf         ,u8"КОНЕЦЕСЛИ"                     ,u8"ENDIF"},
+	{TokenTypes::LessSign              ,u8"<"                             ,u8"<"},
+	{TokenTypes::GreaterSign           ,u8">"                             ,u8">"},
+	{TokenTypes::OperatorFor           ,u8"ДЛЯ"                           ,u8"FOR"},
+	{TokenTypes::OperatorWhile         ,u8"ПОКА"                          ,u8"WHILE"},
+	{TokenTypes::OperatorEndLoop       ,u8"КОНЕЦЦИКЛА"                    ,u8"ENDLOOP"},
+	{TokenTypes::OperatorTry           ,u8"ПОПЫТКА"                       ,u8"TRY"},
+	{TokenTypes::OperatorEndTry        ,u8"КОНЕЦПОПЫТКИ"                  ,u8"ENDTRY"},
+	{TokenTypes::OperatorReturn        ,u8"ВОЗВРАТ"                       ,u8"RETURN"},
+	{TokenTypes::DirectiveIf           ,u8"#Если"                         ,u8"#IF"},
+	{TokenTypes::DirectiveThen         ,u8"#Тогда"                        ,u8"#THEN"},
+	{TokenTypes::DirectiveElseIf       ,u8"#ИначеЕсли"                    ,u8"#ELSEIF"},
+	{TokenTypes::DirectiveElse         ,u8"#Иначе"                        ,u8"#ELSE"},
+	{TokenTypes::DirectiveEndIf        ,u8"#КонецЕсли"                    ,u8"#ENDIF"},
+	{TokenTypes::DirectiveInsert       ,u8"#Вставка"                      ,u8"#INSERT"},
+	{TokenTypes::DirectiveEndInsert    ,u8"#КонецВставки"                 ,u8"#ENDINSERT"},
+	{TokenTypes::DirectiveDelete       ,u8"#Удаление"                     ,u8"#DELETE"},
+	{TokenTypes::DirectiveEndDelete    ,u8"#КонецУдаления"                ,u8"#ENDDELETE"},
+	{TokenTypes::DirectiveRegion       ,u8"#Область"                      ,u8"#REGION"},
+	{TokenTypes::DirectiveEndRegion    ,u8"#КонецОбласти"                 ,u8"#ENDREGION"},
+	{TokenTypes::KeywordAnd            ,u8"И"                             ,u8"AND"},
+	{TokenTypes::KeywordOr             ,u8"ИЛИ"                           ,u8"OR"},
+	{TokenTypes::KeywordNot            ,u8"НЕ"                            ,u8"NOT"},
+	{TokenTypes::KeywordVar            ,u8"ПЕРЕМ"                         ,u8"VAR"},
+	{TokenTypes::KeywordLoop           ,u8"ЦИКЛ"                          ,u8"LOOP"},
+	{TokenTypes::KeywordEach           ,u8"КАЖДОГО"                       ,u8"EACH"},
+	{TokenTypes::KeywordVal            ,u8"ЗНАЧ"                          ,u8"VAL"},
+	{TokenTypes::OpeningSquareBracket  ,u8"["                             ,u8"["},
+	{TokenTypes::ClosingSquareBracket  ,u8"]"                             ,u8"]"}
+};
+
+constexpr size_t KEYWORD_HASH_SLOTS = 128;
+constexpr size_t KEYWORD_HASH_BUCKETS = 32;
+constexpr size_t KEYWORD_MAX_BUCKET_SIZE = 16;
+
+// Keywords are ASCII or Cyrillic, so folding those two ranges is enough
+// for case-insensitive matching
+constexpr uint32_t FoldKeywordSymbol(uint32_t c)
+{
+	if (c >= 'a' && c <= 'z')
+		return c - ('a' - 'A');
+
+	if (c >= 0x430 && c <= 0x44F)
+		return c - 0x20;
+
+	if (c == 0x451)
+		return 0x401;
+
+	return c;
+}
+
+// Decodes the UTF-8 sequence at value[i] and advances i past it. Invalid
+// sequences decode byte by byte, which is enough to never match a keyword.
+constexpr uint32_t NextKeywordSymbol(const char* value, size_t length, size_t& i)
+{
+	uint32_t c = (unsigned char)value[i++];
+
+	if (c < 0xC0)
+		return c;
+
+	size_t continuationBytes = c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+	uint32_t codePoint = c & (0x3F >> continuationBytes);
+
+	for (size_t j = 0; j < continuationBytes && i < length && ((unsigned char)value[i] & 0xC0) == 0x80; j++)
+		codePoint = (codePoint << 6) | ((unsigned char)value[i++] & 0x3F);
+
+	return codePoint;
+}
+
+constexpr size_t KeywordLength(const char* keyword)
+{
+	size_t length = 0;
+
+	while (keyword[length])
+		length++;
+
+	return length;
+}
+
+// Folded upper and lower case letters of both alphabets have the same
+// UTF-8 length, so byte lengths can be compared first
+constexpr bool KeywordEquals(const char* keyword, size_t keywordLength, const char* value, size_t valueLength)
+{
+	if (keywordLength != valueLength)
+		return false;
+
+	size_t i = 0;
+	size_t j = 0;
+
+	while (i < keywordLength)
+		if (FoldKeywordSymbol(NextKeywordSymbol(keyword, keywordLength, i)) != FoldKeywordSymbol(NextKeywordSymbol(value, valueLength, j)))
+			return false;
+
+	return true;
+}
+
+// FNV-1a over folded code points
+constexpr uint32_t HashKeyword(const char* value, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	size_t i = 0;
+
+	while (i < length)
+	{
+		hash ^= FoldKeywordSymbol(NextKeywordSymbol(value, length, i));
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Murmur3 finalizer, re-seeded by the bucket displacement
+constexpr uint32_t MixKeywordHash(uint32_t hash, uint32_t displacement)
+{
+	hash ^= displacement;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+typedef struct
+{
+	const char* keywords[KEYWORD_HASH_SLOTS];
+	size_t lengths[KEYWORD_HASH_SLOTS];
+	TokenTypes types[KEYWORD_HASH_SLOTS];
+	uint32_t displacements[KEYWORD_HASH_BUCKETS];
+	size_t maxLength;
+	bool valid;
+}keywordHashTable_t;
+
+// Hash-and-displace perfect hash over both keyword sets: every key is placed
+// into bucket hash % KEYWORD_HASH_BUCKETS, then buckets are placed largest first,
+// each searching for a displacement that maps all its keys to free slots.
+constexpr keywordHashTable_t BuildKeywordHashTable()
+{
+	constexpr size_t dictionarySize = sizeof(g_TokenDictionary) / sizeof(g_TokenDictionary[0]);
+
+	keywordHashTable_t table{};
+
+	const char* keys[dictionarySize * 2] = {};
+	size_t keyLengths[dictionarySize * 2] = {};
+	TokenTypes keyTypes[dictionarySize * 2] = {};
+	uint32_t keyHashes[dictionarySize * 2] = {};
+	size_t keyCount = 0;
+
+	for (size_t i = 0; i < dictionarySize * 2; i++)
+	{
+		const tokenDictionary_t& entry = g_TokenDictionary[i / 2];
+		const char* keyword = (i % 2) ? entry.english : entry.russian;
+		size_t length = KeywordLength(keyword);
+
+		bool duplicate = false;
+
+		for (size_t j = 0; j < keyCount; j++)
+			if (KeywordEquals(keys[j], keyLengths[j], keyword, length))
+				duplicate = true;
+
+		if (duplicate)
+			continue;
+
+		keys[keyCount] = keyword;
+		keyLengths[keyCount] = length;
+		keyTypes[keyCount] = entry.tokenType;
+		keyHashes[keyCount] = HashKeyword(keyword, length);
+		keyCount++;
+
+		if (length > table.maxLength)
+			table.maxLength = length;
+	}
+
+	if (keyCount > KEYWORD_HASH_SLOTS)
+		return table;
+
+	size_t bucketKeys[KEYWORD_HASH_BUCKETS][KEYWORD_MAX_BUCKET_SIZE] = {};
+	size_t bucketSizes[KEYWORD_HASH_BUCKETS] = {};
+
+	for (size_t i = 0; i < keyCount; i++)
+	{
+		size_t bucket = keyHashes[i] % KEYWORD_HASH_BUCKETS;
+
+		if (bucketSizes[bucket] == KEYWORD_MAX_BUCKET_SIZE)
+			return table;
+
+		bucketKeys[bucket][bucketSizes[bucket]++] = i;
+	}
+
+	bool bucketPlaced[KEYWORD_HASH_BUCKETS] = {};
+	bool slotUsed[KEYWORD_HASH_SLOTS] = {};
+
+	for (size_t pass = 0; pass < KEYWORD_HASH_BUCKETS; pass++)
+	{
+		size_t bucket = KEYWORD_HASH_BUCKETS;
+
+		for (size_t i = 0; i < KEYWORD_HASH_BUCKETS; i++)
+			if (!bucketPlaced[i] && (bucket == KEYWORD_HASH_BUCKETS || bucketSizes[i] > bucketSizes[bucket]))
+				bucket = i;
+
+		bucketPlaced[bucket] = true;
+
+		if (!bucketSizes[bucket])
+			continue;
+
+		bool placed = false;
+
+		for (uint32_t displacement = 1; displacement < 100000 && !placed; displacement++)
+		{
+			size_t slots[KEYWORD_MAX_BUCKET_SIZE] = {};
+			placed = true;
+
+			for (size_t i = 0; i < bucketSizes[bucket] && placed; i++)
+			{
+				slots[i] = MixKeywordHash(keyHashes[bucketKeys[bucket][i]], displacement) % KEYWORD_HASH_SLOTS;
+
+				if (slotUsed[slots[i]])
+					placed = false;
+
+				for (size_t j = 0; j < i; j++)
+					if (slots[j] == slots[i])
+						placed = false;
+			}
+
+			if (!placed)
+				continue;
+
+			table.displacements[bucket] = displacement;
+
+			for (size_t i = 0; i < bucketSizes[bucket]; i++)
+			{
+				size_t key = bucketKeys[bucket][i];
+
+				slotUsed[slots[i]] = true;
+				table.keywords[slots[i]] = keys[key];
+				table.lengths[slots[i]] = keyLengths[key];
+				table.types[slots[i]] = keyTypes[key];
+			}
+		}
+
+		if (!placed)
+			return table;
+	}
+
+	table.valid = true;
+	return table;
+}
+
+constexpr keywordHashTable_t g_KeywordHashTable = BuildKeywordHashTable();
+static_assert(g_KeywordHashTable.valid, "Keyword dictionary has no perfect hash for the current table size");
+
+BSL::TokenTypes TokenTypeFromValue(std::string_view tokenValue)
+{
+	size_t length = tokenValue.length();
+
+	if (length == 0 || length > g_KeywordHashTable.maxLength)
+		return TokenTypes::Identifier;
+
+	uint32_t hash = HashKeyword(tokenValue.data(), length);
+	size_t slot = MixKeywordHash(hash, g_KeywordHashTable.displacements[hash % KEYWORD_HASH_BUCKETS]) % KEYWORD_HASH_SLOTS;
+
+	const char* keyword = g_KeywordHashTable.keywords[slot];
+
+	if (keyword && KeywordEquals(keyword, g_KeywordHashTable.lengths[slot], tokenValue.data(), length))
+		return g_KeywordHashTable.types[slot];
+
+	return TokenTypes::Identifier;
+}
+
+std::string FoldIdentifier(std::string_view value)
+{
+	std::string result;
+	FoldIdentifier(value, result);
+
+	return result;
+}
+
+void FoldIdentifier(std::string_view value, std::string& result)
+{
+	result.resize(value.length());
+	char* output = result.data();
+
+	// ASCII and the two-byte Cyrillic letters FoldKeywordSymbol folds are
+	// folded in place, byte lengths staying the same; anything else decodes
+	for (size_t i = 0; i < value.length();)
+	{
+		unsigned char c = (unsigned char)value[i];
+		unsigned char next = i + 1 < value.length() ? (unsigned char)value[i + 1] : 0;
+
+		if (c < 0x80)
+		{
+			*output++ = (char)(c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c);
+			i++;
+		}
+		else if (c == 0xD0 && next >= 0x80 && next <= 0xBF)
+		{
+			// а-п to А-П
+			*output++ = (char)c;
+			*output++ = (char)(next >= 0xB0 ? next - 0x20 : next);
+			i += 2;
+		}
+		else if (c == 0xD1 && next >= 0x80 && next <= 0x91 && next != 0x90)
+		{
+			// р-я to Р-Я, ё to Ё
+			*output++ = (char)0xD0;
+			*output++ = (char)(next == 0x91 ? 0x81 : next + 0x20);
+			i += 2;
+		}
+		else
+		{
+			result.resize(output - result.data());
+			AppendUtf8(result, FoldKeywordSymbol(NextKeywordSymbol(value.data(), value.length(), i)));
+
+			size_t written = result.length();
+			result.resize(written + value.length() - i);
+			output = result.data() + written;
+		}
+	}
+
+	result.resize(output - result.data());
+}
+
+BSL::TokenTypes TokenTypeFromValueLinear(std::string tokenValue)
+{
+	std::string upperValue;
+
+	for (size_t i = 0; i < tokenValue.length();)
+	{
+		uint32_t c = NextKeywordSymbol(tokenValue.data(), tokenValue.length(), i);
+		AppendUtf8(upperValue, FoldKeywordSymbol(c));
+	}
+
+	for (auto dict : g_TokenDictionary)
+	{
+		if (dict.russian == upperValue)
+			return dict.tokenType;
+		else if (dict.english == upperValue)
+			return dict.tokenType;
+	}
+
+	return TokenTypes::Identifier;
+}
+
+}
@@ -0,0 +1,731 @@
+#include "BSLLanguageServer.h"
+#include "BSLSymbolIndex.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace BSL
+{
+
+// JSON-RPC error codes
+constexpr int LSP_PARSE_ERROR = -32700;
+constexpr int LSP_INVALID_REQUEST = -32600;
+constexpr int LSP_METHOD_NOT_FOUND = -32601;
+
+// LSP SymbolKind values
+constexpr int LSP_SYMBOL_NAMESPACE = 3;
+constexpr int LSP_SYMBOL_FUNCTION = 12;
+
+// LSP DiagnosticSeverity of a syntax error
+constexpr int LSP_SEVERITY_ERROR = 1;
+
+// Code units a UTF-8 lead byte stands for in UTF-16, 0 for continuation bytes
+static size_t Utf16Units(unsigned char c)
+{
+	if ((c & 0xC0) == 0x80)
+		return 0;
+
+	return c >= 0xF0 ? 2 : 1;
+}
+
+static size_t PositionToOffset(const tokenStreamSource_t& source, const JsonValue& position)
+{
+	std::string_view text = source.buffer.Text();
+	int64_t line = position["line"].AsInt();
+	int64_t character = position["character"].AsInt();
+
+	if (line < 0)
+		return 0;
+
+	if ((size_t)line >= source.lineStarts.size())
+		return text.length();
+
+	size_t offset = source.lineStarts[(size_t)line];
+
+	// Step whole symbols, stopping at the end of the line
+	while (offset < text.length() && text[offset] != '\n' && character > 0)
+	{
+		character -= Utf16Units((unsigned char)text[offset++]);
+
+		while (offset < text.length() && Utf16Units((unsigned char)text[offset]) == 0)
+			offset++;
+	}
+
+	return offset;
+}
+
+static void WritePosition(JsonWriter& writer, const tokenStreamSource_t& source, size_t offset)
+{
+	std::string_view text = source.buffer.Text();
+	auto line = std::upper_bound(source.lineStarts.begin(), source.lineStarts.end(), (uint32_t)offset) - 1;
+
+	size_t character = 0;
+
+	for (size_t i = *line; i < offset && i < text.length(); i++)
+		character += Utf16Units((unsigned char)text[i]);
+
+	writer.BeginObject();
+	writer.Key("line").Int(line - source.lineStarts.begin());
+	writer.Key("character").Int(character);
+	writer.EndObject();
+}
+
+static void WriteRange(JsonWriter& writer, const tokenStreamSource_t& source, size_t begin, size_t end)
+{
+	writer.BeginObject();
+	writer.Key("start");
+	WritePosition(writer, source, begin);
+	writer.Key("end");
+	WritePosition(writer, source, end);
+	writer.EndObject();
+}
+
+static size_t LineOf(const tokenStreamSource_t& source, size_t offset)
+{
+	return std::upper_bound(source.lineStarts.begin(), source.lineStarts.end(), (uint32_t)offset) - source.lineStarts.begin() - 1;
+}
+
+// Offset just past a token, the closing quote of a string literal included
+static size_t TokenEnd(const TokenTable& tokens, size_t index)
+{
+	return tokens.SourceOffset(index) + tokens.SourceLength(index) + (tokens.HasFlag(index, TOKEN_FLAG_STRING_LITERAL) ? 1 : 0);
+}
+
+// End keyword matching a block keyword, Identifier if the token opens none
+static TokenTypes BlockEnd(TokenTypes type)
+{
+	switch (type)
+	{
+	case TokenTypes::BeginProcedure: return TokenTypes::EndProcedure;
+	case TokenTypes::BeginFunction: return TokenTypes::EndFunction;
+	case TokenTypes::OperatorIf: return TokenTypes::OperatorEndIf;
+	case TokenTypes::OperatorFor: return TokenTypes::OperatorEndLoop;
+	case TokenTypes::OperatorWhile: return TokenTypes::OperatorEndLoop;
+	case TokenTypes::OperatorTry: return TokenTypes::OperatorEndTry;
+	case TokenTypes::DirectiveIf: return TokenTypes::DirectiveEndIf;
+	case TokenTypes::DirectiveInsert: return TokenTypes::DirectiveEndInsert;
+	case TokenTypes::DirectiveDelete: return TokenTypes::DirectiveEndDelete;
+	case TokenTypes::DirectiveRegion: return TokenTypes::DirectiveEndRegion;
+	default: return TokenTypes::Identifier;
+	}
+}
+
+static bool IsBlockEnd(TokenTypes type)
+{
+	switch (type)
+	{
+	case TokenTypes::EndProcedure: case TokenTypes::EndFunction: case TokenTypes::OperatorEndIf: case TokenTypes::OperatorEndLoop:
+	case TokenTypes::OperatorEndTry: case TokenTypes::DirectiveEndIf: case TokenTypes::DirectiveEndInsert: case TokenTypes::DirectiveEndDelete:
+	case TokenTypes::DirectiveEndRegion:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// One pass with a stack of open blocks. An end keyword closes the innermost
+// block it can end, dropping blocks left open inside it; an end keyword
+// nothing opened is ignored, so half-typed code still gets its blocks.
+static void MatchBlocks(const TokenTable& tokens, std::vector<tokenBlock_t>& blocks)
+{
+	std::vector<uint32_t> open;
+
+	blocks.clear();
+
+	for (uint32_t i = 0; i < tokens.Size(); i++)
+	{
+		TokenTypes type = tokens.Type(i);
+
+		if (BlockEnd(type) != TokenTypes::Identifier)
+			open.push_back(i);
+		else if (IsBlockEnd(type))
+		{
+			auto opener = std::find_if(open.rbegin(), open.rend(), [&](uint32_t begin) { return BlockEnd(tokens.Type(begin)) == type; });
+
+			if (opener == open.rend())
+				continue;
+
+			blocks.push_back({ *opener, i });
+			open.erase(opener.base() - 1, open.end());
+		}
+	}
+
+	std::sort(blocks.begin(), blocks.end(), [](const tokenBlock_t& a, const tokenBlock_t& b) { return a.begin < b.begin; });
+}
+
+// With edit given, only the subprograms it touched are parsed again
+static void ParseDocument(lspDocument_t& document, const tokenStreamEdit_t* edit = nullptr)
+{
+	TokenStream& stream = *document.stream;
+
+	if (!edit)
+		document.tree.Clear();
+
+	document.subprogramNodes.clear();
+	document.subprogramsByName.clear();
+
+	stream.Reset();
+
+	if (edit && document.tree.Size())
+		ReparseAbstractSyntaxTree(&stream, *edit, document.tree);
+	else
+		BuildAbstractSyntaxTree(&stream, document.tree);
+
+	for (AstNode node : document.tree.Root().Children())
+	{
+		if (node.Type() != ASTNodeTypes::Function && node.Type() != ASTNodeTypes::Procedure)
+			continue;
+
+		document.subprogramNodes.push_back({ document.tree.Node(node.Index()).token, node.Index() });
+		document.subprogramsByName.emplace(node.Subprogram().nameAtom, node.Index());
+	}
+
+	MatchBlocks(*stream.Table(), document.blocks);
+}
+
+// textDocument/publishDiagnostics notification with the syntax errors of the
+// document, an empty list once there are none
+static std::string PublishDiagnostics(const std::string& uri, const lspDocument_t& document)
+{
+	const TokenTable& tokens = *document.stream->Table();
+	const tokenStreamSource_t& source = tokens.Source();
+	size_t textEnd = source.buffer.Text().length();
+
+	JsonWriter writer;
+
+	writer.BeginObject();
+	writer.Key("jsonrpc").String("2.0");
+	writer.Key("method").String("textDocument/publishDiagnostics");
+	writer.Key("params");
+	writer.BeginObject();
+	writer.Key("uri").String(uri);
+	writer.Key("version").Int(document.version);
+	writer.Key("diagnostics");
+	writer.BeginArray();
+
+	for (const parseDiagnostic_t& diagnostic : document.tree.Diagnostics())
+	{
+		bool atEnd = diagnostic.token == AST_NO_TOKEN;
+
+		writer.BeginObject();
+		writer.Key("range");
+		WriteRange(writer, source, atEnd ? textEnd : tokens.RawStart(diagnostic.token), atEnd ? textEnd : TokenEnd(tokens, diagnostic.token));
+		writer.Key("severity").Int(LSP_SEVERITY_ERROR);
+		writer.Key("source").String("BSLTool");
+		writer.Key("message").String(DiagnosticMessage(diagnostic));
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+	writer.EndObject();
+
+	return writer.Release();
+}
+
+LanguageServer::LanguageServer() : m_ShutdownRequested(false), m_Exited(false)
+{
+}
+
+lspDocument_t* LanguageServer::FindDocument(const JsonValue& params)
+{
+	auto found = m_Documents.find(params["textDocument"]["uri"].AsString());
+	return found != m_Documents.end() ? found->second.get() : nullptr;
+}
+
+void LanguageServer::DidOpen(const JsonValue& params)
+{
+	const JsonValue& textDocument = params["textDocument"];
+
+	auto document = std::make_unique<lspDocument_t>();
+	document->version = textDocument["version"].AsInt();
+	document->stream = std::make_unique<TokenStream>(SourceBuffer::FromUtf8(textDocument["text"].AsString()));
+
+	ParseDocument(*document);
+	m_Documents[textDocument["uri"].AsString()] = std::move(document);
+}
+
+void LanguageServer::DidChange(const JsonValue& params)
+{
+	lspDocument_t* document = FindDocument(params);
+
+	if (!document)
+		return;
+
+	document->version = params["textDocument"]["version"].AsInt();
+
+	// Tokens all the changes touched, unless the text was replaced as a whole
+	std::optional<tokenStreamEdit_t> edit;
+	bool replaced = false;
+
+	for (const JsonValue& change : params["contentChanges"].Items())
+	{
+		const JsonValue& range = change["range"];
+
+		if (range.IsNull())
+		{
+			document->stream = std::make_unique<TokenStream>(SourceBuffer::FromUtf8(change["text"].AsString()));
+			replaced = true;
+			continue;
+		}
+
+		const tokenStreamSource_t& source = document->stream->Table()->Source();
+		size_t begin = PositionToOffset(source, range["start"]);
+		size_t end = std::max(begin, PositionToOffset(source, range["end"]));
+
+		tokenStreamEdit_t applied = document->stream->ApplyEdit(begin, end - begin, change["text"].AsString());
+		edit = edit ? CombineEdits(*edit, applied) : applied;
+	}
+
+	ParseDocument(*document, edit && !replaced ? &*edit : nullptr);
+}
+
+void LanguageServer::DidClose(const JsonValue& params)
+{
+	m_Documents.erase(params["textDocument"]["uri"].AsString());
+}
+
+void LanguageServer::Initialize(JsonWriter& result)
+{
+	result.BeginObject();
+
+	result.Key("capabilities");
+	result.BeginObject();
+
+	result.Key("textDocumentSync");
+	result.BeginObject();
+	result.Key("openClose").Bool(true);
+	// Incremental
+	result.Key("change").Int(2);
+	result.EndObject();
+
+	result.Key("documentSymbolProvider").Bool(true);
+	result.Key("foldingRangeProvider").Bool(true);
+	result.Key("hoverProvider").Bool(true);
+	result.EndObject();
+
+	result.Key("serverInfo");
+	result.BeginObject();
+	result.Key("name").String("BSLTool");
+	result.EndObject();
+
+	result.EndObject();
+}
+
+// Regions and subprograms, subprograms nested in the regions around them
+void LanguageServer::DocumentSymbol(const JsonValue& params, JsonWriter& result)
+{
+	lspDocument_t* document = FindDocument(params);
+
+	if (!document)
+	{
+		result.Null();
+		return;
+	}
+
+	const TokenTable& tokens = *document->stream->Table();
+	const tokenStreamSource_t& source = tokens.Source();
+	std::string_view text = source.buffer.Text();
+
+	// End tokens of the regions whose children are being written
+	std::vector<uint32_t> openRegions;
+
+	result.BeginArray();
+
+	for (const tokenBlock_t& block : document->blocks)
+	{
+		TokenTypes type = tokens.Type(block.begin);
+
+		if (type != TokenTypes::DirectiveRegion && type != TokenTypes::BeginProcedure && type != TokenTypes::BeginFunction)
+			continue;
+
+		while (!openRegions.empty() && openRegions.back() < block.begin)
+		{
+			result.EndArray();
+			result.EndObject();
+			openRegions.pop_back();
+		}
+
+		result.BeginObject();
+
+		if (type == TokenTypes::DirectiveRegion)
+		{
+			size_t name = block.begin + 1;
+			bool named = name < block.end && tokens.Type(name) == TokenTypes::Identifier;
+
+			result.Key("name").String(tokens.Value(named ? name : block.begin));
+			result.Key("kind").Int(LSP_SYMBOL_NAMESPACE);
+			result.Key("range");
+			WriteRange(result, source, tokens.RawStart(block.begin), TokenEnd(tokens, block.end));
+			result.Key("selectionRange");
+			WriteRange(result, source, tokens.RawStart(named ? name : block.begin), TokenEnd(tokens, named ? name : block.begin));
+			result.Key("children");
+			result.BeginArray();
+
+			openRegions.push_back(block.end);
+			continue;
+		}
+
+		// Name and export come from the tree; a module that doesn't parse
+		// still gets its outline, named after the token following the keyword
+		auto node = std::lower_bound(document->subprogramNodes.begin(), document->subprogramNodes.end(), std::make_pair(block.begin, (uint32_t)0));
+		bool hasNode = node != document->subprogramNodes.end() && node->first == block.begin;
+
+		const subprogramPayload_t* subprogram = hasNode ? &document->tree.Subprogram(node->second) : nullptr;
+
+		size_t nameOffset;
+		std::string header = SubprogramHeaderText(text, tokens.SourceOffset(block.begin), subprogram && subprogram->exported, nameOffset);
+
+		std::string_view name = subprogram ? subprogram->name : block.begin + 1 < block.end ? tokens.Value(block.begin + 1) : std::string_view();
+
+		result.Key("name").String(name.empty() ? std::string_view(header) : name);
+		result.Key("detail").String(header);
+		result.Key("kind").Int(LSP_SYMBOL_FUNCTION);
+		result.Key("range");
+		WriteRange(result, source, tokens.RawStart(block.begin), TokenEnd(tokens, block.end));
+		result.Key("selectionRange");
+		WriteRange(result, source, nameOffset, nameOffset + name.length());
+		result.EndObject();
+	}
+
+	for (; !openRegions.empty(); openRegions.pop_back())
+	{
+		result.EndArray();
+		result.EndObject();
+	}
+
+	result.EndArray();
+}
+
+// Every block spanning more than one line, and runs of comment lines. The
+// line of the end keyword is left out, so it stays visible when folded.
+void LanguageServer::FoldingRange(const JsonValue& params, JsonWriter& result)
+{
+	lspDocument_t* document = FindDocument(params);
+
+	if (!document)
+	{
+		result.Null();
+		return;
+	}
+
+	const TokenTable& tokens = *document->stream->Table();
+	const tokenStreamSource_t& source = tokens.Source();
+
+	auto writeRange = [&](size_t startLine, size_t endLine, const char* kind)
+	{
+		result.BeginObject();
+		result.Key("startLine").Int(startLine);
+		result.Key("endLine").Int(endLine);
+
+		if (kind)
+			result.Key("kind").String(kind);
+
+		result.EndObject();
+	};
+
+	result.BeginArray();
+
+	for (const tokenBlock_t& block : document->blocks)
+	{
+		size_t startLine = LineOf(source, tokens.SourceOffset(block.begin));
+		size_t endLine = LineOf(source, tokens.SourceOffset(block.end));
+
+		if (endLine > startLine + 1)
+			writeRange(startLine, endLine - 1, tokens.Type(block.begin) == TokenTypes::DirectiveRegion ? "region" : nullptr);
+	}
+
+	size_t commentStart = 0;
+	size_t commentEnd = 0;
+	bool inComments = false;
+
+	for (size_t i = 0; i <= tokens.Size(); i++)
+	{
+		if (i < tokens.Size() && tokens.Type(i) == TokenTypes::Comment)
+		{
+			size_t line = LineOf(source, tokens.SourceOffset(i));
+
+			if (inComments && line == commentEnd + 1)
+			{
+				commentEnd = line;
+				continue;
+			}
+
+			if (inComments && commentEnd > commentStart)
+				writeRange(commentStart, commentEnd, "comment");
+
+			commentStart = commentEnd = line;
+			inComments = true;
+			continue;
+		}
+
+		if (inComments && commentEnd > commentStart)
+			writeRange(commentStart, commentEnd, "comment");
+
+		inComments = false;
+	}
+
+	result.EndArray();
+}
+
+// Header of the subprogram an identifier names, if the module has it
+void LanguageServer::Hover(const JsonValue& params, JsonWriter& result)
+{
+	lspDocument_t* document = FindDocument(params);
+
+	if (!document)
+	{
+		result.Null();
+		return;
+	}
+
+	const TokenTable& tokens = *document->stream->Table();
+	const tokenStreamSource_t& source = tokens.Source();
+	size_t offset = PositionToOffset(source, params["position"]);
+
+	// Last token starting at or before the position
+	size_t first = 0;
+	size_t last = tokens.Size();
+
+	while (first < last)
+	{
+		size_t middle = (first + last) / 2;
+
+		if (tokens.RawStart(middle) <= offset)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	if (first == 0 || tokens.Type(first - 1) != TokenTypes::Identifier || offset > TokenEnd(tokens, first - 1))
+	{
+		result.Null();
+		return;
+	}
+
+	size_t token = first - 1;
+	auto found = document->subprogramsByName.find(tokens.Atom(token));
+
+	if (found == document->subprogramsByName.end())
+	{
+		result.Null();
+		return;
+	}
+
+	const subprogramPayload_t& subprogram = document->tree.Subprogram(found->second);
+
+	std::string contents = "```bsl\n";
+
+	for (std::string_view annotation : subprogram.annotations)
+	{
+		contents.append(annotation);
+		contents += '\n';
+	}
+
+	size_t nameOffset;
+	contents += SubprogramHeaderText(source.buffer.Text(), tokens.SourceOffset(document->tree.Node(found->second).token), subprogram.exported, nameOffset);
+	contents += "\n```";
+
+	result.BeginObject();
+	result.Key("contents");
+	result.BeginObject();
+	result.Key("kind").String("markdown");
+	result.Key("value").String(contents);
+	result.EndObject();
+	result.Key("range");
+	WriteRange(result, source, tokens.RawStart(token), TokenEnd(tokens, token));
+	result.EndObject();
+}
+
+static std::string ErrorResponse(const JsonValue& id, int code, const char* message)
+{
+	JsonWriter writer;
+
+	writer.BeginObject();
+	writer.Key("jsonrpc").String("2.0");
+	writer.Key("id").Value(id);
+	writer.Key("error");
+	writer.BeginObject();
+	writer.Key("code").Int(code);
+	writer.Key("message").String(message);
+	writer.EndObject();
+	writer.EndObject();
+
+	return writer.Release();
+}
+
+void LanguageServer::HandleMessage(std::string_view message, std::vector<std::string>& output)
+{
+	JsonValue request;
+
+	if (!JsonValue::Parse(message, request))
+	{
+		output.push_back(ErrorResponse(JsonValue(), LSP_PARSE_ERROR, "Parse error"));
+		return;
+	}
+
+	const std::string& method = request["method"].AsString();
+	const JsonValue& params = request["params"];
+	const JsonValue& id = request["id"];
+
+	// Notifications have no id and get no response
+	if (id.IsNull())
+	{
+		if (method == "textDocument/didOpen")
+			DidOpen(params);
+		else if (method == "textDocument/didChange")
+			DidChange(params);
+		else if (method == "textDocument/didClose")
+			DidClose(params);
+		else if (method == "exit")
+			m_Exited = true;
+
+		// Diagnostics follow every change of a document
+		if (method == "textDocument/didOpen" || method == "textDocument/didChange")
+		{
+			const std::string& uri = params["textDocument"]["uri"].AsString();
+			auto found = m_Documents.find(uri);
+
+			if (found != m_Documents.end())
+				output.push_back(PublishDiagnostics(uri, *found->second));
+		}
+
+		return;
+	}
+
+	if (m_ShutdownRequested)
+	{
+		output.push_back(ErrorResponse(id, LSP_INVALID_REQUEST, "Server is shut down"));
+		return;
+	}
+
+	JsonWriter writer;
+
+	writer.BeginObject();
+	writer.Key("jsonrpc").String("2.0");
+	writer.Key("id").Value(id);
+	writer.Key("result");
+
+	if (method == "initialize")
+		Initialize(writer);
+	else if (method == "shutdown")
+	{
+		m_ShutdownRequested = true;
+		writer.Null();
+	}
+	else if (method == "textDocument/documentSymbol")
+		DocumentSymbol(params, writer);
+	else if (method == "textDocument/foldingRange")
+		FoldingRange(params, writer);
+	else if (method == "textDocument/hover")
+		Hover(params, writer);
+	else
+	{
+		output.push_back(ErrorResponse(id, LSP_METHOD_NOT_FOUND, "Method not found"));
+		return;
+	}
+
+	writer.EndObject();
+	output.push_back(writer.Release());
+}
+
+// Reads one message framed by a Content-Length header; false at the end of input
+static bool ReadMessage(FILE* input, std::string& message)
+{
+	size_t length = 0;
+	bool hasLength = false;
+	std::string line;
+
+	while (true)
+	{
+		int c = fgetc(input);
+
+		if (c == EOF)
+			return false;
+
+		if (c != '\n')
+		{
+			line += (char)c;
+			continue;
+		}
+
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+
+		// Blank line ends the header
+		if (line.empty())
+		{
+			if (hasLength)
+				break;
+
+			continue;
+		}
+
+		const char* name = "content-length:";
+		size_t nameLength = strlen(name);
+
+		if (line.length() > nameLength && std::equal(name, name + nameLength, line.begin(), [](char a, char b) { return a == tolower((unsigned char)b); }))
+		{
+			length = (size_t)strtoull(line.c_str() + nameLength, nullptr, 10);
+			hasLength = true;
+		}
+
+		line.clear();
+	}
+
+	message.resize(length);
+	return fread(&message[0], 1, length, input) == length;
+}
+
+int RunLanguageServer(int argc, char** argv)
+{
+	// stdio is the only transport; clients launching servers pass --stdio
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--stdio"))
+		{
+			fprintf(stderr, "Usage: BSLTool lsp [--stdio]\n");
+			return 1;
+		}
+	}
+
+#ifdef _WIN32
+	// Content-Length counts bytes, so no CRLF translation
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	LanguageServer server;
+	std::string message;
+	std::vector<std::string> output;
+
+	while (ReadMessage(stdin, message))
+	{
+		output.clear();
+		server.HandleMessage(message, output);
+
+		for (const std::string& response : output)
+		{
+			fprintf(stdout, "Content-Length: %zu\r\n\r\n", response.length());
+			fwrite(response.data(), 1, response.length(), stdout);
+		}
+
+		fflush(stdout);
+
+		if (server.Exited())
+			return server.ExitCode();
+	}
+
+	// Input closed without exit
+	return 1;
+}
+
+}
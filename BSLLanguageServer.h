@@ -0,0 +1,88 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "BSLAbstractSyntaxTree.h"
+#include "BSLJson.h"
+#include "BSLToken.h"
+
+namespace BSL
+{
+
+// Keyword opening a block and the keyword closing it, as token indices
+typedef struct
+{
+	uint32_t begin;
+	uint32_t end;
+}tokenBlock_t;
+
+// Open document. The text lives in the token stream, which edits are applied
+// to, so only the tokens around an edit are lexed again and only the
+// subprograms it touched are parsed again; the tables derived from the tree
+// are rebuilt after every change.
+typedef struct
+{
+	int64_t version;
+
+	std::unique_ptr<TokenStream> stream;
+	SyntaxTree tree;
+
+	// Subprogram nodes by the token of their keyword, in token order
+	std::vector<std::pair<uint32_t, uint32_t>> subprogramNodes;
+
+	// Subprogram nodes by the atom of their name
+	std::unordered_map<uint32_t, uint32_t> subprogramsByName;
+
+	// Matched blocks of the module, by begin token
+	std::vector<tokenBlock_t> blocks;
+}lspDocument_t;
+
+// Language Server Protocol over JSON-RPC, transport aside: takes messages
+// one at a time and returns the messages to send back. Supports incremental
+// document sync, documentSymbol, foldingRange and hover, and publishes the
+// syntax errors of a document after every change; positions are in UTF-16
+// code units as the protocol defaults to.
+class LanguageServer
+{
+	std::unordered_map<std::string, std::unique_ptr<lspDocument_t>> m_Documents;
+
+	bool m_ShutdownRequested;
+	bool m_Exited;
+
+	lspDocument_t* FindDocument(const JsonValue& params);
+
+	void DidOpen(const JsonValue& params);
+	void DidChange(const JsonValue& params);
+	void DidClose(const JsonValue& params);
+
+	void Initialize(JsonWriter& result);
+	void DocumentSymbol(const JsonValue& params, JsonWriter& result);
+	void FoldingRange(const JsonValue& params, JsonWriter& result);
+	void Hover(const JsonValue& params, JsonWriter& result);
+public:
+	LanguageServer();
+
+	// Handles one JSON-RPC message, appending the response or notifications,
+	// if any, to output
+	void HandleMessage(std::string_view message, std::vector<std::string>& output);
+
+	// Set once the exit notification came
+	bool Exited() const
+	{
+		return m_Exited;
+	}
+
+	// Process exit code the protocol asks for: 0 only if shutdown came first
+	int ExitCode() const
+	{
+		return m_ShutdownRequested ? 0 : 1;
+	}
+};
+
+// Entry point of "BSLTool lsp": serves the protocol over stdin and stdout
+// with Content-Length framing until the client sends exit
+int RunLanguageServer(int argc, char** argv);
+
+}
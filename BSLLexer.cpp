@@ -0,0 +1,512 @@
+#include "BSLLexer.h"
+#include "BSLToken.h"
+#include <algorithm>
+#include <array>
+#include "BSLScan.h"
+
+constexpr auto CR = '\n';
+
+namespace BSL
+{
+
+enum SymbolClass : uint8_t
+{
+	Whitespace,
+	LineFeed,
+	Letter,
+	Digit,
+	Dot,
+	SingleQuote,
+	Ampersand,
+	Divider,
+	DoubleQuote,
+	SymbolClassCount
+};
+
+// Letters are everything else, including all bytes of multibyte UTF-8 symbols
+// and symbols like | # that identifiers have always been allowed to contain
+static constexpr std::array<SymbolClass, 256> MakeSymbolClasses()
+{
+	std::array<SymbolClass, 256> classes = {};
+
+	for (size_t i = 0; i < 256; i++)
+		classes[i] = i < 33 ? Whitespace : Letter;
+
+	for (char c : "\\/*%()-=+;,<>[]")
+		if (c)
+			classes[(unsigned char)c] = Divider;
+
+	for (char c = '0'; c <= '9'; c++)
+		classes[(unsigned char)c] = Digit;
+
+	classes[(unsigned char)CR] = LineFeed;
+	classes[(unsigned char)'.'] = Dot;
+	classes[(unsigned char)'\''] = SingleQuote;
+	classes[(unsigned char)'&'] = Ampersand;
+	classes[(unsigned char)'\"'] = DoubleQuote;
+
+	return classes;
+}
+
+static constexpr auto g_SymbolClasses = MakeSymbolClasses();
+
+// Token types of the dividers, which are tokens by themselves
+static constexpr std::array<TokenTypes, 256> MakeDividerTypes()
+{
+	std::array<TokenTypes, 256> types = {};
+
+	for (size_t i = 0; i < 256; i++)
+		types[i] = TokenTypes::Identifier;
+
+	types[(unsigned char)'('] = TokenTypes::OpeningBracket;
+	types[(unsigned char)')'] = TokenTypes::ClosingBracket;
+	types[(unsigned char)'='] = TokenTypes::EqualsSign;
+	types[(unsigned char)'+'] = TokenTypes::PlusSign;
+	types[(unsigned char)'-'] = TokenTypes::MinusSign;
+	types[(unsigned char)'*'] = TokenTypes::MultiplySign;
+	types[(unsigned char)'/'] = TokenTypes::DivisionSign;
+	types[(unsigned char)'%'] = TokenTypes::ModuloSign;
+	types[(unsigned char)';'] = TokenTypes::EndExpression;
+	types[(unsigned char)'.'] = TokenTypes::DotSign;
+	types[(unsigned char)','] = TokenTypes::Comma;
+	types[(unsigned char)'<'] = TokenTypes::LessSign;
+	types[(unsigned char)'>'] = TokenTypes::GreaterSign;
+	types[(unsigned char)'['] = TokenTypes::OpeningSquareBracket;
+	types[(unsigned char)']'] = TokenTypes::ClosingSquareBracket;
+
+	return types;
+}
+
+static constexpr auto g_DividerTypes = MakeDividerTypes();
+
+// States of the word automaton. A word is the longest run of symbols the
+// automaton accepts: 123, 1.5, '20200101', &AtServer, Identifier123.
+enum WordState : uint8_t
+{
+	WordStart,
+	WordIdentifier,
+	WordInteger,
+	WordIntegerDot,
+	WordFraction,
+	WordAnnotation,
+	WordDateOpen,
+	WordDateDigits,
+	WordDate,
+	WordDone,
+	WordStateCount
+};
+
+// What a word ending in a state is, WordNone for states that can't end one
+enum WordKind : uint8_t
+{
+	WordNone,
+	WordKeywordOrIdentifier,
+	WordNumber,
+	WordAnnotationKind,
+	WordDateKind
+};
+
+typedef std::array<std::array<WordState, SymbolClassCount>, WordStateCount> wordTransitions_t;
+
+static constexpr wordTransitions_t MakeWordTransitions()
+{
+	wordTransitions_t transitions = {};
+
+	for (auto& state : transitions)
+		for (auto& next : state)
+			next = WordDone;
+
+	auto setWordSymbols = [&](WordState state, WordState next)
+	{
+		transitions[state][Letter] = next;
+		transitions[state][Digit] = next;
+		transitions[state][SingleQuote] = next;
+		transitions[state][Ampersand] = next;
+	};
+
+	transitions[WordStart][Letter] = WordIdentifier;
+	transitions[WordStart][Digit] = WordInteger;
+	transitions[WordStart][SingleQuote] = WordDateOpen;
+	transitions[WordStart][Ampersand] = WordAnnotation;
+
+	setWordSymbols(WordIdentifier, WordIdentifier);
+
+	setWordSymbols(WordInteger, WordIdentifier);
+	transitions[WordInteger][Digit] = WordInteger;
+	transitions[WordInteger][Dot] = WordIntegerDot;
+
+	transitions[WordIntegerDot][Digit] = WordFraction;
+
+	transitions[WordFraction][Digit] = WordFraction;
+
+	setWordSymbols(WordAnnotation, WordAnnotation);
+
+	setWordSymbols(WordDateOpen, WordIdentifier);
+	transitions[WordDateOpen][Digit] = WordDateDigits;
+
+	setWordSymbols(WordDateDigits, WordIdentifier);
+	transitions[WordDateDigits][Digit] = WordDateDigits;
+	transitions[WordDateDigits][SingleQuote] = WordDate;
+
+	setWordSymbols(WordDate, WordIdentifier);
+
+	return transitions;
+}
+
+static constexpr auto g_WordTransitions = MakeWordTransitions();
+
+static constexpr std::array<WordKind, WordStateCount> MakeWordKinds()
+{
+	std::array<WordKind, WordStateCount> kinds = {};
+
+	kinds[WordIdentifier] = WordKeywordOrIdentifier;
+	kinds[WordDateOpen] = WordKeywordOrIdentifier;
+	kinds[WordDateDigits] = WordKeywordOrIdentifier;
+	kinds[WordInteger] = WordNumber;
+	kinds[WordFraction] = WordNumber;
+	kinds[WordAnnotation] = WordAnnotationKind;
+	kinds[WordDate] = WordDateKind;
+
+	return kinds;
+}
+
+static constexpr auto g_WordKinds = MakeWordKinds();
+
+// Fraction digits past what fits in a uint64_t don't change the double anyway
+constexpr size_t MAX_FRACTION_DIGITS = 18;
+
+static constexpr std::array<double, MAX_FRACTION_DIGITS + 1> MakePowersOfTen()
+{
+	std::array<double, MAX_FRACTION_DIGITS + 1> powers = {};
+	double power = 1;
+
+	for (auto& p : powers)
+	{
+		p = power;
+		power *= 10;
+	}
+
+	return powers;
+}
+
+static constexpr auto g_PowersOfTen = MakePowersOfTen();
+
+Lexer::Lexer(size_t startOffset)
+{
+	m_Offset = startOffset;
+	m_TokenStartOffset = startOffset;
+	m_TokenValueStart = 0;
+	m_TokenValueLength = 0;
+	m_HasEscapes = false;
+	m_InStringLiteral = false;
+	m_InComment = false;
+}
+
+size_t Lexer::KeepFrom() const
+{
+	// Between tokens the start offset is set again before it is used
+	if (TokenValueEmpty() && !m_InStringLiteral)
+		return m_Offset;
+
+	if (m_TokenValueLength && !m_HasEscapes)
+		return std::min(m_TokenStartOffset, m_TokenValueStart);
+
+	return m_TokenStartOffset;
+}
+
+bool Lexer::Lex(std::string_view window, size_t windowOffset, bool final, ITokenSink& sink)
+{
+	const char* source = window.data();
+	size_t dataLength = window.length();
+
+	const char lineFeed = CR;
+	const char quote = '\"';
+
+	// Offsets below are relative to the window; the sink gets source offsets.
+	// Words are lexed in one go, so only a comment or a string literal can be
+	// carried over from the previous window.
+	size_t offset = m_Offset - windowOffset;
+	size_t tokenStartOffset = m_TokenStartOffset - windowOffset;
+	size_t tokenValueStart = m_TokenValueLength ? m_TokenValueStart - windowOffset : 0;
+	size_t tokenValueLength = m_TokenValueLength;
+	bool hasEscapes = m_HasEscapes;
+	std::string& escapedValue = m_EscapedValue;
+	bool inStringLiteral = m_InStringLiteral;
+	bool inComment = m_InComment;
+	bool stopped = false;
+	bool deferred = false;
+
+	// The symbol after the current one has to be known, so stop short of the
+	// end of a window that is not the last one
+	size_t lexLength = final || dataLength == 0 ? dataLength : dataLength - 1;
+
+	auto peekSymbol = [&](size_t peekOffset) -> char {
+
+		size_t calculatedOffset = offset + peekOffset;
+
+		if (calculatedOffset < dataLength)
+			return source[calculatedOffset];
+		else
+			return 0;
+	};
+
+	auto tokenValueEmpty = [&]() -> bool
+	{
+		return !hasEscapes && tokenValueLength == 0;
+	};
+
+	auto appendCurrentSymbol = [&]()
+	{
+		if (hasEscapes)
+			escapedValue += source[offset];
+		else
+		{
+			if (!tokenValueLength)
+				tokenValueStart = offset;
+
+			tokenValueLength++;
+		}
+	};
+
+	// Moves over a run of bytes starting at the current one; the loop itself
+	// advances past the last byte of the run
+	auto skipSymbols = [&](size_t count)
+	{
+		offset += count - 1;
+	};
+
+	auto appendSymbols = [&](size_t count)
+	{
+		if (hasEscapes)
+			escapedValue.append(source + offset, count);
+		else
+		{
+			if (!tokenValueLength)
+				tokenValueStart = offset;
+
+			tokenValueLength += count;
+		}
+
+		skipSymbols(count);
+	};
+
+	auto resetTokenValue = [&]()
+	{
+		tokenValueLength = 0;
+		hasEscapes = false;
+		escapedValue.clear();
+	};
+
+	auto startToken = [&]()
+	{
+		tokenStartOffset = offset;
+	};
+
+	auto pushToken = [&](TokenTypes type, std::string_view value, bool ownedValue, size_t valueOffset, double numericValue)
+	{
+		lexedToken_t token;
+		token.type = type;
+		token.value = value;
+		token.ownedValue = ownedValue;
+		token.offset = windowOffset + valueOffset;
+		token.numericValue = numericValue;
+
+		if (!sink.PushToken(token))
+			stopped = true;
+	};
+
+	// Pushes the comment or string literal accumulated so far
+	auto pushCurrentTokenAndStartNext = [&]()
+	{
+		TokenTypes type = inStringLiteral ? TokenTypes::StringConst : TokenTypes::Comment;
+
+		if (hasEscapes)
+			pushToken(type, escapedValue, true, tokenStartOffset, 0);
+		else if (tokenValueLength)
+			pushToken(type, window.substr(tokenValueStart, tokenValueLength), false, tokenStartOffset, 0);
+		// "" is an empty literal, starting past the opening quote as the others do
+		else if (inStringLiteral)
+			pushToken(type, window.substr(offset, 0), false, offset, 0);
+
+		startToken();
+		resetTokenValue();
+	};
+
+	// Runs the word automaton from the current symbol and pushes the longest
+	// word it accepted. Returns false if the word may go on in the next window.
+	auto lexWord = [&]() -> bool
+	{
+		WordState state = WordStart;
+		size_t end = offset;
+
+		WordState acceptedState = WordStart;
+		size_t acceptedEnd = offset;
+
+		double integerPart = 0;
+		uint64_t fractionDigits = 0;
+		size_t fractionLength = 0;
+
+		for (; end < dataLength; end++)
+		{
+			unsigned char symbol = (unsigned char)source[end];
+			WordState next = g_WordTransitions[state][g_SymbolClasses[symbol]];
+
+			if (next == WordDone)
+				break;
+
+			if (next == WordInteger)
+				integerPart = integerPart * 10 + (symbol - '0');
+			else if (next == WordFraction && fractionLength < MAX_FRACTION_DIGITS)
+			{
+				fractionDigits = fractionDigits * 10 + (symbol - '0');
+				fractionLength++;
+			}
+
+			state = next;
+
+			if (g_WordKinds[state] != WordNone)
+			{
+				acceptedState = state;
+				acceptedEnd = end + 1;
+			}
+		}
+
+		if (end == dataLength && !final)
+			return false;
+
+		std::string_view value = window.substr(offset, acceptedEnd - offset);
+
+		switch (g_WordKinds[acceptedState])
+		{
+		case WordNumber:
+			// Backing off from "1." leaves the fraction empty
+			pushToken(TokenTypes::NumericConst, value, false, offset, integerPart + fractionDigits / g_PowersOfTen[fractionLength]);
+			break;
+		case WordAnnotationKind:
+			pushToken(TokenTypes::Annotation, value, false, offset, 0);
+			break;
+		case WordDateKind:
+			pushToken(TokenTypes::DateConst, value, false, offset, 0);
+			break;
+		default:
+			pushToken(TokenTypeFromValue(value), value, false, offset, 0);
+			break;
+		}
+
+		skipSymbols(acceptedEnd - offset);
+		return true;
+	};
+
+	while (true)
+	{
+		if (offset >= lexLength || stopped)
+			break;
+
+		char curSymbol = peekSymbol(0);
+		char nextSymbol = peekSymbol(1);
+
+		if (curSymbol == CR)
+		{
+			sink.PushLineStart(windowOffset + offset + 1);
+
+			if (inComment)
+			{
+				pushCurrentTokenAndStartNext();
+				inComment = false;
+			}
+		}
+
+		if (inStringLiteral)
+		{
+			if (curSymbol == '\"')
+			{
+				if (nextSymbol == '\"')
+				{
+					// A literal starting with "" starts past the opening quote too
+					if (tokenValueEmpty())
+						startToken();
+
+					appendCurrentSymbol();
+
+					if (!hasEscapes)
+					{
+						escapedValue.assign(source + tokenValueStart, tokenValueLength);
+						hasEscapes = true;
+					}
+
+					offset++;
+				}
+				else
+				{
+					pushCurrentTokenAndStartNext();
+					inStringLiteral = false;
+				}
+			}
+			else
+			{
+				if (tokenValueEmpty())
+					startToken();
+
+				// Literal text up to the closing quote or the next line, whose feed still has to be counted
+				appendSymbols(std::max<size_t>(1, ScanUntil(source + offset, dataLength - offset, quote, lineFeed)));
+			}
+		}
+		else if (inComment)
+		{
+			// Comment runs to the end of the line
+			appendSymbols(ScanUntil(source + offset, dataLength - offset, lineFeed, lineFeed));
+		}
+		else
+		{
+			switch (g_SymbolClasses[(unsigned char)curSymbol])
+			{
+			case LineFeed:
+				break;
+			case Whitespace:
+				skipSymbols(ScanWhitespace(source + offset, dataLength - offset));
+				break;
+			case DoubleQuote:
+				inStringLiteral = true;
+				startToken();
+				resetTokenValue();
+				break;
+			case Divider:
+			case Dot:
+				if (curSymbol == '/' && nextSymbol == '/')
+				{
+					inComment = true;
+					startToken();
+					appendSymbols(ScanUntil(source + offset, dataLength - offset, lineFeed, lineFeed));
+				}
+				else
+					pushToken(g_DividerTypes[(unsigned char)curSymbol], window.substr(offset, 1), false, offset, 0);
+				break;
+			default:
+				// Lex the word again once the next window is there
+				if (!lexWord())
+					deferred = true;
+				break;
+			}
+		}
+
+		if (deferred)
+			break;
+
+		offset++;
+	}
+
+	if (final && !stopped && !tokenValueEmpty())
+		pushCurrentTokenAndStartNext();
+
+	m_Offset = windowOffset + offset;
+	m_TokenStartOffset = windowOffset + tokenStartOffset;
+	m_TokenValueStart = windowOffset + tokenValueStart;
+	m_TokenValueLength = tokenValueLength;
+	m_HasEscapes = hasEscapes;
+	m_InStringLiteral = inStringLiteral;
+	m_InComment = inComment;
+
+	return !stopped;
+}
+
+}
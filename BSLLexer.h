@@ -0,0 +1,90 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include "BSLTokenTypes.h"
+
+namespace BSL
+{
+
+typedef struct
+{
+	TokenTypes type;
+
+	// View into the lexed window, or into a temporary copy if ownedValue is set
+	std::string_view value;
+	bool ownedValue;
+
+	size_t offset;
+
+	// Parsed value of a NumericConst
+	double numericValue;
+
+}lexedToken_t;
+
+// Receives tokens and line starts from Lexer
+class ITokenSink
+{
+public:
+	virtual ~ITokenSink() {}
+
+	// Returning false stops the lexer once it is done with the current symbol
+	virtual bool PushToken(const lexedToken_t& token) = 0;
+
+	// Offset of the first byte of every line but the first one
+	virtual void PushLineStart(size_t offset) = 0;
+};
+
+// BSL lexer that can be fed the source text in consecutive windows and
+// resumes where the previous window or a stop requested by the sink left off.
+// Words (identifiers, keywords, numbers, dates, annotations) are scanned and
+// classified by an automaton over symbol classes, see BSLLexer.cpp.
+class Lexer
+{
+	size_t m_Offset;
+	size_t m_TokenStartOffset;
+
+	// Comment or string literal value is source[m_TokenValueStart, m_TokenValueStart + m_TokenValueLength)
+	// until a "" escape is met, after which it is accumulated in m_EscapedValue instead
+	size_t m_TokenValueStart;
+	size_t m_TokenValueLength;
+	bool m_HasEscapes;
+	std::string m_EscapedValue;
+
+	bool m_InStringLiteral;
+	bool m_InComment;
+
+	bool TokenValueEmpty() const
+	{
+		return !m_HasEscapes && m_TokenValueLength == 0;
+	}
+public:
+	// startOffset has to be a token boundary
+	Lexer(size_t startOffset = 0);
+
+	// Lexes window, the source text from windowOffset on, which has to start no
+	// later than KeepFrom(). Unless final is set the lexer stops before a word
+	// or symbol pair that may continue in the next window. Returns false if the
+	// sink stopped it.
+	bool Lex(std::string_view window, size_t windowOffset, bool final, ITokenSink& sink);
+
+	// Offset of the next symbol to lex
+	size_t Offset() const
+	{
+		return m_Offset;
+	}
+
+	// First offset the lexer still needs to see, i.e. the start of the token being lexed
+	size_t KeepFrom() const;
+};
+
+// The lexer as it was before the word automaton: classifies a word only after
+// it is scanned, splits decimal numbers at the dot, has no dates and drops a
+// word written right before an opening quote. Kept as the reference for
+// RunLexerCheck; lexes the whole text in one window.
+void BaselineLex(std::string_view text, ITokenSink& sink);
+
+// Lexes the given module files with both Lexer and BaselineLex and reports
+// differences other than the intended ones; returns nonzero if there are any
+int RunLexerCheck(int argc, char** argv);
+
+};
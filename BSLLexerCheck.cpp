@@ -0,0 +1,494 @@
+#include "BSLLexer.h"
+#include "BSLToken.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <locale>
+#include <sstream>
+#include <vector>
+#include "BSLScan.h"
+
+constexpr auto CR = '\n';
+
+namespace BSL
+{
+
+static bool IsWhitespaceSymbol(char curSymbol)
+{
+	return (unsigned char)curSymbol < 33;
+}
+
+static bool IsTokenDivider(char curSymbol)
+{
+	switch (curSymbol)
+	{
+	case '\\': case '/': case '%': case '(': case ')': case '-': case '=': case '+':
+	case ';': case '.': case ',': case '<': case '>': case '[': case ']':
+		return true;
+	}
+
+	return false;
+}
+
+static bool IsIdentifierSymbol(char curSymbol)
+{
+	return !IsWhitespaceSymbol(curSymbol) && !IsTokenDivider(curSymbol) && curSymbol != '\"';
+}
+
+static TokenTypes ClassifyWord(std::string_view tokenValue, bool isStringLiteral)
+{
+	bool isNumber = std::all_of(tokenValue.begin(), tokenValue.end(), [](char c) { return c >= '0' && c <= '9'; });
+
+	if (isStringLiteral)
+		return TokenTypes::StringConst;
+	else if (tokenValue[0] == '&')
+		return TokenTypes::Annotation;
+	else if (isNumber)
+		return TokenTypes::NumericConst;
+	else if (tokenValue.length() >= 2 && tokenValue[0] == '/' && tokenValue[1] == '/')
+		return TokenTypes::Comment;
+	else
+		return TokenTypeFromValue(tokenValue);
+}
+
+void BaselineLex(std::string_view text, ITokenSink& sink)
+{
+	const char* source = text.data();
+	size_t dataLength = text.length();
+
+	const char lineFeed = CR;
+	const char quote = '\"';
+
+	size_t offset = 0;
+	size_t tokenStartOffset = 0;
+	size_t tokenValueStart = 0;
+	size_t tokenValueLength = 0;
+	bool hasEscapes = false;
+	std::string escapedValue;
+	bool inStringLiteral = false;
+	bool inComment = false;
+
+	auto peekSymbol = [&](size_t peekOffset) -> char {
+
+		size_t calculatedOffset = offset + peekOffset;
+
+		if (calculatedOffset < dataLength)
+			return source[calculatedOffset];
+		else
+			return 0;
+	};
+
+	auto tokenValueEmpty = [&]() -> bool
+	{
+		return !hasEscapes && tokenValueLength == 0;
+	};
+
+	auto appendCurrentSymbol = [&]()
+	{
+		if (hasEscapes)
+			escapedValue += source[offset];
+		else
+		{
+			if (!tokenValueLength)
+				tokenValueStart = offset;
+
+			tokenValueLength++;
+		}
+	};
+
+	auto appendSymbols = [&](size_t count)
+	{
+		if (hasEscapes)
+			escapedValue.append(source + offset, count);
+		else
+		{
+			if (!tokenValueLength)
+				tokenValueStart = offset;
+
+			tokenValueLength += count;
+		}
+
+		offset += count - 1;
+	};
+
+	auto resetTokenValue = [&]()
+	{
+		tokenValueLength = 0;
+		hasEscapes = false;
+		escapedValue.clear();
+	};
+
+	auto startToken = [&]()
+	{
+		tokenStartOffset = offset;
+	};
+
+	auto pushCurrentTokenAndStartNext = [&]()
+	{
+		if (!tokenValueEmpty())
+		{
+			lexedToken_t token;
+			token.value = hasEscapes ? std::string_view(escapedValue) : text.substr(tokenValueStart, tokenValueLength);
+			token.ownedValue = hasEscapes;
+			token.offset = tokenStartOffset;
+			token.type = ClassifyWord(token.value, inStringLiteral);
+			token.numericValue = 0;
+
+			sink.PushToken(token);
+		}
+
+		startToken();
+		resetTokenValue();
+	};
+
+	while (offset < dataLength)
+	{
+		char curSymbol = peekSymbol(0);
+		char nextSymbol = peekSymbol(1);
+
+		if (curSymbol == CR)
+		{
+			sink.PushLineStart(offset + 1);
+			inComment = false;
+		}
+
+		if (curSymbol == '/' && nextSymbol == '/' && !(inComment || inStringLiteral))
+		{
+			pushCurrentTokenAndStartNext();
+			inComment = true;
+		}
+
+		if (inComment)
+			appendSymbols(ScanUntil(source + offset, dataLength - offset, lineFeed, lineFeed));
+		else if (IsWhitespaceSymbol(curSymbol) && !inStringLiteral)
+		{
+			pushCurrentTokenAndStartNext();
+
+			if (curSymbol != CR)
+				offset += ScanWhitespace(source + offset, dataLength - offset) - 1;
+		}
+		else if (IsTokenDivider(curSymbol) && !inStringLiteral)
+		{
+			pushCurrentTokenAndStartNext();
+
+			appendCurrentSymbol();
+
+			pushCurrentTokenAndStartNext();
+		}
+		else if (curSymbol == '\"')
+		{
+			if (inStringLiteral)
+			{
+				if (nextSymbol == '\"')
+				{
+					appendCurrentSymbol();
+
+					if (!hasEscapes)
+					{
+						escapedValue.assign(source + tokenValueStart, tokenValueLength);
+						hasEscapes = true;
+					}
+
+					offset++;
+				}
+				else
+				{
+					pushCurrentTokenAndStartNext();
+					inStringLiteral = false;
+				}
+			}
+			else
+			{
+				inStringLiteral = true;
+				startToken();
+				resetTokenValue();
+			}
+		}
+		else if (inStringLiteral)
+		{
+			if (tokenValueEmpty())
+				startToken();
+
+			appendSymbols(std::max<size_t>(1, ScanUntil(source + offset, dataLength - offset, quote, lineFeed)));
+		}
+		else
+		{
+			if (tokenValueEmpty())
+				startToken();
+
+			size_t length = 1;
+
+			while (offset + length < dataLength && IsIdentifierSymbol(source[offset + length]))
+				length++;
+
+			appendSymbols(length);
+		}
+
+		offset++;
+	}
+
+	pushCurrentTokenAndStartNext();
+}
+
+typedef struct
+{
+	TokenTypes type;
+	std::string value;
+	size_t offset;
+	double numericValue;
+}checkedToken_t;
+
+class TokenCollector : public ITokenSink
+{
+public:
+	std::vector<checkedToken_t> tokens;
+
+	bool PushToken(const lexedToken_t& token) override
+	{
+		tokens.push_back({token.type, std::string(token.value), token.offset, token.numericValue});
+		return true;
+	}
+
+	void PushLineStart(size_t) override
+	{
+	}
+};
+
+typedef struct
+{
+	size_t tokens;
+	size_t decimals;
+	size_t dates;
+	size_t wordsBeforeQuotes;
+	size_t escapedLiterals;
+	size_t emptyLiterals;
+	size_t operatorSigns;
+	size_t mismatches;
+}lexerCheckResult_t;
+
+// Independent of the C locale, which main sets to the user's one
+static double ParseNumber(const std::string& value)
+{
+	std::istringstream stream(value);
+	stream.imbue(std::locale::classic());
+
+	double result = 0;
+	stream >> result;
+
+	return result;
+}
+
+static bool SameToken(const checkedToken_t& expected, const checkedToken_t& actual)
+{
+	if (expected.type != actual.type || expected.offset != actual.offset || expected.value != actual.value)
+		return false;
+
+	if (actual.type == TokenTypes::NumericConst)
+	{
+		double number = ParseNumber(actual.value);
+
+		if (std::fabs(actual.numericValue - number) > 1e-12 * std::max(1.0, std::fabs(number)))
+			return false;
+	}
+
+	return true;
+}
+
+static void ReportMismatch(const char* fileName, const checkedToken_t* expected, const checkedToken_t* actual)
+{
+	auto print = [](const char* name, const checkedToken_t* token)
+	{
+		if (token)
+			printf("  %s: type %d at %zu \"%s\"\n", name, (int)token->type, token->offset, token->value.c_str());
+		else
+			printf("  %s: end of module\n", name);
+	};
+
+	printf("%s: tokens differ\n", fileName);
+	print("baseline", expected);
+	print("lexer", actual);
+}
+
+// Walks both token sequences, accepting only the differences the word automaton is meant to make
+static void CompareTokens(const char* fileName, std::string_view text, std::vector<checkedToken_t> expected, const std::vector<checkedToken_t>& actual, lexerCheckResult_t& result)
+{
+	size_t i = 0;
+	size_t j = 0;
+
+	while (i < expected.size() || j < actual.size())
+	{
+		const checkedToken_t* expectedToken = i < expected.size() ? &expected[i] : nullptr;
+		const checkedToken_t* actualToken = j < actual.size() ? &actual[j] : nullptr;
+
+		if (expectedToken && actualToken && SameToken(*expectedToken, *actualToken))
+		{
+			result.tokens++;
+			i++;
+			j++;
+			continue;
+		}
+
+		if (actualToken)
+		{
+			size_t end = actualToken->offset + actualToken->value.length();
+			size_t wordEnd = actualToken->offset;
+
+			while (wordEnd < text.length() && IsIdentifierSymbol(text[wordEnd]))
+				wordEnd++;
+
+			// A word right before an opening quote is no longer dropped, nor are the
+			// tokens the lexer splits such a word into now
+			if (actualToken->type != TokenTypes::StringConst && ((end < text.length() && text[end] == '\"') ||
+				(wordEnd > actualToken->offset && wordEnd < text.length() && text[wordEnd] == '\"')) &&
+				(!expectedToken || expectedToken->offset > actualToken->offset))
+			{
+				result.wordsBeforeQuotes++;
+				j++;
+				continue;
+			}
+
+			// "" used to be dropped
+			if (actualToken->type == TokenTypes::StringConst && actualToken->value.empty() &&
+				(!expectedToken || expectedToken->offset > actualToken->offset))
+			{
+				result.emptyLiterals++;
+				j++;
+				continue;
+			}
+
+			// A string literal starting with "" used to start at the opening quote
+			if (expectedToken && actualToken->type == TokenTypes::StringConst && expectedToken->type == TokenTypes::StringConst &&
+				expectedToken->offset + 1 == actualToken->offset && expectedToken->value == actualToken->value && actualToken->value[0] == '\"')
+			{
+				result.escapedLiterals++;
+				i++;
+				j++;
+				continue;
+			}
+
+			// % used to be an identifier
+			if (expectedToken && actualToken->type == TokenTypes::ModuloSign && expectedToken->type == TokenTypes::Identifier &&
+				expectedToken->offset == actualToken->offset && expectedToken->value == actualToken->value)
+			{
+				result.operatorSigns++;
+				i++;
+				j++;
+				continue;
+			}
+
+			// * used to be a part of the word around it, which is split at it now
+			size_t star = expectedToken && expectedToken->type != TokenTypes::StringConst && expectedToken->type != TokenTypes::Comment ?
+				expectedToken->value.find('*') : std::string::npos;
+
+			if (star != std::string::npos && actualToken->type != TokenTypes::StringConst && expectedToken->offset == actualToken->offset)
+			{
+				checkedToken_t word = *expectedToken;
+				std::vector<checkedToken_t> parts;
+
+				if (star)
+					parts.push_back({ ClassifyWord(word.value.substr(0, star), false), word.value.substr(0, star), word.offset, 0 });
+
+				parts.push_back({ TokenTypes::MultiplySign, "*", word.offset + star, 0 });
+
+				if (star + 1 < word.value.length())
+					parts.push_back({ ClassifyWord(word.value.substr(star + 1), false), word.value.substr(star + 1), word.offset + star + 1, 0 });
+
+				expected.erase(expected.begin() + i);
+				expected.insert(expected.begin() + i, parts.begin(), parts.end());
+				result.operatorSigns++;
+				continue;
+			}
+
+			// Dates used to be identifiers
+			if (expectedToken && actualToken->type == TokenTypes::DateConst && expectedToken->type == TokenTypes::Identifier &&
+				expectedToken->offset == actualToken->offset && expectedToken->value == actualToken->value)
+			{
+				result.dates++;
+				i++;
+				j++;
+				continue;
+			}
+
+			// Decimals used to be split into integer part, dot and a word starting with
+			// the fraction, which got dropped if an opening quote followed it
+			if (expectedToken && actualToken->type == TokenTypes::NumericConst && i + 1 < expected.size() &&
+				expectedToken->type == TokenTypes::NumericConst && expectedToken->offset == actualToken->offset &&
+				expected[i + 1].type == TokenTypes::DotSign)
+			{
+				size_t fractionOffset = expected[i + 1].offset + 1;
+				size_t digits = 0;
+
+				while (fractionOffset + digits < text.length() && text[fractionOffset + digits] >= '0' && text[fractionOffset + digits] <= '9')
+					digits++;
+
+				checkedToken_t merged = *actualToken;
+				merged.value = expectedToken->value + "." + std::string(text.substr(fractionOffset, digits));
+
+				if (digits && SameToken(merged, *actualToken))
+				{
+					i += 2;
+
+					if (i < expected.size() && expected[i].type != TokenTypes::StringConst && expected[i].offset == fractionOffset)
+					{
+						checkedToken_t& fraction = expected[i];
+
+						// The rest of that word is a token of its own now
+						if (digits < fraction.value.length())
+						{
+							fraction.offset += digits;
+							fraction.value.erase(0, digits);
+							fraction.type = ClassifyWord(fraction.value, false);
+						}
+						else
+							i++;
+					}
+
+					result.decimals++;
+					j++;
+					continue;
+				}
+			}
+		}
+
+		if (result.mismatches++ < 10)
+			ReportMismatch(fileName, expectedToken, actualToken);
+
+		if (expectedToken)
+			i++;
+
+		if (actualToken)
+			j++;
+	}
+}
+
+int RunLexerCheck(int argc, char** argv)
+{
+	lexerCheckResult_t result = {};
+
+	for (int i = 0; i < argc; i++)
+	{
+		SourceBuffer source;
+
+		if (!source.LoadFile(argv[i]))
+		{
+			fprintf(stderr, "Can't open %s\n", argv[i]);
+			return 1;
+		}
+
+		TokenCollector expected;
+		BaselineLex(source.Text(), expected);
+
+		TokenCollector actual;
+		Lexer lexer;
+		lexer.Lex(source.Text(), 0, true, actual);
+
+		CompareTokens(argv[i], source.Text(), std::move(expected.tokens), actual.tokens, result);
+	}
+
+	printf("%d modules, %zu tokens equal, %zu decimals, %zu dates, %zu words before quotes, %zu literals starting with \"\", %zu empty literals, %zu operator signs, %zu unexpected differences\n",
+		argc, result.tokens, result.decimals, result.dates, result.wordsBeforeQuotes, result.escapedLiterals, result.emptyLiterals, result.operatorSigns, result.mismatches);
+
+	return result.mismatches ? 1 : 0;
+}
+
+}
@@ -0,0 +1,121 @@
+#include "BSLMemoryStats.h"
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace BSL
+{
+
+thread_local allocationCounters_t g_ThreadAllocations;
+
+allocationCounters_t ThreadAllocations()
+{
+	return g_ThreadAllocations;
+}
+
+size_t PeakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	// Kilobytes everywhere but on macOS
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+}
+
+// Every form of new and delete but the aligned ones. The standard library's
+// nothrow forms call these, but runtimes that replace them, such as
+// sanitizers, would then pair their nothrow new with this delete.
+void* operator new(size_t size)
+{
+	BSL::g_ThreadAllocations.count++;
+	BSL::g_ThreadAllocations.bytes += size;
+
+	while (true)
+	{
+		if (void* block = malloc(size ? size : 1))
+			return block;
+
+		std::new_handler handler = std::get_new_handler();
+
+		if (!handler)
+			throw std::bad_alloc();
+
+		handler();
+	}
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* block) noexcept
+{
+	free(block);
+}
+
+void operator delete[](void* block) noexcept
+{
+	free(block);
+}
+
+void operator delete(void* block, size_t) noexcept
+{
+	free(block);
+}
+
+void operator delete[](void* block, size_t) noexcept
+{
+	free(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) noexcept
+{
+	free(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) noexcept
+{
+	free(block);
+}
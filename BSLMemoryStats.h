@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace BSL
+{
+
+// Allocations made through operator new, which this module replaces to
+// count them; per thread, so that counting costs no synchronization
+typedef struct
+{
+	uint64_t count;
+	uint64_t bytes;
+}allocationCounters_t;
+
+// Allocations of the calling thread since it started
+allocationCounters_t ThreadAllocations();
+
+// Largest resident set of the process so far in bytes, 0 where unknown
+size_t PeakResidentBytes();
+
+}
@@ -0,0 +1,461 @@
+#include "BSLModuleCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace BSL
+{
+
+constexpr uint32_t MODULE_CACHE_MAGIC = 0x434C5342; // "BSLC"
+constexpr uint32_t MODULE_CACHE_BYTE_ORDER = 0x01020304;
+
+// Element size of every section, in CacheSections order
+static const size_t g_CacheElementSizes[CACHE_SECTION_COUNT] =
+{
+	sizeof(TokenTypes),
+	sizeof(uint32_t),
+	sizeof(uint32_t),
+	sizeof(uint8_t),
+	sizeof(uint32_t),
+	sizeof(cachedOwnedValue_t),
+	sizeof(cachedNumericValue_t),
+	sizeof(astNode_t),
+	sizeof(cachedSubprogram_t),
+	sizeof(cacheString_t),
+	sizeof(cachedArgument_t),
+	sizeof(double),
+	1,
+};
+
+static_assert(sizeof(moduleCacheHeader_t) % 8 == 0, "sections start 8-aligned after the header");
+static_assert(sizeof(astNode_t) == 20, "node rows are written as they are in memory");
+
+static constexpr uint64_t g_HashPrimes[5] =
+{
+	0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x85EBCA77C2B2AE63ull, 0x27D4EB2F165667C5ull,
+};
+
+static constexpr uint64_t RotateLeft(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// Little endian, as XXH64 reads its input; compilers make one load of it
+static constexpr uint64_t ReadLittleEndian(const char* data, size_t bytes)
+{
+	uint64_t value = 0;
+
+	for (size_t i = 0; i < bytes; i++)
+		value |= (uint64_t)(unsigned char)data[i] << (8 * i);
+
+	return value;
+}
+
+static constexpr uint64_t HashRound(uint64_t lane, uint64_t word)
+{
+	lane += word * g_HashPrimes[1];
+	return RotateLeft(lane, 31) * g_HashPrimes[0];
+}
+
+static constexpr uint64_t MergeLane(uint64_t hash, uint64_t lane)
+{
+	hash ^= HashRound(0, lane);
+	return hash * g_HashPrimes[0] + g_HashPrimes[3];
+}
+
+// XXH64 with seed 0: four independent lanes over 32-byte stripes keep
+// several multiplications in flight, so hashing runs at memory speed
+static constexpr uint64_t Xxh64(std::string_view text)
+{
+	const char* data = text.data();
+	const char* end = data + text.length();
+	uint64_t hash = 0;
+
+	if (text.length() >= 32)
+	{
+		uint64_t lanes[4] = { g_HashPrimes[0] + g_HashPrimes[1], g_HashPrimes[1], 0, 0 - g_HashPrimes[0] };
+
+		for (; end - data >= 32; data += 32)
+		{
+			lanes[0] = HashRound(lanes[0], ReadLittleEndian(data, 8));
+			lanes[1] = HashRound(lanes[1], ReadLittleEndian(data + 8, 8));
+			lanes[2] = HashRound(lanes[2], ReadLittleEndian(data + 16, 8));
+			lanes[3] = HashRound(lanes[3], ReadLittleEndian(data + 24, 8));
+		}
+
+		hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+
+		for (uint64_t lane : lanes)
+			hash = MergeLane(hash, lane);
+	}
+	else
+		hash = g_HashPrimes[4];
+
+	hash += text.length();
+
+	for (; end - data >= 8; data += 8)
+	{
+		hash ^= HashRound(0, ReadLittleEndian(data, 8));
+		hash = RotateLeft(hash, 27) * g_HashPrimes[0] + g_HashPrimes[3];
+	}
+
+	if (end - data >= 4)
+	{
+		hash ^= ReadLittleEndian(data, 4) * g_HashPrimes[0];
+		hash = RotateLeft(hash, 23) * g_HashPrimes[1] + g_HashPrimes[2];
+		data += 4;
+	}
+
+	for (; data < end; data++)
+	{
+		hash ^= (unsigned char)*data * g_HashPrimes[4];
+		hash = RotateLeft(hash, 11) * g_HashPrimes[0];
+	}
+
+	hash ^= hash >> 33;
+	hash *= g_HashPrimes[1];
+	hash ^= hash >> 29;
+	hash *= g_HashPrimes[2];
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+// Reference XXH64 values, covering every tail step and the stripe loop
+static_assert(Xxh64("") == 0xEF46DB3751D8E999ull, "HashSource is not XXH64");
+static_assert(Xxh64("a") == 0xD24EC4F1A98C6E5Bull, "HashSource is not XXH64");
+static_assert(Xxh64("abcd") == 0xDE0327B0D25D92CCull, "HashSource is not XXH64");
+static_assert(Xxh64("abcdefghijkl") == 0x4B09B7D3A233D4B3ull, "HashSource is not XXH64");
+static_assert(Xxh64("Procedure Test() Export EndProcedure") == 0xCD13FFCC7B88E37Eull, "HashSource is not XXH64");
+static_assert(Xxh64("0123456789abcdefghijklmnopqrstuvwxyz0123456789") == 0x4AE5684CD402FBB4ull, "HashSource is not XXH64");
+
+uint64_t HashSource(std::string_view text)
+{
+	return Xxh64(text);
+}
+
+std::string_view CachedModule::TokenValue(size_t index) const
+{
+	uint32_t offset = (uint32_t)TokenOffset(index);
+
+	if (!HasTokenFlag(index, TOKEN_FLAG_OWNED_VALUE))
+		return m_Source.substr(offset, TokenLength(index));
+
+	const cachedOwnedValue_t* values = Section<cachedOwnedValue_t>(CacheSections::OwnedValues);
+	const cachedOwnedValue_t* found = std::lower_bound(values, values + Count(CacheSections::OwnedValues), offset,
+		[](const cachedOwnedValue_t& value, uint32_t offset) { return value.sourceOffset < offset; });
+
+	return String(found->value);
+}
+
+double CachedModule::TokenNumericValue(size_t index) const
+{
+	if (TokenType(index) != TokenTypes::NumericConst)
+		return 0;
+
+	uint32_t offset = (uint32_t)TokenOffset(index);
+
+	const cachedNumericValue_t* values = Section<cachedNumericValue_t>(CacheSections::NumericValues);
+	const cachedNumericValue_t* found = std::lower_bound(values, values + Count(CacheSections::NumericValues), offset,
+		[](const cachedNumericValue_t& value, uint32_t offset) { return value.sourceOffset < offset; });
+
+	return found->value;
+}
+
+// Same as TokenTable::TextPosition over the entry's line-start table
+textHumanPosition_t CachedModule::TokenTextPosition(size_t index) const
+{
+	const uint32_t* lineStarts = Section<uint32_t>(CacheSections::LineStarts);
+	uint32_t offset = (uint32_t)TokenOffset(index);
+
+	const uint32_t* line = std::upper_bound(lineStarts, lineStarts + Count(CacheSections::LineStarts), offset) - 1;
+
+	textHumanPosition_t result;
+	result.row = line - lineStarts + 1;
+	result.column = 1;
+
+	for (uint32_t i = *line; i < offset; i++)
+		if ((m_Source[i] & 0xC0) != 0x80)
+			result.column++;
+
+	return result;
+}
+
+argumentDescriptor_t CachedModule::Argument(const cachedSubprogram_t& subprogram, size_t index) const
+{
+	const cachedArgument_t& argument = Section<cachedArgument_t>(CacheSections::Arguments)[subprogram.firstArgument + index];
+
+	argumentDescriptor_t result;
+	result.name = String(argument.name);
+	result.byValue = argument.byValue != 0;
+	result.hasDefaultValue = argument.hasDefaultValue != 0;
+	result.defaultValue = String(argument.defaultValue);
+
+	return result;
+}
+
+// Lays an entry out in memory: the header, then the sections in order, each
+// 8-aligned; strings are pooled and go last
+class CacheEntryWriter
+{
+	std::vector<char> m_Image;
+	std::string m_Strings;
+
+	moduleCacheHeader_t& Header()
+	{
+		return *(moduleCacheHeader_t*)m_Image.data();
+	}
+public:
+	CacheEntryWriter()
+	{
+		m_Image.resize(sizeof(moduleCacheHeader_t));
+	}
+
+	cacheString_t AddString(std::string_view value)
+	{
+		cacheString_t result = { (uint32_t)m_Strings.length(), (uint32_t)value.length() };
+		m_Strings.append(value);
+
+		return result;
+	}
+
+	template<class T>
+	void AddSection(CacheSections section, const T* data, size_t count)
+	{
+		m_Image.resize((m_Image.size() + 7) & ~(size_t)7);
+
+		Header().sections[(size_t)section].offset = m_Image.size();
+		Header().sections[(size_t)section].count = count;
+
+		if (count)
+			m_Image.insert(m_Image.end(), (const char*)data, (const char*)(data + count));
+	}
+
+	template<class T>
+	void AddSection(CacheSections section, const std::vector<T>& rows)
+	{
+		AddSection(section, rows.data(), rows.size());
+	}
+
+	const std::vector<char>& Finish(uint64_t sourceHash, uint64_t sourceLength)
+	{
+		AddSection(CacheSections::Strings, m_Strings.data(), m_Strings.length());
+
+		moduleCacheHeader_t& header = Header();
+		header.magic = MODULE_CACHE_MAGIC;
+		header.version = MODULE_CACHE_VERSION;
+		header.byteOrder = MODULE_CACHE_BYTE_ORDER;
+		header.sectionCount = (uint32_t)CACHE_SECTION_COUNT;
+		header.sourceHash = sourceHash;
+		header.sourceLength = sourceLength;
+		header.fileSize = m_Image.size();
+
+		return m_Image;
+	}
+};
+
+ModuleCache::ModuleCache(std::string directory) : m_Directory(std::move(directory))
+{
+}
+
+std::string ModuleCache::EntryPath(uint64_t sourceHash) const
+{
+	char name[48];
+	snprintf(name, sizeof(name), "%016llx.v%u.bslc", (unsigned long long)sourceHash, MODULE_CACHE_VERSION);
+
+	return (fs::path(m_Directory) / name).string();
+}
+
+// Header checks only: all that is read later is bounded by the section table,
+// while the contents were written by this code and are trusted
+static bool IsValidEntry(const char* data, size_t length, uint64_t sourceHash, size_t sourceLength)
+{
+	if (length < sizeof(moduleCacheHeader_t))
+		return false;
+
+	const moduleCacheHeader_t* header = (const moduleCacheHeader_t*)data;
+
+	if (header->magic != MODULE_CACHE_MAGIC || header->version != MODULE_CACHE_VERSION || header->byteOrder != MODULE_CACHE_BYTE_ORDER ||
+		header->sectionCount != CACHE_SECTION_COUNT || header->sourceHash != sourceHash || header->sourceLength != sourceLength ||
+		header->fileSize != length)
+		return false;
+
+	for (size_t i = 0; i < CACHE_SECTION_COUNT; i++)
+	{
+		const cacheSection_t& section = header->sections[i];
+
+		if (section.offset % 8 || section.offset > length || section.count > (length - section.offset) / g_CacheElementSizes[i])
+			return false;
+	}
+
+	size_t tokens = header->sections[(size_t)CacheSections::TokenTypes].count;
+
+	return header->sections[(size_t)CacheSections::TokenOffsets].count == tokens &&
+		header->sections[(size_t)CacheSections::TokenLengths].count == tokens &&
+		header->sections[(size_t)CacheSections::TokenFlags].count == tokens &&
+		header->sections[(size_t)CacheSections::LineStarts].count > 0;
+}
+
+bool ModuleCache::Load(std::string_view text, uint64_t sourceHash, CachedModule& module) const
+{
+	module.m_Data = nullptr;
+	module.m_Header = nullptr;
+
+	if (!module.m_File.Map(EntryPath(sourceHash).c_str()))
+		return false;
+
+	if (!IsValidEntry(module.m_File.Data(), module.m_File.Length(), sourceHash, text.length()))
+	{
+		module.m_File.Unmap();
+		return false;
+	}
+
+	module.m_Data = module.m_File.Data();
+	module.m_Header = (const moduleCacheHeader_t*)module.m_File.Data();
+	module.m_Source = text;
+
+	return true;
+}
+
+bool ModuleCache::Store(uint64_t sourceHash, const TokenTable& tokens, const SyntaxTree& tree) const
+{
+	const tokenStreamSource_t& source = tokens.Source();
+	CacheEntryWriter writer;
+
+	std::vector<TokenTypes> types(tokens.Size());
+	std::vector<uint32_t> offsets(tokens.Size());
+	std::vector<uint32_t> lengths(tokens.Size());
+	std::vector<uint8_t> flags(tokens.Size());
+
+	for (size_t i = 0; i < tokens.Size(); i++)
+	{
+		types[i] = tokens.Type(i);
+		offsets[i] = (uint32_t)tokens.SourceOffset(i);
+		lengths[i] = (uint32_t)tokens.SourceLength(i);
+		flags[i] = tokens.Flags(i);
+	}
+
+	writer.AddSection(CacheSections::TokenTypes, types);
+	writer.AddSection(CacheSections::TokenOffsets, offsets);
+	writer.AddSection(CacheSections::TokenLengths, lengths);
+	writer.AddSection(CacheSections::TokenFlags, flags);
+	writer.AddSection(CacheSections::LineStarts, source.lineStarts);
+
+	// Both maps iterate in offset order, which is what the lookups need
+	std::vector<cachedOwnedValue_t> ownedValues;
+
+	for (const auto& value : source.ownedValues)
+		ownedValues.push_back({ value.first, writer.AddString(value.second) });
+
+	std::vector<cachedNumericValue_t> numericValues;
+
+	for (const auto& value : source.numericValues)
+		numericValues.push_back({ value.first, 0, value.second });
+
+	writer.AddSection(CacheSections::OwnedValues, ownedValues);
+	writer.AddSection(CacheSections::NumericValues, numericValues);
+
+	// Side tables are rebuilt in node order, payloads pointing at the new rows
+	std::vector<astNode_t> nodes(tree.Size());
+	std::vector<cachedSubprogram_t> subprograms;
+	std::vector<cacheString_t> annotations;
+	std::vector<cachedArgument_t> arguments;
+	std::vector<double> numericConstants;
+
+	for (uint32_t i = 0; i < tree.Size(); i++)
+	{
+		const astNode_t& node = tree.Node(i);
+		astNode_t& row = nodes[i];
+
+		// Zeroed first so that padding is written as zeros too
+		memset(&row, 0, sizeof(row));
+		row.type = node.type;
+		row.token = node.token;
+		row.firstChild = node.firstChild;
+		row.nextSibling = node.nextSibling;
+		row.payload = node.payload;
+
+		if (node.type == ASTNodeTypes::Function || node.type == ASTNodeTypes::Procedure)
+		{
+			const subprogramPayload_t& subprogram = tree.Subprogram(i);
+
+			cachedSubprogram_t cached = {};
+			cached.name = writer.AddString(subprogram.name);
+			cached.firstAnnotation = (uint32_t)annotations.size();
+			cached.annotationCount = (uint32_t)subprogram.annotations.Size();
+			cached.firstArgument = (uint32_t)arguments.size();
+			cached.argumentCount = (uint32_t)subprogram.arguments.Size();
+			cached.exported = subprogram.exported;
+
+			for (std::string_view annotation : subprogram.annotations)
+				annotations.push_back(writer.AddString(annotation));
+
+			for (const argumentDescriptor_t& argument : subprogram.arguments)
+			{
+				cachedArgument_t cachedArgument = {};
+				cachedArgument.name = writer.AddString(argument.name);
+				cachedArgument.defaultValue = writer.AddString(argument.defaultValue);
+				cachedArgument.byValue = argument.byValue;
+				cachedArgument.hasDefaultValue = argument.hasDefaultValue;
+
+				arguments.push_back(cachedArgument);
+			}
+
+			row.payload = (uint32_t)subprograms.size();
+			subprograms.push_back(cached);
+		}
+		else if (node.type == ASTNodeTypes::NumericConstant)
+		{
+			row.payload = (uint32_t)numericConstants.size();
+			numericConstants.push_back(tree.NumericValue(i));
+		}
+		else if (node.type == ASTNodeTypes::Identifier)
+		{
+			// Atoms are only meaningful within the process that interned them
+			row.payload = IDENTIFIER_NO_ATOM;
+		}
+	}
+
+	writer.AddSection(CacheSections::Nodes, nodes);
+	writer.AddSection(CacheSections::Subprograms, subprograms);
+	writer.AddSection(CacheSections::Annotations, annotations);
+	writer.AddSection(CacheSections::Arguments, arguments);
+	writer.AddSection(CacheSections::NumericConstants, numericConstants);
+
+	const std::vector<char>& image = writer.Finish(sourceHash, source.buffer.Text().length());
+
+	std::error_code error;
+	fs::create_directories(m_Directory, error);
+
+	// Unique per writer, so that threads and processes storing the same
+	// entry at once each rename a complete file over the other
+	std::random_device random;
+	std::string path = EntryPath(sourceHash);
+	std::string temporaryPath = path + "." + std::to_string(((uint64_t)random() << 32) | random()) + ".tmp";
+
+	FILE* file = fopen(temporaryPath.c_str(), "wb");
+
+	if (!file)
+		return false;
+
+	bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+	written = fclose(file) == 0 && written;
+
+	if (written)
+		fs::rename(temporaryPath, path, error);
+
+	if (!written || error)
+	{
+		fs::remove(temporaryPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "BSLAbstractSyntaxTree.h"
+#include "BSLToken.h"
+
+namespace BSL
+{
+
+// Bump whenever the entry layout or what the lexer and parser produce for the
+// same text changes; entries written by another version are never looked at
+constexpr uint32_t MODULE_CACHE_VERSION = 7;
+
+// 64-bit hash of the module text, the content part of a cache key
+uint64_t HashSource(std::string_view text);
+
+// Sections of a cache entry, in file order
+enum class CacheSections : uint32_t
+{
+	TokenTypes,
+	TokenOffsets,
+	TokenLengths,
+	TokenFlags,
+	LineStarts,
+	OwnedValues,
+	NumericValues,
+	Nodes,
+	Subprograms,
+	Annotations,
+	Arguments,
+	NumericConstants,
+	Strings,
+};
+
+constexpr size_t CACHE_SECTION_COUNT = (size_t)CacheSections::Strings + 1;
+
+// Everything in an entry refers to other parts of it by offset from the
+// start of the file, so the mapping is used as is, wherever it lands.
+// Integers are in the byte order of the writer, which the header records.
+typedef struct
+{
+	// Offset of the first element, a multiple of 8
+	uint64_t offset;
+	uint64_t count;
+}cacheSection_t;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t sectionCount;
+
+	uint64_t sourceHash;
+	uint64_t sourceLength;
+	uint64_t fileSize;
+
+	cacheSection_t sections[CACHE_SECTION_COUNT];
+}moduleCacheHeader_t;
+
+// Bytes [offset, offset + length) of the Strings section
+typedef struct
+{
+	uint32_t offset;
+	uint32_t length;
+}cacheString_t;
+
+// Row of OwnedValues, sorted by sourceOffset
+typedef struct
+{
+	uint32_t sourceOffset;
+	cacheString_t value;
+}cachedOwnedValue_t;
+
+// Row of NumericValues, sorted by sourceOffset
+typedef struct
+{
+	uint32_t sourceOffset;
+	uint32_t reserved;
+	double value;
+}cachedNumericValue_t;
+
+// Row of Subprograms; the payload of Function and Procedure nodes in the
+// entry's node table is the row here
+typedef struct
+{
+	cacheString_t name;
+
+	// Rows of Annotations and Arguments
+	uint32_t firstAnnotation;
+	uint32_t annotationCount;
+	uint32_t firstArgument;
+	uint32_t argumentCount;
+
+	uint8_t exported;
+	uint8_t reserved[3];
+}cachedSubprogram_t;
+
+typedef struct
+{
+	cacheString_t name;
+	cacheString_t defaultValue;
+
+	uint8_t byValue;
+	uint8_t hasDefaultValue;
+	uint8_t reserved[2];
+}cachedArgument_t;
+
+// Token table and syntax tree of a module read in place from a mapped cache
+// entry. Accessors mirror TokenTable and SyntaxTree; token values are views
+// into the source text the entry was looked up with, which has to outlive
+// this object, or into the mapping.
+class CachedModule
+{
+	const char* m_Data;
+	const moduleCacheHeader_t* m_Header;
+	std::string_view m_Source;
+
+	MappedFile m_File;
+
+	friend class ModuleCache;
+
+	template<class T>
+	const T* Section(CacheSections section) const
+	{
+		return (const T*)(m_Data + m_Header->sections[(size_t)section].offset);
+	}
+
+	size_t Count(CacheSections section) const
+	{
+		return (size_t)m_Header->sections[(size_t)section].count;
+	}
+
+	std::string_view String(const cacheString_t& value) const
+	{
+		return std::string_view(Section<char>(CacheSections::Strings) + value.offset, value.length);
+	}
+public:
+	CachedModule() : m_Data(nullptr), m_Header(nullptr)
+	{
+	}
+
+	explicit operator bool() const
+	{
+		return m_Header != nullptr;
+	}
+
+	size_t TokenCount() const
+	{
+		return Count(CacheSections::TokenTypes);
+	}
+
+	TokenTypes TokenType(size_t index) const
+	{
+		return Section<TokenTypes>(CacheSections::TokenTypes)[index];
+	}
+
+	size_t TokenOffset(size_t index) const
+	{
+		return Section<uint32_t>(CacheSections::TokenOffsets)[index];
+	}
+
+	size_t TokenLength(size_t index) const
+	{
+		return Section<uint32_t>(CacheSections::TokenLengths)[index];
+	}
+
+	bool HasTokenFlag(size_t index, uint8_t flag) const
+	{
+		return (Section<uint8_t>(CacheSections::TokenFlags)[index] & flag) != 0;
+	}
+
+	std::string_view TokenValue(size_t index) const;
+	textHumanPosition_t TokenTextPosition(size_t index) const;
+	// Value of a NumericConst token, 0 for other tokens
+	double TokenNumericValue(size_t index) const;
+
+	size_t NodeCount() const
+	{
+		return Count(CacheSections::Nodes);
+	}
+
+	// Links and tokens are indices into this entry's tables, as in SyntaxTree
+	const astNode_t& Node(uint32_t index) const
+	{
+		return Section<astNode_t>(CacheSections::Nodes)[index];
+	}
+
+	double NumericValue(uint32_t index) const
+	{
+		return Section<double>(CacheSections::NumericConstants)[Node(index).payload];
+	}
+
+	ASTOperators Operator(uint32_t index) const
+	{
+		return (ASTOperators)Node(index).payload;
+	}
+
+	const cachedSubprogram_t& Subprogram(uint32_t index) const
+	{
+		return Section<cachedSubprogram_t>(CacheSections::Subprograms)[Node(index).payload];
+	}
+
+	std::string_view SubprogramName(const cachedSubprogram_t& subprogram) const
+	{
+		return String(subprogram.name);
+	}
+
+	std::string_view Annotation(const cachedSubprogram_t& subprogram, size_t index) const
+	{
+		return String(Section<cacheString_t>(CacheSections::Annotations)[subprogram.firstAnnotation + index]);
+	}
+
+	// Built on the fly, its strings point into the mapping
+	argumentDescriptor_t Argument(const cachedSubprogram_t& subprogram, size_t index) const;
+};
+
+// Directory of cache entries, one file per module text named after the hash
+// of the text and MODULE_CACHE_VERSION. An entry only depends on the text, so
+// it never goes stale: edited modules get a new key, and entries nothing
+// refers to any more can be deleted at any time. Safe to use from several
+// threads and processes at once.
+class ModuleCache
+{
+	std::string m_Directory;
+
+	std::string EntryPath(uint64_t sourceHash) const;
+public:
+	ModuleCache(std::string directory);
+
+	// Maps the entry for text if there is a valid one. sourceHash is
+	// HashSource(text), for callers that already have it.
+	bool Load(std::string_view text, uint64_t sourceHash, CachedModule& module) const;
+
+	// Writes the entry for the text tokens were lexed from. The file is
+	// written under a temporary name and renamed, so readers never see half
+	// an entry; returns false if it couldn't be written.
+	bool Store(uint64_t sourceHash, const TokenTable& tokens, const SyntaxTree& tree) const;
+};
+
+}
@@ -0,0 +1,567 @@
+﻿#include "BSLModuleGenerator.h"
+#include <cctype>
+#include <iterator>
+#include <random>
+
+namespace BSL
+{
+
+// Spellings of a keyword the generator writes
+typedef struct
+{
+	const char* russian;
+	const char* english;
+}generatedKeyword_t;
+
+const generatedKeyword_t g_GeneratedProcedure = { u8"Процедура", "Procedure" };
+const generatedKeyword_t g_GeneratedFunction = { u8"Функция", "Function" };
+const generatedKeyword_t g_GeneratedEndProcedure = { u8"КонецПроцедуры", "EndProcedure" };
+const generatedKeyword_t g_GeneratedEndFunction = { u8"КонецФункции", "EndFunction" };
+const generatedKeyword_t g_GeneratedExport = { u8"Экспорт", "Export" };
+const generatedKeyword_t g_GeneratedVal = { u8"Знач", "Val" };
+const generatedKeyword_t g_GeneratedVar = { u8"Перем", "Var" };
+const generatedKeyword_t g_GeneratedIf = { u8"Если", "If" };
+const generatedKeyword_t g_GeneratedThen = { u8"Тогда", "Then" };
+const generatedKeyword_t g_GeneratedElseIf = { u8"ИначеЕсли", "ElseIf" };
+const generatedKeyword_t g_GeneratedElse = { u8"Иначе", "Else" };
+const generatedKeyword_t g_GeneratedEndIf = { u8"КонецЕсли", "EndIf" };
+const generatedKeyword_t g_GeneratedWhile = { u8"Пока", "While" };
+const generatedKeyword_t g_GeneratedFor = { u8"Для", "For" };
+const generatedKeyword_t g_GeneratedEach = { u8"Каждого", "Each" };
+const generatedKeyword_t g_GeneratedIn = { u8"Из", "In" };
+const generatedKeyword_t g_GeneratedTo = { u8"По", "To" };
+const generatedKeyword_t g_GeneratedLoop = { u8"Цикл", "Loop" };
+const generatedKeyword_t g_GeneratedEndLoop = { u8"КонецЦикла", "EndLoop" };
+const generatedKeyword_t g_GeneratedTry = { u8"Попытка", "Try" };
+const generatedKeyword_t g_GeneratedExcept = { u8"Исключение", "Except" };
+const generatedKeyword_t g_GeneratedEndTry = { u8"КонецПопытки", "EndTry" };
+const generatedKeyword_t g_GeneratedRaise = { u8"ВызватьИсключение", "Raise" };
+const generatedKeyword_t g_GeneratedReturn = { u8"Возврат", "Return" };
+const generatedKeyword_t g_GeneratedNew = { u8"Новый", "New" };
+const generatedKeyword_t g_GeneratedAnd = { u8"И", "And" };
+const generatedKeyword_t g_GeneratedOr = { u8"Или", "Or" };
+const generatedKeyword_t g_GeneratedNot = { u8"Не", "Not" };
+const generatedKeyword_t g_GeneratedTrue = { u8"Истина", "True" };
+const generatedKeyword_t g_GeneratedFalse = { u8"Ложь", "False" };
+const generatedKeyword_t g_GeneratedUndefined = { u8"Неопределено", "Undefined" };
+const generatedKeyword_t g_GeneratedRegion = { u8"#Область", "#Region" };
+const generatedKeyword_t g_GeneratedEndRegion = { u8"#КонецОбласти", "#EndRegion" };
+
+const char* const g_GeneratedNames[] =
+{
+	u8"Результат", u8"Параметры", u8"Объект", u8"ТаблицаЗначений", u8"Строка", u8"Массив", u8"Контрагент",
+	u8"Номенклатура", u8"Выборка", u8"Запрос", u8"Отказ", u8"СтруктураПараметров", u8"ТекущийЭлемент",
+	"Result", "Items", "Counter", "Value", "Document", "Settings", "Row", "Buffer",
+};
+
+const char* const g_GeneratedMembers[] =
+{
+	u8"Ссылка", u8"Количество", u8"Найти", u8"Добавить", u8"Вставить", u8"Свойство", u8"Получить",
+	u8"Выполнить", u8"Выбрать", u8"Следующий", u8"Сумма", u8"Наименование", u8"Код",
+	"Ref", "Count", "Find", "Add", "Insert", "Get", "Amount", "Description",
+};
+
+const char* const g_GeneratedTypes[] =
+{
+	u8"Структура", u8"Массив", u8"Соответствие", u8"ТаблицаЗначений", u8"Запрос", "Structure", "Array", "Map",
+};
+
+const char* const g_GeneratedAnnotations[] =
+{
+	u8"&НаСервере", u8"&НаКлиенте", u8"&НаСервереБезКонтекста", u8"&НаКлиентеНаСервереБезКонтекста", "&AtServer", "&AtClient",
+};
+
+const char* const g_GeneratedComments[] =
+{
+	u8"// Заполняет реквизиты документа по данным основания",
+	u8"// Проверка заполнения выполняется до записи",
+	u8"// TODO: вынести в общий модуль",
+	"// Returns the cached value or reads it again",
+	"//",
+	u8"// Параметры:\n//  Объект - ДокументОбъект - заполняемый документ",
+};
+
+const char* const g_GeneratedStrings[] =
+{
+	"", u8"Готово", u8"Не заполнен реквизит \"\"Контрагент\"\"", u8"ВЫБРАТЬ Ссылка ИЗ Справочник.Номенклатура", "Done: %1",
+	u8"Строка с переносом\n\t\t|и продолжением", "ru = 'Текст'; en = 'Text'",
+};
+
+// Deepest nesting of statements and of expressions
+constexpr int GENERATED_STATEMENT_DEPTH = 3;
+constexpr int GENERATED_EXPRESSION_DEPTH = 3;
+
+class ModuleGenerator
+{
+	std::mt19937 m_Random;
+	std::string m_Text;
+
+	// Keywords of the current subprogram are in English
+	bool m_English;
+	// Keywords of the current subprogram are in upper case, English ones only
+	bool m_Uppercase;
+
+	int m_Indent;
+	size_t m_Locals;
+
+	size_t Pick(size_t count)
+	{
+		return m_Random() % count;
+	}
+
+	bool Chance(unsigned percent)
+	{
+		return m_Random() % 100 < percent;
+	}
+
+	template<size_t N>
+	const char* PickFrom(const char* const (&values)[N])
+	{
+		return values[Pick(N)];
+	}
+
+	void Keyword(const generatedKeyword_t& keyword)
+	{
+		if (!m_English)
+		{
+			m_Text += keyword.russian;
+			return;
+		}
+
+		for (const char* c = keyword.english; *c; c++)
+			m_Text += m_Uppercase ? (char)toupper((unsigned char)*c) : *c;
+	}
+
+	void NewLine()
+	{
+		m_Text += '\n';
+		m_Text.append(m_Indent, '\t');
+	}
+
+	void Name()
+	{
+		if (m_Locals && Chance(40))
+			m_Text += u8"Локальная" + std::to_string(Pick(m_Locals));
+		else
+			m_Text += PickFrom(g_GeneratedNames);
+	}
+
+	void StringLiteral()
+	{
+		m_Text += '"';
+		m_Text += PickFrom(g_GeneratedStrings);
+		m_Text += '"';
+	}
+
+	void Arguments(int depth)
+	{
+		m_Text += '(';
+
+		for (size_t i = 0, count = Pick(depth ? 3 : 4); i < count; i++)
+		{
+			if (i)
+				m_Text += ", ";
+
+			// An omitted argument
+			if (i && Chance(5))
+				continue;
+
+			Expression(depth + 1);
+		}
+
+		m_Text += ')';
+	}
+
+	void Operand(int depth)
+	{
+		// Mostly plain operands, less so the shallower
+		bool nested = depth < GENERATED_EXPRESSION_DEPTH && Chance(60 - depth * 20);
+
+		switch (Pick(nested ? 12 : 6))
+		{
+		case 0:
+			m_Text += std::to_string(Pick(1000));
+			break;
+		case 1:
+			m_Text += std::to_string(Pick(100)) + "." + std::to_string(Pick(100));
+			break;
+		case 2:
+			StringLiteral();
+			break;
+		case 3:
+			m_Text += "'2024" + std::to_string(10 + Pick(3)) + std::to_string(10 + Pick(19)) + "'";
+			break;
+		case 4:
+			Keyword(Chance(50) ? g_GeneratedTrue : Chance(50) ? g_GeneratedFalse : g_GeneratedUndefined);
+			break;
+		case 5:
+			Name();
+			break;
+		case 6:
+			Name();
+			m_Text += '.';
+			m_Text += PickFrom(g_GeneratedMembers);
+			break;
+		case 7:
+			Name();
+			m_Text += '.';
+			m_Text += PickFrom(g_GeneratedMembers);
+			Arguments(depth);
+			break;
+		case 8:
+			Name();
+			m_Text += '[';
+			Expression(depth + 1);
+			m_Text += ']';
+			break;
+		case 9:
+			Keyword(g_GeneratedNew);
+			m_Text += ' ';
+			m_Text += PickFrom(g_GeneratedTypes);
+
+			if (Chance(70))
+				Arguments(depth);
+			break;
+		case 10:
+			m_Text += '(';
+			Expression(depth + 1);
+			m_Text += ')';
+			break;
+		default:
+			m_Text += '-';
+			Operand(depth + 1);
+			break;
+		}
+	}
+
+	void Expression(int depth)
+	{
+		const char* const operators[] = { " + ", " - ", " * ", " / ", " % " };
+
+		Operand(depth);
+
+		for (size_t i = 0, count = Chance(40) ? 1 + Pick(2) : 0; i < count; i++)
+		{
+			m_Text += operators[Pick(std::size(operators))];
+			Operand(depth);
+		}
+	}
+
+	void Condition(int depth)
+	{
+		const char* const comparisons[] = { " = ", " <> ", " < ", " > ", " <= ", " >= " };
+
+		if (Chance(15))
+		{
+			Keyword(g_GeneratedNot);
+			m_Text += ' ';
+		}
+
+		Expression(depth);
+		m_Text += comparisons[Pick(std::size(comparisons))];
+		Expression(depth);
+
+		if (depth < GENERATED_EXPRESSION_DEPTH && Chance(30))
+		{
+			m_Text += ' ';
+			Keyword(Chance(50) ? g_GeneratedAnd : g_GeneratedOr);
+			m_Text += ' ';
+			Condition(depth + 1);
+		}
+	}
+
+	void Block(int depth)
+	{
+		m_Indent++;
+
+		for (size_t i = 0, count = 1 + Pick(depth ? 3 : 8); i < count; i++)
+			Statement(depth);
+
+		m_Indent--;
+	}
+
+	// Comment lines, indented like the statements around them
+	void Comment()
+	{
+		for (const char* c = PickFrom(g_GeneratedComments); *c; c++)
+		{
+			if (*c == '\n')
+				NewLine();
+			else
+				m_Text += *c;
+		}
+	}
+
+	void Statement(int depth)
+	{
+		NewLine();
+
+		bool nested = depth < GENERATED_STATEMENT_DEPTH;
+
+		switch (Pick(nested ? 14 : 8))
+		{
+		case 0:
+			Comment();
+			break;
+		case 1:
+		case 2:
+			Name();
+			m_Text += '.';
+			m_Text += PickFrom(g_GeneratedMembers);
+			Arguments(0);
+			m_Text += ';';
+			break;
+		case 3:
+			Name();
+			m_Text += '[';
+			Expression(1);
+			m_Text += "] = ";
+			Expression(0);
+			m_Text += ';';
+			break;
+		case 4:
+			Keyword(g_GeneratedRaise);
+			m_Text += ' ';
+			StringLiteral();
+			m_Text += ';';
+			break;
+		default:
+			Name();
+			m_Text += " = ";
+			Expression(0);
+			m_Text += ';';
+
+			if (Chance(10))
+				m_Text += u8" // уточнить";
+			break;
+		case 8:
+		case 9:
+			Keyword(g_GeneratedIf);
+			m_Text += ' ';
+			Condition(0);
+			m_Text += ' ';
+			Keyword(g_GeneratedThen);
+			Block(depth + 1);
+
+			for (size_t i = 0, count = Chance(30) ? 1 + Pick(2) : 0; i < count; i++)
+			{
+				NewLine();
+				Keyword(g_GeneratedElseIf);
+				m_Text += ' ';
+				Condition(0);
+				m_Text += ' ';
+				Keyword(g_GeneratedThen);
+				Block(depth + 1);
+			}
+
+			if (Chance(40))
+			{
+				NewLine();
+				Keyword(g_GeneratedElse);
+				Block(depth + 1);
+			}
+
+			NewLine();
+			Keyword(g_GeneratedEndIf);
+			m_Text += ';';
+			break;
+		case 10:
+			Keyword(g_GeneratedWhile);
+			m_Text += ' ';
+			Condition(0);
+			m_Text += ' ';
+			Keyword(g_GeneratedLoop);
+			Block(depth + 1);
+			NewLine();
+			Keyword(g_GeneratedEndLoop);
+			m_Text += ';';
+			break;
+		case 11:
+			Keyword(g_GeneratedFor);
+			m_Text += ' ';
+			Keyword(g_GeneratedEach);
+			m_Text += ' ';
+			Name();
+			m_Text += ' ';
+			Keyword(g_GeneratedIn);
+			m_Text += ' ';
+			Name();
+			m_Text += ' ';
+			Keyword(g_GeneratedLoop);
+			Block(depth + 1);
+			NewLine();
+			Keyword(g_GeneratedEndLoop);
+			m_Text += ';';
+			break;
+		case 12:
+			Keyword(g_GeneratedFor);
+			m_Text += ' ';
+			Name();
+			m_Text += " = 1 ";
+			Keyword(g_GeneratedTo);
+			m_Text += ' ';
+			Expression(1);
+			m_Text += ' ';
+			Keyword(g_GeneratedLoop);
+			Block(depth + 1);
+			NewLine();
+			Keyword(g_GeneratedEndLoop);
+			m_Text += ';';
+			break;
+		case 13:
+			Keyword(g_GeneratedTry);
+			Block(depth + 1);
+			NewLine();
+			Keyword(g_GeneratedExcept);
+			Block(depth + 1);
+			NewLine();
+			Keyword(g_GeneratedEndTry);
+			m_Text += ';';
+			break;
+		}
+	}
+
+	// Annotation, header, locals and body of a procedure or function
+	void Subprogram(size_t index)
+	{
+		m_English = Chance(25);
+		m_Uppercase = m_English && Chance(10);
+
+		if (Chance(50))
+		{
+			Comment();
+			NewLine();
+		}
+
+		if (Chance(60))
+		{
+			m_Text += PickFrom(g_GeneratedAnnotations);
+			NewLine();
+		}
+
+		bool function = Chance(40);
+
+		Keyword(function ? g_GeneratedFunction : g_GeneratedProcedure);
+		m_Text += ' ';
+		m_Text += m_English ? "Handle" : u8"Обработать";
+		m_Text += PickFrom(g_GeneratedNames);
+		m_Text += std::to_string(index);
+		m_Text += '(';
+
+		for (size_t i = 0, count = Pick(5); i < count; i++)
+		{
+			if (i)
+				m_Text += ", ";
+
+			if (Chance(30))
+			{
+				Keyword(g_GeneratedVal);
+				m_Text += ' ';
+			}
+
+			m_Text += m_English ? "Parameter" : u8"Параметр";
+			m_Text += std::to_string(i + 1);
+
+			if (Chance(20))
+			{
+				m_Text += " = ";
+				Operand(GENERATED_EXPRESSION_DEPTH);
+			}
+		}
+
+		m_Text += ')';
+
+		if (Chance(30))
+		{
+			m_Text += ' ';
+			Keyword(g_GeneratedExport);
+		}
+
+		m_Indent++;
+		m_Locals = Pick(4);
+
+		if (m_Locals)
+		{
+			NewLine();
+			Keyword(g_GeneratedVar);
+			m_Text += ' ';
+
+			for (size_t i = 0; i < m_Locals; i++)
+				m_Text += (i ? u8", Локальная" : u8"Локальная") + std::to_string(i);
+
+			m_Text += ';';
+		}
+
+		m_Indent--;
+		Block(0);
+
+		if (function)
+		{
+			m_Indent++;
+			NewLine();
+			Keyword(g_GeneratedReturn);
+			m_Text += ' ';
+			Expression(0);
+			m_Text += ';';
+			m_Indent--;
+		}
+
+		NewLine();
+		Keyword(function ? g_GeneratedEndFunction : g_GeneratedEndProcedure);
+		m_Text += "\n\n";
+
+		m_Locals = 0;
+	}
+
+public:
+	ModuleGenerator(unsigned seed) : m_Random(seed), m_English(false), m_Uppercase(false), m_Indent(0), m_Locals(0)
+	{
+	}
+
+	std::string Generate(size_t bytes)
+	{
+		m_Text.reserve(bytes + 4096);
+
+		m_English = false;
+		Keyword(g_GeneratedVar);
+		m_Text += u8" ПараметрыМодуля Экспорт;\n\n";
+
+		// Subprograms left in the open region
+		size_t regionLeft = 0;
+
+		for (size_t index = 0; m_Text.length() < bytes; index++)
+		{
+			if (!regionLeft)
+			{
+				m_English = Chance(25);
+				m_Uppercase = false;
+				Keyword(g_GeneratedRegion);
+				m_Text += ' ';
+				m_Text += m_English ? "Section" : u8"Раздел";
+				m_Text += std::to_string(index);
+				m_Text += "\n\n";
+
+				regionLeft = 1 + Pick(12);
+			}
+
+			Subprogram(index);
+
+			if (!--regionLeft || m_Text.length() >= bytes)
+			{
+				m_English = Chance(25);
+				Keyword(g_GeneratedEndRegion);
+				m_Text += "\n\n";
+				regionLeft = 0;
+			}
+		}
+
+		return std::move(m_Text);
+	}
+};
+
+std::string GenerateBslModule(size_t bytes, unsigned seed)
+{
+	return ModuleGenerator(seed).Generate(bytes);
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace BSL
+{
+
+// Module text of at least bytes bytes, the same for the same seed, laid out
+// the way configuration modules are: regions of procedures and functions
+// with annotations, comments, string literals (empty, with escapes, with
+// line breaks), and If, While, For and Try statements nested a few levels
+// deep. Keywords are in Russian or English, in either letter case, per
+// subprogram. The module always parses without diagnostics.
+std::string GenerateBslModule(size_t bytes, unsigned seed);
+
+}
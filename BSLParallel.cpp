@@ -0,0 +1,132 @@
+#include "BSLParallel.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace BSL
+{
+
+// Indices of one WorkStealingFor thread; items are coarse enough for a lock
+class WorkDeque
+{
+	std::mutex m_Lock;
+	std::deque<size_t> m_Indices;
+public:
+	void Push(size_t index)
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Indices.push_back(index);
+	}
+
+	bool PopFront(size_t& index)
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+
+		if (m_Indices.empty())
+			return false;
+
+		index = m_Indices.front();
+		m_Indices.pop_front();
+		return true;
+	}
+
+	bool PopBack(size_t& index)
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+
+		if (m_Indices.empty())
+			return false;
+
+		index = m_Indices.back();
+		m_Indices.pop_back();
+		return true;
+	}
+};
+
+size_t HardwareThreadCount()
+{
+	return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+void ParallelFor(size_t count, size_t threadCount, const std::function<void(size_t worker, size_t index)>& body)
+{
+	if (!threadCount)
+		threadCount = HardwareThreadCount();
+
+	threadCount = std::min(threadCount, count);
+
+	std::atomic<size_t> next(0);
+
+	auto work = [&](size_t worker)
+	{
+		for (size_t index = next++; index < count; index = next++)
+			body(worker, index);
+	};
+
+	std::vector<std::thread> threads;
+
+	for (size_t worker = 1; worker < threadCount; worker++)
+		threads.emplace_back(work, worker);
+
+	work(0);
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+void WorkStealingFor(size_t count, size_t threadCount, const std::function<void(size_t worker, size_t index)>& body)
+{
+	// There would be no deque for the calling thread
+	if (!count)
+		return;
+
+	if (!threadCount)
+		threadCount = HardwareThreadCount();
+
+	threadCount = std::min(threadCount, count);
+
+	std::vector<WorkDeque> deques(threadCount);
+
+	for (size_t index = 0; index < count; index++)
+		deques[index % threadCount].Push(index);
+
+	// Nothing is added once started, so a thread finding every deque empty is done
+	auto work = [&](size_t worker)
+	{
+		size_t index;
+
+		while (true)
+		{
+			if (deques[worker].PopFront(index))
+			{
+				body(worker, index);
+				continue;
+			}
+
+			bool stolen = false;
+
+			for (size_t i = 1; i < threadCount && !stolen; i++)
+				stolen = deques[(worker + i) % threadCount].PopBack(index);
+
+			if (!stolen)
+				return;
+
+			body(worker, index);
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (size_t worker = 1; worker < threadCount; worker++)
+		threads.emplace_back(work, worker);
+
+	work(0);
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+}
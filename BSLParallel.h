@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+namespace BSL
+{
+
+// Threads the hardware runs at once, at least 1
+size_t HardwareThreadCount();
+
+// Calls body(worker, index) for every index below count on threadCount
+// threads, the calling one included; 0 means HardwareThreadCount(). Indices
+// are handed out in increasing order to whichever thread is free. worker is
+// below threadCount and is never used by two threads at the same time, so
+// body can keep per-thread state indexed by it. body must not throw.
+void ParallelFor(size_t count, size_t threadCount, const std::function<void(size_t worker, size_t index)>& body);
+
+// Same contract as ParallelFor for items of uneven cost. Indices are dealt
+// round robin into a deque per thread up front; a thread takes from the
+// front of its own deque and, once that is empty, steals from the back of
+// the others'. Callers put the costliest items first, so they start first
+// and what is stolen at the end is small.
+void WorkStealingFor(size_t count, size_t threadCount, const std::function<void(size_t worker, size_t index)>& body);
+
+}
@@ -0,0 +1,334 @@
+﻿#include "BSLAbstractSyntaxTree.h"
+#include "BSLDirectives.h"
+#include "BSLModuleGenerator.h"
+#include "BSLSource.h"
+#include "BSLToken.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace BSL
+{
+
+// Module text, the diagnostics it should get and the children its first node
+// of the given type should have, Unparsed standing for one without a token
+typedef struct
+{
+	const char* text;
+	size_t diagnostics;
+	ASTNodeTypes node;
+	std::vector<ASTNodeTypes> children;
+}parserCase_t;
+
+static const parserCase_t g_ParserCases[] =
+{
+	{ u8"А = \"\";", 0, ASTNodeTypes::AssigmentExpression, { ASTNodeTypes::Identifier, ASTNodeTypes::StringConstant } },
+	{ u8"Б = П <> \"\";", 0, ASTNodeTypes::ComparisonExpression, { ASTNodeTypes::Identifier, ASTNodeTypes::StringConstant } },
+	{ u8"Процедура Т(П = \"\")\nКонецПроцедуры", 0, ASTNodeTypes::Module, { ASTNodeTypes::Procedure } },
+	{ u8"А = \"\" + \"\"\"\" + \"\";", 0, ASTNodeTypes::ArithmeticExpression, { ASTNodeTypes::ArithmeticExpression, ASTNodeTypes::StringConstant } },
+	{ u8"Ф(\"\", \"\");", 0, ASTNodeTypes::SubprogramCall, { ASTNodeTypes::Identifier, ASTNodeTypes::StringConstant, ASTNodeTypes::StringConstant } },
+	{ u8"Ф();", 0, ASTNodeTypes::SubprogramCall, { ASTNodeTypes::Identifier } },
+	{ u8"Ф(1, , 2);", 0, ASTNodeTypes::SubprogramCall, { ASTNodeTypes::Identifier, ASTNodeTypes::NumericConstant, ASTNodeTypes::Unparsed, ASTNodeTypes::NumericConstant } },
+	{ u8"Ф(, 1);", 0, ASTNodeTypes::SubprogramCall, { ASTNodeTypes::Identifier, ASTNodeTypes::Unparsed, ASTNodeTypes::NumericConstant } },
+	{ u8"Ф(1, );", 0, ASTNodeTypes::SubprogramCall, { ASTNodeTypes::Identifier, ASTNodeTypes::NumericConstant, ASTNodeTypes::Unparsed } },
+	{ u8"Ф(,);", 0, ASTNodeTypes::SubprogramCall, { ASTNodeTypes::Identifier, ASTNodeTypes::Unparsed, ASTNodeTypes::Unparsed } },
+	{ u8"А = Новый Массив(, 2);", 0, ASTNodeTypes::NewExpression, { ASTNodeTypes::Identifier, ASTNodeTypes::Unparsed, ASTNodeTypes::NumericConstant } },
+	{ u8"А = Б*В % Г;", 0, ASTNodeTypes::ArithmeticExpression, { ASTNodeTypes::ArithmeticExpression, ASTNodeTypes::Identifier } },
+	{ u8"А = Б%В;", 0, ASTNodeTypes::ArithmeticExpression, { ASTNodeTypes::Identifier, ASTNodeTypes::Identifier } },
+	{ u8"Ф(1, , 2;", 1, ASTNodeTypes::SubprogramCall, { ASTNodeTypes::Identifier, ASTNodeTypes::NumericConstant, ASTNodeTypes::Unparsed, ASTNodeTypes::NumericConstant } },
+};
+
+// Module text with preprocessor directives, the diagnostics pruning it for
+// the server should find and the procedures left to parse
+typedef struct
+{
+	const char* text;
+	std::vector<DiagnosticCodes> diagnostics;
+	size_t procedures;
+}directiveCase_t;
+
+static const directiveCase_t g_DirectiveCases[] =
+{
+	{ u8"#Если Сервер Тогда\nПроцедура А()\nКонецПроцедуры\n#КонецЕсли", {}, 1 },
+	{ u8"#Если Сервер И Тогда\nПроцедура А()\nКонецПроцедуры\n#КонецЕсли\nПроцедура Б()\nКонецПроцедуры", { DiagnosticCodes::UnexpectedToken }, 1 },
+	{ u8"#Если (Сервер Тогда\nПроцедура А()\nКонецПроцедуры\n#Иначе\nПроцедура Б()\nКонецПроцедуры\n#КонецЕсли", { DiagnosticCodes::UnexpectedToken }, 1 },
+	{ u8"#Если Сервер\nПроцедура А()\nКонецПроцедуры\n#КонецЕсли", { DiagnosticCodes::UnexpectedToken }, 0 },
+	{ u8"#КонецЕсли\nПроцедура А()\nКонецПроцедуры", { DiagnosticCodes::UnmatchedDirective }, 1 },
+	{ u8"#ИначеЕсли Клиент Тогда\nПроцедура А()\nКонецПроцедуры", { DiagnosticCodes::UnmatchedDirective }, 1 },
+	{ u8"#Вставка\n#КонецЕсли\nПроцедура А()\nКонецПроцедуры\n#КонецВставки", { DiagnosticCodes::UnmatchedDirective }, 1 },
+	{ u8"#Если Клиент Тогда\nПроцедура А()\nКонецПроцедуры", { DiagnosticCodes::MissingEndDirective }, 0 },
+	{ u8"#Удаление\n#Если Сервер Тогда\nПроцедура А()\nКонецПроцедуры\n#Иначе", { DiagnosticCodes::MissingEndDirective, DiagnosticCodes::MissingEndDirective }, 0 },
+};
+
+// First node of type in preorder, none if there is no such node
+static AstNode FindNode(AstNode node, ASTNodeTypes type)
+{
+	if (node.Type() == type)
+		return node;
+
+	for (AstNode child : node.Children())
+	{
+		AstNode found = FindNode(child, type);
+
+		if (found)
+			return found;
+	}
+
+	return AstNode();
+}
+
+static bool CheckCase(const parserCase_t& parserCase)
+{
+	TokenStream stream{ std::string(parserCase.text) };
+	SyntaxTree tree;
+	BuildAbstractSyntaxTree(&stream, tree);
+
+	bool passed = tree.Diagnostics().size() == parserCase.diagnostics;
+	AstNode node = FindNode(tree.Root(), parserCase.node);
+
+	if (!node)
+		passed = false;
+	else
+	{
+		size_t i = 0;
+
+		for (AstNode child : node.Children())
+		{
+			if (i == parserCase.children.size() || child.Type() != parserCase.children[i] ||
+				(child.Type() == ASTNodeTypes::Unparsed && child.Token()))
+				passed = false;
+
+			i++;
+		}
+
+		if (i != parserCase.children.size())
+			passed = false;
+	}
+
+	// An empty literal is a token of no length between its quotes
+	std::string_view text = parserCase.text;
+
+	for (size_t i = 0; i < stream.Table()->Size(); i++)
+	{
+		TokenHandle token(stream.Table(), i);
+
+		if (!token.SourceLength() && (token.Type() != TokenTypes::StringConst || !token.Value().empty() ||
+			text.substr(token.SourceOffset() - 1, 2) != "\"\""))
+			passed = false;
+	}
+
+	if (!passed)
+	{
+		printf("%s: unexpected tree\n", parserCase.text);
+
+		for (const parseDiagnostic_t& diagnostic : tree.Diagnostics())
+			printf("  %s\n", DiagnosticMessage(diagnostic).c_str());
+	}
+
+	return passed;
+}
+
+static bool CheckDirectiveCase(const directiveCase_t& directiveCase, const DirectiveSymbols& symbols)
+{
+	TokenStream stream{ std::string(directiveCase.text) };
+	TokenTable compiled;
+	std::vector<inactiveTokenRange_t> inactive;
+	std::vector<parseDiagnostic_t> diagnostics;
+
+	PruneInactiveCode(*stream.Table(), symbols, compiled, inactive, diagnostics);
+
+	TokenSpan span(&compiled, 0, compiled.Size());
+	SyntaxTree tree;
+	BuildAbstractSyntaxTree(&span, tree);
+
+	size_t procedures = 0;
+
+	for (AstNode child : tree.Root().Children())
+		procedures += child.Type() == ASTNodeTypes::Procedure ? 1 : 0;
+
+	bool passed = procedures == directiveCase.procedures && tree.Diagnostics().empty() && diagnostics.size() == directiveCase.diagnostics.size();
+
+	for (size_t i = 0; passed && i < diagnostics.size(); i++)
+		passed = diagnostics[i].code == directiveCase.diagnostics[i];
+
+	if (!passed)
+	{
+		printf("%s: unexpected pruning, %zu procedures\n", directiveCase.text, procedures);
+
+		for (const parseDiagnostic_t& diagnostic : diagnostics)
+			printf("  %s\n", DiagnosticMessage(diagnostic).c_str());
+	}
+
+	return passed;
+}
+
+// Text the random edits insert: tokens that open, close and break subprograms,
+// blocks, statements and literals
+const char* const g_EditTexts[] =
+{
+	"", "", ";", "(", ")", ",", "\"", "\n", " = ", "//",
+	u8"Процедура П()\n", u8"Функция Ф(А, Б = \"\") Экспорт\n", u8"КонецПроцедуры\n", u8"КонецФункции\n",
+	u8"&НаСервере\n", u8"Если А Тогда\n", u8"КонецЕсли;\n", u8"Возврат ", u8"А = Б(1, , 2);\n",
+};
+
+// Node types, tokens and operators in preorder, each followed by its child
+// count, and the diagnostics, so that trees compare regardless of row order
+static std::vector<uint32_t> FlattenTree(const SyntaxTree& tree)
+{
+	std::vector<uint32_t> result;
+	std::vector<AstNode> pending = { tree.Root() };
+
+	while (!pending.empty())
+	{
+		AstNode node = pending.back();
+		pending.pop_back();
+
+		const astNode_t& row = tree.Node(node.Index());
+		uint32_t payload = 0;
+
+		switch (row.type)
+		{
+		case ASTNodeTypes::ArithmeticExpression:
+		case ASTNodeTypes::ComparisonExpression:
+		case ASTNodeTypes::LogicalExpression:
+		case ASTNodeTypes::Identifier:
+			payload = row.payload;
+			break;
+		case ASTNodeTypes::Function:
+		case ASTNodeTypes::Procedure:
+			payload = node.Subprogram().endToken;
+			break;
+		}
+
+		size_t first = pending.size();
+
+		for (AstNode child : node.Children())
+			pending.push_back(child);
+
+		std::reverse(pending.begin() + first, pending.end());
+
+		result.insert(result.end(), { (uint32_t)row.type, row.token, payload, (uint32_t)(pending.size() - first) });
+	}
+
+	for (const parseDiagnostic_t& diagnostic : tree.Diagnostics())
+		result.insert(result.end(), { (uint32_t)diagnostic.code, diagnostic.token, (uint32_t)diagnostic.expected });
+
+	return result;
+}
+
+// Applies random edits to text one after another, bringing the tree up to
+// date with ReparseAbstractSyntaxTree after each, and compares it with the
+// tree built from scratch from the edited text; returns the edits after
+// which they differ
+static size_t CheckReparse(const char* name, std::string text, size_t edits, unsigned seed)
+{
+	std::mt19937 random(seed);
+
+	TokenStream stream(text);
+	SyntaxTree tree;
+	BuildAbstractSyntaxTree(&stream, tree);
+
+	size_t failed = 0;
+
+	auto boundary = [&](size_t offset)
+	{
+		while (offset < text.length() && (text[offset] & 0xC0) == 0x80)
+			offset++;
+
+		return offset;
+	};
+
+	for (size_t i = 0; i < edits; i++)
+	{
+		size_t offset = boundary(random() % (text.length() + 1));
+		size_t removed = boundary(std::min(text.length(), offset + random() % 24)) - offset;
+		const char* inserted = g_EditTexts[random() % std::size(g_EditTexts)];
+
+		tokenStreamEdit_t edit = stream.ApplyEdit(offset, removed, inserted);
+		text.replace(offset, removed, inserted);
+
+		stream.Reset();
+		ReparseAbstractSyntaxTree(&stream, edit, tree);
+
+		TokenStream fresh(text);
+		SyntaxTree built;
+		BuildAbstractSyntaxTree(&fresh, built);
+
+		if (FlattenTree(tree) != FlattenTree(built))
+		{
+			if (failed++ < 3)
+				printf("%s: reparse after edit %zu at %zu (%zu bytes removed, \"%s\" inserted) differs from a full build\n", name, i, offset, removed, inserted);
+
+			// Go on from the right tree
+			tree.Clear();
+			stream.Reset();
+			BuildAbstractSyntaxTree(&stream, tree);
+		}
+	}
+
+	return failed;
+}
+
+int RunParserCheck(int argc, char** argv)
+{
+	size_t edits = 200;
+	unsigned seed = 1;
+	std::vector<std::pair<std::string, std::string>> modules;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--edits") && i + 1 < argc)
+			edits = strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+		else
+		{
+			SourceBuffer source;
+
+			if (!source.LoadFile(argv[i]))
+			{
+				fprintf(stderr, "Can't open %s\n", argv[i]);
+				return 1;
+			}
+
+			modules.emplace_back(argv[i], std::string(source.Text()));
+		}
+	}
+
+	if (modules.empty())
+	{
+		for (unsigned i = 0; i < 4; i++)
+			modules.emplace_back("generated module " + std::to_string(i), GenerateBslModule(8 * 1024, seed + i));
+	}
+
+	size_t failed = 0;
+
+	for (const parserCase_t& parserCase : g_ParserCases)
+		if (!CheckCase(parserCase))
+			failed++;
+
+	DirectiveSymbols symbols;
+	symbols.DefineContext("Server");
+
+	for (const directiveCase_t& directiveCase : g_DirectiveCases)
+		if (!CheckDirectiveCase(directiveCase, symbols))
+			failed++;
+
+	size_t failedEdits = 0;
+
+	for (size_t i = 0; i < modules.size(); i++)
+		failedEdits += CheckReparse(modules[i].first.c_str(), modules[i].second, edits, seed + (unsigned)i);
+
+	printf("%zu cases, %zu failed; %zu modules with %zu random edits each, %zu reparsed differently\n",
+		std::size(g_ParserCases) + std::size(g_DirectiveCases), failed, modules.size(), edits, failedEdits);
+
+	return failed || failedEdits ? 1 : 0;
+}
+
+}
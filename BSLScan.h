@@ -0,0 +1,164 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BSL_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define BSL_SCAN_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Run scanners used by the lexer to skip over comment, string literal and
+// whitespace runs of UTF-8 text. Each returns the length of the run starting
+// at data, i.e. the index of the first byte that stops it (or length).
+// Stop symbols are ASCII, so they never match inside multibyte sequences.
+// Vectorized with AVX2/SSE2 when the target has them, scalar otherwise.
+
+namespace BSL
+{
+
+namespace ScanDetail
+{
+
+inline unsigned CountTrailingZeros(uint32_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+#ifdef BSL_SCAN_SSE2
+struct Sse2Ops
+{
+	typedef __m128i vector_t;
+	static const size_t bytes = 16;
+	static const uint32_t fullMask = 0xFFFF;
+
+	static __m128i Load(const void* p) { return _mm_loadu_si128((const __m128i*)p); }
+	static __m128i Set(char c) { return _mm_set1_epi8(c); }
+	static __m128i Equal(__m128i a, __m128i b) { return _mm_cmpeq_epi8(a, b); }
+	static __m128i Or(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+	static __m128i AndNot(__m128i a, __m128i b) { return _mm_andnot_si128(a, b); }
+	static uint32_t Mask(__m128i v) { return (uint32_t)_mm_movemask_epi8(v); }
+
+	// Unsigned v <= 32, i.e. control symbols and space
+	static __m128i Whitespace(__m128i v) { return _mm_cmpeq_epi8(_mm_subs_epu8(v, _mm_set1_epi8(32)), _mm_setzero_si128()); }
+};
+#endif
+
+#ifdef BSL_SCAN_AVX2
+struct Avx2Ops
+{
+	typedef __m256i vector_t;
+	static const size_t bytes = 32;
+	static const uint32_t fullMask = 0xFFFFFFFF;
+
+	static __m256i Load(const void* p) { return _mm256_loadu_si256((const __m256i*)p); }
+	static __m256i Set(char c) { return _mm256_set1_epi8(c); }
+	static __m256i Equal(__m256i a, __m256i b) { return _mm256_cmpeq_epi8(a, b); }
+	static __m256i Or(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+	static __m256i AndNot(__m256i a, __m256i b) { return _mm256_andnot_si256(a, b); }
+	static uint32_t Mask(__m256i v) { return (uint32_t)_mm256_movemask_epi8(v); }
+
+	static __m256i Whitespace(__m256i v) { return _mm256_cmpeq_epi8(_mm256_subs_epu8(v, _mm256_set1_epi8(32)), _mm256_setzero_si256()); }
+};
+#endif
+
+// Advances offset over whole vectors until one contains a stop symbol.
+// stopMask(vector) returns the movemask of the lanes that stop the run.
+template<typename Ops, typename StopMask>
+bool ScanVectors(const char* data, size_t length, size_t& offset, StopMask stopMask)
+{
+	for (; offset + Ops::bytes <= length; offset += Ops::bytes)
+	{
+		uint32_t mask = stopMask(Ops::Load(data + offset));
+
+		if (mask)
+		{
+			offset += CountTrailingZeros(mask);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template<typename Ops>
+bool ScanVectorsUntil(const char* data, size_t length, size_t& offset, char first, char second)
+{
+	auto firstVector = Ops::Set(first);
+	auto secondVector = Ops::Set(second);
+
+	return ScanVectors<Ops>(data, length, offset, [&](typename Ops::vector_t v)
+	{
+		return Ops::Mask(Ops::Or(Ops::Equal(v, firstVector), Ops::Equal(v, secondVector)));
+	});
+}
+
+template<typename Ops>
+bool ScanVectorsWhitespace(const char* data, size_t length, size_t& offset)
+{
+	auto lineFeed = Ops::Set('\n');
+
+	return ScanVectors<Ops>(data, length, offset, [&](typename Ops::vector_t v)
+	{
+		auto skipped = Ops::AndNot(Ops::Equal(v, lineFeed), Ops::Whitespace(v));
+		return ~Ops::Mask(skipped) & Ops::fullMask;
+	});
+}
+
+}
+
+// Run up to the first occurrence of either stop symbol
+inline size_t ScanUntil(const char* data, size_t length, char first, char second)
+{
+	size_t offset = 0;
+
+#ifdef BSL_SCAN_AVX2
+	if (ScanDetail::ScanVectorsUntil<ScanDetail::Avx2Ops>(data, length, offset, first, second))
+		return offset;
+#endif
+#ifdef BSL_SCAN_SSE2
+	if (ScanDetail::ScanVectorsUntil<ScanDetail::Sse2Ops>(data, length, offset, first, second))
+		return offset;
+#endif
+
+	while (offset < length && data[offset] != first && data[offset] != second)
+		offset++;
+
+	return offset;
+}
+
+// Run of whitespace (symbols below 33) other than line feeds, which the lexer counts
+inline size_t ScanWhitespace(const char* data, size_t length)
+{
+	size_t offset = 0;
+
+#ifdef BSL_SCAN_AVX2
+	if (ScanDetail::ScanVectorsWhitespace<ScanDetail::Avx2Ops>(data, length, offset))
+		return offset;
+#endif
+#ifdef BSL_SCAN_SSE2
+	if (ScanDetail::ScanVectorsWhitespace<ScanDetail::Sse2Ops>(data, length, offset))
+		return offset;
+#endif
+
+	while (offset < length && (unsigned char)data[offset] < 33 && data[offset] != '\n')
+		offset++;
+
+	return offset;
+}
+
+}
@@ -0,0 +1,410 @@
+#include "BSLSource.h"
+#include "BSLTrace.h"
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace BSL
+{
+
+// CP1251 symbols 0x80-0xBF; 0xC0-0xFF map linearly onto U+0410-U+044F
+const uint16_t g_Cp1251UpperHalf[64] =
+{
+	0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+	0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0xFFFD, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+	0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+	0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+	0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+	0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+};
+
+bool IsValidUtf8(const unsigned char* data, size_t length)
+{
+	size_t i = 0;
+
+	while (i < length)
+	{
+		unsigned char c = data[i];
+
+		if (c < 0x80)
+		{
+			i++;
+			continue;
+		}
+
+		size_t sequenceLength;
+
+		if ((c & 0xE0) == 0xC0 && c >= 0xC2)
+			sequenceLength = 2;
+		else if ((c & 0xF0) == 0xE0)
+			sequenceLength = 3;
+		else if ((c & 0xF8) == 0xF0 && c <= 0xF4)
+			sequenceLength = 4;
+		else
+			return false;
+
+		if (i + sequenceLength > length)
+			return false;
+
+		for (size_t j = 1; j < sequenceLength; j++)
+			if ((data[i + j] & 0xC0) != 0x80)
+				return false;
+
+		i += sequenceLength;
+	}
+
+	return true;
+}
+
+SourceEncoding DetectSourceEncoding(const char* data, size_t length)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+
+	if (length >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+		return SourceEncoding::Utf8WithBOM;
+
+	if (length >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE)
+		return SourceEncoding::Utf16LE;
+
+	if (length >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF)
+		return SourceEncoding::Utf16BE;
+
+	if (IsValidUtf8(bytes, length))
+		return SourceEncoding::Utf8;
+
+	return SourceEncoding::Cp1251;
+}
+
+void AppendUtf8(std::string& output, uint32_t codePoint)
+{
+	if (codePoint < 0x80)
+		output += (char)codePoint;
+	else if (codePoint < 0x800)
+	{
+		output += (char)(0xC0 | (codePoint >> 6));
+		output += (char)(0x80 | (codePoint & 0x3F));
+	}
+	else if (codePoint < 0x10000)
+	{
+		output += (char)(0xE0 | (codePoint >> 12));
+		output += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+		output += (char)(0x80 | (codePoint & 0x3F));
+	}
+	else
+	{
+		output += (char)(0xF0 | (codePoint >> 18));
+		output += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+		output += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+		output += (char)(0x80 | (codePoint & 0x3F));
+	}
+}
+
+void TranscodeUtf16(std::string& output, const unsigned char* data, size_t length, bool bigEndian)
+{
+	output.reserve(length + length / 2);
+
+	auto unitAt = [&](size_t i) -> uint32_t
+	{
+		return bigEndian ? (data[i] << 8) | data[i + 1] : data[i] | (data[i + 1] << 8);
+	};
+
+	for (size_t i = 0; i + 1 < length; i += 2)
+	{
+		uint32_t unit = unitAt(i);
+
+		if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < length)
+		{
+			uint32_t low = unitAt(i + 2);
+
+			if (low >= 0xDC00 && low < 0xE000)
+			{
+				AppendUtf8(output, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+				i += 2;
+				continue;
+			}
+		}
+
+		AppendUtf8(output, unit);
+	}
+}
+
+void TranscodeCp1251(std::string& output, const unsigned char* data, size_t length)
+{
+	output.reserve(length * 2);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char c = data[i];
+
+		if (c < 0x80)
+			output += (char)c;
+		else if (c < 0xC0)
+			AppendUtf8(output, g_Cp1251UpperHalf[c - 0x80]);
+		else
+			AppendUtf8(output, 0x410 + (c - 0xC0));
+	}
+}
+
+SourceBuffer::SourceBuffer()
+{
+	m_Text = "";
+	m_Length = 0;
+	m_Encoding = SourceEncoding::Utf8;
+}
+
+SourceBuffer::SourceBuffer(std::string text) : SourceBuffer()
+{
+	m_Transcoded = std::move(text);
+	AdoptBytes(m_Transcoded.data(), m_Transcoded.length());
+}
+
+SourceBuffer SourceBuffer::FromUtf8(std::string text)
+{
+	SourceBuffer result;
+
+	result.m_Transcoded = std::move(text);
+	result.m_Text = result.m_Transcoded.data();
+	result.m_Length = result.m_Transcoded.length();
+
+	return result;
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer&& other) noexcept : SourceBuffer()
+{
+	*this = std::move(other);
+}
+
+SourceBuffer& SourceBuffer::operator=(SourceBuffer&& other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	// Text inside the owned string has to be rebased, the string may move its storage
+	const char* ownedBegin = other.m_Transcoded.data();
+	bool ownsText = other.m_Text >= ownedBegin && other.m_Text < ownedBegin + other.m_Transcoded.length();
+	size_t ownedOffset = ownsText ? other.m_Text - ownedBegin : 0;
+
+	m_Transcoded = std::move(other.m_Transcoded);
+	m_Text = ownsText ? m_Transcoded.data() + ownedOffset : other.m_Text;
+	m_Length = other.m_Length;
+	m_Encoding = other.m_Encoding;
+	m_File = std::move(other.m_File);
+
+	other.m_Text = "";
+	other.m_Length = 0;
+
+	return *this;
+}
+
+// Points m_Text at UTF-8 text for the given bytes: in place for UTF-8,
+// otherwise into m_Transcoded
+void SourceBuffer::AdoptBytes(const char* data, size_t length)
+{
+	TraceScope scope("decode");
+
+	m_Encoding = DetectSourceEncoding(data, length);
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	std::string transcoded;
+
+	switch (m_Encoding)
+	{
+	case SourceEncoding::Utf8:
+		m_Text = data;
+		m_Length = length;
+		return;
+	case SourceEncoding::Utf8WithBOM:
+		m_Text = data + 3;
+		m_Length = length - 3;
+		return;
+	case SourceEncoding::Utf16LE:
+		TranscodeUtf16(transcoded, bytes + 2, length - 2, false);
+		break;
+	case SourceEncoding::Utf16BE:
+		TranscodeUtf16(transcoded, bytes + 2, length - 2, true);
+		break;
+	case SourceEncoding::Cp1251:
+		TranscodeCp1251(transcoded, bytes, length);
+		break;
+	}
+
+	m_Transcoded = std::move(transcoded);
+	m_Text = m_Transcoded.data();
+	m_Length = m_Transcoded.length();
+}
+
+bool SourceBuffer::LoadFile(const char* fileName)
+{
+	m_Transcoded.clear();
+	m_Text = "";
+	m_Length = 0;
+
+	{
+		TraceScope scope("read");
+
+		if (!m_File.Map(fileName, true))
+			return false;
+	}
+
+	if (!m_File.Length())
+		return true;
+
+	AdoptBytes(m_File.Data(), m_File.Length());
+
+	// Transcoded sources no longer need the file
+	if (m_Encoding != SourceEncoding::Utf8 && m_Encoding != SourceEncoding::Utf8WithBOM)
+		m_File.Unmap();
+
+	return true;
+}
+
+MappedFile::MappedFile() : m_View(nullptr), m_Length(0)
+#ifdef _WIN32
+	, m_FileHandle(INVALID_HANDLE_VALUE), m_MappingHandle(nullptr)
+#endif
+{
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : MappedFile()
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	Unmap();
+
+	m_View = other.m_View;
+	m_Length = other.m_Length;
+#ifdef _WIN32
+	m_FileHandle = other.m_FileHandle;
+	m_MappingHandle = other.m_MappingHandle;
+	other.m_FileHandle = INVALID_HANDLE_VALUE;
+	other.m_MappingHandle = nullptr;
+#endif
+
+	other.m_View = nullptr;
+	other.m_Length = 0;
+
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	Unmap();
+}
+
+void MappedFile::Unmap()
+{
+#ifdef _WIN32
+	if (m_View)
+		UnmapViewOfFile(m_View);
+
+	if (m_MappingHandle)
+		CloseHandle(m_MappingHandle);
+
+	if (m_FileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(m_FileHandle);
+
+	m_FileHandle = INVALID_HANDLE_VALUE;
+	m_MappingHandle = nullptr;
+#else
+	if (m_View)
+		munmap(m_View, m_Length);
+#endif
+
+	m_View = nullptr;
+	m_Length = 0;
+}
+
+bool MappedFile::Map(const char* fileName, bool sequential)
+{
+	Unmap();
+
+#ifdef _WIN32
+	// Sharing delete lets the file be replaced by a rename while mapped
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	m_FileHandle = file;
+
+	if (fileSize.QuadPart == 0)
+		return true;
+
+	m_MappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!m_MappingHandle)
+	{
+		Unmap();
+		return false;
+	}
+
+	m_View = MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0);
+	m_Length = (size_t)fileSize.QuadPart;
+
+	if (!m_View)
+	{
+		Unmap();
+		return false;
+	}
+#else
+	int file = open(fileName, O_RDONLY);
+
+	if (file < 0)
+		return false;
+
+	struct stat fileStat;
+
+	if (fstat(file, &fileStat) != 0)
+	{
+		close(file);
+		return false;
+	}
+
+	if (fileStat.st_size == 0)
+	{
+		close(file);
+		return true;
+	}
+
+	void* view = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (view == MAP_FAILED)
+		return false;
+
+	if (sequential)
+		madvise(view, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+
+	m_View = view;
+	m_Length = (size_t)fileStat.st_size;
+#endif
+
+	return true;
+}
+
+}
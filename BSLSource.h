@@ -0,0 +1,95 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace BSL
+{
+
+enum class SourceEncoding
+{
+	Utf8,
+	Utf8WithBOM,
+	Utf16LE,
+	Utf16BE,
+	Cp1251,
+};
+
+// Read-only mapping of a whole file
+class MappedFile
+{
+	void* m_View;
+	size_t m_Length;
+#ifdef _WIN32
+	void* m_FileHandle;
+	void* m_MappingHandle;
+#endif
+public:
+	MappedFile();
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	// Replaces the current mapping; an empty file succeeds with no data.
+	// sequential hints that the file is going to be read once from the start.
+	bool Map(const char* fileName, bool sequential = false);
+	void Unmap();
+
+	const char* Data() const
+	{
+		return (const char*)m_View;
+	}
+
+	size_t Length() const
+	{
+		return m_Length;
+	}
+};
+
+// Module text as UTF-8. UTF-8 files are memory-mapped and used in place
+// (without the BOM); UTF-16 and CP1251 files are transcoded once into an
+// owned buffer.
+class SourceBuffer
+{
+	const char* m_Text;
+	size_t m_Length;
+
+	std::string m_Transcoded;
+	SourceEncoding m_Encoding;
+
+	MappedFile m_File;
+
+	void AdoptBytes(const char* data, size_t length);
+public:
+	SourceBuffer();
+	SourceBuffer(std::string text);
+	SourceBuffer(SourceBuffer&& other) noexcept;
+	SourceBuffer& operator=(SourceBuffer&& other) noexcept;
+	SourceBuffer(const SourceBuffer&) = delete;
+	SourceBuffer& operator=(const SourceBuffer&) = delete;
+
+	bool LoadFile(const char* fileName);
+
+	// Takes text known to be UTF-8 without a BOM, skipping detection
+	static SourceBuffer FromUtf8(std::string text);
+
+	std::string_view Text() const
+	{
+		return std::string_view(m_Text, m_Length);
+	}
+
+	SourceEncoding Encoding() const
+	{
+		return m_Encoding;
+	}
+};
+
+SourceEncoding DetectSourceEncoding(const char* data, size_t length);
+void AppendUtf8(std::string& output, uint32_t codePoint);
+// Append the UTF-8 form of the given bytes to output
+void TranscodeUtf16(std::string& output, const unsigned char* data, size_t length, bool bigEndian);
+void TranscodeCp1251(std::string& output, const unsigned char* data, size_t length);
+
+}
@@ -0,0 +1,600 @@
+#include "BSLSymbolIndex.h"
+#include "BSLAbstractSyntaxTree.h"
+#include "BSLBatch.h"
+#include "BSLParallel.h"
+#include "BSLToken.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace BSL
+{
+
+constexpr uint32_t SYMBOL_INDEX_MAGIC = 0x58494C42; // "BLIX"
+constexpr uint32_t SYMBOL_INDEX_BYTE_ORDER = 0x01020304;
+
+// Symbol of one module as collected by a worker
+typedef struct
+{
+	std::string key;
+	std::string name;
+	std::string signature;
+
+	size_t offset;
+	size_t row;
+	size_t column;
+
+	bool isFunction;
+	bool exported;
+}indexedSymbol_t;
+
+// Subprogram header facts both a SyntaxTree and a CachedModule have
+typedef struct
+{
+	bool isFunction;
+	bool exported;
+	size_t keywordOffset;
+	std::string_view name;
+}subprogramHeader_t;
+
+static bool IsHeaderSpace(char c)
+{
+	return (unsigned char)c < 33;
+}
+
+// Skips whitespace and // comments from offset on
+static size_t SkipHeaderGap(std::string_view text, size_t offset)
+{
+	while (offset < text.length())
+	{
+		if (IsHeaderSpace(text[offset]))
+			offset++;
+		else if (text.compare(offset, 2, "//") == 0)
+		{
+			while (offset < text.length() && text[offset] != '\n')
+				offset++;
+		}
+		else
+			break;
+	}
+
+	return offset;
+}
+
+static size_t SkipHeaderWord(std::string_view text, size_t offset)
+{
+	while (offset < text.length() && !IsHeaderSpace(text[offset]) && text[offset] != '(' && text.compare(offset, 2, "//") != 0)
+		offset++;
+
+	return offset;
+}
+
+std::string SubprogramHeaderText(std::string_view text, size_t keywordOffset, bool exported, size_t& nameOffset)
+{
+	nameOffset = SkipHeaderGap(text, SkipHeaderWord(text, keywordOffset));
+
+	std::string result;
+	size_t offset = keywordOffset;
+	bool inString = false;
+	bool closed = false;
+
+	auto appendGap = [&]()
+	{
+		size_t next = SkipHeaderGap(text, offset);
+
+		if (next != offset && !result.empty() && result.back() != '(')
+			result += ' ';
+
+		offset = next;
+	};
+
+	while (offset < text.length() && !closed)
+	{
+		char c = text[offset];
+
+		if (inString)
+		{
+			result += c;
+			offset++;
+			inString = c != '\"' && c != '\n';
+			continue;
+		}
+
+		if (IsHeaderSpace(c) || text.compare(offset, 2, "//") == 0)
+		{
+			appendGap();
+
+			if (offset < text.length() && text[offset] == ')' && !result.empty() && result.back() == ' ')
+				result.pop_back();
+
+			continue;
+		}
+
+		result += c;
+		offset++;
+		inString = c == '\"';
+		closed = c == ')';
+	}
+
+	if (exported)
+	{
+		appendGap();
+
+		size_t end = SkipHeaderWord(text, offset);
+		result.append(text.substr(offset, end - offset));
+	}
+
+	return result;
+}
+
+// Collects symbols of one module, headers in source order, so that rows and
+// columns are counted in one pass over the text
+class ModuleSymbolCollector
+{
+	std::string_view m_Text;
+	std::vector<indexedSymbol_t>& m_Symbols;
+
+	size_t m_Offset;
+	size_t m_Row;
+	size_t m_Column;
+
+	void AdvanceTo(size_t offset)
+	{
+		for (; m_Offset < offset; m_Offset++)
+		{
+			if (m_Text[m_Offset] == '\n')
+			{
+				m_Row++;
+				m_Column = 1;
+			}
+			else if ((m_Text[m_Offset] & 0xC0) != 0x80)
+				m_Column++;
+		}
+	}
+public:
+	ModuleSymbolCollector(std::string_view text, std::vector<indexedSymbol_t>& symbols) : m_Text(text), m_Symbols(symbols), m_Offset(0), m_Row(1), m_Column(1)
+	{
+	}
+
+	template<class Annotations>
+	void Add(const subprogramHeader_t& header, const Annotations& annotations)
+	{
+		indexedSymbol_t symbol;
+		symbol.name = header.name;
+		symbol.key = FoldIdentifier(header.name);
+		symbol.isFunction = header.isFunction;
+		symbol.exported = header.exported;
+
+		for (std::string_view annotation : annotations)
+		{
+			symbol.signature.append(annotation);
+			symbol.signature += ' ';
+		}
+
+		symbol.signature += SubprogramHeaderText(m_Text, header.keywordOffset, header.exported, symbol.offset);
+
+		AdvanceTo(symbol.offset);
+		symbol.row = m_Row;
+		symbol.column = m_Column;
+
+		m_Symbols.push_back(std::move(symbol));
+	}
+};
+
+static bool IsSubprogram(ASTNodeTypes type)
+{
+	return type == ASTNodeTypes::Function || type == ASTNodeTypes::Procedure;
+}
+
+static void CollectSymbols(const SyntaxTree& tree, const TokenTable& tokens, std::vector<indexedSymbol_t>& symbols)
+{
+	ModuleSymbolCollector collector(tokens.Source().buffer.Text(), symbols);
+
+	for (AstNode node : tree.Root().Children())
+	{
+		if (!IsSubprogram(node.Type()))
+			continue;
+
+		const subprogramPayload_t& subprogram = node.Subprogram();
+		subprogramHeader_t header = { node.Type() == ASTNodeTypes::Function, subprogram.exported, tokens.SourceOffset(tree.Node(node.Index()).token), subprogram.name };
+
+		collector.Add(header, subprogram.annotations);
+	}
+}
+
+static void CollectSymbols(const CachedModule& module, std::string_view text, std::vector<indexedSymbol_t>& symbols)
+{
+	ModuleSymbolCollector collector(text, symbols);
+	std::vector<std::string_view> annotations;
+
+	for (uint32_t node = module.NodeCount() ? module.Node(0).firstChild : AST_NO_NODE; node != AST_NO_NODE; node = module.Node(node).nextSibling)
+	{
+		if (!IsSubprogram(module.Node(node).type))
+			continue;
+
+		const cachedSubprogram_t& subprogram = module.Subprogram(node);
+		subprogramHeader_t header = { module.Node(node).type == ASTNodeTypes::Function, subprogram.exported != 0, module.TokenOffset(module.Node(node).token), module.SubprogramName(subprogram) };
+
+		annotations.clear();
+
+		for (uint32_t i = 0; i < subprogram.annotationCount; i++)
+			annotations.push_back(module.Annotation(subprogram, i));
+
+		collector.Add(header, annotations);
+	}
+}
+
+// Returns false if the module can't be opened
+static bool CollectModuleSymbols(const std::string& path, const ModuleCache* cache, std::vector<indexedSymbol_t>& symbols)
+{
+	SourceBuffer source;
+
+	if (!source.LoadFile(path.c_str()))
+		return false;
+
+	uint64_t sourceHash = 0;
+
+	if (cache)
+	{
+		sourceHash = HashSource(source.Text());
+
+		CachedModule module;
+
+		if (cache->Load(source.Text(), sourceHash, module))
+		{
+			CollectSymbols(module, source.Text(), symbols);
+			return true;
+		}
+	}
+
+	TokenStream stream(std::move(source));
+	SyntaxTree tree;
+
+	BuildAbstractSyntaxTree(&stream, tree);
+	CollectSymbols(tree, *stream.Table(), symbols);
+
+	// Modules with errors are parsed again next time, they are likely edited
+	if (cache && tree.Diagnostics().empty())
+		cache->Store(sourceHash, *stream.Table(), tree);
+
+	return true;
+}
+
+SymbolIndex::SymbolIndex() : m_Data(nullptr), m_Header(nullptr)
+{
+}
+
+SymbolIndex::SymbolIndex(SymbolIndex&& other) noexcept : SymbolIndex()
+{
+	*this = std::move(other);
+}
+
+SymbolIndex& SymbolIndex::operator=(SymbolIndex&& other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	// Moving a vector keeps its storage, so m_Data stays valid either way
+	m_Image = std::move(other.m_Image);
+	m_File = std::move(other.m_File);
+	m_Data = other.m_Data;
+	m_Header = other.m_Header;
+
+	other.m_Data = nullptr;
+	other.m_Header = nullptr;
+
+	return *this;
+}
+
+void SymbolIndex::AdoptImage(std::vector<char> image)
+{
+	m_File.Unmap();
+	m_Image = std::move(image);
+	m_Data = m_Image.data();
+	m_Header = (const symbolIndexHeader_t*)m_Data;
+}
+
+void SymbolIndex::Build(const std::vector<std::string>& files, size_t threadCount, const ModuleCache* cache, std::vector<std::string>& failedFiles)
+{
+	std::vector<std::vector<indexedSymbol_t>> moduleSymbols(files.size());
+	std::vector<char> failed(files.size());
+
+	WorkStealingFor(files.size(), threadCount, [&](size_t, size_t index)
+	{
+		failed[index] = !CollectModuleSymbols(files[index], cache, moduleSymbols[index]);
+	});
+
+	for (size_t i = 0; i < files.size(); i++)
+		if (failed[i])
+			failedFiles.push_back(files[i]);
+
+	// (module, symbol) pairs in key order
+	std::vector<std::pair<uint32_t, uint32_t>> order;
+
+	for (uint32_t i = 0; i < files.size(); i++)
+		for (uint32_t j = 0; j < moduleSymbols[i].size(); j++)
+			order.push_back({ i, j });
+
+	std::sort(order.begin(), order.end(), [&](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b)
+	{
+		const indexedSymbol_t& first = moduleSymbols[a.first][a.second];
+		const indexedSymbol_t& second = moduleSymbols[b.first][b.second];
+
+		if (int difference = first.key.compare(second.key))
+			return difference < 0;
+
+		return a < b;
+	});
+
+	std::string strings;
+
+	auto addString = [&](std::string_view value) -> cacheString_t
+	{
+		cacheString_t result = { (uint32_t)strings.length(), (uint32_t)value.length() };
+		strings.append(value);
+
+		return result;
+	};
+
+	std::vector<cacheString_t> paths;
+
+	for (const std::string& path : files)
+		paths.push_back(addString(path));
+
+	std::vector<symbolRecord_t> records;
+	records.reserve(order.size());
+
+	for (const std::pair<uint32_t, uint32_t>& position : order)
+	{
+		const indexedSymbol_t& symbol = moduleSymbols[position.first][position.second];
+
+		symbolRecord_t record = {};
+		record.key = addString(symbol.key);
+		record.name = addString(symbol.name);
+		record.signature = addString(symbol.signature);
+		record.file = position.first;
+		record.offset = (uint32_t)symbol.offset;
+		record.row = (uint32_t)symbol.row;
+		record.column = (uint32_t)symbol.column;
+		record.isFunction = symbol.isFunction;
+		record.exported = symbol.exported;
+
+		records.push_back(record);
+	}
+
+	// Header, paths, records and strings, each 8-aligned
+	auto aligned = [](size_t size) { return (size + 7) & ~(size_t)7; };
+
+	symbolIndexHeader_t header = {};
+	header.magic = SYMBOL_INDEX_MAGIC;
+	header.version = SYMBOL_INDEX_VERSION;
+	header.byteOrder = SYMBOL_INDEX_BYTE_ORDER;
+	header.files = { aligned(sizeof(header)), paths.size() };
+	header.symbols = { aligned(header.files.offset + paths.size() * sizeof(cacheString_t)), records.size() };
+	header.strings = { aligned(header.symbols.offset + records.size() * sizeof(symbolRecord_t)), strings.length() };
+	header.fileSize = header.strings.offset + strings.length();
+
+	std::vector<char> image(header.fileSize);
+	memcpy(image.data(), &header, sizeof(header));
+
+	if (!paths.empty())
+		memcpy(image.data() + header.files.offset, paths.data(), paths.size() * sizeof(cacheString_t));
+
+	if (!records.empty())
+		memcpy(image.data() + header.symbols.offset, records.data(), records.size() * sizeof(symbolRecord_t));
+
+	if (!strings.empty())
+		memcpy(image.data() + header.strings.offset, strings.data(), strings.length());
+
+	AdoptImage(std::move(image));
+}
+
+bool SymbolIndex::Save(const char* fileName) const
+{
+	if (!m_Header)
+		return false;
+
+	FILE* file = fopen(fileName, "wb");
+
+	if (!file)
+		return false;
+
+	bool written = fwrite(m_Data, 1, (size_t)m_Header->fileSize, file) == m_Header->fileSize;
+
+	return fclose(file) == 0 && written;
+}
+
+static bool IsValidSection(const cacheSection_t& section, size_t elementSize, size_t length)
+{
+	return section.offset % 8 == 0 && section.offset <= length && section.count <= (length - section.offset) / elementSize;
+}
+
+bool SymbolIndex::Load(const char* fileName)
+{
+	m_Image.clear();
+	m_Data = nullptr;
+	m_Header = nullptr;
+
+	if (!m_File.Map(fileName))
+		return false;
+
+	const symbolIndexHeader_t* header = (const symbolIndexHeader_t*)m_File.Data();
+	size_t length = m_File.Length();
+
+	if (length < sizeof(symbolIndexHeader_t) || header->magic != SYMBOL_INDEX_MAGIC || header->version != SYMBOL_INDEX_VERSION ||
+		header->byteOrder != SYMBOL_INDEX_BYTE_ORDER || header->fileSize != length ||
+		!IsValidSection(header->files, sizeof(cacheString_t), length) || !IsValidSection(header->symbols, sizeof(symbolRecord_t), length) ||
+		!IsValidSection(header->strings, 1, length))
+	{
+		m_File.Unmap();
+		return false;
+	}
+
+	m_Data = m_File.Data();
+	m_Header = header;
+
+	return true;
+}
+
+symbolDefinition_t SymbolIndex::Definition(size_t index) const
+{
+	const symbolRecord_t& record = Records()[index];
+	const cacheString_t* paths = (const cacheString_t*)(m_Data + m_Header->files.offset);
+
+	symbolDefinition_t result;
+	result.name = String(record.name);
+	result.signature = String(record.signature);
+	result.file = String(paths[record.file]);
+	result.offset = record.offset;
+	result.row = record.row;
+	result.column = record.column;
+	result.isFunction = record.isFunction != 0;
+	result.exported = record.exported != 0;
+
+	return result;
+}
+
+std::pair<size_t, size_t> SymbolIndex::KeyRange(std::string_view name, bool exact) const
+{
+	if (!m_Header)
+		return { 0, 0 };
+
+	std::string key = FoldIdentifier(name);
+
+	const symbolRecord_t* begin = Records();
+	const symbolRecord_t* end = begin + m_Header->symbols.count;
+
+	const symbolRecord_t* first = std::lower_bound(begin, end, key, [&](const symbolRecord_t& record, const std::string& key)
+	{
+		return String(record.key) < key;
+	});
+
+	// Keys starting with a prefix follow each other from the first one on
+	const symbolRecord_t* last = std::partition_point(first, end, [&](const symbolRecord_t& record)
+	{
+		std::string_view recordKey = String(record.key);
+		return exact ? recordKey == key : recordKey.substr(0, key.length()) == key;
+	});
+
+	return { (size_t)(first - begin), (size_t)(last - begin) };
+}
+
+static void PrintDefinitions(const SymbolIndex& index, std::pair<size_t, size_t> range, size_t limit)
+{
+	for (size_t i = range.first; i < range.second && i < range.first + limit; i++)
+	{
+		symbolDefinition_t definition = index.Definition(i);
+		printf("%s:%zu:%zu: %s\n", std::string(definition.file).c_str(), definition.row, definition.column, std::string(definition.signature).c_str());
+	}
+
+	if (range.second - range.first > limit)
+		printf("... %zu more\n", range.second - range.first - limit);
+}
+
+static int RunIndexBuild(int argc, char** argv)
+{
+	size_t threadCount = HardwareThreadCount();
+	std::unique_ptr<ModuleCache> cache;
+	const char* indexFile = nullptr;
+	std::vector<batchFile_t> files;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			threadCount = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "--cache") && i + 1 < argc)
+			cache = std::make_unique<ModuleCache>(argv[++i]);
+		else if (!indexFile)
+			indexFile = argv[i];
+		else if (!CollectFiles(argv[i], files))
+			fprintf(stderr, "Can't read %s\n", argv[i]);
+	}
+
+	if (!indexFile || files.empty())
+	{
+		fprintf(stderr, "No modules to index\n");
+		return 1;
+	}
+
+	// Largest first, as in batch
+	std::sort(files.begin(), files.end(), [](const batchFile_t& a, const batchFile_t& b)
+	{
+		return a.size != b.size ? a.size > b.size : a.path < b.path;
+	});
+
+	std::vector<std::string> paths;
+
+	for (const batchFile_t& file : files)
+		paths.push_back(file.path);
+
+	auto start = std::chrono::steady_clock::now();
+
+	SymbolIndex index;
+	std::vector<std::string> failedFiles;
+	index.Build(paths, threadCount, cache.get(), failedFiles);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::sort(failedFiles.begin(), failedFiles.end());
+
+	for (const std::string& path : failedFiles)
+		printf("%s: not indexed\n", path.c_str());
+
+	if (!index.Save(indexFile))
+	{
+		fprintf(stderr, "Can't write %s\n", indexFile);
+		return 1;
+	}
+
+	printf("%zu symbols from %zu modules in %.3f s on %zu threads, %zu failed\n", index.Size(), files.size(), seconds, threadCount, failedFiles.size());
+
+	return failedFiles.empty() ? 0 : 1;
+}
+
+int RunSymbolIndex(int argc, char** argv)
+{
+	if (argc > 0 && !strcmp(argv[0], "build"))
+		return RunIndexBuild(argc - 1, argv + 1);
+
+	bool find = argc == 3 && !strcmp(argv[0], "find");
+	bool complete = argc == 3 && !strcmp(argv[0], "complete");
+
+	if (!find && !complete)
+	{
+		fprintf(stderr, "Usage: index build [-j threads] [--cache directory] index path...\n"
+			"       index find index name\n"
+			"       index complete index prefix\n");
+		return 1;
+	}
+
+	SymbolIndex index;
+
+	if (!index.Load(argv[1]))
+	{
+		fprintf(stderr, "Can't read index %s\n", argv[1]);
+		return 1;
+	}
+
+	auto lookup = [&]() { return find ? index.Find(argv[2]) : index.Complete(argv[2]); };
+
+	// A single lookup is too short for the clock, so time a run of them
+	const size_t repeats = 100000;
+	std::pair<size_t, size_t> range;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < repeats; i++)
+		range = lookup();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	PrintDefinitions(index, range, 50);
+	printf("%zu of %zu symbols match, %.2f us per lookup\n", range.second - range.first, index.Size(), seconds / repeats * 1e6);
+
+	return range.first == range.second ? 1 : 0;
+}
+
+}
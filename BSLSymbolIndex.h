@@ -0,0 +1,147 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "BSLModuleCache.h"
+#include "BSLSource.h"
+
+namespace BSL
+{
+
+// Bump whenever the index file layout changes
+constexpr uint32_t SYMBOL_INDEX_VERSION = 1;
+
+// Row of the Symbols section, sorted by key, then file, then offset
+typedef struct
+{
+	// FoldIdentifier of the name
+	cacheString_t key;
+	cacheString_t name;
+	cacheString_t signature;
+
+	// Row of the Files section
+	uint32_t file;
+
+	// Where the name is written in the module
+	uint32_t offset;
+	uint32_t row;
+	uint32_t column;
+
+	uint8_t isFunction;
+	uint8_t exported;
+	uint8_t reserved[2];
+}symbolRecord_t;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t reserved;
+
+	uint64_t fileSize;
+
+	// cacheString_t paths, symbolRecord_t rows and the string pool
+	cacheSection_t files;
+	cacheSection_t symbols;
+	cacheSection_t strings;
+}symbolIndexHeader_t;
+
+// Definition as returned by lookups; strings point into the index
+typedef struct
+{
+	std::string_view name;
+	// Header as written in the module, e.g. "&НаСервере Функция Имя(Знач А, Б = 1) Экспорт"
+	std::string_view signature;
+	std::string_view file;
+
+	size_t offset;
+	size_t row;
+	size_t column;
+
+	bool isFunction;
+	bool exported;
+}symbolDefinition_t;
+
+// Procedures and functions of a set of modules by name. Records are one
+// array sorted by folded name, so an exact match or every name starting with
+// a prefix is a contiguous range found by binary search. The same layout is
+// kept in memory and on disk, so a saved index is mapped and used in place.
+class SymbolIndex
+{
+	// Built image, empty for a mapped index
+	std::vector<char> m_Image;
+	MappedFile m_File;
+
+	const char* m_Data;
+	const symbolIndexHeader_t* m_Header;
+
+	std::string_view String(const cacheString_t& value) const
+	{
+		return std::string_view(m_Data + m_Header->strings.offset + value.offset, value.length);
+	}
+
+	const symbolRecord_t* Records() const
+	{
+		return (const symbolRecord_t*)(m_Data + m_Header->symbols.offset);
+	}
+
+	// Records whose key starts with key, or equals it if exact is set
+	std::pair<size_t, size_t> KeyRange(std::string_view name, bool exact) const;
+	void AdoptImage(std::vector<char> image);
+public:
+	SymbolIndex();
+	SymbolIndex(SymbolIndex&& other) noexcept;
+	SymbolIndex& operator=(SymbolIndex&& other) noexcept;
+	SymbolIndex(const SymbolIndex&) = delete;
+	SymbolIndex& operator=(const SymbolIndex&) = delete;
+
+	// Parses the given modules on threadCount threads (0 for one per core)
+	// and indexes their subprograms, those of modules with syntax errors
+	// too. Modules that fail to open are skipped and added to failedFiles.
+	// With a cache, modules that have an entry are read from it and parsed
+	// ones without errors are stored.
+	void Build(const std::vector<std::string>& files, size_t threadCount, const ModuleCache* cache, std::vector<std::string>& failedFiles);
+
+	bool Save(const char* fileName) const;
+	bool Load(const char* fileName);
+
+	size_t Size() const
+	{
+		return m_Header ? (size_t)m_Header->symbols.count : 0;
+	}
+
+	size_t FileCount() const
+	{
+		return m_Header ? (size_t)m_Header->files.count : 0;
+	}
+
+	symbolDefinition_t Definition(size_t index) const;
+
+	// Indices [first, second) of the definitions named name, in any case
+	std::pair<size_t, size_t> Find(std::string_view name) const
+	{
+		return KeyRange(name, true);
+	}
+
+	// Indices [first, second) of the definitions whose name starts with prefix,
+	// in any case, ordered by name
+	std::pair<size_t, size_t> Complete(std::string_view prefix) const
+	{
+		return KeyRange(prefix, false);
+	}
+};
+
+// Header of the subprogram whose keyword is at keywordOffset as written, up
+// to the closing bracket or Экспорт, with comments dropped and whitespace
+// runs replaced by one space; also finds the offset of the name
+std::string SubprogramHeaderText(std::string_view text, size_t keywordOffset, bool exported, size_t& nameOffset);
+
+// Entry point of "BSLTool index": "build [-j threads] [--cache directory]
+// index path..." indexes the modules the paths name, "find index name" and
+// "complete index prefix" print the matching definitions
+int RunSymbolIndex(int argc, char** argv);
+
+}
@@ -1,6 +1,6 @@
-#include <windows.h>
 #include "BSLToken.h"
 #include <algorithm>
+#include "BSLTrace.h"
 #include "Utils.h"
 
 constexpr auto CR = '\n';
@@ -8,385 +8,509 @@ constexpr auto CR = '\n';
 namespace BSL
 {
 
-void TokenStream::DoLexModule(std::wstring& sourceCode)
+std::string_view TokenTable::Value(size_t index) const
 {
-	size_t dataLength = sourceCode.length();
+	if (HasFlag(index, TOKEN_FLAG_OWNED_VALUE))
+		return m_Source->ownedValues.find(m_Offsets[index])->second;
 
-	if (!dataLength)
-		return;
+	return m_Source->buffer.Text().substr(m_Offsets[index], m_Lengths[index]);
+}
 
-	size_t offset = 0;
-	bool inStringLiteral = false;
-	bool inComment = false;
+double TokenTable::NumericValue(size_t index) const
+{
+	if (m_Types[index] != TokenTypes::NumericConst)
+		return 0;
 
-	size_t tokenStartRow = 0;
-	size_t tokenStartColumn = 0;
-	size_t tokenStartOffset = 0;
-	
-	size_t currentRow = 1;
-	size_t currentColumn = 1;
-		
-	std::wstring tokenValue = L"";
+	return m_Source->numericValues.find(m_Offsets[index])->second;
+}
+
+// Row from the line-start table; the column counts code points from the
+// start of the line, so UTF-8 continuation bytes are not counted
+textHumanPosition_t TokenTable::TextPosition(size_t index) const
+{
+	const std::vector<uint32_t>& lineStarts = m_Source->lineStarts;
+	uint32_t offset = m_Offsets[index];
 
-	auto peekSymbol = [&](size_t peekOffset) -> wchar_t {
+	auto line = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset) - 1;
+	const char* text = m_Source->buffer.Text().data();
 
-		size_t calculatedOffset = offset + peekOffset;
+	textHumanPosition_t result;
+	result.row = line - lineStarts.begin() + 1;
+	result.column = 1;
 
-		if (calculatedOffset < dataLength)
-			return sourceCode[calculatedOffset];
-		else
-			return NULL;
-	};
+	for (uint32_t i = *line; i < offset; i++)
+		if ((text[i] & 0xC0) != 0x80)
+			result.column++;
 
-	auto pushCurrentTokenAndStartNext = [&]()
-	{
-		PushToken(tokenValue, tokenStartRow, tokenStartColumn, tokenStartOffset, inStringLiteral);
+	return result;
+}
+
+void TokenTable::Push(TokenTypes type, size_t offset, size_t length, uint8_t flags, uint32_t atom)
+{
+	m_Types.push_back(type);
+	m_Offsets.push_back((uint32_t)offset);
+	m_Lengths.push_back((uint32_t)length);
+	m_Flags.push_back(flags);
+	m_Atoms.push_back(atom);
+
+	if (m_TypeIndex)
+		m_TypeIndex->Add(type, m_Types.size() - 1);
+}
+
+void TokenTable::Append(const TokenTable& other, size_t first, size_t last)
+{
+	if (!m_Source)
+		m_Source = other.m_Source;
+
+	m_Types.insert(m_Types.end(), other.m_Types.begin() + first, other.m_Types.begin() + last);
+	m_Offsets.insert(m_Offsets.end(), other.m_Offsets.begin() + first, other.m_Offsets.begin() + last);
+	m_Lengths.insert(m_Lengths.end(), other.m_Lengths.begin() + first, other.m_Lengths.begin() + last);
+	m_Flags.insert(m_Flags.end(), other.m_Flags.begin() + first, other.m_Flags.begin() + last);
+	m_Atoms.insert(m_Atoms.end(), other.m_Atoms.begin() + first, other.m_Atoms.begin() + last);
+}
 
-		tokenStartOffset = offset;
-		tokenValue = L"";
-	};
+template<class T>
+static void ReplaceRange(std::vector<T>& data, size_t first, size_t last, const std::vector<T>& replacement)
+{
+	size_t removed = last - first;
+	size_t common = std::min(removed, replacement.size());
+
+	std::copy(replacement.begin(), replacement.begin() + common, data.begin() + first);
+
+	if (removed > common)
+		data.erase(data.begin() + first + common, data.begin() + last);
+	else
+		data.insert(data.begin() + first + common, replacement.begin() + common, replacement.end());
+}
 
-	while (true)
+// Moves the values keyed by offsets from from on out of values
+template<class T>
+static std::map<uint32_t, T> ExtractValuesFrom(std::map<uint32_t, T>& values, size_t from)
+{
+	std::map<uint32_t, T> extracted;
+
+	for (auto value = values.lower_bound((uint32_t)from); value != values.end();)
+		extracted.insert(values.extract(value++));
+
+	return extracted;
+}
+
+// Moves the values keyed by offsets from from on back into values, shifted by delta
+template<class T>
+static void RestoreValuesFrom(std::map<uint32_t, T>& values, std::map<uint32_t, T>& extracted, size_t from, ptrdiff_t delta)
+{
+	for (auto value = extracted.lower_bound((uint32_t)from); value != extracted.end();)
 	{
-		if (offset == dataLength)
-			break;
+		auto node = extracted.extract(value++);
+		node.key() = (uint32_t)(node.key() + delta);
+		values.insert(std::move(node));
+	}
+}
 
-		wchar_t curSymbol = peekSymbol(0);
-		wchar_t nextSymbol = peekSymbol(1);
+void TokenTable::Replace(size_t first, size_t last, const TokenTable& replacement)
+{
+	if (m_TypeIndex)
+		m_TypeIndex->Replace(first, last, replacement);
+
+	ReplaceRange(m_Types, first, last, replacement.m_Types);
+	ReplaceRange(m_Offsets, first, last, replacement.m_Offsets);
+	ReplaceRange(m_Lengths, first, last, replacement.m_Lengths);
+	ReplaceRange(m_Flags, first, last, replacement.m_Flags);
+	ReplaceRange(m_Atoms, first, last, replacement.m_Atoms);
+}
 
-		if (curSymbol == CR)
-		{
-			currentColumn = 1;
-			currentRow++;
-			inComment = false;
-		}
+std::pair<const uint32_t*, const uint32_t*> TokenTypeIndex::PositionsInRange(TokenTypes type, size_t begin, size_t end) const
+{
+	const std::vector<uint32_t>& positions = m_Positions[(size_t)type];
 
-		if (curSymbol == '/' && nextSymbol == '/' && !(inComment || inStringLiteral))
-		{
-			pushCurrentTokenAndStartNext();
-			inComment = true;
-		}
+	auto first = std::lower_bound(positions.begin(), positions.end(), (uint32_t)begin);
+	auto last = std::lower_bound(first, positions.end(), (uint32_t)end);
 
-		if (inComment)
-		{
-			tokenValue += curSymbol;
-		}
-		else if (IsWhitespaceSymbol(curSymbol) && !inStringLiteral)
-		{
-			pushCurrentTokenAndStartNext();
-		}
-		else if (IsTokenDivider(curSymbol) && !inStringLiteral)
-		{
-			pushCurrentTokenAndStartNext();
+	return std::make_pair(positions.data() + (first - positions.begin()), positions.data() + (last - positions.begin()));
+}
 
-			tokenValue += curSymbol;
+void TokenTypeIndex::Replace(size_t first, size_t last, const TokenTable& replacement)
+{
+	std::vector<uint32_t> inserted[TOKEN_TYPE_COUNT];
 
-			pushCurrentTokenAndStartNext();
-		}
-		else if (curSymbol == '\"')
-		{
-			if (inStringLiteral)
-			{
-				if (nextSymbol == '\"')
-				{
-					tokenValue += '"';
-					offset++;
-				}
-				else
-				{
-					pushCurrentTokenAndStartNext();
-					inStringLiteral = false;
-				}
-			}
-			else
-			{
-				inStringLiteral = true;
-				tokenStartOffset = offset;
-				tokenValue = L"";
-
-			}
-		}
-		else
-		{
-			if (tokenValue == L"")
-			{
-				tokenStartOffset = offset;
-				tokenStartRow = currentRow;
-				tokenStartColumn = currentColumn;
-			}
-
-			tokenValue += curSymbol;
-		}
+	for (size_t i = 0; i < replacement.Size(); i++)
+		inserted[(size_t)replacement.Type(i)].push_back((uint32_t)(first + i));
 
-		currentColumn++;
-		offset++;
+	ptrdiff_t delta = (ptrdiff_t)replacement.Size() - (ptrdiff_t)(last - first);
 
+	for (size_t type = 0; type < TOKEN_TYPE_COUNT; type++)
+	{
+		std::vector<uint32_t>& positions = m_Positions[type];
+
+		size_t removedFirst = std::lower_bound(positions.begin(), positions.end(), (uint32_t)first) - positions.begin();
+		size_t removedLast = std::lower_bound(positions.begin() + removedFirst, positions.end(), (uint32_t)last) - positions.begin();
+
+		if (delta)
+			for (size_t i = removedLast; i < positions.size(); i++)
+				positions[i] = (uint32_t)(positions[i] + delta);
+
+		ReplaceRange(positions, removedFirst, removedLast, inserted[type]);
+		m_Present.set(type, !positions.empty());
 	}
+}
+
+void TokenTable::Clear()
+{
+	m_Types.clear();
+	m_Offsets.clear();
+	m_Lengths.clear();
+	m_Flags.clear();
+	m_Atoms.clear();
+
+	if (m_TypeIndex)
+		m_TypeIndex = std::make_unique<TokenTypeIndex>();
+}
+
+// Lexes from startOffset, which has to be a token boundary, appending to m_Data.
+// With resync given, stops as soon as the new tokens line up with the old
+// ones (see CheckResync) and returns true; that last token is left in m_Data.
+// A full lex also fills the line-start table, ApplyEdit maintains it otherwise.
+bool TokenStream::DoLexModule(size_t startOffset, lexResync_t* resync)
+{
+	TraceScope scope("lex");
 
+	Lexer lexer(startOffset);
 
-	if (tokenValue != L"")
-		pushCurrentTokenAndStartNext();
+	m_Resync = resync;
+	lexer.Lex(m_Data.m_Source->buffer.Text(), 0, true, *this);
+	m_Resync = nullptr;
+
+	return resync && resync->synced;
 }
 
-TokenStream::TokenStream(std::wstring& sourceCode)
+TokenStream::TokenStream(SourceBuffer sourceCode, bool indexTypes) : TokenSpan(&m_Data, 0, 0)
 {
-	m_Position = 0;
-	m_Data.clear();
+	m_Resync = nullptr;
+
+	if (indexTypes)
+		m_Data.m_TypeIndex = std::make_unique<TokenTypeIndex>();
 
-	DoLexModule(sourceCode);
+	m_Data.m_Source = std::make_shared<tokenStreamSource_t>();
+	m_Data.m_Source->buffer = std::move(sourceCode);
+	m_Data.m_Source->lineStarts.push_back(0);
+
+	DoLexModule();
+	m_End = m_Data.Size();
 }
 
-TokenStream::~TokenStream()
+TokenStream::TokenStream(std::string sourceCode, bool indexTypes) : TokenStream(SourceBuffer(std::move(sourceCode)), indexTypes)
 {
-	m_Data.clear();
-	m_Data.shrink_to_fit();
 }
 
-void TokenStream::Reset()
+// Called after every token pushed by an incremental re-lex. Once a new token
+// starts past the inserted text exactly where an old token started, both
+// lexers are between tokens in front of identical text, so the rest of the
+// old tokens stays valid.
+bool TokenStream::CheckResync(lexResync_t& resync)
 {
-	m_Position = 0;
+	size_t start = m_Data.RawStart(m_Data.Size() - 1);
+
+	if (start < resync.editEnd)
+		return false;
+
+	size_t oldStart = (size_t)((ptrdiff_t)start - resync.delta);
+	const TokenTable& tail = *resync.tailTokens;
+
+	while (resync.tailPosition < tail.Size() && tail.RawStart(resync.tailPosition) < oldStart)
+		resync.tailPosition++;
+
+	return resync.tailPosition < tail.Size() && tail.RawStart(resync.tailPosition) == oldStart;
 }
 
-BSL::tokenStreamElement_t* TokenStream::PeekNextToken()
+tokenStreamEdit_t TokenStream::ApplyEdit(size_t offset, size_t removedLength, std::string_view insertedText)
 {
-	if (m_Position + 1 == m_Data.size())
+	tokenStreamSource_t& source = *m_Data.m_Source;
+	std::string_view oldText = source.buffer.Text();
+
+	offset = std::min(offset, oldText.length());
+	removedLength = std::min(removedLength, oldText.length() - offset);
+
+	size_t editEnd = offset + removedLength;
+	ptrdiff_t delta = (ptrdiff_t)insertedText.length() - (ptrdiff_t)removedLength;
+
+	// Restart at the last token starting before the edit, which may be extended
+	// by it; string literal offsets point past the quote, so step over them
+	size_t first = 0;
+	size_t last = m_Data.Size();
+
+	while (first < last)
 	{
-		throw new UnexcpectedEndOfTokenStream;
-		return nullptr;
+		size_t middle = (first + last) / 2;
+
+		if (m_Data.RawStart(middle) < offset)
+			first = middle + 1;
+		else
+			last = middle;
 	}
 
-	tokenStreamElement_t* el = &m_Data[m_Position + 1];
-	return el;
-}
+	size_t restart = first;
 
-BSL::tokenStreamElement_t* TokenStream::ReadToken(bool expectingToHaveAny)
-{
-	if (m_Position == m_Data.size())
+	if (restart > 0)
+		restart--;
+
+	while (restart > 0 && m_Data.HasFlag(restart, TOKEN_FLAG_STRING_LITERAL))
+		restart--;
+
+	// An integer and a dot right after it may turn into a decimal number
+	if (restart > 0 && m_Data.Type(restart) == TokenTypes::DotSign && m_Data.Type(restart - 1) == TokenTypes::NumericConst &&
+		m_Data.SourceOffset(restart - 1) + m_Data.SourceLength(restart - 1) == m_Data.SourceOffset(restart))
+		restart--;
+
+	size_t restartOffset = restart > 0 ? m_Data.RawStart(restart) : 0;
+
+	std::string newText;
+	newText.reserve(oldText.length() + insertedText.length() - removedLength);
+	newText.append(oldText.substr(0, offset));
+	newText.append(insertedText);
+	newText.append(oldText.substr(editEnd));
+
+	// Lines starting inside the removed range go away, the inserted text brings
+	// its own and lines after the edit move with the text
+	auto firstRemovedLine = std::upper_bound(source.lineStarts.begin(), source.lineStarts.end(), (uint32_t)offset);
+	auto firstKeptLine = std::upper_bound(firstRemovedLine, source.lineStarts.end(), (uint32_t)editEnd);
+
+	std::vector<uint32_t> insertedLines;
+
+	for (size_t i = 0; i < insertedText.length(); i++)
+		if (insertedText[i] == CR)
+			insertedLines.push_back((uint32_t)(offset + i + 1));
+
+	for (auto line = firstKeptLine; line != source.lineStarts.end(); ++line)
+		*line = (uint32_t)(*line + delta);
+
+	ReplaceRange(source.lineStarts, firstRemovedLine - source.lineStarts.begin(), firstKeptLine - source.lineStarts.begin(), insertedLines);
+
+	// Owned and numeric values are keyed by offset: those from the re-lexed range
+	// are pushed again by the lexer, later ones are re-keyed once the tail is known
+	std::map<uint32_t, std::string> oldOwnedValues = ExtractValuesFrom(source.ownedValues, restartOffset);
+	std::map<uint32_t, double> oldNumericValues = ExtractValuesFrom(source.numericValues, restartOffset);
+
+	source.buffer = SourceBuffer::FromUtf8(std::move(newText));
+
+	// The lexer appends to m_Data, so let it start empty while the old tokens
+	// are kept aside for resync checks and splicing
+	TokenTable tokens;
+	tokens.m_Source = m_Data.m_Source;
+	std::swap(tokens, m_Data);
+
+	lexResync_t resync;
+	resync.tailTokens = &tokens;
+	resync.tailPosition = restart;
+	resync.delta = delta;
+	resync.editEnd = offset + insertedText.length();
+	resync.synced = false;
+
+	bool synced = DoLexModule(restartOffset, &resync);
+
+	size_t tailStart = tokens.Size();
+
+	if (synced)
 	{
-		if (expectingToHaveAny)
-			throw new UnexcpectedEndOfTokenStream;
+		// The last token pushed is the first old token after the resync point
+		tailStart = resync.tailPosition;
+
+		m_Data.m_Types.pop_back();
+		m_Data.m_Offsets.pop_back();
+		m_Data.m_Lengths.pop_back();
+		m_Data.m_Flags.pop_back();
+		m_Data.m_Atoms.pop_back();
+
+		size_t tailOffset = tokens.SourceOffset(tailStart);
 
-			return nullptr;
+		RestoreValuesFrom(source.ownedValues, oldOwnedValues, tailOffset, delta);
+		RestoreValuesFrom(source.numericValues, oldNumericValues, tailOffset, delta);
 	}
 
-	tokenStreamElement_t* el = &m_Data[m_Position];
-	m_Position++;
-	return el;
+	std::swap(tokens, m_Data);
+
+	size_t removedTokens = tailStart - restart;
+	m_Data.Replace(restart, tailStart, tokens);
+
+	for (size_t i = restart + tokens.Size(); i < m_Data.Size(); i++)
+		m_Data.m_Offsets[i] = (uint32_t)(m_Data.m_Offsets[i] + delta);
+
+	tokenStreamEdit_t result;
+	result.firstToken = restart;
+	result.removedTokens = removedTokens;
+	result.insertedTokens = tokens.Size();
+
+	m_End = m_Data.Size();
+	m_Position = 0;
+	return result;
 }
 
-void TokenStream::CheckToken(TokenTypes type)
+tokenStreamEdit_t CombineEdits(const tokenStreamEdit_t& first, const tokenStreamEdit_t& second)
 {
-	tokenStreamElement_t* el = ReadToken(true);
+	// End of what changed, in the indices between the edits and after both
+	size_t middleEnd = std::max(first.firstToken + first.insertedTokens, second.firstToken + second.removedTokens);
+	size_t newEnd = middleEnd + second.insertedTokens - second.removedTokens;
 
-	if (el->type != type)
-		throw new UnexcpectedToken(type, el->type);
+	tokenStreamEdit_t result;
+	result.firstToken = std::min(first.firstToken, second.firstToken);
+	result.insertedTokens = newEnd - result.firstToken;
+	result.removedTokens = newEnd + first.removedTokens - first.insertedTokens + second.removedTokens - second.insertedTokens - result.firstToken;
 
+	return result;
 }
 
-BSL::tokenStreamElement_t* TokenStream::CurrentToken()
+TokenStream::~TokenStream()
 {
-	if (m_Position == m_Data.size())
-	{
-		throw new UnexcpectedEndOfTokenStream;
-		return nullptr;
-	}
+	m_Data.Clear();
+}
 
-	tokenStreamElement_t* el = &m_Data[m_Position];	
-	return el;
+void TokenSpan::Reset()
+{
+	m_Position = m_Begin;
 }
 
-bool TokenStream::HasToken(TokenTypes type)
+TokenHandle TokenSpan::PeekNextToken()
 {
-	for (auto token : m_Data)
-		if (token.type == type)
-			return true;
+	if (m_Position + 1 >= m_End)
+		return TokenHandle();
 
-	return false;
+	return TokenHandle(m_Table, m_Position + 1);
 }
 
-TokenStream* TokenStream::ExtractSubstream(TokenTypes blockStartToken, TokenTypes blockEndToken)
+TokenHandle TokenSpan::ReadToken()
 {
-	TokenStream* pResult = new TokenStream;
-	//pResult->m_Data.push_back(*currentToken);
-
-	int level = 0;
+	if (m_Position == m_End)
+		return TokenHandle();
 
-	while (true)
-	{
-		tokenStreamElement_t* nextToken = ReadToken();
+	TokenHandle el(m_Table, m_Position);
+	m_Position++;
+	return el;
+}
 
-		if (!nextToken)
-			throw new UnexcpectedEndOfTokenStream;
+TokenHandle TokenSpan::CurrentToken()
+{
+	if (m_Position == m_End)
+		return TokenHandle();
 
-		if (nextToken->type == blockStartToken)
-			level++;
+	return TokenHandle(m_Table, m_Position);
+}
 
-		if (nextToken->type == blockEndToken)
-		{
-			if (level == 0)
-			{
-				//pResult->m_Data.push_back(*nextToken);
-				break;
-			}
-			
-			level--;
-		}
+bool TokenSpan::HasToken(TokenTypes type)
+{
+	if (const TokenTypeIndex* index = m_Table->TypeIndex())
+	{
+		if (m_Begin == 0 && m_End == m_Table->Size())
+			return index->Has(type);
 
-		pResult->m_Data.push_back(*nextToken);
-		
+		auto positions = index->PositionsInRange(type, m_Begin, m_End);
+		return positions.first != positions.second;
 	}
 
-	return pResult;
+	auto begin = m_Table->m_Types.begin();
+	return std::find(begin + m_Begin, begin + m_End, type) != begin + m_End;
 }
 
-TokenStream* TokenStream::ExtractExpressionSubstream()
+std::vector<TokenHandle> TokenSpan::TokensOfType(TokenTypes type)
 {
-	if (m_Position == m_Data.size())
-		return nullptr;
+	std::vector<TokenHandle> result;
 
-	TokenStream* pResult = new TokenStream;
-	
-	while (true)
+	if (const TokenTypeIndex* index = m_Table->TypeIndex())
 	{
-		tokenStreamElement_t* el = ReadToken();
-
-		if (el == nullptr)
-			break;
+		auto positions = index->PositionsInRange(type, m_Begin, m_End);
 
-		if (el->type == TokenTypes::EndExpression)
-			break;
-
-		pResult->m_Data.push_back(*el);
+		result.reserve(positions.second - positions.first);
 
+		for (const uint32_t* position = positions.first; position != positions.second; position++)
+			result.emplace_back(m_Table, *position);
+	}
+	else
+	{
+		for (size_t i = m_Begin; i < m_End; i++)
+			if (m_Table->Type(i) == type)
+				result.emplace_back(m_Table, i);
 	}
 
-	return pResult;
+	return result;
 }
 
-void TokenStream::PushToken(std::wstring& tokenValue, size_t tokenStartRow, size_t tokenStartColumn, size_t offset, bool isStringLiteral)
+std::optional<TokenSpan> TokenSpan::ExtractSubstream(TokenTypes blockStartToken, TokenTypes blockEndToken)
 {
-	if (tokenValue == L"")
-		return;
+	TraceScope scope("extract");
 
-	if (tokenValue[0] == 0xFEFF)
-		return;
+	size_t begin = m_Position;
+	int level = 0;
 
-//  	if (trim(tokenValue) == L"")
-//  		return;
+	while (m_Position < m_End)
+	{
+		TokenTypes type = m_Table->Type(m_Position++);
 
-	tokenStreamElement_t elem;
+		if (type == blockStartToken)
+			level++;
 
-	elem.value = tokenValue;	
-	elem.textPosition.row = tokenStartRow;
-	elem.textPosition.column = tokenStartColumn;
-	elem.sourceOffset = offset;
-	elem.sourceLength = tokenValue.length();
-	elem.isStringLiteral = isStringLiteral;
+		if (type == blockEndToken)
+		{
+			if (level == 0)
+				return TokenSpan(m_Table, begin, m_Position - 1);
+			
+			level--;
+		}
+	}
 
-	wchar_t* p;
-	long converted = wcstol(tokenValue.c_str(), &p, 10);
+	return std::nullopt;
+}
 
+std::optional<TokenSpan> TokenSpan::ExtractExpressionSubstream()
+{
+	if (m_Position == m_End)
+		return std::nullopt;
 
-	if (isStringLiteral)
-		elem.type = TokenTypes::StringConst;
-	else if (tokenValue[0] == L'&')
-		elem.type = TokenTypes::Annotation;
-	else if (*p == 0)
-		elem.type = TokenTypes::NumericConst;
-	else if (tokenValue.length() >= 2 && tokenValue[0] == '/' && tokenValue[1] == '/')
-		elem.type = TokenTypes::Comment;
-	else
-		elem.type = TokenTypeFromValue(tokenValue);
+	size_t begin = m_Position;
 	
-	elem.isFunctionCallHint = false;
-	m_Data.push_back(elem);
+	while (m_Position < m_End)
+	{
+		if (m_Table->Type(m_Position++) == TokenTypes::EndExpression)
+			return TokenSpan(m_Table, begin, m_Position - 1);
+	}
 
+	return TokenSpan(m_Table, begin, m_End);
 }
 
-tokenDictionary_t g_TokenDictionary[] =
-{
-	{TokenTypes::BeginProcedure        ,L""                     ,L"PROCEDURE"},
-	{TokenTypes::BeginFunction         ,L""                       ,L"FUNCTION"},
-	{TokenTypes::EndProcedure          ,L""                ,L"ENDPROCEDURE"},
-	{TokenTypes::EndFunction           ,L""                  ,L"ENDFUNCTION"},
-	{TokenTypes::EqualsSign            ,L"="                             ,L"="},
-	{TokenTypes::OpeningBracket        ,L"("                             ,L"("},
-	{TokenTypes::ClosingBracket        ,L")"                             ,L")"},
-	{TokenTypes::ExportKeyword         ,L""                       ,L"EXPORT"},
-	{TokenTypes::Comma                 ,L","		                     ,L","},
-	{TokenTypes::EndExpression         ,L";"                             ,L";"},
-	{TokenTypes::PlusSign              ,L"+"                             ,L"+"},
-	{TokenTypes::MinusSign             ,L"-"                             ,L"-"},
-	{TokenTypes::MultiplySign          ,L"*"                             ,L"*"},
-	{TokenTypes::DivisionSign          ,L"/"                             ,L"/"},
-	{TokenTypes::DotSign               ,L"."                             ,L"."},
-	{TokenTypes::BooleanConst          ,L""                          ,L"FALSE"},
-	{TokenTypes::BooleanConst          ,L""                        ,L"TRUE"},
-	{TokenTypes::OperatorNew           ,L""                         ,L"NEW"},
-	{TokenTypes::OperatorIf            ,L""                          ,L"IF"},
-	{TokenTypes::OperatorThen          ,L""                         ,L"THEN"},
-	{TokenTypes::OperatorElse          ,L""                         ,L"ELSE"},
-	{TokenTypes::OperatorElseIf        ,L""                     ,L"ELSEIF"},
-	{TokenTypes::OperatorEndIf         ,L""                     ,L"ENDIF"},
-	{TokenTypes::LessSign              ,L"<"                             ,L"<"},
-	{TokenTypes::GreaterSign           ,L">"                             ,L">"},
-	{TokenTypes::OperatorFor           ,L""                           ,L"FOR"},
-	{TokenTypes::OperatorWhile         ,L""                          ,L"WHILE"},
-	{TokenTypes::OperatorEndLoop       ,L""                    ,L"ENDLOOP"},
-	{TokenTypes::OperatorTry           ,L""                       ,L"TRY"},
-	{TokenTypes::OperatorEndTry        ,L""                  ,L"ENDTRY"},
-	{TokenTypes::DirectiveIf           ,L"#"                         ,L"#IF"},
-	{TokenTypes::DirectiveThen         ,L"#"                        ,L"#THEN"},
-	{TokenTypes::DirectiveElseIf       ,L"#"                    ,L"#ELSEIF"},
-	{TokenTypes::DirectiveElse         ,L"#"                        ,L"#ELSE"},
-	{TokenTypes::DirectiveEndIf        ,L"#"                    ,L"#ENDIF"},
-	{TokenTypes::DirectiveInsert       ,L"#"                      ,L"#INSERT"},
-	{TokenTypes::DirectiveEndInsert    ,L"#"                 ,L"#ENDINSERT"},
-	{TokenTypes::DirectiveDelete       ,L"#"                     ,L"#DELETE"},
-	{TokenTypes::DirectiveEndDelete    ,L"#"                ,L"#ENDDELETE"},
-	{TokenTypes::DirectiveRegion       ,L"#"                      ,L"#REGION"},
-	{TokenTypes::DirectiveEndRegion    ,L"#"                 ,L"#ENDREGION"},
-	{TokenTypes::KeywordAnd            ,L""                             ,L"AND"},
-	{TokenTypes::KeywordOr             ,L""                           ,L"OR"},
-	{TokenTypes::KeywordNot            ,L""                            ,L"NOT"},
-	{TokenTypes::KeywordVar            ,L""                         ,L"VAR"},
-	{TokenTypes::KeywordLoop           ,L""                          ,L"LOOP"},
-	{TokenTypes::KeywordEach           ,L""                       ,L"EACH"},
-	{TokenTypes::KeywordVal            ,L""                          ,L"VAL"},
-	{TokenTypes::OpeningSquareBracket  ,L"["                             ,L"["},
-	{TokenTypes::ClosingSquareBracket  ,L"]"                             ,L"]"}
-};
-
-BSL::TokenTypes TokenTypeFromValue(std::wstring tokenValue)
+bool TokenStream::PushToken(const lexedToken_t& token)
 {
-	std::transform(tokenValue.begin(), tokenValue.end(),tokenValue.begin(), ::towupper);
+	// Past the resync point the old tokens take over
+	if (m_Resync && m_Resync->synced)
+		return false;
 
-	for (auto dict : g_TokenDictionary)
+	uint8_t flags = 0;
+
+	if (token.type == TokenTypes::StringConst)
+		flags |= TOKEN_FLAG_STRING_LITERAL;
+
+	if (token.ownedValue)
 	{
-		if (dict.russian == tokenValue)
-			return dict.tokenType;
-		else if (dict.english == tokenValue)
-			return dict.tokenType;
+		flags |= TOKEN_FLAG_OWNED_VALUE;
+		m_Data.m_Source->ownedValues[(uint32_t)token.offset] = token.value;
 	}
 
-	return TokenTypes::Identifier;
-}
+	if (token.type == TokenTypes::NumericConst)
+		m_Data.m_Source->numericValues[(uint32_t)token.offset] = token.numericValue;
 
-bool TokenStream::IsWhitespaceSymbol(wchar_t curSymbol)
-{
-	return curSymbol < 33;
-}
+	uint32_t atom = IDENTIFIER_NO_ATOM;
 
-bool TokenStream::IsTokenDivider(wchar_t curSymbol)
-{
-	const wchar_t* dividers = L"\\/%()-=+;.,<>[]";
-	return wcschr(dividers, curSymbol) != nullptr;
+	if (token.type == TokenTypes::Identifier || token.type == TokenTypes::Annotation)
+		atom = g_Identifiers.Intern(token.value);
+
+	m_Data.Push(token.type, token.offset, token.value.length(), flags, atom);
+
+	if (m_Resync)
+		m_Resync->synced = CheckResync(*m_Resync);
+
+	return !m_Resync || !m_Resync->synced;
 }
 
-UnexcpectedToken::UnexcpectedToken(TokenTypes expectedToken, TokenTypes recivedToken)
+void TokenStream::PushLineStart(size_t offset)
 {
-	m_ExpectedType = expectedToken;
-	m_RecivedType = recivedToken;
+	if (!m_Resync)
+		m_Data.m_Source->lineStarts.push_back((uint32_t)offset);
 }
 
 }
@@ -1,144 +1,386 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <exception>
+#include <map>
+#include <memory>
+#include <optional>
+#include <bitset>
+#include "BSLIdentifiers.h"
+#include "BSLSource.h"
+#include "BSLTokenTypes.h"
+#include "BSLLexer.h"
 
 namespace BSL
 {
 
-enum class TokenTypes
-{	
-	Identifier,
-	BeginProcedure,
-	BeginFunction,
-	EndProcedure,
-	EndFunction,
-	EqualsSign,
-	OpeningBracket,
-	ClosingBracket,
-	ExportKeyword,
-	Comma,
-	EndExpression,
-	PlusSign,
-	MinusSign,
-	MultiplySign,
-	DivisionSign,
-	DotSign,
-	BooleanConst,
-	OperatorNew,
-	OperatorIf,
-	OperatorThen,
-	OperatorElse,
-	OperatorElseIf,
-	OperatorEndIf,
-	LessSign,
-	GreaterSign,
-	OperatorFor,
-	OperatorWhile,
-	OperatorEndLoop,
-	OperatorTry,
-	OperatorEndTry,
-	DirectiveIf,
-	DirectiveThen,
-	DirectiveElseIf,
-	DirectiveElse,
-	DirectiveEndIf,
-	DirectiveInsert,
-	DirectiveEndInsert,
-	DirectiveDelete,
-	DirectiveEndDelete,
-	DirectiveRegion,
-	DirectiveEndRegion,
-	KeywordAnd,
-	KeywordOr,
-	KeywordNot,
-	KeywordVar,
-	KeywordLoop,
-	KeywordEach,
-	KeywordVal,
-	OpeningSquareBracket,
-	ClosingSquareBracket,
-	StringConst,
-	Comment,
-	NumericConst,
-	Annotation,
-};
-
 typedef struct
 {
 	TokenTypes tokenType;
-	const wchar_t* russian;
-	const wchar_t* english;
+	const char* russian;
+	const char* english;
 
 }tokenDictionary_t;
 
 //tokenDictionary_t* LookupTokenDictionary(const std::wstring& value);
-TokenTypes TokenTypeFromValue(std::wstring tokenValue);
+TokenTypes TokenTypeFromValue(std::string_view tokenValue);
+// Dictionary scan replaced by the keyword hash, kept as a baseline for benchmarks
+TokenTypes TokenTypeFromValueLinear(std::string tokenValue);
+// Identifier with ASCII and Cyrillic letters in upper case, so that names
+// compare the way the language compares them: case-insensitively
+std::string FoldIdentifier(std::string_view value);
+// Same into result, which is cleared first, reusing its capacity
+void FoldIdentifier(std::string_view value, std::string& result);
 
 typedef struct  
 {
 	size_t row, column;
 }textHumanPosition_t;
 
-class UnexcpectedEndOfTokenStream : public std::exception
+// Result of TokenStream::ApplyEdit: tokens [firstToken, firstToken + insertedTokens)
+// replaced removedTokens tokens starting at the same index
+typedef struct
 {
+	size_t firstToken;
+	size_t removedTokens;
+	size_t insertedTokens;
+}tokenStreamEdit_t;
 
-};
+// One edit covering first and then second, second being in the token
+// indices first left behind; the tokens between the two count as replaced
+tokenStreamEdit_t CombineEdits(const tokenStreamEdit_t& first, const tokenStreamEdit_t& second);
+
+class TokenTable;
 
-class UnexcpectedToken : public std::exception
+// Table positions of the tokens of every type, in order, and which types
+// occur at all. Built while lexing when TokenStream is asked for it.
+class TokenTypeIndex
 {
-	TokenTypes m_ExpectedType;
-	TokenTypes m_RecivedType;
+	std::bitset<TOKEN_TYPE_COUNT> m_Present;
+	std::vector<uint32_t> m_Positions[TOKEN_TYPE_COUNT];
 public:
-	UnexcpectedToken(TokenTypes expectedToken, TokenTypes recivedToken);
+	void Add(TokenTypes type, size_t position)
+	{
+		m_Present.set((size_t)type);
+		m_Positions[(size_t)type].push_back((uint32_t)position);
+	}
+
+	bool Has(TokenTypes type) const
+	{
+		return m_Present.test((size_t)type);
+	}
+
+	const std::vector<uint32_t>& Positions(TokenTypes type) const
+	{
+		return m_Positions[(size_t)type];
+	}
+
+	// Positions of the given type within [begin, end) as a range of Positions(type)
+	std::pair<const uint32_t*, const uint32_t*> PositionsInRange(TokenTypes type, size_t begin, size_t end) const;
+
+	// Follows TokenTable::Replace
+	void Replace(size_t first, size_t last, const TokenTable& replacement);
 };
 
+// State of an incremental re-lex: tokens that followed the restart point
+// before the edit, and how source offsets after the edit moved
 typedef struct
 {
-	TokenTypes type;
-	std::wstring value;
+	const TokenTable* tailTokens;
+	size_t tailPosition;
+	ptrdiff_t delta;
+	size_t editEnd;
+	bool synced;
+}lexResync_t;
 
-	size_t sourceOffset;
-	size_t sourceLength;
+// Token values are UTF-8 views into this buffer: either a span of the source
+// text or, for string literals with "" escapes, an unescaped copy in ownedValues.
+// Shared between a stream and all substreams extracted from it.
+typedef struct
+{
+	SourceBuffer buffer;
 
-	textHumanPosition_t textPosition;
+	// Unescaped string literal values by token source offset
+	std::map<uint32_t, std::string> ownedValues;
 
-	bool isStringLiteral;
+	// Values of numeric constants, parsed by the lexer, by token source offset
+	std::map<uint32_t, double> numericValues;
 
-	bool isFunctionCallHint;
+	// Source offset of the first byte of every line, lineStarts[0] is 0
+	std::vector<uint32_t> lineStarts;
+}tokenStreamSource_t;
 
-}tokenStreamElement_t;
+constexpr uint8_t TOKEN_FLAG_STRING_LITERAL = 1 << 0;
+constexpr uint8_t TOKEN_FLAG_FUNCTION_CALL_HINT = 1 << 1;
+// Value is in tokenStreamSource_t::ownedValues rather than a span of the source
+constexpr uint8_t TOKEN_FLAG_OWNED_VALUE = 1 << 2;
 
-class TokenStream
+// Token sequence stored as parallel arrays, about 14 bytes per token.
+// Values and text positions are not stored but derived from the source
+// offset: string literals point at their first character past the quote.
+// Identifiers and annotations carry their g_Identifiers atom.
+class TokenTable
 {
-	std::vector<tokenStreamElement_t> m_Data;
-	size_t m_Position;
+	std::vector<TokenTypes> m_Types;
+	std::vector<uint32_t> m_Offsets;
+	std::vector<uint32_t> m_Lengths;
+	std::vector<uint8_t> m_Flags;
+	std::vector<uint32_t> m_Atoms;
+
+	std::shared_ptr<tokenStreamSource_t> m_Source;
+	std::unique_ptr<TokenTypeIndex> m_TypeIndex;
 
-	void DoLexModule(std::wstring & sourceCode);
+	friend class TokenSpan;
+	friend class TokenStream;
 public:
-	TokenStream(std::wstring & sourceCode);
-	~TokenStream();
+	size_t Size() const
+	{
+		return m_Types.size();
+	}
+
+	TokenTypes Type(size_t index) const
+	{
+		return m_Types[index];
+	}
+
+	size_t SourceOffset(size_t index) const
+	{
+		return m_Offsets[index];
+	}
+
+	size_t SourceLength(size_t index) const
+	{
+		return m_Lengths[index];
+	}
+
+	bool HasFlag(size_t index, uint8_t flag) const
+	{
+		return (m_Flags[index] & flag) != 0;
+	}
+
+	uint8_t Flags(size_t index) const
+	{
+		return m_Flags[index];
+	}
+
+	// IDENTIFIER_NO_ATOM unless the token is an Identifier or an Annotation
+	uint32_t Atom(size_t index) const
+	{
+		return m_Atoms[index];
+	}
+
+	void SetFlag(size_t index, uint8_t flag, bool value)
+	{
+		if (value)
+			m_Flags[index] |= flag;
+		else
+			m_Flags[index] &= ~flag;
+	}
+
+	// Offset where the lexer started the token, i.e. including the opening quote of a string literal
+	size_t RawStart(size_t index) const
+	{
+		return m_Offsets[index] - (HasFlag(index, TOKEN_FLAG_STRING_LITERAL) ? 1 : 0);
+	}
+
+	std::string_view Value(size_t index) const;
+	textHumanPosition_t TextPosition(size_t index) const;
+	// Value of a NumericConst token, 0 for other tokens
+	double NumericValue(size_t index) const;
+
+	// Source text and side tables the values are derived from
+	const tokenStreamSource_t& Source() const
+	{
+		return *m_Source;
+	}
+
+	// Null unless the owning TokenStream was asked to index token types
+	const TokenTypeIndex* TypeIndex() const
+	{
+		return m_TypeIndex.get();
+	}
+
+	void Push(TokenTypes type, size_t offset, size_t length, uint8_t flags, uint32_t atom);
+	// Appends tokens [first, last) of other; a table without a source takes other's
+	void Append(const TokenTable& other, size_t first, size_t last);
+	// Replaces tokens [first, last) with all tokens of replacement
+	void Replace(size_t first, size_t last, const TokenTable& replacement);
+	void Clear();
+};
+
+// Lightweight reference to a token of a TokenTable. Behaves like the token
+// pointers it replaces: tests false when there is no token and supports ->.
+class TokenHandle
+{
+	TokenTable* m_Table;
+	size_t m_Index;
+public:
+	TokenHandle() : m_Table(nullptr), m_Index(0)
+	{
+	}
+
+	TokenHandle(TokenTable* table, size_t index) : m_Table(table), m_Index(index)
+	{
+	}
+
+	explicit operator bool() const
+	{
+		return m_Table != nullptr;
+	}
+
+	const TokenHandle* operator->() const
+	{
+		return this;
+	}
+
+	size_t Index() const
+	{
+		return m_Index;
+	}
+
+	TokenTypes Type() const
+	{
+		return m_Table->Type(m_Index);
+	}
+
+	std::string_view Value() const
+	{
+		return m_Table->Value(m_Index);
+	}
+
+	size_t SourceOffset() const
+	{
+		return m_Table->SourceOffset(m_Index);
+	}
+
+	size_t SourceLength() const
+	{
+		return m_Table->SourceLength(m_Index);
+	}
+
+	textHumanPosition_t TextPosition() const
+	{
+		return m_Table->TextPosition(m_Index);
+	}
+
+	double NumericValue() const
+	{
+		return m_Table->NumericValue(m_Index);
+	}
+
+	uint32_t Atom() const
+	{
+		return m_Table->Atom(m_Index);
+	}
+
+	bool IsStringLiteral() const
+	{
+		return m_Table->HasFlag(m_Index, TOKEN_FLAG_STRING_LITERAL);
+	}
+
+	bool IsFunctionCallHint() const
+	{
+		return m_Table->HasFlag(m_Index, TOKEN_FLAG_FUNCTION_CALL_HINT);
+	}
+
+	void SetFunctionCallHint(bool value) const
+	{
+		m_Table->SetFlag(m_Index, TOKEN_FLAG_FUNCTION_CALL_HINT, value);
+	}
+};
+
+// Read cursor over tokens [m_Begin, m_End) of a TokenTable. Substreams are
+// spans over the same table, so extracting one copies no tokens; a span is
+// valid as long as the TokenStream owning the table and until its next edit.
+class TokenSpan
+{
+protected:
+	TokenTable* m_Table;
+	size_t m_Begin;
+	size_t m_End;
+
+	// Index into m_Table of the next token to read
+	size_t m_Position;
+public:
+	TokenSpan(TokenTable* table, size_t begin, size_t end) : m_Table(table), m_Begin(begin), m_End(end), m_Position(begin)
+	{
+	}
 
 	void Reset();
-	tokenStreamElement_t* PeekNextToken();
-	tokenStreamElement_t* ReadToken(bool expectingToHaveAny = false);
-	void CheckToken(TokenTypes type);	
-	tokenStreamElement_t* CurrentToken();
+	// These return an empty handle past the end of the span
+	TokenHandle PeekNextToken();
+	TokenHandle ReadToken();
+	TokenHandle CurrentToken();
 	
 	bool HasToken(TokenTypes type);
+	// All tokens of the given type in order; with a type index this costs the
+	// number of matches rather than the span length
+	std::vector<TokenHandle> TokensOfType(TokenTypes type);
 
-	TokenStream* ExtractSubstream(TokenTypes blockStartToken, TokenTypes blockEndToken);	
-	TokenStream* ExtractExpressionSubstream();
-private:
-	void PushToken(std::wstring& tokenValue, size_t tokenStartRow, size_t tokenStartColumn, size_t offset, bool isStringLiteral);
-	
-	bool IsWhitespaceSymbol(wchar_t curSymbol);
-	bool IsTokenDivider(wchar_t curSymbol);
+	size_t Size() const
+	{
+		return m_End - m_Begin;
+	}
+
+	TokenTable* Table() const
+	{
+		return m_Table;
+	}
+
+	// Table index of the next token to read, End() once all are read
+	size_t Position() const
+	{
+		return m_Position;
+	}
 
-	TokenStream()
+	size_t End() const
 	{
-		m_Position = 0;
+		return m_End;
 	}
+
+	// Moves the read position to a table index within the span
+	void Seek(size_t position)
+	{
+		m_Position = position;
+	}
+
+	// Span up to the blockEndToken matching the current nesting level; the
+	// read position moves past it. None if the span ends before that token.
+	std::optional<TokenSpan> ExtractSubstream(TokenTypes blockStartToken, TokenTypes blockEndToken);
+	// Span up to the next EndExpression or the end, none if there are no tokens left
+	std::optional<TokenSpan> ExtractExpressionSubstream();
+};
+
+class TokenStream : public TokenSpan, private ITokenSink
+{
+	TokenTable m_Data;
+
+	lexResync_t* m_Resync;
+
+	bool DoLexModule(size_t startOffset = 0, lexResync_t* resync = nullptr);
+	bool CheckResync(lexResync_t& resync);
+public:
+	// With indexTypes set, a TokenTypeIndex is kept for HasToken and TokensOfType
+	TokenStream(SourceBuffer sourceCode, bool indexTypes = false);
+	TokenStream(std::string sourceCode, bool indexTypes = false);
+	TokenStream(const TokenStream&) = delete;
+	TokenStream& operator=(const TokenStream&) = delete;
+	~TokenStream();
+
+	// Replaces removedLength bytes at offset with insertedText and re-lexes only
+	// from the last token boundary before the edit until the new tokens line up
+	// with the old ones again; later tokens are shifted. Resets the read position
+	// and invalidates token handles and substreams taken before the edit.
+	tokenStreamEdit_t ApplyEdit(size_t offset, size_t removedLength, std::string_view insertedText);
+
+	std::string_view SourceText()
+	{
+		return m_Data.m_Source->buffer.Text();
+	}
+private:
+	bool PushToken(const lexedToken_t& token) override;
+	void PushLineStart(size_t offset) override;
 };
 
 
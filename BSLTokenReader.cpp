@@ -0,0 +1,229 @@
+#include "BSLTokenReader.h"
+#include <algorithm>
+
+constexpr auto CR = '\n';
+
+namespace BSL
+{
+
+TokenReader::TokenReader()
+{
+	m_Encoding = SourceEncoding::Utf8;
+	m_EndOfFile = true;
+	m_TextOffset = 0;
+	m_LexerFinished = true;
+	m_HasReadToken = false;
+	m_WantedTokens = 0;
+	m_PositionOffset = 0;
+	m_Position = {1, 1};
+}
+
+bool TokenReader::Open(const char* fileName)
+{
+	m_File.close();
+	m_File.clear();
+	m_File.open(fileName, std::ios::binary);
+
+	if (!m_File)
+		return false;
+
+	m_Pending.clear();
+	m_Text.clear();
+	m_TextOffset = 0;
+	m_Lexer = Lexer();
+	m_Tokens.clear();
+	m_HasReadToken = false;
+	m_PositionOffset = 0;
+	m_Position = {1, 1};
+
+	m_Pending.resize(ChunkSize);
+	m_File.read(&m_Pending[0], ChunkSize);
+	m_Pending.resize((size_t)m_File.gcount());
+
+	m_EndOfFile = m_Pending.length() < ChunkSize;
+	m_LexerFinished = false;
+
+	// A UTF-8 sequence cut off by the chunk end must not make it look like CP1251
+	const unsigned char* bytes = (const unsigned char*)m_Pending.data();
+	size_t detectLength = m_Pending.length();
+
+	if (!m_EndOfFile)
+	{
+		size_t continuation = 0;
+
+		while (continuation < 3 && continuation < detectLength && (bytes[detectLength - 1 - continuation] & 0xC0) == 0x80)
+			continuation++;
+
+		if (continuation < detectLength && bytes[detectLength - 1 - continuation] >= 0xC0)
+			detectLength -= continuation + 1;
+	}
+
+	m_Encoding = DetectSourceEncoding(m_Pending.data(), detectLength);
+
+	switch (m_Encoding)
+	{
+	case SourceEncoding::Utf8WithBOM:
+		m_Pending.erase(0, 3);
+		break;
+	case SourceEncoding::Utf16LE:
+	case SourceEncoding::Utf16BE:
+		m_Pending.erase(0, 2);
+		break;
+	}
+
+	TranscodePending();
+	return true;
+}
+
+// Appends the UTF-8 form of the pending bytes to m_Text, keeping back what
+// can only be transcoded together with the next chunk
+void TokenReader::TranscodePending()
+{
+	const unsigned char* bytes = (const unsigned char*)m_Pending.data();
+	size_t length = m_Pending.length();
+
+	switch (m_Encoding)
+	{
+	case SourceEncoding::Utf16LE:
+	case SourceEncoding::Utf16BE:
+		{
+			bool bigEndian = m_Encoding == SourceEncoding::Utf16BE;
+			length &= ~(size_t)1;
+
+			if (!m_EndOfFile && length >= 2)
+			{
+				uint32_t lastUnit = bigEndian ? (bytes[length - 2] << 8) | bytes[length - 1] : bytes[length - 2] | (bytes[length - 1] << 8);
+
+				if (lastUnit >= 0xD800 && lastUnit < 0xDC00)
+					length -= 2;
+			}
+
+			TranscodeUtf16(m_Text, bytes, length, bigEndian);
+		}
+		break;
+	case SourceEncoding::Cp1251:
+		TranscodeCp1251(m_Text, bytes, length);
+		break;
+	default:
+		m_Text.append(m_Pending, 0, length);
+		break;
+	}
+
+	m_Pending.erase(0, length);
+}
+
+void TokenReader::ReadChunk()
+{
+	// Text before the token being lexed and the last position computed is not needed any more
+	size_t keepFrom = std::min(m_Lexer.KeepFrom(), m_PositionOffset);
+
+	m_Text.erase(0, keepFrom - m_TextOffset);
+	m_TextOffset = keepFrom;
+
+	size_t pendingLength = m_Pending.length();
+
+	m_Pending.resize(pendingLength + ChunkSize);
+	m_File.read(&m_Pending[pendingLength], ChunkSize);
+
+	size_t readLength = (size_t)m_File.gcount();
+	m_Pending.resize(pendingLength + readLength);
+
+	if (readLength < ChunkSize)
+		m_EndOfFile = true;
+
+	TranscodePending();
+}
+
+// Makes sure m_Tokens holds at least count tokens, unless the module ends before
+bool TokenReader::LexTokens(size_t count)
+{
+	while (m_Tokens.size() < count)
+	{
+		if (m_LexerFinished)
+			return false;
+
+		m_WantedTokens = count;
+
+		// PushToken stops the lexer once there are enough tokens
+		if (!m_Lexer.Lex(m_Text, m_TextOffset, m_EndOfFile, *this))
+			continue;
+
+		if (m_EndOfFile)
+			m_LexerFinished = true;
+		else
+			ReadChunk();
+	}
+
+	return true;
+}
+
+bool TokenReader::PushToken(const lexedToken_t& token)
+{
+	for (; m_PositionOffset < token.offset; m_PositionOffset++)
+	{
+		char symbol = m_Text[m_PositionOffset - m_TextOffset];
+
+		if (symbol == CR)
+		{
+			m_Position.row++;
+			m_Position.column = 1;
+		}
+		else if ((symbol & 0xC0) != 0x80)
+			m_Position.column++;
+	}
+
+	readerToken_t readerToken;
+	readerToken.type = token.type;
+	readerToken.value.assign(token.value);
+	readerToken.sourceOffset = token.offset;
+	readerToken.sourceLength = token.value.length();
+	readerToken.textPosition = m_Position;
+	readerToken.isStringLiteral = token.type == TokenTypes::StringConst;
+	readerToken.numericValue = token.numericValue;
+
+	m_Tokens.push_back(std::move(readerToken));
+
+	return m_Tokens.size() < m_WantedTokens;
+}
+
+// Positions are tracked while pushing tokens instead
+void TokenReader::PushLineStart(size_t)
+{
+}
+
+const readerToken_t* TokenReader::PeekNextToken()
+{
+	size_t next = m_HasReadToken ? 1 : 0;
+
+	if (!LexTokens(next + 2))
+		return nullptr;
+
+	return &m_Tokens[next + 1];
+}
+
+const readerToken_t* TokenReader::ReadToken()
+{
+	if (m_HasReadToken)
+	{
+		m_Tokens.pop_front();
+		m_HasReadToken = false;
+	}
+
+	if (!LexTokens(1))
+		return nullptr;
+
+	m_HasReadToken = true;
+	return &m_Tokens.front();
+}
+
+const readerToken_t* TokenReader::CurrentToken()
+{
+	size_t next = m_HasReadToken ? 1 : 0;
+
+	if (!LexTokens(next + 1))
+		return nullptr;
+
+	return &m_Tokens[next];
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <fstream>
+#include "BSLToken.h"
+
+namespace BSL
+{
+
+// Token produced by TokenReader. Owns its value, as the source text behind
+// the reader is dropped.
+typedef struct
+{
+	TokenTypes type;
+	std::string value;
+
+	size_t sourceOffset;
+	size_t sourceLength;
+
+	textHumanPosition_t textPosition;
+
+	bool isStringLiteral;
+
+	// Value of a NumericConst
+	double numericValue;
+
+}readerToken_t;
+
+// Pull-mode alternative to TokenStream for modules too large to keep in
+// memory: reads the file in chunks and lexes only as far as the tokens asked
+// for. Only the text of the token being lexed and the tokens between the last
+// one read and the furthest one peeked at are kept, so memory use does not
+// depend on the file size. Token pointers stay valid until the next ReadToken.
+class TokenReader : private ITokenSink
+{
+	std::ifstream m_File;
+	SourceEncoding m_Encoding;
+	bool m_EndOfFile;
+
+	// Bytes read but not transcoded yet, e.g. half of a UTF-16 surrogate pair
+	std::string m_Pending;
+
+	// UTF-8 source text from m_TextOffset on
+	std::string m_Text;
+	size_t m_TextOffset;
+
+	Lexer m_Lexer;
+	bool m_LexerFinished;
+
+	// The last token read, if m_HasReadToken, followed by the lexed tokens not read yet
+	std::deque<readerToken_t> m_Tokens;
+	bool m_HasReadToken;
+	size_t m_WantedTokens;
+
+	// Text position of m_PositionOffset, advanced as tokens are pushed
+	size_t m_PositionOffset;
+	textHumanPosition_t m_Position;
+
+	void TranscodePending();
+	void ReadChunk();
+	bool LexTokens(size_t count);
+
+	bool PushToken(const lexedToken_t& token) override;
+	void PushLineStart(size_t offset) override;
+public:
+	static const size_t ChunkSize = 64 * 1024;
+
+	TokenReader();
+
+	// The encoding is detected from the first chunk
+	bool Open(const char* fileName);
+
+	// These return nullptr at the end of the module
+	const readerToken_t* PeekNextToken();
+	const readerToken_t* ReadToken();
+	const readerToken_t* CurrentToken();
+
+	SourceEncoding Encoding() const
+	{
+		return m_Encoding;
+	}
+};
+
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace BSL
+{
+
+enum class TokenTypes : uint8_t
+{	
+	Identifier,
+	BeginProcedure,
+	BeginFunction,
+	EndProcedure,
+	EndFunction,
+	EqualsSign,
+	OpeningBracket,
+	ClosingBracket,
+	ExportKeyword,
+	Comma,
+	EndExpression,
+	PlusSign,
+	MinusSign,
+	MultiplySign,
+	DivisionSign,
+	ModuloSign,
+	DotSign,
+	BooleanConst,
+	OperatorNew,
+	OperatorIf,
+	OperatorThen,
+	OperatorElse,
+	OperatorElseIf,
+	OperatorEndIf,
+	LessSign,
+	GreaterSign,
+	OperatorFor,
+	OperatorWhile,
+	OperatorEndLoop,
+	OperatorTry,
+	OperatorEndTry,
+	OperatorReturn,
+	DirectiveIf,
+	DirectiveThen,
+	DirectiveElseIf,
+	DirectiveElse,
+	DirectiveEndIf,
+	DirectiveInsert,
+	DirectiveEndInsert,
+	DirectiveDelete,
+	DirectiveEndDelete,
+	DirectiveRegion,
+	DirectiveEndRegion,
+	KeywordAnd,
+	KeywordOr,
+	KeywordNot,
+	KeywordVar,
+	KeywordLoop,
+	KeywordEach,
+	KeywordVal,
+	OpeningSquareBracket,
+	ClosingSquareBracket,
+	StringConst,
+	Comment,
+	NumericConst,
+	Annotation,
+	DateConst,
+};
+
+// Number of TokenTypes values, DateConst being the last one
+constexpr size_t TOKEN_TYPE_COUNT = (size_t)TokenTypes::DateConst + 1;
+
+};
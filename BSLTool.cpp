@@ -1,51 +1,76 @@
 ﻿// BSLTool.cpp : Этот файл содержит функцию "main". Здесь начинается и заканчивается выполнение программы.
 //
 
-#define _CRT_SECURE_NO_WARNINGS
-
-#include <windows.h>
 #include <iostream>
+#include <cstring>
 #include "BSLToken.h"
 #include "BSLAbstractSyntaxTree.h"
+#include "BSLBatch.h"
+#include "BSLBenchmark.h"
+#include "BSLLanguageServer.h"
+#include "BSLSymbolIndex.h"
+#include "BSLTokenReader.h"
 
-
-wchar_t* ReadFile(const char* fileName)
+int main(int argc, char** argv)
 {
-    FILE* fp = fopen(fileName, "rb");
+    setlocale(LC_ALL, "");
 
-    fseek(fp, 0, SEEK_END);
-    size_t dataLength = ftell(fp) + 2;
-    fseek(fp, 0, SEEK_SET);
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+        return BSL::RunBenchmarks(argc - 2, argv + 2);
 
+    // Parses every module under the given directories or matching the given masks
+    if (argc > 1 && !strcmp(argv[1], "batch"))
+        return BSL::RunBatch(argc - 2, argv + 2);
 
-    char* data = new char[dataLength];
-    memset(data, 0, dataLength);
-    fread(data, dataLength, 1, fp);
-    fclose(fp);
+    // Language server over stdin and stdout, for editors
+    if (argc > 1 && !strcmp(argv[1], "lsp"))
+        return BSL::RunLanguageServer(argc - 2, argv + 2);
 
-    int reformatedSize = MultiByteToWideChar(CP_UTF8, 0, (char*)data, -1, 0, 0);
+    // Builds or queries the index of procedures and functions of a configuration
+    if (argc > 1 && !strcmp(argv[1], "index"))
+        return BSL::RunSymbolIndex(argc - 2, argv + 2);
 
-    wchar_t* newData = new wchar_t[reformatedSize];
+    // Compares the lexer with the one it replaced on the given modules
+    if (argc > 1 && !strcmp(argv[1], "lexcheck"))
+        return BSL::RunLexerCheck(argc - 2, argv + 2);
 
-    MultiByteToWideChar(CP_UTF8, 0, (char*)data, -1, newData, reformatedSize);
+    // Parses the cases of constructs the parser once got wrong and checks reparsing after random edits
+    if (argc > 1 && !strcmp(argv[1], "parsecheck"))
+        return BSL::RunParserCheck(argc - 2, argv + 2);
 
-    delete[] data;
+    // Token count of a module of any size, lexed without loading it whole
+    if (argc > 2 && !strcmp(argv[1], "tokens"))
+    {
+        BSL::TokenReader reader;
 
-    return newData;
+        if (!reader.Open(argv[2]))
+        {
+            fprintf(stderr, "Can't open %s\n", argv[2]);
+            return 1;
+        }
 
-}
+        size_t tokenCount = 0;
 
-int main()
-{
-    setlocale(LC_ALL, "");
-    wchar_t* data = ReadFile("ModuleSimple.txt");
-    auto data_str = std::wstring(data);
+        while (reader.ReadToken())
+            tokenCount++;
+
+        printf("%zu\n", tokenCount);
+        return 0;
+    }
+
+    BSL::SourceBuffer source;
+
+    if (!source.LoadFile("ModuleSimple.txt"))
+    {
+        fprintf(stderr, "Can't open ModuleSimple.txt\n");
+        return 1;
+    }
 
-    BSL::TokenStream* stream = new BSL::TokenStream(data_str);
+    BSL::TokenStream* stream = new BSL::TokenStream(std::move(source));
 
-    BSL::IAbstractSyntaxTreeNode* pTree = BSL::BuildAbstractSyntaxTree(stream);
+    BSL::SyntaxTree tree;
+    BSL::BuildAbstractSyntaxTree(stream, tree);
 
-    delete[] data;
     delete stream;
 }
 
@@ -0,0 +1,87 @@
+#include "BSLTrace.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace BSL
+{
+
+std::atomic<bool> g_TracingEnabled(false);
+
+// Events of one thread, which only it appends to
+typedef struct
+{
+	uint32_t id;
+	std::vector<traceEvent_t> events;
+}traceThread_t;
+
+static std::mutex g_TraceThreadsLock;
+
+// Kept after their threads exit, so that their events can still be collected
+static std::vector<std::unique_ptr<traceThread_t>> g_TraceThreads;
+
+static std::chrono::steady_clock::time_point g_TraceEpoch;
+
+thread_local int64_t g_TraceModule = -1;
+
+void EnableTracing(bool enabled)
+{
+	static std::once_flag epoch;
+	std::call_once(epoch, []() { g_TraceEpoch = std::chrono::steady_clock::now(); });
+
+	g_TracingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+int64_t TraceClock()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_TraceEpoch).count();
+}
+
+// Events of the calling thread, registered on its first event
+static traceThread_t& CurrentTraceThread()
+{
+	thread_local traceThread_t* current = nullptr;
+
+	if (!current)
+	{
+		std::lock_guard<std::mutex> lock(g_TraceThreadsLock);
+
+		g_TraceThreads.push_back(std::make_unique<traceThread_t>());
+		current = g_TraceThreads.back().get();
+		current->id = (uint32_t)g_TraceThreads.size() - 1;
+	}
+
+	return *current;
+}
+
+void RecordTraceEvent(const char* name, int64_t start)
+{
+	traceThread_t& thread = CurrentTraceThread();
+	thread.events.push_back(traceEvent_t{ name, thread.id, g_TraceModule, start, TraceClock() });
+}
+
+void SetTraceModule(int64_t module)
+{
+	g_TraceModule = module;
+}
+
+std::vector<traceEvent_t> CollectTraceEvents()
+{
+	std::lock_guard<std::mutex> lock(g_TraceThreadsLock);
+	std::vector<traceEvent_t> events;
+
+	for (const auto& thread : g_TraceThreads)
+		events.insert(events.end(), thread->events.begin(), thread->events.end());
+
+	return events;
+}
+
+void ClearTraceEvents()
+{
+	std::lock_guard<std::mutex> lock(g_TraceThreadsLock);
+
+	for (const auto& thread : g_TraceThreads)
+		thread->events.clear();
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace BSL
+{
+
+extern std::atomic<bool> g_TracingEnabled;
+
+// Tracing records the phases of the work done on every thread as timed
+// events, for a Chrome trace and per-module metrics. It is off unless
+// enabled, when a TraceScope costs one test of a flag.
+void EnableTracing(bool enabled);
+
+inline bool TracingEnabled()
+{
+	return g_TracingEnabled.load(std::memory_order_relaxed);
+}
+
+// Nanoseconds since tracing was first enabled
+int64_t TraceClock();
+
+// Adds an event of the calling thread that started at start and ends now
+void RecordTraceEvent(const char* name, int64_t start);
+
+// Times its own lifetime as a phase called name, a string literal. Phases
+// nest, a phase's time includes that of the phases within it.
+class TraceScope
+{
+	const char* m_Name;
+	int64_t m_Start;
+public:
+	explicit TraceScope(const char* name) : m_Name(nullptr), m_Start(0)
+	{
+		if (TracingEnabled())
+		{
+			m_Name = name;
+			m_Start = TraceClock();
+		}
+	}
+
+	~TraceScope()
+	{
+		if (m_Name)
+			RecordTraceEvent(m_Name, m_Start);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+};
+
+// Events the calling thread records from now on belong to the module of that
+// index, -1 for none
+void SetTraceModule(int64_t module);
+
+typedef struct
+{
+	const char* name;
+	uint32_t thread;
+	int64_t module;
+	int64_t start;
+	int64_t end;
+}traceEvent_t;
+
+// Events of all threads so far, each thread's in the order they ended.
+// These race with threads still recording, they are for between runs.
+std::vector<traceEvent_t> CollectTraceEvents();
+void ClearTraceEvents();
+
+}
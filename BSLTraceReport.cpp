@@ -0,0 +1,230 @@
+#include "BSLTraceReport.h"
+#include "BSLJson.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <map>
+
+namespace BSL
+{
+
+const char* const g_TokenTypeNames[] =
+{
+	"Identifier", "BeginProcedure", "BeginFunction", "EndProcedure", "EndFunction", "EqualsSign",
+	"OpeningBracket", "ClosingBracket", "ExportKeyword", "Comma", "EndExpression", "PlusSign",
+	"MinusSign", "MultiplySign", "DivisionSign", "ModuloSign", "DotSign", "BooleanConst", "OperatorNew",
+	"OperatorIf", "OperatorThen", "OperatorElse", "OperatorElseIf", "OperatorEndIf", "LessSign",
+	"GreaterSign", "OperatorFor", "OperatorWhile", "OperatorEndLoop", "OperatorTry", "OperatorEndTry",
+	"OperatorReturn", "DirectiveIf", "DirectiveThen", "DirectiveElseIf", "DirectiveElse", "DirectiveEndIf",
+	"DirectiveInsert", "DirectiveEndInsert", "DirectiveDelete", "DirectiveEndDelete", "DirectiveRegion",
+	"DirectiveEndRegion", "KeywordAnd", "KeywordOr", "KeywordNot", "KeywordVar", "KeywordLoop",
+	"KeywordEach", "KeywordVal", "OpeningSquareBracket", "ClosingSquareBracket", "StringConst",
+	"Comment", "NumericConst", "Annotation", "DateConst",
+};
+
+static_assert(std::size(g_TokenTypeNames) == TOKEN_TYPE_COUNT, "a token type has no name");
+
+const char* const g_NodeTypeNames[] =
+{
+	"Module", "Function", "Procedure", "ConditionalOperator", "ArithmeticExpression", "AssigmentExpression",
+	"MemberExpression", "SubscriptExpression", "Comment", "ForLoop", "WhileLoop", "SubprogramCall",
+	"NumericConstant", "Unparsed", "UnparsedExpression", "ComparisonExpression", "LogicalExpression",
+	"NewExpression", "Identifier", "StringConstant", "DateConstant", "BooleanConstant",
+};
+
+static_assert(std::size(g_NodeTypeNames) == AST_NODE_TYPE_COUNT, "a node type has no name");
+
+void CountTokenTypes(const TokenTable& tokens, moduleMetrics_t& metrics)
+{
+	for (size_t i = 0; i < tokens.Size(); i++)
+		metrics.tokensByType[(size_t)tokens.Type(i)]++;
+}
+
+void CountNodeTypes(const SyntaxTree& tree, moduleMetrics_t& metrics)
+{
+	for (uint32_t i = 0; i < tree.Size(); i++)
+		metrics.nodesByType[(size_t)tree.Node(i).type]++;
+}
+
+// Events and time of one phase
+typedef struct
+{
+	uint64_t count;
+	int64_t nanoseconds;
+}phaseTotals_t;
+
+typedef std::map<std::string, phaseTotals_t> phaseMap_t;
+
+static bool WriteFile(const char* path, const std::string& text)
+{
+	FILE* file = fopen(path, "wb");
+
+	if (!file)
+		return false;
+
+	bool written = fwrite(text.data(), 1, text.length(), file) == text.length();
+	return fclose(file) == 0 && written;
+}
+
+bool WriteChromeTrace(const char* path, const std::vector<traceEvent_t>& events, const std::vector<moduleMetrics_t>& modules)
+{
+	JsonWriter writer;
+
+	writer.BeginObject();
+	writer.Key("displayTimeUnit").String("ms");
+	writer.Key("traceEvents");
+	writer.BeginArray();
+
+	uint32_t threads = 0;
+
+	for (const traceEvent_t& event : events)
+		threads = std::max(threads, event.thread + 1);
+
+	for (uint32_t thread = 0; thread < threads; thread++)
+	{
+		writer.BeginObject();
+		writer.Key("name").String("thread_name");
+		writer.Key("ph").String("M");
+		writer.Key("pid").Int(1);
+		writer.Key("tid").Int(thread);
+		writer.Key("args");
+		writer.BeginObject();
+		writer.Key("name").String("thread " + std::to_string(thread));
+		writer.EndObject();
+		writer.EndObject();
+	}
+
+	// Complete events, timed in microseconds
+	for (const traceEvent_t& event : events)
+	{
+		writer.BeginObject();
+		writer.Key("name").String(event.name);
+		writer.Key("cat").String("BSLTool");
+		writer.Key("ph").String("X");
+		writer.Key("pid").Int(1);
+		writer.Key("tid").Int(event.thread);
+		writer.Key("ts").Double(event.start / 1e3, 15);
+		writer.Key("dur").Double((event.end - event.start) / 1e3, 15);
+
+		if (event.module >= 0 && (size_t)event.module < modules.size())
+		{
+			writer.Key("args");
+			writer.BeginObject();
+			writer.Key("module").String(modules[event.module].path);
+			writer.EndObject();
+		}
+
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+
+	return WriteFile(path, writer.Text());
+}
+
+static void WritePhases(JsonWriter& writer, const phaseMap_t& phases)
+{
+	writer.Key("phases");
+	writer.BeginObject();
+
+	for (const auto& phase : phases)
+	{
+		writer.Key(phase.first);
+		writer.BeginObject();
+		writer.Key("count").Int(phase.second.count);
+		writer.Key("seconds").Double(phase.second.nanoseconds / 1e9, 6);
+		writer.EndObject();
+	}
+
+	writer.EndObject();
+}
+
+// Counters of the types that occur, by type name
+static void WriteTypeCounts(JsonWriter& writer, const char* key, const uint64_t* counts, const char* const* names, size_t typeCount)
+{
+	writer.Key(key);
+	writer.BeginObject();
+
+	for (size_t i = 0; i < typeCount; i++)
+		if (counts[i])
+			writer.Key(names[i]).Int(counts[i]);
+
+	writer.EndObject();
+}
+
+static void WriteCounters(JsonWriter& writer, const moduleMetrics_t& metrics)
+{
+	writer.Key("bytes").Int(metrics.bytes);
+	writer.Key("allocations").Int(metrics.allocations.count);
+	writer.Key("allocated_bytes").Int(metrics.allocations.bytes);
+	WriteTypeCounts(writer, "tokens", metrics.tokensByType, g_TokenTypeNames, TOKEN_TYPE_COUNT);
+	WriteTypeCounts(writer, "nodes", metrics.nodesByType, g_NodeTypeNames, AST_NODE_TYPE_COUNT);
+}
+
+bool WriteTraceMetrics(const char* path, const std::vector<traceEvent_t>& events, const std::vector<moduleMetrics_t>& modules, double seconds, size_t threadCount)
+{
+	phaseMap_t runPhases;
+	std::vector<phaseMap_t> modulePhases(modules.size());
+
+	for (const traceEvent_t& event : events)
+	{
+		phaseTotals_t& run = runPhases[event.name];
+		run.count++;
+		run.nanoseconds += event.end - event.start;
+
+		if (event.module < 0 || (size_t)event.module >= modules.size())
+			continue;
+
+		phaseTotals_t& module = modulePhases[event.module][event.name];
+		module.count++;
+		module.nanoseconds += event.end - event.start;
+	}
+
+	moduleMetrics_t totals = {};
+
+	for (const moduleMetrics_t& module : modules)
+	{
+		totals.bytes += module.bytes;
+		totals.allocations.count += module.allocations.count;
+		totals.allocations.bytes += module.allocations.bytes;
+
+		for (size_t i = 0; i < TOKEN_TYPE_COUNT; i++)
+			totals.tokensByType[i] += module.tokensByType[i];
+
+		for (size_t i = 0; i < AST_NODE_TYPE_COUNT; i++)
+			totals.nodesByType[i] += module.nodesByType[i];
+	}
+
+	JsonWriter writer;
+
+	writer.BeginObject();
+	writer.Key("run");
+	writer.BeginObject();
+	writer.Key("seconds").Double(seconds, 6);
+	writer.Key("threads").Int(threadCount);
+	writer.Key("modules").Int(modules.size());
+	writer.Key("peak_rss").Int(PeakResidentBytes());
+	WriteCounters(writer, totals);
+	WritePhases(writer, runPhases);
+	writer.EndObject();
+
+	writer.Key("modules");
+	writer.BeginArray();
+
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		writer.BeginObject();
+		writer.Key("path").String(modules[i].path);
+		WriteCounters(writer, modules[i]);
+		WritePhases(writer, modulePhases[i]);
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.EndObject();
+
+	return WriteFile(path, writer.Text());
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BSLAbstractSyntaxTree.h"
+#include "BSLMemoryStats.h"
+#include "BSLTrace.h"
+
+namespace BSL
+{
+
+// Counters of one module, filled in by whoever processes it
+typedef struct
+{
+	std::string path;
+	uint64_t bytes;
+	uint64_t tokensByType[TOKEN_TYPE_COUNT];
+	uint64_t nodesByType[AST_NODE_TYPE_COUNT];
+	allocationCounters_t allocations;
+}moduleMetrics_t;
+
+void CountTokenTypes(const TokenTable& tokens, moduleMetrics_t& metrics);
+void CountNodeTypes(const SyntaxTree& tree, moduleMetrics_t& metrics);
+
+// Chrome trace-event file of the events, one timeline per thread, for
+// chrome://tracing or Perfetto; module names come from modules
+bool WriteChromeTrace(const char* path, const std::vector<traceEvent_t>& events, const std::vector<moduleMetrics_t>& modules);
+
+// JSON summary of the run and of every module: counters, and the time and
+// count of every phase summed over the events
+bool WriteTraceMetrics(const char* path, const std::vector<traceEvent_t>& events, const std::vector<moduleMetrics_t>& modules, double seconds, size_t threadCount);
+
+}